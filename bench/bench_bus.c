@@ -0,0 +1,229 @@
+/**
+	* @file bench_bus.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to measure the bluez_* modules end to end against tools/mock_bluetoothd, see bench/bus.txt
+	*
+	*	- The modules are set up the way main.c does, the devices of the mock come in through GetManagedObjects.
+	*	- calls: BENCH_CALLS Properties.GetAll through bluez_command, BENCH_IN_FLIGHT at a time, the latency
+	*	  is from bluez_command_call to the callback.
+	*	- signals: the RSSI storm of the mock, the rate we keep up with, the CPU time per signal and how late
+	*	  a 1 ms timer of the same loop fires while the storm is on, which is how long anything else waits.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+
+#include "bench_common.h"
+#include "bluetooth_device.h"
+#include "bluez_match_rule.h"
+#include "bluez_signal_router.h"
+#include "bluez_command.h"
+#include "bluez_adapter_api.h"
+#include "bluez_device_api.h"
+#include "bluez_mediaplayer_api.h"
+#include "bluez_object_manager_api.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"bus"
+#define BENCH_CALLS				2000
+#define BENCH_IN_FLIGHT			32
+#define BENCH_MAX_LAG_SAMPLES	60000		// one a millisecond for a minute
+#define BENCH_POPULATE_TRIES	20
+#define BENCH_POPULATE_WAIT_MS	50
+#define BENCH_QUIET_MS			500			// the storm is over after this long without a signal
+
+/*
+ * Private Function Declerations
+*/
+static void bench_send_call(void);
+static void bench_call_done(BluezCommand * command, gpointer userData);
+static gboolean bench_calls_done(gpointer userData);
+static gboolean bench_storm_started(gpointer userData);
+static gboolean bench_storm_over(gpointer userData);
+static gboolean bench_lag_tick(gpointer userData);
+
+/*
+ * Private Variables
+*/
+static int mDevices;
+static guint mSent;
+static guint mDone;
+static guint mFailed;
+static guint64 mCallStartNs[BENCH_CALLS];
+static guint64 mCallUs[BENCH_CALLS];
+
+static guint64 mLagUs[BENCH_MAX_LAG_SAMPLES];
+static guint mLagSamples;
+static guint64 mLastTickNs;
+static guint64 mLastSignals;
+static guint64 mLastSignalNs;
+
+int main(void)
+{
+	GDBusConnection * connection;
+	guint64 startNs;
+	guint64 startCpu;
+	guint64 signals;
+	guint64 elapsedNs;
+	guint source;
+	int tries;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+
+	connection = bench_connect_bluez(5000);
+	if(connection == NULL)
+		return 1;
+
+	/*1. Set up like main.c, the devices the mock already has come in with one call */
+	bluetooth_device_init(BLUETOOTH_DEVICE_DEFAULT_CAPACITY);
+	bluez_match_rule_init(connection);
+	bluez_signal_router_init(connection);
+	bluez_command_init(connection);
+	bluez_adapter_init(connection);
+	bluez_device_init(connection);
+	bluez_device_init_signals();
+	bluez_media_player_init(connection);
+	bluez_object_manager_init(connection);
+
+	// the mock owns the name a moment before its script adds the devices
+	for(tries = 0; tries < BENCH_POPULATE_TRIES && mDevices == 0; tries++)
+	{
+		if(tries > 0)
+			g_usleep(BENCH_POPULATE_WAIT_MS * 1000);
+		bluez_object_manager_populate();
+		mDevices = bluetooth_device_get_number_devices();
+	}
+
+	if(mDevices == 0)
+	{
+		g_printerr("%s: the mock has no devices\n", BENCH_NAME);
+		return 1;
+	}
+
+	/*2. Calls, a window of them in flight at once */
+	startNs = bench_now_ns();
+	while(mSent < BENCH_IN_FLIGHT)
+		bench_send_call();
+
+	if(!bench_run_until(bench_calls_done, NULL, 30000))
+	{
+		g_printerr("%s: %u of %u calls answered\n", BENCH_NAME, mDone, BENCH_CALLS);
+		return 1;
+	}
+
+	bench_print_rate(BENCH_NAME, "GetAll", mDone, bench_now_ns() - startNs, "calls");
+	bench_print_latency(BENCH_NAME, "GetAll latency", mCallUs, mDone, "us");
+
+	/*3. Signals, measured from the first one of the storm until it stops */
+	mLastSignals = bluez_signal_router_get_signal_count();
+	if(!bench_run_until(bench_storm_started, NULL, 10000))
+	{
+		g_printerr("%s: the mock sent no RSSI storm\n", BENCH_NAME);
+		return 1;
+	}
+
+	startNs = mLastTickNs = mLastSignalNs = bench_now_ns();
+	startCpu = bench_cpu_ns();
+	signals = mLastSignals;
+	source = g_timeout_add(1, bench_lag_tick, NULL);
+
+	bench_run_until(bench_storm_over, NULL, 60000);
+
+	g_source_remove(source);
+	elapsedNs = mLastSignalNs - startNs;
+	signals = mLastSignals - signals;
+
+	bench_print_rate(BENCH_NAME, "PropertiesChanged", signals, elapsedNs, "signals");
+	g_print("%s cpu per signal: %.2f us\n", BENCH_NAME, signals ? (bench_cpu_ns() - startCpu) / 1000.0 / signals : 0.0);
+	bench_print_latency(BENCH_NAME, "loop lag during storm", mLagUs, mLagSamples, "us");
+
+	if(mFailed > 0)
+		g_printerr("%s: %u calls failed\n", BENCH_NAME, mFailed);
+
+	bluez_log_deinit();
+
+	return mFailed > 0 ? 1 : 0;
+}
+
+/*
+ * Private Functions
+*/
+static void bench_send_call(void)
+{
+	guint call = mSent++;
+	char path[BLUETOOTH_DEVICE_PATH_SIZE];
+
+	bluetooth_device_copy_path_at_index(call % mDevices + 1, path);
+
+	mCallStartNs[call] = bench_now_ns();
+	bluez_command_unref(bluez_command_call(path,
+				"org.freedesktop.DBus.Properties",
+				"GetAll",
+				g_variant_new("(s)", BLUEZ_DEVICE_INTERFACE),
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				bench_call_done,
+				GUINT_TO_POINTER(call)));
+}
+
+static void bench_call_done(BluezCommand * command, gpointer userData)
+{
+	guint call = GPOINTER_TO_UINT(userData);
+
+	mCallUs[mDone++] = (bench_now_ns() - mCallStartNs[call]) / 1000;
+
+	if(bluez_command_get_state(command) != BLUEZ_COMMAND_SUCCEEDED)
+		mFailed++;
+
+	// keep the window full
+	if(mSent < BENCH_CALLS)
+		bench_send_call();
+}
+
+static gboolean bench_calls_done(gpointer userData)
+{
+	(void)userData;
+
+	return mDone == BENCH_CALLS;
+}
+
+static gboolean bench_storm_started(gpointer userData)
+{
+	(void)userData;
+
+	return bluez_signal_router_get_signal_count() != mLastSignals;
+}
+
+static gboolean bench_storm_over(gpointer userData)
+{
+	(void)userData;
+
+	guint64 signals = bluez_signal_router_get_signal_count();
+	guint64 now = bench_now_ns();
+
+	if(signals != mLastSignals)
+	{
+		mLastSignals = signals;
+		mLastSignalNs = now;
+	}
+
+	return now - mLastSignalNs > BENCH_QUIET_MS * 1000000ull;
+}
+
+static gboolean bench_lag_tick(gpointer userData)
+{
+	(void)userData;
+
+	guint64 now = bench_now_ns();
+	guint64 late = now - mLastTickNs;
+
+	// what is past the 1 ms the timer asked for
+	late = late > 1000000 ? late - 1000000 : 0;
+	if(mLagSamples < BENCH_MAX_LAG_SAMPLES)
+		mLagUs[mLagSamples++] = late / 1000;
+
+	mLastTickNs = now;
+
+	return G_SOURCE_CONTINUE;
+}
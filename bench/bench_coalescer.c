@@ -0,0 +1,231 @@
+/**
+	* @file bench_coalescer.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to compare the main loop CPU an RSSI storm of BENCH_RATE events a second costs with the
+	*        coalescer off and on, see bench/coalescer.txt
+	*
+	*	- The storm is replayed on the main loop: every BENCH_TICK_MS a timer hands what the rate owes to
+	*	  bluez_signal_router_inject, RSSI on its own over BENCH_DEVICES devices, the way bluez sends it with
+	*	  DuplicateData on. The signals are built before the clock starts, only their handling is measured.
+	*	- off: a window of 0 ms, every RSSI is written to the registry and queued as an event.
+	*	- on: a window of RSSI_COALESCE_DEFAULT_WINDOW_MS with the latest value, what bluez_device_api uses.
+	*	The event queue is drained on the same loop, like the consumer would. The CPU is the one of the main
+	*	thread only, the log writer and the GDBus thread are not in it.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+
+#include "bench_common.h"
+#include "bluetooth_device.h"
+#include "bluez_match_rule.h"
+#include "bluez_signal_router.h"
+#include "bluez_command.h"
+#include "bluez_device_api.h"
+#include "bluez_rssi_coalescer.h"
+#include "bluez_event_queue.h"
+#include "bluez_dbus_names.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"coalescer"
+#define BENCH_RATE				5000		// RSSI events a second
+#define BENCH_SECONDS			3			// of storm for each mode
+#define BENCH_DEVICES			200
+#define BENCH_VALUES			8			// RSSI values built for each device
+#define BENCH_TICK_MS			10
+#define BENCH_BATCH				64
+
+/*
+ * Private Types
+*/
+typedef struct
+{
+	guint64	EVENTS;			// RSSI signals injected
+	guint64	CPU_NS;			// main thread
+	guint64	ELAPSED_NS;
+	guint64	WRITES;			// registry updates after coalescing
+	guint64	QUEUED;			// events the consumer got
+} BenchResult;
+
+/*
+ * Private Function Declerations
+*/
+static void bench_run(guint windowMs, BenchResult * result);
+static gboolean bench_tick(gpointer userData);
+static gboolean bench_storm_over(gpointer userData);
+static void bench_drain(void);
+static void bench_report(const char * mode, const BenchResult * result);
+
+/*
+ * Private Variables
+*/
+static char mPaths[BENCH_DEVICES][BLUETOOTH_DEVICE_PATH_SIZE];
+static GVariant * mSignals[BENCH_DEVICES][BENCH_VALUES];
+static guint64 mInjected;
+static guint64 mQueued;
+static guint64 mStartNs;
+static guint64 mEndNs;
+static double mDue;
+static guint64 mLastNs;
+static guint mNext;
+
+int main(void)
+{
+	GDBusConnection * connection;
+	BluetoothDevice device;
+	BenchResult off;
+	BenchResult on;
+	GVariantBuilder changed;
+	int i;
+	int v;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+
+	connection = bench_connect_bluez(5000);
+	if(connection == NULL)
+		return 1;
+
+	/*1. The modules of the device signals, set up like main.c */
+	bluetooth_device_init(BLUETOOTH_DEVICE_DEFAULT_CAPACITY);
+	bluez_match_rule_init(connection);
+	bluez_signal_router_init(connection);
+	bluez_command_init(connection);
+	bluez_device_init(connection);
+	bluez_device_init_signals();
+
+	/*2. The devices are known and their signals are built before the clock starts */
+	for(i = 0; i < BENCH_DEVICES; i++)
+	{
+		g_snprintf(mPaths[i], sizeof(mPaths[i]), BLUEZ_HCI_PATH_PREFIX "0/dev_00_00_00_00_%02X_%02X", i >> 8, i & 0xff);
+		bluetooth_device_init_properties(&device, mPaths[i]);
+		bluetooth_device_add_device(&device);
+
+		for(v = 0; v < BENCH_VALUES; v++)
+		{
+			g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+			g_variant_builder_add(&changed, "{sv}", "RSSI", g_variant_new_int16(-40 - (i * 7 + v * 5) % 50));
+			mSignals[i][v] = g_variant_ref_sink(g_variant_new("(sa{sv}as)", BLUEZ_DEVICE_INTERFACE, &changed, NULL));
+		}
+	}
+
+	/*3. The same storm, coalescer off then on */
+	bench_run(0, &off);
+	bench_report("off", &off);
+
+	bench_run(RSSI_COALESCE_DEFAULT_WINDOW_MS, &on);
+	bench_report("on", &on);
+
+	g_print("%s main loop cpu on / off: %.3f, registry writes on / off: %.3f\n", BENCH_NAME,
+			off.CPU_NS ? (double)on.CPU_NS / off.CPU_NS : 0.0, off.WRITES ? (double)on.WRITES / off.WRITES : 0.0);
+
+	for(i = 0; i < BENCH_DEVICES; i++)
+		for(v = 0; v < BENCH_VALUES; v++)
+			g_variant_unref(mSignals[i][v]);
+
+	bluez_log_deinit();
+
+	// every event has to reach the registry one way or the other, and coalescing has to write less
+	if(off.WRITES != off.EVENTS || on.WRITES == 0 || on.WRITES >= off.WRITES || off.QUEUED != off.WRITES || on.QUEUED != on.WRITES)
+	{
+		g_printerr("%s: off %llu events %llu writes %llu queued, on %llu writes %llu queued\n", BENCH_NAME,
+				(unsigned long long)off.EVENTS, (unsigned long long)off.WRITES, (unsigned long long)off.QUEUED,
+				(unsigned long long)on.WRITES, (unsigned long long)on.QUEUED);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Private Functions
+*/
+static void bench_run(guint windowMs, BenchResult * result)
+{
+	RssiCoalescerStats before;
+	RssiCoalescerStats after;
+	guint64 cpuNs;
+	guint source;
+
+	bluez_rssi_coalescer_init(windowMs, RSSI_COALESCE_LATEST);
+	bluez_rssi_coalescer_get_stats(&before);
+
+	mInjected = 0;
+	mQueued = 0;
+	mDue = 0;
+	mStartNs = mLastNs = bench_now_ns();
+	mEndNs = mStartNs + BENCH_SECONDS * 1000000000ull;
+	cpuNs = bench_thread_cpu_ns();
+
+	source = g_timeout_add(BENCH_TICK_MS, bench_tick, NULL);
+	bench_run_until(bench_storm_over, NULL, (BENCH_SECONDS + 5) * 1000);
+	g_source_remove(source);
+
+	// the last window closes, then the consumer catches up
+	bluez_rssi_coalescer_flush();
+	bench_drain();
+
+	result->CPU_NS = bench_thread_cpu_ns() - cpuNs;
+	result->ELAPSED_NS = bench_now_ns() - mStartNs;
+	result->EVENTS = mInjected;
+	result->QUEUED = mQueued;
+
+	bluez_rssi_coalescer_get_stats(&after);
+	result->WRITES = after.UPDATES - before.UPDATES;
+}
+
+static gboolean bench_tick(gpointer userData)
+{
+	(void)userData;
+
+	guint64 now = bench_now_ns();
+	guint device;
+
+	/*1. What the rate owes since the last tick, a late tick catches up */
+	mDue += BENCH_RATE * (now - mLastNs) / 1e9;
+	mLastNs = now;
+
+	while(mDue >= 1.0 && now < mEndNs)
+	{
+		device = mNext % BENCH_DEVICES;
+		bluez_signal_router_inject(mPaths[device], mSignals[device][(mNext / BENCH_DEVICES) % BENCH_VALUES]);
+		mNext++;
+		mInjected++;
+		mDue -= 1.0;
+	}
+
+	/*2. The consumer keeps up */
+	bench_drain();
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bench_storm_over(gpointer userData)
+{
+	(void)userData;
+
+	return bench_now_ns() >= mEndNs;
+}
+
+static void bench_drain(void)
+{
+	BluezEvent events[BENCH_BATCH];
+	guint count;
+
+	while((count = bluez_event_queue_pop_batch(events, BENCH_BATCH)) > 0)
+		mQueued += count;
+}
+
+static void bench_report(const char * mode, const BenchResult * result)
+{
+	char what[64];
+
+	g_snprintf(what, sizeof(what), "%s RSSI", mode);
+	bench_print_rate(BENCH_NAME, what, result->EVENTS, result->ELAPSED_NS, "events");
+
+	g_print("%s %s main loop cpu: %.1f ms, %.2f us per event, %.1f%% of the loop, %llu registry writes, %llu events queued\n",
+			BENCH_NAME, mode, result->CPU_NS / 1e6, result->EVENTS ? result->CPU_NS / 1000.0 / result->EVENTS : 0.0,
+			result->ELAPSED_NS ? 100.0 * result->CPU_NS / result->ELAPSED_NS : 0.0,
+			(unsigned long long)result->WRITES, (unsigned long long)result->QUEUED);
+}
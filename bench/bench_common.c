@@ -0,0 +1,162 @@
+/**
+	* @file bench_common.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the helpers shared by the benchmarks of make bench
+	*
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#define _GNU_SOURCE				// RUSAGE_THREAD
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "bench_common.h"
+#include "bluez_dbus_names.h"
+#include "bluez_match_rule.h"		// DBUS_DAEMON_NAME
+
+#define BENCH_POLL_MS	10			// between two looks at the owner of org.bluez
+
+/*
+ * Private Function Declerations
+*/
+static int bench_compare(const void * a, const void * b);
+static gboolean bench_timeout(gpointer userData);
+
+guint64 bench_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (guint64)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+guint64 bench_cpu_ns(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return ((guint64)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000u
+			+ ((guint64)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000u;
+}
+
+guint64 bench_thread_cpu_ns(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_THREAD, &usage);
+	return ((guint64)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000u
+			+ ((guint64)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000u;
+}
+
+guint64 bench_percentile(guint64 * samples, guint count, double percent)
+{
+	guint index;
+
+	if(count == 0)
+		return 0;
+
+	qsort(samples, count, sizeof(guint64), bench_compare);
+
+	// nearest rank, p100 is the largest sample
+	index = (guint)(percent / 100.0 * count + 0.5);
+	index = index == 0 ? 0 : index - 1;
+
+	return samples[MIN(index, count - 1)];
+}
+
+void bench_print_rate(const char * bench, const char * what, guint64 count, guint64 elapsedNs, const char * unit)
+{
+	double seconds = elapsedNs / 1e9;
+
+	g_print("%s %s: %llu in %.3f s, %.0f %s/s\n", bench, what, (unsigned long long)count, seconds,
+			seconds > 0 ? count / seconds : 0.0, unit);
+}
+
+void bench_print_latency(const char * bench, const char * what, guint64 * samples, guint count, const char * unit)
+{
+	guint64 p50 = bench_percentile(samples, count, 50);
+
+	// sorted by the first call, the others only index
+	g_print("%s %s: p50 %llu p90 %llu p99 %llu max %llu %s\n", bench, what, (unsigned long long)p50,
+			(unsigned long long)bench_percentile(samples, count, 90),
+			(unsigned long long)bench_percentile(samples, count, 99),
+			(unsigned long long)(count ? samples[count - 1] : 0), unit);
+}
+
+GDBusConnection * bench_connect_bluez(guint timeoutMs)
+{
+	GDBusConnection * connection;
+	GError * error = NULL;
+	GVariant * reply;
+	gboolean owned = FALSE;
+	guint waited;
+
+	connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+	if(connection == NULL)
+	{
+		g_printerr("Not able to get connection to system bus: %s\n", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	/*1. The mock is started next to us, it may not own the name yet */
+	for(waited = 0; !owned && waited < timeoutMs; waited += BENCH_POLL_MS)
+	{
+		reply = g_dbus_connection_call_sync(connection, DBUS_DAEMON_NAME, "/org/freedesktop/DBus", DBUS_DAEMON_NAME,
+				"NameHasOwner", g_variant_new("(s)", BLUEZ_BUS_NAME), G_VARIANT_TYPE("(b)"),
+				G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+		if(reply != NULL)
+		{
+			g_variant_get(reply, "(b)", &owned);
+			g_variant_unref(reply);
+		}
+
+		if(!owned)
+			g_usleep(BENCH_POLL_MS * 1000);
+	}
+
+	if(!owned)
+	{
+		g_printerr("%s did not show up on the bus\n", BLUEZ_BUS_NAME);
+		g_object_unref(connection);
+		return NULL;
+	}
+
+	return connection;
+}
+
+bool bench_run_until(gboolean (*condition)(gpointer userData), gpointer userData, guint timeoutMs)
+{
+	GMainContext * context = g_main_context_get_thread_default();
+	bool expired = false;
+	guint source = g_timeout_add(timeoutMs, bench_timeout, &expired);
+
+	while(!condition(userData) && !expired)
+		g_main_context_iteration(context, TRUE);
+
+	if(!expired)
+		g_source_remove(source);
+
+	return !expired;
+}
+
+/*
+ * Private Functions
+*/
+static int bench_compare(const void * a, const void * b)
+{
+	guint64 left = *(const guint64 *)a;
+	guint64 right = *(const guint64 *)b;
+
+	return left < right ? -1 : left > right;
+}
+
+static gboolean bench_timeout(gpointer userData)
+{
+	*(bool *)userData = true;
+
+	return G_SOURCE_REMOVE;
+}
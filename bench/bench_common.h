@@ -0,0 +1,83 @@
+#ifndef BENCHCOMMON_H
+#define BENCHCOMMON_H
+
+/**
+	* @file bench_common.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file holds what the benchmarks of make bench share: a clock, percentiles and the report lines.
+	*
+	* Every benchmark is a small program linked against the same objects as Stereo, see bench/run_bench.sh.
+	* Results are printed one measurement per line so two runs can be compared with diff:
+	*	<bench> <what>: <count> in <s> s, <rate> <unit>/s
+	*	<bench> <what>: p50 <v> p90 <v> p99 <v> max <v> <unit>
+	* A benchmark exits with 1 when what it measured did not work, a slow result is only reported.
+**/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+/**
+       * @brief Returns a monotonic time in nanoseconds
+       */
+guint64 bench_now_ns(void);
+
+/**
+       * @brief Returns the user and system CPU time the process used so far in nanoseconds
+       */
+guint64 bench_cpu_ns(void);
+
+/**
+       * @brief Returns the user and system CPU time the calling thread used so far in nanoseconds
+       */
+guint64 bench_thread_cpu_ns(void);
+
+/**
+       * @brief Sorts samples and returns the value below which percent of them are
+       * @param samples array of samples, sorted in place
+	   * @param count number of samples
+	   * @param percent 0 to 100
+       * @return guint64 the percentile, 0 if there are no samples
+       */
+guint64 bench_percentile(guint64 * samples, guint count, double percent);
+
+/**
+       * @brief Prints how many operations were done and how many a second
+       * @param bench name of the benchmark
+	   * @param what what was measured
+	   * @param count number of operations
+	   * @param elapsedNs time they took
+	   * @param unit name of one operation, example: "signals"
+       */
+void bench_print_rate(const char * bench, const char * what, guint64 count, guint64 elapsedNs, const char * unit);
+
+/**
+       * @brief Prints p50, p90, p99 and the maximum of samples
+       * @param bench name of the benchmark
+	   * @param what what was measured
+	   * @param samples array of samples, sorted in place
+	   * @param count number of samples
+	   * @param unit unit of the samples, example: "us"
+       */
+void bench_print_latency(const char * bench, const char * what, guint64 * samples, guint count, const char * unit);
+
+/**
+       * @brief Connects to the system bus and waits until org.bluez is owned, run_bench.sh points the system bus
+	   * at the private bus the mock runs on
+       * @param timeoutMs how long to wait for the mock
+       * @return GDBusConnection, NULL if the bus or the mock can not be reached
+       */
+GDBusConnection * bench_connect_bluez(guint timeoutMs);
+
+/**
+       * @brief Runs the thread default main context until condition returns true or timeoutMs passed
+       * @param condition polled after every iteration
+	   * @param userData passed to condition
+	   * @param timeoutMs longest time to run
+       * @return boolean True if condition became true, false on timeout
+       */
+bool bench_run_until(gboolean (*condition)(gpointer userData), gpointer userData, guint timeoutMs);
+
+#endif
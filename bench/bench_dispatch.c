@@ -0,0 +1,242 @@
+/**
+	* @file bench_dispatch.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to compare what dispatching one property key costs with a strcmp chain and with a BluezPropertyTable
+	*
+	*	- The keys are those of a Properties.GetAll of org.bluez.Device1, known and unknown ones.
+	*	- strcmp chain: the chain and type checks bluez_device_parse_properties had before the table.
+	*	- table: bluez_property_table_dispatch over the same properties and the same handlers.
+	*	Both are timed over every key and over the unknown keys only, which the chain compares against
+	*	every name before it lets them go.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include "bluez_property_table.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"dispatch"
+#define BENCH_ROUNDS			200000		// every key is dispatched this many times
+#define BENCH_MAX_KEYS			32
+
+/*
+ * Private Types
+*/
+typedef struct
+{
+	guint64	ADDRESS;
+	gint16	RSSI;
+	bool	CONNECTED;
+	bool	PAIRED;
+	bool	TRUSTED;
+	guint	UUIDS;
+	char	ALIAS[64];
+} BenchDevice;
+
+/*
+ * Private Function Declerations
+*/
+static guint bench_set_connected(gpointer target, GVariant * value);
+static guint bench_set_address(gpointer target, GVariant * value);
+static guint bench_set_paired(gpointer target, GVariant * value);
+static guint bench_set_trusted(gpointer target, GVariant * value);
+static guint bench_set_alias(gpointer target, GVariant * value);
+static guint bench_set_rssi(gpointer target, GVariant * value);
+static guint bench_set_uuids(gpointer target, GVariant * value);
+static guint bench_chain(BenchDevice * device, const char * key, GVariant * value);
+static GVariant * bench_device_properties(void);
+static double bench_time(BluezPropertyTable * table, const char ** keys, GVariant ** values, guint count);
+
+/*
+ * Private Variables
+*/
+static const BluezProperty mProperties[] = {
+	{ "Connected",	"b",	bench_set_connected },
+	{ "Address",	"s",	bench_set_address },
+	{ "Paired",		"b",	bench_set_paired },
+	{ "Trusted",	"b",	bench_set_trusted },
+	{ "Alias",		"s",	bench_set_alias },
+	{ "RSSI",		"n",	bench_set_rssi },
+	{ "UUIDs",		"as",	bench_set_uuids },
+};
+
+static BenchDevice mDevice;
+static guint mSink;			// every handler result ends up here, so no dispatch is optimized away
+
+int main(void)
+{
+	BluezPropertyTable * table;
+	GVariant * properties;
+	GVariantIter iter;
+	const char * keys[BENCH_MAX_KEYS];
+	GVariant * values[BENCH_MAX_KEYS];
+	const char * unknownKeys[BENCH_MAX_KEYS];
+	GVariant * unknownValues[BENCH_MAX_KEYS];
+	guint count = 0;
+	guint unknown = 0;
+	double chainNs;
+	double tableNs;
+	guint i;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+	table = bluez_property_table_new(mProperties, G_N_ELEMENTS(mProperties));
+
+	/*1. The keys are taken apart once, only the dispatch is timed */
+	properties = bench_device_properties();
+	g_variant_iter_init(&iter, properties);
+	while(count < BENCH_MAX_KEYS && g_variant_iter_next(&iter, "{&sv}", &keys[count], &values[count]))
+	{
+		if(bluez_property_table_dispatch(table, &mDevice, keys[count], values[count]) == 0)
+		{
+			unknownKeys[unknown] = keys[count];
+			unknownValues[unknown++] = values[count];
+		}
+		count++;
+	}
+
+	/*2. Every key, then the unknown ones only */
+	chainNs = bench_time(NULL, keys, values, count);
+	tableNs = bench_time(table, keys, values, count);
+	g_print("%s every key (%u): strcmp chain %.1f ns, table %.1f ns per key\n", BENCH_NAME, count, chainNs, tableNs);
+
+	chainNs = bench_time(NULL, unknownKeys, unknownValues, unknown);
+	tableNs = bench_time(table, unknownKeys, unknownValues, unknown);
+	g_print("%s unknown keys (%u): strcmp chain %.1f ns, table %.1f ns per key\n", BENCH_NAME, unknown, chainNs, tableNs);
+
+	for(i = 0; i < count; i++)
+		g_variant_unref(values[i]);
+	g_variant_unref(properties);
+
+	bluez_log_deinit();
+
+	// the device must have been filled by both
+	return mDevice.RSSI == -60 && mDevice.CONNECTED && strcmp(mDevice.ALIAS, "Bench") == 0 && mSink != 0 ? 0 : 1;
+}
+
+/*
+ * Private Functions
+*/
+/*
+ * Returns the ns one key takes, table NULL times the strcmp chain
+*/
+static double bench_time(BluezPropertyTable * table, const char ** keys, GVariant ** values, guint count)
+{
+	guint64 start;
+	guint round;
+	guint i;
+
+	if(count == 0)
+		return 0;
+
+	start = bench_now_ns();
+	for(round = 0; round < BENCH_ROUNDS; round++)
+	{
+		for(i = 0; i < count; i++)
+			mSink += table != NULL ? bluez_property_table_dispatch(table, &mDevice, keys[i], values[i])
+						: bench_chain(&mDevice, keys[i], values[i]);
+	}
+
+	return (double)(bench_now_ns() - start) / ((guint64)BENCH_ROUNDS * count);
+}
+
+/*
+ * The dispatch of bluez_device_parse_properties before the table, with the same handlers
+*/
+static guint bench_chain(BenchDevice * device, const char * key, GVariant * value)
+{
+	if(strcmp(key, "Connected") == 0)
+		return g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN) ? bench_set_connected(device, value) : 0;
+	else if(strcmp(key, "Address") == 0)
+		return g_variant_is_of_type(value, G_VARIANT_TYPE_STRING) ? bench_set_address(device, value) : 0;
+	else if(strcmp(key, "Paired") == 0)
+		return g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN) ? bench_set_paired(device, value) : 0;
+	else if(strcmp(key, "Trusted") == 0)
+		return g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN) ? bench_set_trusted(device, value) : 0;
+	else if(strcmp(key, "Alias") == 0)
+		return g_variant_is_of_type(value, G_VARIANT_TYPE_STRING) ? bench_set_alias(device, value) : 0;
+	else if(strcmp(key, "RSSI") == 0)
+		return g_variant_is_of_type(value, G_VARIANT_TYPE_INT16) ? bench_set_rssi(device, value) : 0;
+	else if(strcmp(key, "UUIDs") == 0)
+		return g_variant_is_of_type(value, G_VARIANT_TYPE_STRING_ARRAY) ? bench_set_uuids(device, value) : 0;
+
+	return 0;
+}
+
+/*
+ * What GetAll of org.bluez.Device1 returns for a phone
+*/
+static GVariant * bench_device_properties(void)
+{
+	GVariantBuilder properties;
+	const char * uuids[] = {"0000110a-0000-1000-8000-00805f9b34fb", "0000110e-0000-1000-8000-00805f9b34fb", NULL};
+
+	g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&properties, "{sv}", "Address", g_variant_new_string("00:11:22:33:44:55"));
+	g_variant_builder_add(&properties, "{sv}", "AddressType", g_variant_new_string("public"));
+	g_variant_builder_add(&properties, "{sv}", "Name", g_variant_new_string("Bench"));
+	g_variant_builder_add(&properties, "{sv}", "Alias", g_variant_new_string("Bench"));
+	g_variant_builder_add(&properties, "{sv}", "Class", g_variant_new_uint32(0x5a020c));
+	g_variant_builder_add(&properties, "{sv}", "Icon", g_variant_new_string("phone"));
+	g_variant_builder_add(&properties, "{sv}", "Paired", g_variant_new_boolean(TRUE));
+	g_variant_builder_add(&properties, "{sv}", "Bonded", g_variant_new_boolean(TRUE));
+	g_variant_builder_add(&properties, "{sv}", "Trusted", g_variant_new_boolean(TRUE));
+	g_variant_builder_add(&properties, "{sv}", "Blocked", g_variant_new_boolean(FALSE));
+	g_variant_builder_add(&properties, "{sv}", "LegacyPairing", g_variant_new_boolean(FALSE));
+	g_variant_builder_add(&properties, "{sv}", "RSSI", g_variant_new_int16(-60));
+	g_variant_builder_add(&properties, "{sv}", "TxPower", g_variant_new_int16(4));
+	g_variant_builder_add(&properties, "{sv}", "Connected", g_variant_new_boolean(TRUE));
+	g_variant_builder_add(&properties, "{sv}", "UUIDs", g_variant_new_strv(uuids, -1));
+	g_variant_builder_add(&properties, "{sv}", "Modalias", g_variant_new_string("bluetooth:v004Cp7204d0F00"));
+	g_variant_builder_add(&properties, "{sv}", "Adapter", g_variant_new_object_path("/org/bluez/hci0"));
+	g_variant_builder_add(&properties, "{sv}", "ServicesResolved", g_variant_new_boolean(TRUE));
+	g_variant_builder_add(&properties, "{sv}", "WakeAllowed", g_variant_new_boolean(FALSE));
+
+	return g_variant_ref_sink(g_variant_builder_end(&properties));
+}
+
+static guint bench_set_connected(gpointer target, GVariant * value)
+{
+	((BenchDevice *)target)->CONNECTED = g_variant_get_boolean(value);
+	return 1;
+}
+
+static guint bench_set_address(gpointer target, GVariant * value)
+{
+	((BenchDevice *)target)->ADDRESS = strlen(g_variant_get_string(value, NULL));
+	return 1;
+}
+
+static guint bench_set_paired(gpointer target, GVariant * value)
+{
+	((BenchDevice *)target)->PAIRED = g_variant_get_boolean(value);
+	return 1;
+}
+
+static guint bench_set_trusted(gpointer target, GVariant * value)
+{
+	((BenchDevice *)target)->TRUSTED = g_variant_get_boolean(value);
+	return 1;
+}
+
+static guint bench_set_alias(gpointer target, GVariant * value)
+{
+	g_strlcpy(((BenchDevice *)target)->ALIAS, g_variant_get_string(value, NULL), sizeof(((BenchDevice *)target)->ALIAS));
+	return 1;
+}
+
+static guint bench_set_rssi(gpointer target, GVariant * value)
+{
+	((BenchDevice *)target)->RSSI = g_variant_get_int16(value);
+	return 1;
+}
+
+static guint bench_set_uuids(gpointer target, GVariant * value)
+{
+	((BenchDevice *)target)->UUIDS = g_variant_n_children(value);
+	return 1;
+}
@@ -0,0 +1,134 @@
+/**
+	* @file bench_log.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to compare what a log call costs the calling thread with what g_print costs it
+	*
+	*	- disabled: a BLUEZ_LOG_DEBUG call while the runtime level is lower, a single compare
+	*	- enabled: the same call kept, the path argument is copied into the record, batches are kept
+	*	  below the ring size and the writer catches up in between so nothing is dropped, only the
+	*	  calls are timed
+	*	- g_print: the same line formatted and printed on the calling thread
+	*	Everything printed while measuring goes to /dev/null.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME			"log"
+#define BENCH_CALLS			1000000
+#define BENCH_BATCH			(BLUEZ_LOG_RING_SIZE / 2)
+#define BENCH_KEPT_CALLS	(BENCH_BATCH * 40)		// the writer wakes up every BLUEZ_LOG_FLUSH_MS, a batch each time
+#define BENCH_FORMAT		"***\t Device: RSSI %s %d\n"
+#define BENCH_PATH			"/org/bluez/hci0/dev_00_11_22_33_44_55"
+
+/*
+ * Private Function Declerations
+*/
+static int bench_mute_stdout(void);
+static void bench_restore_stdout(int saved);
+static void bench_wait_for_writer(guint64 written);
+
+int main(void)
+{
+	BluezLogStats stats;
+	guint64 disabledNs = 0;
+	guint64 enabledNs = 0;
+	guint64 printNs = 0;
+	guint64 start;
+	char path[sizeof(BENCH_PATH)];
+	int saved;
+	int i;
+	int j;
+
+	// a buffer the caller owns and changes, like the paths of the signal handlers
+	memcpy(path, BENCH_PATH, sizeof(path));
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_INFO);
+	saved = bench_mute_stdout();
+
+	/*1. Below the runtime level */
+	start = bench_now_ns();
+	for(i = 0; i < BENCH_CALLS; i++)
+		BLUEZ_LOG_DEBUG(BENCH_FORMAT, path, i, 0, 0);
+	disabledNs = bench_now_ns() - start;
+
+	/*2. Kept, only the calls are timed */
+	bluez_log_set_level(BLUEZ_LOG_LEVEL_DEBUG);
+	for(i = 0; i < BENCH_KEPT_CALLS; i += BENCH_BATCH)
+	{
+		start = bench_now_ns();
+		for(j = i; j < i + BENCH_BATCH; j++)
+			BLUEZ_LOG_DEBUG(BENCH_FORMAT, path, j, 0, 0);
+		enabledNs += bench_now_ns() - start;
+
+		bench_wait_for_writer(j);
+	}
+
+	/*3. Formatted and printed by the caller */
+	start = bench_now_ns();
+	for(i = 0; i < BENCH_CALLS; i++)
+		g_print(BENCH_FORMAT, path, i);
+	fflush(stdout);
+	printNs = bench_now_ns() - start;
+
+	bluez_log_get_stats(&stats);
+	bluez_log_deinit();
+	bench_restore_stdout(saved);
+
+	bench_print_rate(BENCH_NAME, "disabled", BENCH_CALLS, disabledNs, "calls");
+	bench_print_rate(BENCH_NAME, "enabled", BENCH_KEPT_CALLS, enabledNs, "calls");
+	bench_print_rate(BENCH_NAME, "g_print", BENCH_CALLS, printNs, "calls");
+	g_print("%s per call: disabled %.1f ns, enabled %.1f ns, g_print %.1f ns\n", BENCH_NAME,
+			(double)disabledNs / BENCH_CALLS, (double)enabledNs / BENCH_KEPT_CALLS, (double)printNs / BENCH_CALLS);
+
+	if(stats.DROPPED > 0)
+	{
+		g_printerr("%s: %llu records dropped\n", BENCH_NAME, (unsigned long long)stats.DROPPED);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Private Functions
+*/
+static int bench_mute_stdout(void)
+{
+	int saved;
+	int null;
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+
+	return saved;
+}
+
+static void bench_restore_stdout(int saved)
+{
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+}
+
+static void bench_wait_for_writer(guint64 written)
+{
+	BluezLogStats stats;
+
+	do
+	{
+		g_usleep(1000);
+		bluez_log_get_stats(&stats);
+	} while(stats.PRINTED < written);
+}
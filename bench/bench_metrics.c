@@ -0,0 +1,157 @@
+/**
+	* @file bench_metrics.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to show recording a D-Bus sample with bluez_metrics costs tens of nanoseconds
+	*
+	*	- call: bluez_metrics_record_call with latencies spread over every bucket, over the methods
+	*	  Stereo calls, the ids are looked up once like bluez_command does.
+	*	- signal: bluez_metrics_record_signal with the interface and member of the signals Stereo
+	*	  receives, it finds its slot by the strings every time.
+	*	- method lookup: bluez_metrics_method for a method already in the table, what a call costs once.
+	*	Each is timed in a tight loop, the counters must have moved by exactly the samples recorded.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+
+#include "bench_common.h"
+#include "bluez_metrics.h"
+#include "bluez_command.h"
+#include "bluez_dbus_names.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"metrics"
+#define BENCH_SAMPLES			10000000	// recorded for each kind
+#define BENCH_LATENCIES			1024		// latencies cycled through, a power of 2
+#define BENCH_BUDGET_NS			100			// a sample is expected below this
+
+/*
+ * Private Types
+*/
+typedef struct
+{
+	const char *	INTERFACE;
+	const char *	MEMBER;
+} BenchKey;
+
+/*
+ * Private Function Declerations
+*/
+static double bench_calls(void);
+static double bench_signals(void);
+static double bench_lookups(void);
+static void bench_report(const char * what, double ns);
+
+/*
+ * Private Variables
+*/
+static const BenchKey mMethods[] = {
+	{ BLUEZ_ADAPTER_INTERFACE,			"StartDiscovery" },
+	{ BLUEZ_DEVICE_INTERFACE,			"Connect" },
+	{ "org.freedesktop.DBus.Properties",	"Get" },
+	{ "org.freedesktop.DBus.Properties",	"GetAll" },
+};
+
+static const BenchKey mSignals[] = {
+	{ BLUEZ_DEVICE_INTERFACE,			"PropertiesChanged" },
+	{ BLUEZ_MediaPlayer_INTERFACE,		"PropertiesChanged" },
+	{ "org.freedesktop.DBus.ObjectManager",	"InterfacesAdded" },
+	{ "org.freedesktop.DBus.ObjectManager",	"InterfacesRemoved" },
+};
+
+static int mIds[G_N_ELEMENTS(mMethods)];
+static gint64 mLatencies[BENCH_LATENCIES];
+static int mSink;			// every looked up id ends up here, so no lookup is optimized away
+
+int main(void)
+{
+	BluezMetricsStats before;
+	BluezMetricsStats after;
+	guint i;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+
+	/*1. Ids and latencies before the clock starts, 1 us to about 4 s so every bucket is hit */
+	for(i = 0; i < G_N_ELEMENTS(mMethods); i++)
+		mIds[i] = bluez_metrics_method(mMethods[i].INTERFACE, mMethods[i].MEMBER);
+
+	for(i = 0; i < BENCH_LATENCIES; i++)
+		mLatencies[i] = (gint64)1 << (i % 22);
+
+	bluez_metrics_get_stats(&before);
+
+	/*2. Each kind of sample in its own loop */
+	bench_report("call", bench_calls());
+	bench_report("signal", bench_signals());
+	bench_report("method lookup", bench_lookups());
+
+	bluez_metrics_get_stats(&after);
+	bluez_log_deinit();
+
+	// every sample must have landed in a slot
+	if(after.CALLS - before.CALLS != BENCH_SAMPLES || after.SIGNALS - before.SIGNALS != BENCH_SAMPLES
+			|| after.UNTRACKED != before.UNTRACKED || mSink < 0)
+	{
+		g_printerr("%s: %llu calls, %llu signals, %llu untracked recorded\n", BENCH_NAME,
+				(unsigned long long)(after.CALLS - before.CALLS), (unsigned long long)(after.SIGNALS - before.SIGNALS),
+				(unsigned long long)(after.UNTRACKED - before.UNTRACKED));
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Private Functions
+*/
+/*
+ * Each returns the ns of one sample
+*/
+static double bench_calls(void)
+{
+	guint64 start = bench_now_ns();
+	guint i;
+
+	for(i = 0; i < BENCH_SAMPLES; i++)
+		bluez_metrics_record_call(mIds[i % G_N_ELEMENTS(mIds)], mLatencies[i & (BENCH_LATENCIES - 1)], BLUEZ_COMMAND_SUCCEEDED);
+
+	return (double)(bench_now_ns() - start) / BENCH_SAMPLES;
+}
+
+static double bench_signals(void)
+{
+	guint64 start = bench_now_ns();
+	const BenchKey * key;
+	guint i;
+
+	for(i = 0; i < BENCH_SAMPLES; i++)
+	{
+		key = &mSignals[i % G_N_ELEMENTS(mSignals)];
+		bluez_metrics_record_signal(key->INTERFACE, key->MEMBER);
+	}
+
+	return (double)(bench_now_ns() - start) / BENCH_SAMPLES;
+}
+
+static double bench_lookups(void)
+{
+	guint64 start = bench_now_ns();
+	const BenchKey * key;
+	guint i;
+
+	for(i = 0; i < BENCH_SAMPLES; i++)
+	{
+		key = &mMethods[i % G_N_ELEMENTS(mMethods)];
+		mSink |= bluez_metrics_method(key->INTERFACE, key->MEMBER);
+	}
+
+	return (double)(bench_now_ns() - start) / BENCH_SAMPLES;
+}
+
+static void bench_report(const char * what, double ns)
+{
+	g_print("%s %s: %.1f ns per sample, %s the %d ns budget\n", BENCH_NAME, what, ns,
+			ns < BENCH_BUDGET_NS ? "within" : "over", BENCH_BUDGET_NS);
+}
@@ -0,0 +1,153 @@
+/**
+	* @file bench_queue.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to measure the events a second bluez_event_queue carries from one thread to another
+	*        and what one bluez_event_queue_push costs the producer
+	*
+	*	- The main thread is the producer, it pushes BENCH_EVENTS events with the path of a device, the
+	*	  way the signal handlers do. A consumer thread drains them in batches of BLUEZ_EVENT_BATCH_SIZE
+	*	  and sleeps in bluez_event_queue_wait when the ring is empty.
+	*	- throughput: the clock runs until the consumer got the last event. A push into a full ring is
+	*	  tried again after the producer yielded, so every event gets through and the consumer gets the
+	*	  CPU on a single core too, the tries are reported as drops.
+	*	- enqueue latency: every push that is accepted is timed on its own, a sleeping consumer and the
+	*	  lock it costs to wake it are in it.
+	*	The consumer checks every event comes out once and in order.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+
+#include "bench_common.h"
+#include "bluez_event_queue.h"
+#include "bluez_dbus_names.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"queue"
+#define BENCH_EVENTS			2000000		// pushed in each run
+#define BENCH_WAIT_MS			100
+
+/*
+ * Private Function Declerations
+*/
+static guint64 bench_run(guint64 * samples);
+static gpointer bench_consumer(gpointer userData);
+
+/*
+ * Private Variables
+*/
+static gint mOutOfOrder;		// events that did not come out in the order they went in
+
+int main(void)
+{
+	BluezEventQueueStats before;
+	BluezEventQueueStats after;
+	guint64 * samples;
+	guint64 elapsedNs;
+	guint64 dropped;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+	samples = g_new(guint64, BENCH_EVENTS);
+
+	/*1. Throughput, nothing but the pushes is done on the producer */
+	bluez_event_queue_get_stats(&before);
+	elapsedNs = bench_run(NULL);
+	bluez_event_queue_get_stats(&after);
+	dropped = after.DROPPED - before.DROPPED;
+
+	bench_print_rate(BENCH_NAME, "producer to consumer", BENCH_EVENTS, elapsedNs, "events");
+	g_print("%s full ring: %llu pushes tried again, max depth %u / %u\n", BENCH_NAME,
+			(unsigned long long)dropped, after.MAX_DEPTH, BLUEZ_EVENT_QUEUE_SIZE);
+
+	/*2. Enqueue latency, every accepted push timed */
+	bench_run(samples);
+	bench_print_latency(BENCH_NAME, "enqueue", samples, BENCH_EVENTS, "ns");
+
+	bluez_event_queue_get_stats(&after);
+	g_free(samples);
+	bluez_log_deinit();
+
+	// every event must have come out once, in order, and the ring must be empty again
+	if(g_atomic_int_get(&mOutOfOrder) != 0 || after.DEPTH != 0 || after.POPPED - before.POPPED != 2ull * BENCH_EVENTS)
+	{
+		g_printerr("%s: %d events out of order, %llu popped, depth %u\n", BENCH_NAME, g_atomic_int_get(&mOutOfOrder),
+				(unsigned long long)(after.POPPED - before.POPPED), after.DEPTH);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Private Functions
+*/
+/*
+ * Pushes BENCH_EVENTS events to a consumer thread, samples NULL times the run only, returns the ns it took
+*/
+static guint64 bench_run(guint64 * samples)
+{
+	GThread * consumer;
+	guint64 startNs;
+	guint64 pushNs;
+	guint64 elapsedNs;
+	guint i;
+
+	consumer = g_thread_new("bench_consumer", bench_consumer, NULL);
+
+	startNs = bench_now_ns();
+	for(i = 0; i < BENCH_EVENTS; i++)
+	{
+		if(samples == NULL)
+		{
+			while(!bluez_event_queue_push(BLUEZ_EVENT_DEVICE_RSSI, BLUEZ_HCI_PATH_PREFIX "0/dev_00_11_22_33_44_55", (gint16)i))
+				g_thread_yield();
+			continue;
+		}
+
+		// the time of a push that is tried again is the one that got the event in
+		for(;;)
+		{
+			pushNs = bench_now_ns();
+			if(bluez_event_queue_push(BLUEZ_EVENT_DEVICE_RSSI, BLUEZ_HCI_PATH_PREFIX "0/dev_00_11_22_33_44_55", (gint16)i))
+				break;
+			g_thread_yield();
+		}
+
+		samples[i] = bench_now_ns() - pushNs;
+	}
+
+	g_thread_join(consumer);
+	elapsedNs = bench_now_ns() - startNs;
+
+	return elapsedNs;
+}
+
+static gpointer bench_consumer(gpointer userData)
+{
+	(void)userData;
+
+	BluezEvent events[BLUEZ_EVENT_BATCH_SIZE];
+	guint received = 0;
+	guint count;
+	guint i;
+
+	while(received < BENCH_EVENTS)
+	{
+		count = bluez_event_queue_pop_batch(events, BLUEZ_EVENT_BATCH_SIZE);
+		if(count == 0)
+		{
+			bluez_event_queue_wait(BENCH_WAIT_MS);
+			continue;
+		}
+
+		for(i = 0; i < count; i++, received++)
+		{
+			if(events[i].VALUE != (gint16)received)
+				g_atomic_int_inc(&mOutOfOrder);
+		}
+	}
+
+	return NULL;
+}
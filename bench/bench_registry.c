@@ -0,0 +1,168 @@
+/**
+	* @file bench_registry.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to show the device registry costs the same per operation from 10 to 10,000 devices
+	*
+	*	- For every size the registry is filled, updated, looked up and emptied through the public
+	*	  bluetooth_device_* API, the cost of one operation is printed per size.
+	*	- The next line compares an RSSI update with 10,000 devices to one with 10, it stays close to 1
+	*	  as long as the hash index and the positional array do their job.
+	*	- Once the sizes warmed the registry up, a churn of devices with rotating addresses comes and goes
+	*	  the way a steady scan does, the allocation counters of the registry may not show a heap allocation.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+
+#include "bench_common.h"
+#include "bluetooth_device.h"
+#include "double_link_list.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"registry"
+#define BENCH_MAX_DEVICES		10000
+#define BENCH_OPERATIONS		200000		// updates and lookups per size, whatever the size
+#define BENCH_PATH_SIZE			40
+#define BENCH_CHURN_DEVICES		1000		// devices in the registry at once during the churn
+#define BENCH_CHURN_ROUNDS		100
+
+/*
+ * Private Function Declerations
+*/
+static double bench_size(int devices);
+static void bench_churn(void);
+
+/*
+ * Private Variables
+*/
+static const int mSizes[] = {10, 100, 1000, BENCH_MAX_DEVICES};
+static char mPaths[BENCH_MAX_DEVICES][BENCH_PATH_SIZE];
+static bool mFailed;
+
+int main(void)
+{
+	double first = 0;
+	double last = 0;
+	guint i;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+
+	// starts small, the registry grows to the largest size like it does in a crowded scan
+	bluetooth_device_init(BLUETOOTH_DEVICE_DEFAULT_CAPACITY);
+
+	for(i = 0; i < BENCH_MAX_DEVICES; i++)
+		snprintf(mPaths[i], BENCH_PATH_SIZE, "/org/bluez/hci0/dev_00_00_00_%02X_%02X_%02X",
+				(i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+
+	for(i = 0; i < G_N_ELEMENTS(mSizes); i++)
+	{
+		last = bench_size(mSizes[i]);
+		if(i == 0)
+			first = last;
+	}
+
+	g_print("%s update cost %d/%d devices: %.2f\n", BENCH_NAME, BENCH_MAX_DEVICES, mSizes[0], first > 0 ? last / first : 0.0);
+
+	bench_churn();
+
+	bluez_log_deinit();
+
+	return mFailed ? 1 : 0;
+}
+
+/*
+ * Private Functions
+*/
+/*
+ * Returns the ns of one RSSI update at this size
+*/
+static double bench_size(int devices)
+{
+	BluetoothDevice device;
+	guint64 start;
+	double update;
+	int i;
+
+	/*1. Fill */
+	start = bench_now_ns();
+	for(i = 0; i < devices; i++)
+	{
+		bluetooth_device_init_properties(&device, mPaths[i]);
+		mFailed |= !bluetooth_device_add_device(&device);
+	}
+	g_print("%s %5d devices: add %.0f ns", BENCH_NAME, devices, (double)(bench_now_ns() - start) / devices);
+
+	/*2. RSSI updates spread over every device, the value changes every time */
+	start = bench_now_ns();
+	for(i = 0; i < BENCH_OPERATIONS; i++)
+		mFailed |= !bluetooth_device_property_update_RSSI(mPaths[i % devices], -40 - i % 40);
+	update = (double)(bench_now_ns() - start) / BENCH_OPERATIONS;
+	g_print(", update %.0f ns", update);
+
+	/*3. Lookups the way readers copy a device */
+	start = bench_now_ns();
+	for(i = 0; i < BENCH_OPERATIONS; i++)
+		mFailed |= !bluetooth_device_copy_by_path(mPaths[i % devices], &device);
+	g_print(", lookup %.0f ns", (double)(bench_now_ns() - start) / BENCH_OPERATIONS);
+
+	/*4. Empty it from the front, the worst case of a positional array */
+	start = bench_now_ns();
+	for(i = 0; i < devices; i++)
+		mFailed |= !bluetooth_device_remove_device_by_path(mPaths[i]);
+	g_print(", remove %.0f ns\n", (double)(bench_now_ns() - start) / devices);
+
+	// every device is gone again
+	mFailed |= bluetooth_device_copy_at_index(1, &device);
+
+	return update;
+}
+
+/*
+ * Devices come, change and go after the warm up, the registry may only use what it already has
+*/
+static void bench_churn(void)
+{
+	BluetoothDevice device;
+	NodePoolStats before;
+	NodePoolStats after;
+	guint64 start;
+	int round;
+	int i;
+	int address;
+
+	bluetooth_device_get_allocation_stats(&before);
+
+	start = bench_now_ns();
+	for(round = 0; round < BENCH_CHURN_ROUNDS; round++)
+	{
+		// the addresses rotate, every round brings paths the last one did not have
+		for(i = 0; i < BENCH_CHURN_DEVICES; i++)
+		{
+			address = (round * BENCH_CHURN_DEVICES + i) % BENCH_MAX_DEVICES;
+			bluetooth_device_init_properties(&device, mPaths[address]);
+			mFailed |= !bluetooth_device_add_device(&device);
+			mFailed |= !bluetooth_device_property_update_RSSI(mPaths[address], -40 - i % 40);
+		}
+
+		for(i = 0; i < BENCH_CHURN_DEVICES; i++)
+			mFailed |= !bluetooth_device_remove_device_by_path(mPaths[(round * BENCH_CHURN_DEVICES + i) % BENCH_MAX_DEVICES]);
+	}
+
+	bluetooth_device_get_allocation_stats(&after);
+
+	bench_print_rate(BENCH_NAME, "churn add, update and remove", (guint64)BENCH_CHURN_ROUNDS * BENCH_CHURN_DEVICES,
+			bench_now_ns() - start, "devices");
+	g_print("%s churn heap allocations: %llu, nodes taken from the pool: %llu\n", BENCH_NAME,
+			(unsigned long long)(after.heapAllocations - before.heapAllocations),
+			(unsigned long long)(after.nodeAllocations - before.nodeAllocations));
+
+	// steady state discovery does not touch the heap
+	if(after.heapAllocations != before.heapAllocations)
+	{
+		g_printerr("%s: %llu heap allocations during the churn\n", BENCH_NAME,
+				(unsigned long long)(after.heapAllocations - before.heapAllocations));
+		mFailed = true;
+	}
+}
@@ -0,0 +1,234 @@
+/**
+	* @file bench_soak.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to show the signal hot path does not grow the heap, see bench/soak.txt
+	*
+	*	- Every round BENCH_DEVICES devices with new addresses come and go, the addresses wrap after
+	*	  BENCH_ADDRESSES so the registry, the advertisement slots and the coalescer see paths they
+	*	  already had and paths they did not.
+	*	- Each device gets the PropertiesChanged signals of a scan through bluez_signal_router_inject:
+	*	  a dictionary with its alias, UUIDs, payloads and RSSI, RSSI on its own, and the disconnect.
+	*	  The coalescer is flushed and the event queue drained every round, like the main loop would.
+	*	- The heap in use is taken once every address was seen and again at the end, it may not grow.
+	*	  mallinfo2 counts what the per thread cache of glibc holds as in use, so the benchmark runs
+	*	  itself again with that cache off, or the heap would seem to move by what it happens to hold.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include "bench_common.h"
+#include "bluetooth_device.h"
+#include "bluez_match_rule.h"
+#include "bluez_signal_router.h"
+#include "bluez_command.h"
+#include "bluez_device_api.h"
+#include "bluez_rssi_coalescer.h"
+#include "bluez_event_queue.h"
+#include "bluez_advertisement.h"
+#include "bluez_dbus_names.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"soak"
+#define BENCH_DEVICES			256
+#define BENCH_ADDRESSES			4096		// addresses wrap after this many, every one is seen in the warm up
+#define BENCH_WARM_UP_ROUNDS	(BENCH_ADDRESSES / BENCH_DEVICES)
+#define BENCH_ROUNDS			200
+#define BENCH_RSSI_SIGNALS		3			// RSSI on its own, per device and round
+#define BENCH_BATCH				64
+#define BENCH_TUNABLES			"glibc.malloc.tcache_count=0"
+
+/*
+ * Private Function Declerations
+*/
+static void bench_round(int round);
+static void bench_inject(const char * path, GVariant * changed);
+static GVariant * bench_scan_properties(int address, int round);
+static GVariant * bench_property(const char * key, GVariant * value);
+static gsize bench_heap_in_use(void);
+static void bench_without_tcache(char ** argv);
+
+/*
+ * Private Variables
+*/
+static guint64 mSignals;
+static guint64 mEvents;
+
+int main(int argc, char ** argv)
+{
+	GDBusConnection * connection;
+	gsize warm;
+	gsize end;
+	guint64 signals;
+	guint64 startNs;
+	int round;
+
+	(void)argc;
+	bench_without_tcache(argv);
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+
+	connection = bench_connect_bluez(5000);
+	if(connection == NULL)
+		return 1;
+
+	/*1. The modules of the device signals, set up like main.c */
+	bluetooth_device_init(BLUETOOTH_DEVICE_DEFAULT_CAPACITY);
+	bluez_match_rule_init(connection);
+	bluez_signal_router_init(connection);
+	bluez_command_init(connection);
+	bluez_device_init(connection);
+	bluez_device_init_signals();
+
+	/*2. Warm up until every address was seen once, the tables are as large as they get */
+	for(round = 0; round < BENCH_WARM_UP_ROUNDS; round++)
+		bench_round(round);
+
+	warm = bench_heap_in_use();
+	signals = mSignals;
+	startNs = bench_now_ns();
+
+	/*3. Soak */
+	for(; round < BENCH_WARM_UP_ROUNDS + BENCH_ROUNDS; round++)
+		bench_round(round);
+
+	end = bench_heap_in_use();
+	signals = mSignals - signals;
+
+	bench_print_rate(BENCH_NAME, "PropertiesChanged", signals, bench_now_ns() - startNs, "signals");
+	g_print("%s heap in use: %zu bytes after warm up, %zu after %d rounds, growth %zd bytes, %llu events\n", BENCH_NAME,
+			warm, end, BENCH_ROUNDS, (gssize)(end - warm), (unsigned long long)mEvents);
+
+	bluez_log_deinit();
+
+	return end > warm ? 1 : 0;
+}
+
+/*
+ * Private Functions
+*/
+static void bench_round(int round)
+{
+	BluezEvent events[BENCH_BATCH];
+	BluetoothDevice device;
+	char path[BLUETOOTH_DEVICE_PATH_SIZE];
+	int address;
+	int i;
+	int j;
+
+	for(i = 0; i < BENCH_DEVICES; i++)
+	{
+		address = (round * BENCH_DEVICES + i) % BENCH_ADDRESSES;
+		g_snprintf(path, sizeof(path), BLUEZ_HCI_PATH_PREFIX "0/dev_00_00_00_00_%02X_%02X", address >> 8, address & 0xff);
+
+		/*1. The device shows up, the way InterfacesAdded adds it */
+		bluetooth_device_init_properties(&device, path);
+		bluetooth_device_add_device(&device);
+
+		/*2. What a scan sends for it */
+		bench_inject(path, bench_scan_properties(address, round));
+
+		for(j = 0; j < BENCH_RSSI_SIGNALS; j++)
+			bench_inject(path, bench_property("RSSI", g_variant_new_int16(-40 - (round + i + j) % 40)));
+	}
+
+	/*3. The window closes and the consumer catches up */
+	bluez_rssi_coalescer_flush();
+	while((j = bluez_event_queue_pop_batch(events, BENCH_BATCH)) > 0)
+		mEvents += j;
+
+	/*4. Every device goes away again */
+	for(i = 0; i < BENCH_DEVICES; i++)
+	{
+		address = (round * BENCH_DEVICES + i) % BENCH_ADDRESSES;
+		g_snprintf(path, sizeof(path), BLUEZ_HCI_PATH_PREFIX "0/dev_00_00_00_00_%02X_%02X", address >> 8, address & 0xff);
+
+		bench_inject(path, bench_property("Connected", g_variant_new_boolean(FALSE)));
+		bluez_advertisement_forget(path);
+	}
+
+	while((j = bluez_event_queue_pop_batch(events, BENCH_BATCH)) > 0)
+		mEvents += j;
+}
+
+/*
+ * Routes changed as a PropertiesChanged of org.bluez.Device1, consumes changed
+*/
+static void bench_inject(const char * path, GVariant * changed)
+{
+	GVariant * params = g_variant_ref_sink(g_variant_new("(s@a{sv}@as)", BLUEZ_DEVICE_INTERFACE, changed,
+				g_variant_new_strv(NULL, 0)));
+
+	bluez_signal_router_inject(path, params);
+	g_variant_unref(params);
+	mSignals++;
+}
+
+static GVariant * bench_scan_properties(int address, int round)
+{
+	GVariantBuilder properties;
+	GVariantBuilder manufacturer;
+	GVariantBuilder service;
+	guint8 payload[] = {0x02, 0x15, (guint8)address, (guint8)round};
+	const char * uuids[] = {"0000180f-0000-1000-8000-00805f9b34fb", "0000feaa-0000-1000-8000-00805f9b34fb", NULL};
+	char alias[BLUETOOTH_DEVICE_ALIAS_SIZE];
+
+	g_snprintf(alias, sizeof(alias), "Beacon %d", address);
+
+	g_variant_builder_init(&manufacturer, G_VARIANT_TYPE("a{qv}"));
+	g_variant_builder_add(&manufacturer, "{qv}", 0x004c,
+			g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, payload, sizeof(payload), 1));
+
+	g_variant_builder_init(&service, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&service, "{sv}", uuids[1],
+			g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, payload, sizeof(payload), 1));
+
+	g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&properties, "{sv}", "Alias", g_variant_new_string(alias));
+	g_variant_builder_add(&properties, "{sv}", "UUIDs", g_variant_new_strv(uuids, -1));
+	g_variant_builder_add(&properties, "{sv}", "ManufacturerData", g_variant_builder_end(&manufacturer));
+	g_variant_builder_add(&properties, "{sv}", "ServiceData", g_variant_builder_end(&service));
+	g_variant_builder_add(&properties, "{sv}", "RSSI", g_variant_new_int16(-60));
+
+	return g_variant_builder_end(&properties);
+}
+
+static GVariant * bench_property(const char * key, GVariant * value)
+{
+	GVariantBuilder properties;
+
+	g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&properties, "{sv}", key, value);
+
+	return g_variant_builder_end(&properties);
+}
+
+static gsize bench_heap_in_use(void)
+{
+	struct mallinfo2 info = mallinfo2();
+
+	return info.uordblks + info.hblkhd;
+}
+
+/*
+ * Runs the benchmark again with the per thread cache of malloc off, returns if it already is
+*/
+static void bench_without_tcache(char ** argv)
+{
+	const char * tunables = getenv("GLIBC_TUNABLES");
+
+	if(tunables != NULL && strstr(tunables, BENCH_TUNABLES) != NULL)
+		return;
+
+	setenv("GLIBC_TUNABLES", BENCH_TUNABLES, 1);
+	execv("/proc/self/exe", argv);
+
+	// the heap is measured with the cache on then, it may only seem to grow
+	g_printerr("%s: could not run again without the malloc cache\n", BENCH_NAME);
+}
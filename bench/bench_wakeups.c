@@ -0,0 +1,266 @@
+/**
+	* @file bench_wakeups.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to compare how often the daemon wakes us with the wide subscriptions Stereo made before
+	*        bluez_match_rule and with the match rules it makes now, against tools/mock_bluetoothd, see bench/wakeups.txt
+	*
+	*	- before: a second connection subscribes the way the baseline did, PropertiesChanged and
+	*	  InterfacesAdded / InterfacesRemoved of org.bluez for every path.
+	*	- after: the modules are set up the way main.c does, through bluez_signal_router and bluez_match_rule.
+	*	Both connections listen to the same mixed traffic of the mock at the same time: RSSI and payloads of
+	*	the devices, players, and the noise of GATT, transport and battery objects Stereo does not handle.
+	*	A wakeup is a signal dbus-daemon delivered to the connection, counted by a filter before GDBus routes it.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+
+#include "bench_common.h"
+#include "bluetooth_device.h"
+#include "bluez_match_rule.h"
+#include "bluez_signal_router.h"
+#include "bluez_command.h"
+#include "bluez_adapter_api.h"
+#include "bluez_device_api.h"
+#include "bluez_mediaplayer_api.h"
+#include "bluez_dbus_names.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"wakeups"
+#define BENCH_POLL_MS			10
+#define BENCH_QUIET_MS			500			// the traffic is over after this long without a signal
+#define BENCH_TIMEOUT_MS		30000
+
+/*
+ * Private Function Declerations
+*/
+static GDBusConnection * bench_connect_wide(void);
+static void bench_subscribe_wide(GDBusConnection * connection);
+static GDBusMessage * bench_count(GDBusConnection * conn, GDBusMessage * message, gboolean incoming, gpointer userData);
+static void bench_wide_signal(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *signal,
+				GVariant *params,
+				void *userData);
+static gboolean bench_poll(gpointer userData);
+static gboolean bench_traffic_started(gpointer userData);
+static gboolean bench_traffic_over(gpointer userData);
+
+/*
+ * Private Variables
+*/
+static gint mWakeups[2];			// BENCH_BEFORE and BENCH_AFTER, counted on the GDBus worker threads
+static guint64 mWideSignals;		// what the wide subscriptions handed to their callback
+static guint mLastWakeups;
+static guint64 mLastWakeupNs;
+
+enum { BENCH_BEFORE, BENCH_AFTER };
+
+int main(void)
+{
+	GDBusConnection * connection;
+	GDBusConnection * wide;
+	guint before[2];
+	guint after[2];
+	guint64 startNs;
+	guint64 elapsedNs;
+	guint source;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+
+	connection = bench_connect_bluez(5000);
+	if(connection == NULL)
+		return 1;
+
+	wide = bench_connect_wide();
+	if(wide == NULL)
+		return 1;
+
+	/*1. After: set up like main.c, every handler listens */
+	g_dbus_connection_add_filter(connection, bench_count, GINT_TO_POINTER(BENCH_AFTER), NULL);
+	bluetooth_device_init(BLUETOOTH_DEVICE_DEFAULT_CAPACITY);
+	bluez_match_rule_init(connection);
+	bluez_signal_router_init(connection);
+	bluez_command_init(connection);
+	bluez_adapter_init(connection);
+	bluez_device_init(connection);
+	bluez_device_init_signals();
+	bluez_media_player_init(connection);
+	bluez_adapter_init_signals();
+
+	/*2. Before: the same subscriptions as the baseline */
+	g_dbus_connection_add_filter(wide, bench_count, GINT_TO_POINTER(BENCH_BEFORE), NULL);
+	bench_subscribe_wide(wide);
+
+	/*3. Count from the first signal of the traffic until it stops, the wide connection sees every one */
+	source = g_timeout_add(BENCH_POLL_MS, bench_poll, NULL);
+	mLastWakeups = g_atomic_int_get(&mWakeups[BENCH_BEFORE]);
+	if(!bench_run_until(bench_traffic_started, NULL, BENCH_TIMEOUT_MS))
+	{
+		g_printerr("%s: the mock sent no traffic\n", BENCH_NAME);
+		return 1;
+	}
+
+	startNs = mLastWakeupNs = bench_now_ns();
+	before[0] = g_atomic_int_get(&mWakeups[BENCH_BEFORE]);
+	after[0] = g_atomic_int_get(&mWakeups[BENCH_AFTER]);
+
+	bench_run_until(bench_traffic_over, NULL, BENCH_TIMEOUT_MS);
+
+	g_source_remove(source);
+	elapsedNs = mLastWakeupNs - startNs;
+	before[1] = g_atomic_int_get(&mWakeups[BENCH_BEFORE]) - before[0];
+	after[1] = g_atomic_int_get(&mWakeups[BENCH_AFTER]) - after[0];
+
+	bench_print_rate(BENCH_NAME, "before, wide subscriptions", before[1], elapsedNs, "wakeups");
+	bench_print_rate(BENCH_NAME, "after, match rules", after[1], elapsedNs, "wakeups");
+	g_print("%s after / before: %.3f, %u signals the daemon no longer sends\n", BENCH_NAME,
+			before[1] ? (double)after[1] / before[1] : 0.0, before[1] > after[1] ? before[1] - after[1] : 0);
+
+	bluez_log_deinit();
+
+	// the handlers must still get their signals, and the daemon must have dropped the rest
+	if(after[1] == 0 || after[1] >= before[1] || mWideSignals == 0)
+	{
+		g_printerr("%s: %u wakeups before, %u after\n", BENCH_NAME, before[1], after[1]);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Private Functions
+*/
+/*
+ * A connection of its own to the bus of the mock, so its match rules do not mix with those of the modules
+*/
+static GDBusConnection * bench_connect_wide(void)
+{
+	GDBusConnection * connection;
+	GError * error = NULL;
+	gchar * address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+
+	if(address == NULL)
+	{
+		g_printerr("%s: no system bus address: %s\n", BENCH_NAME, error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	connection = g_dbus_connection_new_for_address_sync(address,
+					G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+					NULL,
+					NULL,
+					&error);
+	g_free(address);
+
+	if(connection == NULL)
+	{
+		g_printerr("%s: not able to open a second connection: %s\n", BENCH_NAME, error->message);
+		g_error_free(error);
+	}
+
+	return connection;
+}
+
+/*
+ * What bluez_adapter_init_signals, bluez_device_init_signals and bluez_media_player_init_signals did before
+*/
+static void bench_subscribe_wide(GDBusConnection * connection)
+{
+	const char * arg0[] = {NULL, NULL, NULL, BLUEZ_MediaController_INTERFACE};		// adapter, device, player, control
+	const char * members[] = {"InterfacesAdded", "InterfacesRemoved"};
+	guint i;
+
+	for(i = 0; i < G_N_ELEMENTS(arg0); i++)
+		g_dbus_connection_signal_subscribe(connection,
+				BLUEZ_BUS_NAME,
+				DBUS_PROPERTIES_INTERFACE,
+				"PropertiesChanged",
+				NULL,
+				arg0[i],
+				G_DBUS_SIGNAL_FLAGS_NONE,
+				bench_wide_signal,
+				NULL,
+				NULL);
+
+	for(i = 0; i < G_N_ELEMENTS(members); i++)
+		g_dbus_connection_signal_subscribe(connection,
+				BLUEZ_BUS_NAME,
+				"org.freedesktop.DBus.ObjectManager",
+				members[i],
+				NULL,
+				NULL,
+				G_DBUS_SIGNAL_FLAGS_NONE,
+				bench_wide_signal,
+				NULL,
+				NULL);
+}
+
+static GDBusMessage * bench_count(GDBusConnection * conn, GDBusMessage * message, gboolean incoming, gpointer userData)
+{
+	(void)conn;
+
+	if(incoming && g_dbus_message_get_message_type(message) == G_DBUS_MESSAGE_TYPE_SIGNAL
+			&& g_strcmp0(g_dbus_message_get_sender(message), DBUS_DAEMON_NAME) != 0)
+		g_atomic_int_inc(&mWakeups[GPOINTER_TO_INT(userData)]);
+
+	return message;
+}
+
+static void bench_wide_signal(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *signal,
+				GVariant *params,
+				void *userData)
+{
+	(void)conn;
+	(void)sender;
+	(void)path;
+	(void)interface;
+	(void)signal;
+	(void)params;
+	(void)userData;
+
+	mWideSignals++;
+}
+
+/*
+ * Keeps the loop iterating while the traffic is quiet, so its end is noticed
+*/
+static gboolean bench_poll(gpointer userData)
+{
+	(void)userData;
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bench_traffic_started(gpointer userData)
+{
+	(void)userData;
+
+	return (guint)g_atomic_int_get(&mWakeups[BENCH_BEFORE]) != mLastWakeups;
+}
+
+static gboolean bench_traffic_over(gpointer userData)
+{
+	(void)userData;
+
+	guint wakeups = g_atomic_int_get(&mWakeups[BENCH_BEFORE]);
+	guint64 now = bench_now_ns();
+
+	if(wakeups != mLastWakeups)
+	{
+		mLastWakeups = wakeups;
+		mLastWakeupNs = now;
+	}
+
+	return now - mLastWakeupNs > BENCH_QUIET_MS * 1000000ull;
+}
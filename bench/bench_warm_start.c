@@ -0,0 +1,265 @@
+/**
+	* @file bench_warm_start.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to compare the round trips and the time to ready of the three ways of reading the devices
+	*        bluetoothd already knows, against tools/mock_bluetoothd, see bench/warm_start.txt
+	*
+	*	- GetManagedObjects: bluez_object_manager_populate, one call for every object
+	*	- GetAll: one Properties.GetAll a device, what a connect event does
+	*	- Get: the six Properties.Get a device the baseline made, every call in flight at once like it did
+	*	The registry is emptied before each way, ready is when the last reply was applied. Every device
+	*	has to be back with its alias, or the benchmark fails.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make bench, see bench/run_bench.sh
+	*/
+#include <stdio.h>
+
+#include "bench_common.h"
+#include "bluetooth_device.h"
+#include "bluez_match_rule.h"
+#include "bluez_signal_router.h"
+#include "bluez_command.h"
+#include "bluez_adapter_api.h"
+#include "bluez_device_api.h"
+#include "bluez_mediaplayer_api.h"
+#include "bluez_object_manager_api.h"
+#include "bluez_log.h"
+
+#define BENCH_NAME				"warm_start"
+#define BENCH_MAX_DEVICES		1024
+#define BENCH_POPULATE_TRIES	20
+#define BENCH_POPULATE_WAIT_MS	50
+#define BENCH_TIMEOUT_MS		30000
+
+/*
+ * Private Function Declerations
+*/
+static void bench_clear(void);
+static bool bench_check(const char * what);
+static void bench_read_all(void);
+static void bench_read_each(void);
+static void bench_get_all_done(BluezCommand * command, gpointer userData);
+static void bench_get_done(BluezCommand * command, gpointer userData);
+static gboolean bench_replies_done(gpointer userData);
+static void bench_report(const char * what, guint64 elapsedNs);
+
+/*
+ * Private Variables
+*/
+static const char * mProperties[] = {PROPERTY_ADDRESS, PROPERTY_NAME, PROPERTY_ICON, PROPERTY_PAIRED, PROPERTY_TRUSTED, PROPERTY_ALIAS};
+static char mPaths[BENCH_MAX_DEVICES][BLUETOOTH_DEVICE_PATH_SIZE];
+static int mDevices;
+static guint mCalls;
+static guint mReplies;
+static guint mFailed;
+
+int main(void)
+{
+	GDBusConnection * connection;
+	ObjectManagerStats stats;
+	guint64 startNs = 0;
+	int tries;
+	int i;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+
+	connection = bench_connect_bluez(5000);
+	if(connection == NULL)
+		return 1;
+
+	bluetooth_device_init(BLUETOOTH_DEVICE_DEFAULT_CAPACITY);
+	bluez_match_rule_init(connection);
+	bluez_signal_router_init(connection);
+	bluez_command_init(connection);
+	bluez_adapter_init(connection);
+	bluez_device_init(connection);
+	bluez_media_player_init(connection);
+	bluez_object_manager_init(connection);
+
+	/*1. GetManagedObjects, the mock owns the name a moment before its script adds the devices */
+	for(tries = 0; tries < BENCH_POPULATE_TRIES && mDevices == 0; tries++)
+	{
+		if(tries > 0)
+		{
+			g_usleep(BENCH_POPULATE_WAIT_MS * 1000);
+			bench_clear();
+		}
+
+		startNs = bench_now_ns();
+		bluez_object_manager_populate();
+		mDevices = bluetooth_device_get_number_devices();
+	}
+
+	bluez_object_manager_get_stats(&stats);
+	mCalls = stats.ROUND_TRIPS;
+	bench_report("GetManagedObjects", bench_now_ns() - startNs);
+
+	if(mDevices == 0 || mDevices > BENCH_MAX_DEVICES || !bench_check("GetManagedObjects"))
+		return 1;
+
+	// the other two ways start from the paths the first one found, like InterfacesAdded would give them
+	for(i = 0; i < mDevices; i++)
+		bluetooth_device_copy_path_at_index(i + 1, mPaths[i]);
+
+	/*2. One GetAll a device */
+	bench_clear();
+	startNs = bench_now_ns();
+	bench_read_all();
+	if(!bench_run_until(bench_replies_done, NULL, BENCH_TIMEOUT_MS))
+		mFailed++;
+	bench_report("GetAll", bench_now_ns() - startNs);
+	bench_check("GetAll");
+
+	/*3. Six Get a device */
+	bench_clear();
+	startNs = bench_now_ns();
+	bench_read_each();
+	if(!bench_run_until(bench_replies_done, NULL, BENCH_TIMEOUT_MS))
+		mFailed++;
+	bench_report("Get", bench_now_ns() - startNs);
+	bench_check("Get");
+
+	if(mFailed > 0)
+		g_printerr("%s: %u calls failed\n", BENCH_NAME, mFailed);
+
+	bluez_log_deinit();
+
+	return mFailed > 0 ? 1 : 0;
+}
+
+/*
+ * Private Functions
+*/
+static void bench_clear(void)
+{
+	bluetooth_device_remove_all_devices();
+	mCalls = 0;
+	mReplies = 0;
+}
+
+/*
+ * Every device is back and its alias was read
+*/
+static bool bench_check(const char * what)
+{
+	BluetoothDevice device;
+	int i;
+
+	for(i = 1; i <= mDevices; i++)
+	{
+		if(!bluetooth_device_copy_at_index(i, &device) || device.ALIAS[0] == '\0')
+		{
+			g_printerr("%s %s: device %d of %d was not read\n", BENCH_NAME, what, i, mDevices);
+			mFailed++;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void bench_read_all(void)
+{
+	BluetoothDevice device;
+	int i;
+
+	for(i = 0; i < mDevices; i++)
+	{
+		bluetooth_device_init_properties(&device, mPaths[i]);
+		bluetooth_device_add_device(&device);
+
+		mCalls++;
+		bluez_command_unref(bluez_command_call(mPaths[i],
+					"org.freedesktop.DBus.Properties",
+					"GetAll",
+					g_variant_new("(s)", BLUEZ_DEVICE_INTERFACE),
+					BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+					bench_get_all_done,
+					GINT_TO_POINTER(i)));
+	}
+}
+
+static void bench_read_each(void)
+{
+	BluetoothDevice device;
+	guint property;
+	int i;
+
+	for(i = 0; i < mDevices; i++)
+	{
+		bluetooth_device_init_properties(&device, mPaths[i]);
+		bluetooth_device_add_device(&device);
+
+		for(property = 0; property < G_N_ELEMENTS(mProperties); property++)
+		{
+			mCalls++;
+			bluez_command_unref(bluez_command_call(mPaths[i],
+						"org.freedesktop.DBus.Properties",
+						"Get",
+						g_variant_new("(ss)", BLUEZ_DEVICE_INTERFACE, mProperties[property]),
+						BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+						bench_get_done,
+						GUINT_TO_POINTER(i * G_N_ELEMENTS(mProperties) + property)));
+		}
+	}
+}
+
+static void bench_get_all_done(BluezCommand * command, gpointer userData)
+{
+	GVariant * result = bluez_command_get_result(command);		// borrowed
+	GVariant * properties;
+
+	mReplies++;
+
+	if(result == NULL || !g_variant_is_of_type(result, G_VARIANT_TYPE("(a{sv})")))
+	{
+		mFailed++;
+		return;
+	}
+
+	g_variant_get(result, "(@a{sv})", &properties);
+	bluetooth_device_update_properties(mPaths[GPOINTER_TO_INT(userData)], properties);
+	g_variant_unref(properties);
+}
+
+static void bench_get_done(BluezCommand * command, gpointer userData)
+{
+	guint call = GPOINTER_TO_UINT(userData);
+	GVariant * result = bluez_command_get_result(command);		// borrowed
+	GVariant * value;
+	GVariantBuilder builder;
+	GVariant * properties;
+
+	mReplies++;
+
+	if(result == NULL || !g_variant_is_of_type(result, G_VARIANT_TYPE("(v)")))
+	{
+		mFailed++;
+		return;
+	}
+
+	// a dictionary with a single entry, the way bluez_device_refresh_property applies it
+	g_variant_get(result, "(v)", &value);
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&builder, "{sv}", mProperties[call % G_N_ELEMENTS(mProperties)], value);
+	properties = g_variant_ref_sink(g_variant_builder_end(&builder));
+
+	bluetooth_device_update_properties(mPaths[call / G_N_ELEMENTS(mProperties)], properties);
+
+	g_variant_unref(properties);
+	g_variant_unref(value);
+}
+
+static gboolean bench_replies_done(gpointer userData)
+{
+	(void)userData;
+
+	return mReplies == mCalls;
+}
+
+static void bench_report(const char * what, guint64 elapsedNs)
+{
+	g_print("%s %s: %d devices, %u round trips, ready in %.1f ms\n", BENCH_NAME, what, mDevices, mCalls, elapsedNs / 1e6);
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Runs every benchmark built by make bench, see bench/bench_common.h for what they print.
+#	bench/run_bench.sh OBJ_DIR MOCK [NAME...]
+# A benchmark with a script bench/NAME.txt runs on a private bus against the mock started with that script,
+# the others run on their own. The output of the mock goes to OBJ_DIR/mock_NAME.log.
+# Exits with 1 if a benchmark failed.
+
+OBJ_DIR=${1:-obj}
+MOCK=${2:-./mock_bluetoothd}
+BENCH_DIR=$(dirname "$0")
+shift 2 2>/dev/null
+
+# make passes the mock as a file name of the current directory
+case $MOCK in
+	*/*) ;;
+	*) MOCK=./$MOCK ;;
+esac
+
+if [ $# -eq 0 ]; then
+	for bench in "$OBJ_DIR"/bench_*; do
+		[ -x "$bench" ] && set -- "$@" "${bench##*/bench_}"
+	done
+fi
+
+failed=0
+for name in "$@"; do
+	echo "*** $name"
+	if [ -f "$BENCH_DIR/$name.txt" ]; then
+		# the mock quits at the end of its script, the benchmark is done well before
+		dbus-run-session -- sh -c "
+			export DBUS_SYSTEM_BUS_ADDRESS=\$DBUS_SESSION_BUS_ADDRESS
+			$MOCK --script '$BENCH_DIR/$name.txt' > '$OBJ_DIR/mock_$name.log' 2>&1 &
+			'$OBJ_DIR/bench_$name'; status=\$?
+			wait
+			exit \$status" || failed=1
+	else
+		"$OBJ_DIR/bench_$name" || failed=1
+	fi
+done
+
+exit $failed
@@ -0,0 +1,164 @@
+/**
+	* @file stress_registry.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to run the device registry with one writer and several readers at once under ThreadSanitizer
+	*
+	*	- The writer adds, updates and removes devices through the public bluetooth_device_* API, on two adapters
+	*	  so devices are merged and released like they are with a second dongle.
+	*	- The readers copy devices by path, by index and all at once, every copy has to be one the writer stored.
+	*	- make stress builds this and every object it links with -fsanitize=thread, a data race or a torn copy
+	*	  fails the run.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make stress
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluetooth_device.h"
+#include "bluez_log.h"
+
+#define STRESS_NAME				"stress_registry"
+#define STRESS_READERS			4
+#define STRESS_DEVICES			256
+#define STRESS_ROUNDS			200			// the writer fills and empties the registry this many times
+#define STRESS_PATH_SIZE		40
+
+/*
+ * Private Function Declerations
+*/
+static gpointer stress_reader(gpointer userData);
+static void stress_write_round(int round);
+static bool stress_check_copy(const BluetoothDevice * device);
+
+/*
+ * Private Variables
+*/
+static char mPaths[2][STRESS_DEVICES][STRESS_PATH_SIZE];		// the same devices seen by hci0 and hci1
+static gint mDone;
+static gint mTorn;
+static gint mReads;
+
+int main(void)
+{
+	GThread * readers[STRESS_READERS];
+	int round;
+	int i;
+
+	bluez_log_init(BLUEZ_LOG_LEVEL_WARN);
+	bluetooth_device_init(BLUETOOTH_DEVICE_DEFAULT_CAPACITY);
+
+	for(i = 0; i < STRESS_DEVICES; i++)
+	{
+		snprintf(mPaths[0][i], STRESS_PATH_SIZE, "/org/bluez/hci0/dev_00_00_00_00_%02X_%02X", (i >> 8) & 0xff, i & 0xff);
+		snprintf(mPaths[1][i], STRESS_PATH_SIZE, "/org/bluez/hci1/dev_00_00_00_00_%02X_%02X", (i >> 8) & 0xff, i & 0xff);
+	}
+
+	/*1. The readers run for as long as the writer does */
+	for(i = 0; i < STRESS_READERS; i++)
+		readers[i] = g_thread_new("reader", stress_reader, GINT_TO_POINTER(i));
+
+	for(round = 0; round < STRESS_ROUNDS; round++)
+		stress_write_round(round);
+
+	g_atomic_int_set(&mDone, 1);
+	for(i = 0; i < STRESS_READERS; i++)
+		g_thread_join(readers[i]);
+
+	bluez_log_deinit();
+
+	g_print("%s: %d rounds, %d reads, %d torn copies\n", STRESS_NAME, STRESS_ROUNDS, g_atomic_int_get(&mReads),
+			g_atomic_int_get(&mTorn));
+
+	return g_atomic_int_get(&mTorn) > 0 ? 1 : 0;
+}
+
+/*
+ * Private Functions
+*/
+static void stress_write_round(int round)
+{
+	BluetoothDevice device;
+	char alias[BLUETOOTH_DEVICE_ALIAS_SIZE];
+	int i;
+
+	/*1. Fill from both adapters, the second add of a device merges into the first */
+	for(i = 0; i < STRESS_DEVICES; i++)
+	{
+		bluetooth_device_init_properties(&device, mPaths[i & 1][i]);
+		bluetooth_device_add_device(&device);
+	}
+	for(i = 0; i < STRESS_DEVICES; i += 3)
+	{
+		bluetooth_device_init_properties(&device, mPaths[~i & 1][i]);
+		bluetooth_device_add_device(&device);
+	}
+
+	/*2. Update every device, the alias always names the device so a reader can tell a torn copy */
+	for(i = 0; i < STRESS_DEVICES; i++)
+	{
+		bluetooth_device_property_update_RSSI(mPaths[i & 1][i], -40 - (round + i) % 40);
+		bluetooth_device_property_update_connection(mPaths[i & 1][i], (round + i) & 1);
+		snprintf(alias, sizeof(alias), "%s %d", mPaths[0][i] + strlen(mPaths[0][i]) - 5, round);
+		bluetooth_device_property_update_alias(mPaths[i & 1][i], alias);
+	}
+
+	/*3. Empty it, one adapter at once, then one device at a time */
+	bluetooth_device_remove_adapter(round & 1);
+	for(i = 0; i < STRESS_DEVICES; i++)
+		bluetooth_device_remove_device_by_path(mPaths[i & 1][i]);
+	bluetooth_device_remove_all_devices();
+}
+
+static gpointer stress_reader(gpointer userData)
+{
+	BluetoothDevice device;
+	BluetoothDevice * devices;
+	char path[BLUETOOTH_DEVICE_PATH_SIZE];
+	int numberOfDevices;
+	int reader = GPOINTER_TO_INT(userData);
+	int reads = 0;
+	int i;
+
+	while(!g_atomic_int_get(&mDone))
+	{
+		for(i = reader; i < STRESS_DEVICES; i += STRESS_READERS, reads++)
+		{
+			if(bluetooth_device_copy_by_path(mPaths[i & 1][i], &device) && !stress_check_copy(&device))
+				g_atomic_int_inc(&mTorn);
+
+			if(bluetooth_device_copy_at_index(i + 1, &device) && !stress_check_copy(&device))
+				g_atomic_int_inc(&mTorn);
+
+			if(bluetooth_device_copy_path_at_index(i + 1, path) && strncmp(path, "/org/bluez/hci", 14) != 0)
+				g_atomic_int_inc(&mTorn);
+		}
+
+		devices = bluetooth_device_snapshot(&numberOfDevices);
+		for(i = 0; i < numberOfDevices; i++)
+		{
+			if(!stress_check_copy(&devices[i]))
+				g_atomic_int_inc(&mTorn);
+		}
+		g_free(devices);
+		reads++;
+	}
+
+	g_atomic_int_add(&mReads, reads);
+
+	return NULL;
+}
+
+/*
+ * A copy is whole if its alias, when set, ends in the same address as its path
+*/
+static bool stress_check_copy(const BluetoothDevice * device)
+{
+	const char * address = device->PATH + strlen(device->PATH) - 5;
+
+	if(strncmp(device->PATH, "/org/bluez/hci", 14) != 0)
+		return false;
+
+	return device->ALIAS[0] == '\0' || strncmp(device->ALIAS, address, 5) == 0;
+}
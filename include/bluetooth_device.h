@@ -11,6 +11,12 @@
 	* Files that use this file are
 	* - bluez_adapter_api.h (adds devices found during scan)
 	* - bluez_device_api.h  (adds devices when connections are made)
+	*
+	* The registry may be read from any thread. Modifiers are serialized by a lock,
+	* bluetooth_device_copy_*, bluetooth_device_snapshot and bluetooth_get_device_path_at_index
+	* never wait for a writer and always return a consistent copy.
+	* bluetooth_get_device_path_at_index and bluetooth_device_get_property_address return a string
+	* of the calling thread, it stays valid until that thread calls the same function again.
 **/
 #ifndef DEVICE_H
 #define DEVICE_H
@@ -19,34 +25,149 @@
 #include <gio/gio.h>
 #include <stdbool.h>
 
+#include "bluetooth_uuid.h"
+#include "bluez_dbus_names.h"
+
 #define MAX_DEVICE_STRING_LEN 	100		/**< MAX Buffer size for Strings. */
-#define MAX_NUMBER_UUIDS		100		/**< MAX Buffer size for number of UUIDs to hold. */
+#define MAX_NUMBER_UUIDS		32		/**< MAX number of UUIDs held per device, more are logged and dropped. */
 #define BT_ADDRESS_STRING_SIZE 	18		/**< Buffer size for deivce MAC ADDRESS 'XX:XX:XX:XX:XX:XX' includes room for NULL termintating character. */
+#define BLUETOOTH_DEVICE_PATH_SIZE	40	/**< Buffer size for a device path '/org/bluez/hciN/dev_XX_XX_XX_XX_XX_XX' includes the NULL. */
+#define BLUETOOTH_DEVICE_ALIAS_SIZE	64	/**< Buffer size for an alias, longer names are cut. */
+#define BLUETOOTH_DEVICE_DEFAULT_CAPACITY	64	/**< Number of devices preallocated by bluetooth_device_init. */
+
+/**
+	* Dirty bits returned by bluetooth_device_apply_properties and bluetooth_device_update_properties,
+	* a bit is set when the property was in the dictionary and its value changed.
+**/
+#define BLUETOOTH_DEVICE_DIRTY_ALIAS		(1u << 0)	/**< ALIAS changed. */
+#define BLUETOOTH_DEVICE_DIRTY_ADDRESS		(1u << 1)	/**< MAC_ADDRESS changed. */
+#define BLUETOOTH_DEVICE_DIRTY_RSSI			(1u << 2)	/**< RSSI changed. */
+#define BLUETOOTH_DEVICE_DIRTY_UUIDS		(1u << 3)	/**< SERVICE_UUIDS changed. */
+#define BLUETOOTH_DEVICE_DIRTY_PAIRED		(1u << 4)	/**< PAIRED changed. */
+#define BLUETOOTH_DEVICE_DIRTY_CONNECTED	(1u << 5)	/**< CONNECTED changed. */
+#define BLUETOOTH_DEVICE_DIRTY_TRUSTED		(1u << 6)	/**< TRUSTED changed. */
 
 typedef struct _BluetoothDevice BluetoothDevice;
+typedef struct _NodePoolStats NodePoolStats;		// defined in double_link_list.h
 
+/**
+	* @brief Compact description of a remote device, roughly 220 bytes.
+	* Strings are kept inside the device, nothing is allocated per device and nothing outlives it,
+	* so a scan of devices with rotating addresses does not grow the heap.
+	* Service UUIDs are ids into the table in bluetooth_uuid.h.
+	* Use bluetooth_device_init_properties before filling in a BluetoothDevice.
+	* A device seen by several adapters is a single BluetoothDevice, PATH is the one below the adapter
+	* that hears it best and RSSI is the RSSI of that adapter.
+**/
 struct _BluetoothDevice{
-	char	PATH[MAX_DEVICE_STRING_LEN];				/**< Path according to bluez, example: /org/bluez/hci0/XX_XX_XX_XX_XX_XX. */
-	char	SERVICE_UUIDS[MAX_NUMBER_UUIDS][37];		/**< List of 128-Bit UUIDs represented on device. */
-	char 	MAC_ADDRESS[BT_ADDRESS_STRING_SIZE];		/**< XX:XX:XX:XX:XX:XX. */
-	char 	ALIAS[MAX_DEVICE_STRING_LEN];				/**< Name of device. */
+	char			PATH[BLUETOOTH_DEVICE_PATH_SIZE];	/**< Path according to bluez, example: /org/bluez/hci0/XX_XX_XX_XX_XX_XX. */
+	char			ALIAS[BLUETOOTH_DEVICE_ALIAS_SIZE];	/**< Name of device. */
+	guint64			MAC_ADDRESS;						/**< 48-Bit address, XX:XX:XX:XX:XX:XX with the first octet in bits 40-47. */
+	BluetoothUuid	SERVICE_UUIDS[MAX_NUMBER_UUIDS];	/**< List of 128-Bit UUIDs represented on device. */
+	gint16 	RSSI;										/**< Receievd signal strength of remote device. */
+	guint8	NUMBER_OF_UUIDS;							/**< keeps track of number of UUIDs. */
 	bool	PAIRED;										/**< Indicates the remove device is paired. */
 	bool	CONNECTED;									/**< Indicates if remote device is currently connected. */
 	bool	TRUSTED;									/**< Indicates if remote device is seen as trusted. */
-	gint16 	RSSI;										/**< Receievd signal strength of remote device. */
-	int		NUMBER_OF_UUIDS;							/**< keeps track of number of UUIDs. */
+	guint8	ADAPTERS;									/**< Bit N is set while adapter hciN has the device. */
+	guint8	BEST_ADAPTER;								/**< N of the adapter with the strongest RSSI, PATH is below it. */
+	gint16	ADAPTER_RSSI[BLUEZ_MAX_ADAPTERS];			/**< Last RSSI reported by each adapter, 0 if none yet. */
 };
 
+/**
+	* @brief Used to select devices, for example by bluetooth_device_remove_devices_if
+	* @return true if the device is selected
+**/
+typedef bool (*bluetooth_device_filter)(BluetoothDevice * device, gpointer userData);
+
+/**
+       * @brief Preallocates room for capacity devices so discovery does not allocate until the registry grows past it
+	   * Optional, without it memory is allocated on the first device added.
+       * @param capacity number of devices to preallocate
+       * @return boolean True if succeed, false if capacity is not positive
+       */
+bool bluetooth_device_init(int capacity);
+
+/**
+       * @brief Resets every property of device and sets its path
+	   * Must be used on a BluetoothDevice declared on the stack before it is filled in and added.
+       * @param device the BluetoothDevice to initialize
+	   * @param path the bluez object path, copied into device
+       */
+void bluetooth_device_init_properties(BluetoothDevice * device, const char * path);
+
+/**
+       * @brief Parses the adapter out of a bluez object path
+       * @param path example: /org/bluez/hci1/dev_XX_XX_XX_XX_XX_XX
+       * @return int N of hciN, -1 if path is not below an adapter or N is not below BLUEZ_MAX_ADAPTERS
+       */
+int bluetooth_device_get_adapter_index(const char * path);
+
+/**
+       * @brief Converts 'XX:XX:XX:XX:XX:XX' into its 48-Bit value
+       * @param address string MAC Address
+	   * @param value filled with the address
+       * @return boolean True if succeed, false if address is malformed
+       */
+bool bluetooth_device_parse_address(const char * address, guint64 * value);
+
+/**
+       * @brief Formats a 48-Bit address as 'XX:XX:XX:XX:XX:XX'
+       * @param value the address
+	   * @param address buffer of at least BT_ADDRESS_STRING_SIZE bytes
+       */
+void bluetooth_device_format_address(guint64 value, char * address);
+
+/**
+       * @brief Applies every known property of a bluez org.bluez.Device1 dictionary to device
+	   * Unknown keys and values of the wrong type are skipped. UUIDs replaces the whole list.
+	   * Used to fill in a BluetoothDevice before it is added.
+       * @param device the BluetoothDevice to update
+	   * @param properties GVariant of type a{sv}
+       * @return guint BLUETOOTH_DEVICE_DIRTY_* bits of the properties that changed
+       */
+guint bluetooth_device_apply_properties(BluetoothDevice * device, GVariant * properties);
+
 /** 
 *	Accessors
 */
 
+/**
+       * @brief Copies the allocation counters of the device registry
+       * @param stats filled with the counters, see double_link_list.h
+       */
+void bluetooth_device_get_allocation_stats(NodePoolStats * stats);
+
 /**
        * @brief Returns the number of devices in the LinkedList
        * @return int number of devices
        */
 int bluetooth_device_get_number_devices(void);
 
+/**
+       * @brief Copies the BluetoothDevice at specified index, safe from any thread
+       * @param index int that is a reference to head of list, 1 based
+	   * @param device filled with a consistent copy
+       * @return boolean True if succeed, false if index is out of range
+       */
+bool bluetooth_device_copy_at_index(int index, BluetoothDevice * device);
+
+/**
+       * @brief Copies the BluetoothDevice with matching path, safe from any thread
+       * @param path specified path to match with
+	   * @param device filled with a consistent copy
+       * @return boolean True if found, false otherwise
+       */
+bool bluetooth_device_copy_by_path(const char * path, BluetoothDevice * device);
+
+/**
+       * @brief Copies every BluetoothDevice in index order, safe from any thread
+	   * All the devices are copied from the same version of the registry.
+       * @param numberOfDevices filled with the number of devices copied
+       * @return array of devices, free with g_free
+       */
+BluetoothDevice * bluetooth_device_snapshot(int * numberOfDevices);
+
 /**
        * @brief Print all members inside the struct BluetoothDevice
        * @param BluetoothDevice the device properties we want to print
@@ -55,25 +176,38 @@ void bluetooth_device_print_properties(BluetoothDevice * device);
 
 /**
        * @brief Prints out every BluetoothDevice and their properties inside the linkedlist
+	   * Works on a snapshot, safe from any thread.
        */
 void bluetooth_device_print_all(void);
 
 /**
-       * @brief  Gets the BluetoothDevice path at specified index from linkedlist  
+       * @brief  Gets the BluetoothDevice path at specified index from linkedlist, constant time  
+	   * Safe from any thread, the path is of a copy kept for the calling thread until its next call.
        * @param index int that is a reference to head of list
-       * @return string path of the BluetoothDevice
+       * @return string path, NULL if index is out of range
        */
 char * bluetooth_get_device_path_at_index(int index);
 
 /**
-       * @brief  Gets the BluetoothDevice path at specified index from linkedlist  
+       * @brief  Copies the BluetoothDevice path at specified index from linkedlist, constant time  
+	   * Safe from any thread, the copy stays valid after the device is removed.
        * @param index int that is a reference to head of list
-       * @return string path of the BluetoothDevice
+	   * @param path buffer of BLUETOOTH_DEVICE_PATH_SIZE filled with the path
+       * @return boolean True if succeed, false if index is out of range
+       */
+bool bluetooth_device_copy_path_at_index(int index, char * path);
+
+/**
+       * @brief  Gets the BluetoothDevice at specified index from linkedlist, constant time  
+	   * The device is not copied, only use it on the thread that modifies the registry.
+       * @param index int that is a reference to head of list
+       * @return BluetoothDevice at index, NULL if index is out of range
        */
 BluetoothDevice * bluetooth_get_device_at_index(int index);
 
 /**
        * @brief  Retrieves the BluetoothDevice with matching path from linkedlist  
+	   * The device is not copied, only use it on the thread that modifies the registry.
        * @param string specified path to match with
        * @return BluetoothDevice if found, NULL othewise
        */
@@ -103,17 +237,28 @@ const char * bluetooth_device_get_property_alias(BluetoothDevice * device);
 
 /**
        * @brief Returns attribute 'mac address' of BluetoothDevice  
+	   * The address is formatted from its 48-Bit value, the string is kept for the calling thread until its next call
        * @param BluetoothDevice
        * @return string MAC Address of device
        */
 const char * bluetooth_device_get_property_address(BluetoothDevice * device);
 
+/**
+       * @brief Copies attribute 'mac address' of BluetoothDevice  
+	   * The address is formatted from its 48-Bit value into address
+       * @param BluetoothDevice
+	   * @param address buffer of BT_ADDRESS_STRING_SIZE
+       * @return string address, MAC Address of device
+       */
+const char * bluetooth_device_copy_property_address(BluetoothDevice * device, char * address);
+
 /*
 *	Modifiers
 */
 /**
        * @brief Adds a BluetoothDevice . Increments Number of devices
 	   * It uses BluetoothDevice.PATH to determine if device already exists.
+	   * When another adapter already has the device, the adapter of newDevice and its RSSI are added to it instead.
        * @param BluetoothDevice
        * @return boolean True if succeed, false if device already exists
        */
@@ -126,22 +271,62 @@ bool bluetooth_device_add_device(BluetoothDevice * newDevice);
        */
 bool bluetooth_device_remove_device_by_index(int index);
 
+/**
+       * @brief Copies the path of the BluetoothDevice at specified index, and removes the device if asked to
+	   * The number is the one bluetooth_device_print_all shows.
+       * @param index integer
+	   * @param addrContainer buffer of BLUETOOTH_DEVICE_PATH_SIZE filled with the path
+	   * @param deleteFlag true to remove the device as well
+       * @return boolean True if succeed, false if device does not exist
+       */
+bool bluetooth_get_device_address_at_index(int index, char * addrContainer, bool deleteFlag);
+
 /**
        * @brief Removes a BluetoothDevice with specified path
-	   * It uses BluetoothDevice.PATH to compare against
+	   * It uses BluetoothDevice.PATH to compare against. Only the adapter of path lets go of the device,
+	   * it is removed once no adapter has it anymore.
        * @param string path 
        * @return boolean True if succeed, false if device does not exist
        */
 bool bluetooth_device_remove_device_by_path(const char * path);
 
+/**
+       * @brief Lets an adapter go of every device it has, used when the adapter disappears
+	   * Devices no other adapter has are removed, the others move below their next best adapter.
+       * @param adapterIndex N of hciN
+       * @return int number of devices removed
+       */
+int bluetooth_device_remove_adapter(int adapterIndex);
+
 /**
        * @brief Removes BluetoothDevices in linkedlist
        * @return boolean True if succeed, false if list is empty
        */
 bool bluetooth_device_remove_all_devices();
 
+/**
+       * @brief Removes every BluetoothDevice selected by filter in a single pass over the linkedlist
+	   * filter may act on a device before it is removed, the device is released once filter returns true.
+	   * filter runs while the registry is locked, it must not call bluetooth_device functions or block,
+	   * D-Bus calls about the removed devices are made after this returns
+       * @param filter called once per device
+	   * @param userData passed through to filter
+       * @return int number of devices removed
+       */
+int bluetooth_device_remove_devices_if(bluetooth_device_filter filter, gpointer userData);
+
 // functions to update the properites of the device
 
+/**
+       * @brief Applies a whole property dictionary to the BluetoothDevice that has matching path
+	   * The device is looked up once and every property is applied in a single registry update,
+	   * see bluetooth_device_apply_properties.
+       * @param string path
+	   * @param properties GVariant of type a{sv}
+       * @return guint BLUETOOTH_DEVICE_DIRTY_* bits of the properties that changed, 0 if device not found
+       */
+guint bluetooth_device_update_properties(const char * path, GVariant * properties);
+
 /**
        * @brief Adds the specified UUID to the BluetoothDevice that has matching path
 	   * adds the UUID to SERVICE_UUIDS array for the device located at the specified path, reutrns false if UUID already exists, or array is full
@@ -187,21 +372,31 @@ bool bluetooth_device_property_update_trusted(const char * path, bool isTrusted)
        */
 bool bluetooth_device_property_update_RSSI(const char * path, gint16 rssi);						// updates the rssi value of the device located at the path, returns false if device cannot be found
 
+/**
+       * @brief Updates the RSSI of several devices under a single registry update
+	   * Used by bluez_rssi_coalescer to deliver a whole window at once, paths that are not in the registry are skipped.
+       * @param paths object paths of the devices
+	   * @param rssi value of each device
+	   * @param count number of devices
+       * @return guint number of devices whose RSSI changed
+       */
+guint bluetooth_device_property_update_RSSI_batch(const char * const * paths, const gint16 * rssi, guint count);
+
 /**
        * @brief Updates the attribute alias of the BluetoothDevice that has matching path
-	   * Updates the alias name of the device located at the path, returns false if device cannot be found (NOTE: name is truncated if it exceeds MAX_DEVICE_STRING_LEN
+	   * Updates the alias name of the device located at the path, returns false if device cannot be found, the name is copied and cut to BLUETOOTH_DEVICE_ALIAS_SIZE
        * @param string path
 	   * @param string alias name
        * @return boolean True if succeed, false if device not found, or uuid array is full
        */
-bool bluetooth_device_property_update_alias(const char * path, const char * name);				// updates the alias name of the device located at the path, returns false if device cannot be found (NOTE: name is truncated if it exceeds MAX_DEVICE_STRING_LEN
+bool bluetooth_device_property_update_alias(const char * path, const char * name);				// updates the alias name of the device located at the path, returns false if device cannot be found
 
 /**
        * @brief Updates the attribute address of the BluetoothDevice that has matching path
 	   * Updates the mac address of the device located at the path, returns false if device cannot be found
        * @param string path
 	   * @param string mac address
-       * @return boolean True if succeed, false if device not found, or uuid array is full
+       * @return boolean True if succeed, false if device not found, or address is malformed
        */
 bool bluetooth_device_property_update_address(const char *path, const char * address);			// updates the mac address of the device located at the path, returns false if device cannot be found
 
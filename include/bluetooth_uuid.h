@@ -0,0 +1,58 @@
+#ifndef BLUETOOTHUUID_H
+#define BLUETOOTHUUID_H
+
+/**
+	* @file bluetooth_uuid.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file implements a process wide intern table of 128-Bit service UUIDs.
+	*
+	* Devices advertise the same handful of UUIDs over and over, so instead of every
+	* BluetoothDevice carrying the 36 character strings, a UUID is parsed once into its
+	* 16 byte binary value and devices only keep a small BluetoothUuid id into this table.
+	* Entries are never removed, so an id stays valid for the life of the process and can be
+	* read from any thread without locking.
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define UUID_STRING_SIZE			37		/**< Buffer size for 'XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX' includes room for NULL terminating character. */
+#define MAX_NUMBER_INTERNED_UUIDS	1024	/**< MAX number of distinct UUIDs the table can hold. */
+#define BLUETOOTH_UUID_INVALID		0		/**< Returned when a UUID cannot be parsed or the table is full. */
+
+typedef guint16 BluetoothUuid;				/**< id of a UUID inside the intern table. */
+
+/**
+       * @brief Returns the id of uuid, adding it to the table the first time it is seen
+	   * Parsing is case insensitive, the table stores the binary value.
+       * @param uuid string in the form XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX
+       * @return BluetoothUuid id, BLUETOOTH_UUID_INVALID if uuid is malformed or the table is full
+       */
+BluetoothUuid bluetooth_uuid_intern(const char * uuid);
+
+/**
+       * @brief Returns the id of uuid if it is in the table, never adds it
+	   * Use it for lookups, a UUID nobody has is not worth a slot.
+       * @param uuid string in the form XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX
+       * @return BluetoothUuid id, BLUETOOTH_UUID_INVALID if uuid is malformed or was never interned
+       */
+BluetoothUuid bluetooth_uuid_lookup(const char * uuid);
+
+/**
+       * @brief Returns the 128-Bit value of an interned UUID
+       * @param id returned by bluetooth_uuid_intern
+       * @return 16 bytes, most significant byte first, NULL if id is not in the table
+       */
+const guint8 * bluetooth_uuid_get_value(BluetoothUuid id);
+
+/**
+       * @brief Formats an interned UUID as a lower case string
+       * @param id returned by bluetooth_uuid_intern
+	   * @param str buffer of at least UUID_STRING_SIZE bytes
+       * @return boolean True if succeed, false if id is not in the table
+       */
+bool bluetooth_uuid_to_string(BluetoothUuid id, char * str);
+
+#endif
@@ -8,6 +8,11 @@
 	* 
 	* @brief This file defines the methods and properties of Bluez's adapter-api.txt.
 	* For more information please refer to https://git.kernel.org/pub/scm/bluetooth/bluez.git/tree/doc/adapter-api.txt
+	*
+	* Adapters are not hard coded, they are picked up from the ObjectManager tree and from InterfacesAdded,
+	* and every adapter method takes the BluezAdapter it acts on. The *_all functions send the call to every
+	* adapter before waiting on any of them, so several adapters power on or scan at the same time.
+	* Devices found by any adapter end up in the same registry, see bluetooth_device.h.
 **/
 
 #include <glib.h>
@@ -99,34 +104,61 @@ struct _DiscoveryFilter{
 	bool	DUPLICATE_DATA;		/**< Default 'true' */
 	bool	DISCOVERABLE;		/**< Default 'true' */
 	gint16 	RSSI;				/**< RSSI Threshold value */
+	guint16	PATHLOSS;			/**< Pathloss Threshold value, 0 to not set it, replaces RSSI when set */
 	int		NUM_OF_UUIDS;		/**< Keeps track of number of uuids we set */
 };
 
 typedef struct _DiscoveryFilter DiscoveryFilter;
-typedef void (*bluez_call_method_callback)(GObject *, GAsyncResult *, gpointer);
+
+/**
+	* @brief An adapter exported by bluez, hciN
+	* Handles point into a table of BLUEZ_MAX_ADAPTERS entries and stay valid for the whole run,
+	* an adapter that disappears keeps its handle with PRESENT false and gets it back when it returns.
+**/
+struct _BluezAdapter{
+	const char *	PATH;			/**< Interned object path, example: /org/bluez/hci0 */
+	int				INDEX;			/**< N of hciN */
+	bool			PRESENT;		/**< Exported by bluez right now */
+	bool			POWERED;		/**< Last Powered seen */
+	bool			DISCOVERING;	/**< Last Discovering seen */
+};
+
+typedef struct _BluezAdapter BluezAdapter;
 
 /*
  * Modifiers
 */
 int bluez_adapter_init(GDBusConnection * conn);
 void bluez_adapter_deinit();
-bool bluez_adapter_power_on(bool setPairable);		// powers on the adapter, user has option to make it pairable or not
-bool bluez_adapter_power_off(void);							// powers off the adapter
-bool bluez_adapter_scan_on(void);							// start scanning for devices, also makes adapter discoverable
-bool bluez_adapter_scan_off(void);
-bool bluez_adapter_pairable(bool value);
+bool bluez_adapter_power_on(BluezAdapter * adapter, bool setPairable);		// powers on the adapter, user has option to make it pairable or not
+bool bluez_adapter_power_off(BluezAdapter * adapter);						// powers off the adapter
+bool bluez_adapter_scan_on(BluezAdapter * adapter);							// start scanning for devices, also makes adapter discoverable
+bool bluez_adapter_scan_off(BluezAdapter * adapter);
+bool bluez_adapter_pairable(BluezAdapter * adapter, bool value);
+int bluez_adapter_power_on_all(bool setPairable);		// powers on every adapter at once, returns the number of adapters powered on
+int bluez_adapter_power_off_all(void);					// powers off every adapter at once, returns the number of adapters powered off
+int bluez_adapter_scan_on_all(void);					// default filter and scan on every powered adapter at once, returns the number of adapters scanning
+int bluez_adapter_scan_off_all(void);					// stops the scan of every powered adapter at once, returns the number of adapters stopped
 void bluez_adapter_init_signals(void);
 void bluez_adapter_mute_signals(void);
-void bluez_adapter_remove_device_found(const char * address);	// bluez caches BT devices found during a scan, this removes them, also bluez auto removes 180seconds if device is connected to
+void bluez_adapter_remove_device_found(const char * objectPath);	// bluez caches BT devices found during a scan, this removes them, the adapter is the one in objectPath, also bluez auto removes 180seconds if device is connected to
+void bluez_adapter_update_properties(const char * path, GVariant * properties);	// adds the adapter at path and applies its org.bluez.Adapter1 properties, used by the object manager warm start
 
 // for setting up filter for discovery settings
-bool bluez_adapter_set_filter(DiscoveryFilter * filterSettings);
-bool bluez_adapter_set_filter_default(void);
+bool bluez_adapter_set_filter(BluezAdapter * adapter, DiscoveryFilter * filterSettings);
+bool bluez_adapter_set_filter_default(BluezAdapter * adapter);
+int bluez_adapter_set_filter_all(DiscoveryFilter * filter);			// filter every scan starts with from now on, also set on every powered adapter at once, returns the number of adapters that took it
 
 
 /*
  * Accessors
 */ 
-bool bluez_is_adapter_on(void);					// returns true if adapter is powered on
-bool bluez_adapter_print_filter_settings(void);
+bool bluez_is_adapter_on(BluezAdapter * adapter);					// returns true if adapter is powered on
+bool bluez_adapter_print_filter_settings(BluezAdapter * adapter);
+void bluez_adapter_get_filter(DiscoveryFilter * filter);			// copies the filter scans start with, the default one until bluez_adapter_set_filter_all is called
+int bluez_adapter_get_count(void);									// number of adapters bluez exports right now
+BluezAdapter * bluez_adapter_get(int index);						// adapter hciN, NULL if bluez does not export it
+BluezAdapter * bluez_adapter_get_by_path(const char * path);		// adapter of an object path, the adapter itself or anything below it, NULL if unknown
+BluezAdapter * bluez_adapter_get_default(void);						// adapter with the lowest N, NULL if there is none
+void bluez_adapter_print_all(void);
 #endif
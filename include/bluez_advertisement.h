@@ -0,0 +1,166 @@
+#ifndef BLUEZADVERTISEMENT_H
+#define BLUEZADVERTISEMENT_H
+
+/**
+	* @file bluez_advertisement.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file parses the ManufacturerData and ServiceData of org.bluez.Device1 and keeps the latest payloads.
+	*
+	* bluez sends what a device advertises as ManufacturerData a{qv} keyed by company id and ServiceData a{sv}
+	* keyed by UUID, every value is an 'ay'. The parsers hand each payload to a visitor as a view into the
+	* serialized GVariant, the bytes are never copied and only valid during the call.
+	* The store keeps the latest payload per company id or UUID of BLUEZ_ADVERTISEMENT_MAX_DEVICES devices in
+	* static slots, nothing is allocated after start up. A new device takes the slot of the device heard the
+	* longest ago once every slot is in use, so presence of beacons is answered without asking bluez.
+	* The store is written from the GMainLoop thread and may be read from any thread.
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+#include "bluetooth_uuid.h"
+
+#define BLUEZ_ADVERTISEMENT_MAX_DEVICES		64		/**< Devices the store keeps payloads of */
+#define BLUEZ_ADVERTISEMENT_MAX_ENTRIES		4		/**< Payloads kept per device, manufacturer and service data together */
+#define BLUEZ_ADVERTISEMENT_MAX_PAYLOAD		27		/**< Bytes kept per payload, the most a legacy advertisement carries */
+
+/*
+ * Payload kinds
+*/
+#define BLUEZ_ADVERTISEMENT_MANUFACTURER	1		/**< ManufacturerData, keyed by COMPANY */
+#define BLUEZ_ADVERTISEMENT_SERVICE			2		/**< ServiceData, keyed by UUID */
+
+/**
+	* @brief One payload as bluez sent it, DATA points into the GVariant being parsed
+**/
+struct _BluezAdvertisementView{
+	guint8			KIND;			/**< BLUEZ_ADVERTISEMENT_* */
+	guint16			COMPANY;		/**< Bluetooth SIG company id, ManufacturerData only */
+	BluetoothUuid	UUID;			/**< Interned service UUID, ServiceData only */
+	const guint8 *	DATA;			/**< Borrowed, valid until the visitor returns */
+	gsize			LENGTH;			/**< Bytes at DATA */
+};
+
+typedef struct _BluezAdvertisementView BluezAdvertisementView;
+
+/**
+	* @brief One payload kept by the store
+**/
+struct _BluezAdvertisementData{
+	gint64			TIME_US;									/**< g_get_monotonic_time of the last update */
+	guint8			KIND;										/**< BLUEZ_ADVERTISEMENT_* */
+	guint8			LENGTH;										/**< Bytes kept in DATA */
+	bool			TRUNCATED;									/**< The payload was longer than BLUEZ_ADVERTISEMENT_MAX_PAYLOAD */
+	guint16			COMPANY;									/**< Bluetooth SIG company id, ManufacturerData only */
+	BluetoothUuid	UUID;										/**< Interned service UUID, ServiceData only */
+	guint8			DATA[BLUEZ_ADVERTISEMENT_MAX_PAYLOAD];
+};
+
+typedef struct _BluezAdvertisementData BluezAdvertisementData;
+
+/**
+	* @brief Counters of the store
+**/
+struct _BluezAdvertisementStats{
+	guint	DEVICES;			/**< Devices with at least one payload */
+	guint64	UPDATES;			/**< Payloads that changed */
+	guint64	UNCHANGED;			/**< Payloads that were the same as the one kept */
+	guint64	TRUNCATED;			/**< Payloads longer than BLUEZ_ADVERTISEMENT_MAX_PAYLOAD */
+	guint64	EVICTED;			/**< Devices or payloads replaced because every slot was in use */
+	guint64	INVALID;			/**< Values that were not an 'ay' or had a malformed UUID */
+};
+
+typedef struct _BluezAdvertisementStats BluezAdvertisementStats;
+
+/**
+	* @brief Called once per payload by the parsers
+	* @param view the payload, DATA is only valid during the call
+	* @param userData passed to the parser
+	* @return false to stop parsing
+**/
+typedef bool (*bluez_advertisement_visitor)(const BluezAdvertisementView * view, gpointer userData);
+
+/**
+       * @brief Hands every payload of a ManufacturerData value to visitor without copying it
+       * @param value GVariant of type a{qv}
+	   * @param visitor called once per payload
+	   * @param userData passed to visitor
+       * @return guint number of payloads visited
+       */
+guint bluez_advertisement_parse_manufacturer_data(GVariant * value, bluez_advertisement_visitor visitor, gpointer userData);
+
+/**
+       * @brief Hands every payload of a ServiceData value to visitor without copying it
+       * @param value GVariant of type a{sv}
+	   * @param visitor called once per payload
+	   * @param userData passed to visitor
+       * @return guint number of payloads visited
+       */
+guint bluez_advertisement_parse_service_data(GVariant * value, bluez_advertisement_visitor visitor, gpointer userData);
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Keeps the ManufacturerData and ServiceData of a Device1 dictionary, other keys are skipped
+	   * Called from the GMainLoop thread only.
+       * @param path object path of the device
+	   * @param properties GVariant of type a{sv}
+       * @return guint number of payloads that changed
+       */
+guint bluez_advertisement_update(const char * path, GVariant * properties);
+
+/**
+       * @brief Drops every payload of a device, called when bluez removes it
+       * @param path object path of the device
+       */
+void bluez_advertisement_forget(const char * path);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Copies the latest ManufacturerData of a company, safe from any thread
+       * @param path object path of the device
+	   * @param company Bluetooth SIG company id
+	   * @param data filled with the payload
+       * @return boolean True if found, false otherwise
+       */
+bool bluez_advertisement_copy_manufacturer_data(const char * path, guint16 company, BluezAdvertisementData * data);
+
+/**
+       * @brief Copies the latest ServiceData of a service, safe from any thread
+       * @param path object path of the device
+	   * @param uuid string in the form XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX
+	   * @param data filled with the payload
+       * @return boolean True if found, false otherwise
+       */
+bool bluez_advertisement_copy_service_data(const char * path, const char * uuid, BluezAdvertisementData * data);
+
+/**
+       * @brief Copies every payload kept for a device, safe from any thread
+       * @param path object path of the device
+	   * @param data array of at least BLUEZ_ADVERTISEMENT_MAX_ENTRIES payloads
+       * @return int number of payloads copied
+       */
+int bluez_advertisement_copy_all(const char * path, BluezAdvertisementData * data);
+
+/**
+       * @brief Prints every device with payloads and the payloads, safe from any thread
+       */
+void bluez_advertisement_print_all(void);
+
+/**
+       * @brief Copies the counters
+       * @param stats filled with the counters
+       */
+void bluez_advertisement_get_stats(BluezAdvertisementStats * stats);
+
+/**
+       * @brief Prints the counters
+       */
+void bluez_advertisement_print_stats(void);
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef BLUEZCOMMAND_H
+#define BLUEZCOMMAND_H
+
+/**
+	* @file bluez_command.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file implements asynchronous method calls to bluez with a completion handle.
+	*
+	* g_dbus_connection_call_sync with a -1 timeout blocks its caller until bluez answers, which for Pair can be
+	* never. Every call made here is asynchronous, has a deadline, and can be cancelled. The BluezCommand returned
+	* is a small reference counted handle the caller can wait on, poll, cancel, or simply drop.
+	* Any number of commands can be in flight at once, they complete in whatever order bluez answers them.
+**/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+/*
+ * Command states
+*/
+#define BLUEZ_COMMAND_PENDING			0		/**< Sent, no reply yet */
+#define BLUEZ_COMMAND_SUCCEEDED			1		/**< Reply received */
+#define BLUEZ_COMMAND_FAILED			2		/**< Bluez returned an error */
+#define BLUEZ_COMMAND_CANCELLED			3		/**< bluez_command_cancel was called before the reply */
+#define BLUEZ_COMMAND_TIMED_OUT			4		/**< Deadline passed before the reply */
+
+/*
+ * Deadlines
+*/
+#define BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS	5000		/**< Power, scan, media and property calls */
+#define BLUEZ_COMMAND_PAIR_TIMEOUT_MS		60000		/**< Pair waits for the user on the remote device */
+
+typedef struct _BluezCommand BluezCommand;
+
+/**
+	* @brief Called once when a command completes, on the GMainContext that was thread default when it was sent
+	* @param command the completed command, borrowed, take a reference to keep it
+	* @param userData passed when the command was sent
+**/
+typedef void (*bluez_command_callback)(BluezCommand * command, gpointer userData);
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Function must be called and passed a valid connection handle before using any other methods.
+       * @param GDBusConnection a valid connection to the DBUS
+       * @return Returns 0 on success, -3 if GDBusConnection parameter passed in is NULL
+       */
+int bluez_command_init(GDBusConnection * conn);
+
+/**
+       * @brief Calls a method of a bluez object without waiting for the reply
+       * @param path object path, example: "/org/bluez/hci0"
+	   * @param interface example: "org.bluez.Adapter1"
+	   * @param method example: "StartDiscovery"
+	   * @param param method arguments, floating references are sunk, NULL for none
+	   * @param timeoutMs deadline of the call
+	   * @param callback called on completion, NULL for none
+	   * @param userData passed to callback
+       * @return BluezCommand owned by the caller, release it with bluez_command_unref
+       */
+BluezCommand * bluez_command_call(const char * path,
+				const char * interface,
+				const char * method,
+				GVariant * param,
+				int timeoutMs,
+				bluez_command_callback callback,
+				gpointer userData);
+
+/**
+       * @brief Sets a property of a bluez object without waiting for the reply
+	   * Same as bluez_command_call with org.freedesktop.DBus.Properties.Set
+       * @param path object path
+	   * @param interface interface owning the property
+	   * @param property property name, example: "Powered"
+	   * @param value new value, floating references are sunk
+	   * @param timeoutMs deadline of the call
+	   * @param callback called on completion, NULL for none
+	   * @param userData passed to callback
+       * @return BluezCommand owned by the caller, release it with bluez_command_unref
+       */
+BluezCommand * bluez_command_set_property(const char * path,
+				const char * interface,
+				const char * property,
+				GVariant * value,
+				int timeoutMs,
+				bluez_command_callback callback,
+				gpointer userData);
+
+/**
+       * @brief Calls a method and waits for it, the blocking functions of the other modules are built on this
+	   * The call is made on a private GMainContext so it can be used from any thread, the GMainLoop thread included.
+       * @param path object path
+	   * @param interface interface of the method
+	   * @param method method name
+	   * @param param method arguments, floating references are sunk, NULL for none
+	   * @param timeoutMs deadline of the call
+	   * @param result if not NULL set to the reply on success, must be unref'd
+       * @return boolean True if succeed, false on error, timeout or cancellation, the reason is logged
+       */
+bool bluez_command_call_sync(const char * path,
+				const char * interface,
+				const char * method,
+				GVariant * param,
+				int timeoutMs,
+				GVariant ** result);
+
+/**
+       * @brief Cancels a pending command, the callback still runs with BLUEZ_COMMAND_CANCELLED
+       * @param command returned by bluez_command_call
+       */
+void bluez_command_cancel(BluezCommand * command);
+
+/**
+       * @brief Blocks until the command completes
+	   * Iterates the command's GMainContext if no other thread is running it, otherwise sleeps until the reply arrives.
+       * @param command returned by bluez_command_call
+       * @return int final state, BLUEZ_COMMAND_SUCCEEDED ... BLUEZ_COMMAND_TIMED_OUT
+       */
+int bluez_command_wait(BluezCommand * command);
+
+/**
+       * @brief Takes a reference to the command
+       * @param command returned by bluez_command_call
+       * @return BluezCommand the same command
+       */
+BluezCommand * bluez_command_ref(BluezCommand * command);
+
+/**
+       * @brief Releases a reference, a pending command keeps running after its last reference is dropped
+       * @param command returned by bluez_command_call, NULL is ignored
+       */
+void bluez_command_unref(BluezCommand * command);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Current state of the command
+       * @param command returned by bluez_command_call
+       * @return int BLUEZ_COMMAND_PENDING ... BLUEZ_COMMAND_TIMED_OUT
+       */
+int bluez_command_get_state(BluezCommand * command);
+
+/**
+       * @brief Reply of a command that succeeded
+       * @param command returned by bluez_command_call
+       * @return GVariant borrowed from the command, NULL unless the state is BLUEZ_COMMAND_SUCCEEDED
+       */
+GVariant * bluez_command_get_result(BluezCommand * command);
+
+/**
+       * @brief Error message of a command that did not succeed
+       * @param command returned by bluez_command_call
+       * @return string borrowed from the command, NULL while pending or on success
+       */
+const char * bluez_command_get_error(BluezCommand * command);
+
+/**
+       * @brief Checks the D-Bus error name bluez replied with
+       * @param command returned by bluez_command_call
+	   * @param errorName example: "org.bluez.Error.AlreadyExists"
+       * @return boolean True if the command failed with that error
+       */
+bool bluez_command_error_is(BluezCommand * command, const char * errorName);
+
+/**
+       * @brief Method name the command was sent with, for logging
+       * @param command returned by bluez_command_call
+       * @return string borrowed from the command
+       */
+const char * bluez_command_get_method(BluezCommand * command);
+
+/**
+       * @brief Number of commands sent and not completed yet
+       * @return guint commands in flight
+       */
+guint bluez_command_get_in_flight(void);
+
+#endif
@@ -42,5 +42,7 @@
  *					hci0 DC:A6:32:36:5C:D2
  */
 #define BLUEZ_HCI0_PATH "/org/bluez/hci0"
+#define BLUEZ_HCI_PATH_PREFIX	BLUEZ_BASE_PATH "/hci"		/**< Adapters are found at runtime, /org/bluez/hci0, /org/bluez/hci1, ..etc */
+#define BLUEZ_MAX_ADAPTERS		8						/**< hci0 to hci7 are tracked, a device keeps its adapters in a guint8 mask */
 
 #endif
@@ -15,6 +15,8 @@
 #include <gio/gio.h>
 #include <stdbool.h>
 
+#include "bluez_command.h"
+
 
 // Properties of org.bluez.Device1
 #define PROPERTY_ADDRESS	"Address"		// Bluetooth device address of remote device
@@ -27,7 +29,8 @@
 /*
 * Accessors
 */
-void bluez_device_read_remote_device_properties(const char * devicePath);		// reads the properties available in the interface org.bluez.Device1
+void bluez_device_read_remote_device_properties(const char * devicePath);		// reads every property of the interface org.bluez.Device1 with a single GetAll
+void bluez_device_refresh_property(const char * path, const char * property);	// reads a single property of org.bluez.Device1, only for a targeted refresh
 
 /*
 * Modifiers
@@ -40,8 +43,10 @@ void bluez_device_mute_signals(void);
 * Other
 */
 int  bluez_device_init(GDBusConnection * conn);
-bool bluez_device_trust_device(const char * path);
-bool bluez_device_pair_device(const char *path);
+bool bluez_device_trust_device(const char * path);													// blocks until Trusted is set, or its deadline passes
+bool bluez_device_pair_device(const char *path);														// blocks until Pair returns, or BLUEZ_COMMAND_PAIR_TIMEOUT_MS passes
+BluezCommand * bluez_device_trust_device_async(const char * path, bluez_command_callback callback, gpointer userData);	// returns at once, release the command with bluez_command_unref
+BluezCommand * bluez_device_pair_device_async(const char * path, bluez_command_callback callback, gpointer userData);	// returns at once, release the command with bluez_command_unref
 
 #endif
 
@@ -0,0 +1,110 @@
+#ifndef BLUEZDISCOVERY_H
+#define BLUEZDISCOVERY_H
+
+/**
+	* @file bluez_discovery.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file implements a controller that keeps the signal rate of a scan within a budget.
+	*
+	* The default discovery filter reports every device down to -100 dBm on both transports, in a busy venue
+	* that is thousands of signals a second. Every period the controller measures the PropertiesChanged rate
+	* and the size of the device registry and moves one step on a ladder of filters:
+	*	0. the filter scans start with, see bluez_adapter_get_filter
+	*	1. DuplicateData off
+	*	2. RSSI -90 or Pathloss 90
+	*	3. RSSI -80 or Pathloss 80
+	*	4. Transport of the target devices, "bredr" for phones streaming A2DP
+	*	5. RSSI -70 or Pathloss 70
+	*	6. RSSI -60 or Pathloss 60
+	* It tightens as soon as the rate is over budget and relaxes only after BLUEZ_DISCOVERY_RELAX_PERIODS calm
+	* periods in a row, the UUIDs of the filter are never touched so the target devices are still found.
+	* Every change is printed with the rate before it, and the rate after it one period later.
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define BLUEZ_DISCOVERY_LEVELS					7			/**< Steps of the ladder above */
+#define BLUEZ_DISCOVERY_RELAX_PERIODS			3			/**< Calm periods in a row before a step back */
+
+#define BLUEZ_DISCOVERY_DEFAULT_MAX_RATE		1000		/**< Signals a second */
+#define BLUEZ_DISCOVERY_DEFAULT_MIN_RATE		250			/**< Signals a second */
+#define BLUEZ_DISCOVERY_DEFAULT_MAX_DEVICES		64
+#define BLUEZ_DISCOVERY_DEFAULT_PERIOD_MS		2000
+#define BLUEZ_DISCOVERY_DEFAULT_RSSI_LIMIT		-60			/**< Strongest RSSI threshold the ladder goes to */
+
+/**
+	* @brief What the controller aims for
+**/
+struct _DiscoveryBudget{
+	guint	MAX_RATE;			/**< Signals a second above which the filter is tightened */
+	guint	MIN_RATE;			/**< Signals a second below which the filter is relaxed, less than MAX_RATE */
+	guint	MAX_DEVICES;		/**< Registry size above which the filter is tightened unless the scan is calm */
+	guint	PERIOD_MS;			/**< Time between two decisions */
+	gint16	RSSI_LIMIT;			/**< Strongest RSSI threshold used, Pathloss uses its negation */
+	char	TRANSPORT[10];		/**< Transport of the target devices, "bredr" or "le" */
+	bool	USE_PATHLOSS;		/**< Tighten on Pathloss instead of RSSI, for targets advertising TxPower */
+};
+
+typedef struct _DiscoveryBudget DiscoveryBudget;
+
+/**
+	* @brief State and counters of the controller
+**/
+struct _DiscoveryStats{
+	bool	RUNNING;			/**< Started and not stopped */
+	guint	LEVEL;				/**< Step of the ladder in use */
+	guint	MAX_LEVEL;			/**< Highest step the adapters accepted */
+	double	RATE;				/**< Signals a second over the last period */
+	int		DEVICES;			/**< Registry size at the last period */
+	guint	TIGHTENED;			/**< Steps up */
+	guint	RELAXED;			/**< Steps back */
+	guint	REJECTED;			/**< Steps no adapter took */
+};
+
+typedef struct _DiscoveryStats DiscoveryStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Fills budget with the BLUEZ_DISCOVERY_DEFAULT_* values and "bredr" for the A2DP sources we look for
+       * @param budget filled with the defaults
+       */
+void bluez_discovery_default_budget(DiscoveryBudget * budget);
+
+/**
+       * @brief Starts deciding every budget->PERIOD_MS from the thread default main context
+	   * The filter scans start with is step 0, the adapters must have been added, see bluez_adapter_api.h
+       * @param budget copied, NULL for the defaults
+       * @return boolean True if succeed, false if already running
+       */
+bool bluez_discovery_start(const DiscoveryBudget * budget);
+
+/**
+       * @brief Stops deciding and puts the filter of step 0 back
+       */
+void bluez_discovery_stop(void);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Returns true while the controller runs
+       */
+bool bluez_discovery_is_running(void);
+
+/**
+       * @brief Copies the state of the controller
+       * @param stats filled with the state
+       */
+void bluez_discovery_get_stats(DiscoveryStats * stats);
+
+/**
+       * @brief Prints the state of the controller and the filter in use
+       */
+void bluez_discovery_print_stats(void);
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef BLUEZEVENTQUEUE_H
+#define BLUEZEVENTQUEUE_H
+
+/**
+	* @file bluez_event_queue.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file hands the events parsed on the GMainLoop thread over to a consumer thread.
+	*
+	* The signal handlers turn what they parsed into a small typed BluezEvent and push it onto a bounded
+	* single producer / single consumer ring, no lock is taken on either side. The consumer drains it in
+	* batches at its own pace, a slow consumer never holds up the bus, when the ring is full the newest
+	* event is dropped and counted instead.
+	* The producer is the thread running the default GMainContext, there must be exactly one consumer thread.
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define BLUEZ_EVENT_QUEUE_SIZE			1024		/**< Slots in the ring, must be a power of 2 */
+#define BLUEZ_EVENT_BATCH_SIZE			64			/**< Events a consumer is expected to pop at once */
+#define BLUEZ_EVENT_PATH_SIZE			64			/**< Bytes kept of the object path, room for .../dev_XX_XX_XX_XX_XX_XX/player0 */
+
+/*
+ * Event types
+*/
+#define BLUEZ_EVENT_DEVICE_ADDED		1		/**< Device appeared on the adapter */
+#define BLUEZ_EVENT_DEVICE_REMOVED		2		/**< Device removed from the adapter */
+#define BLUEZ_EVENT_DEVICE_CONNECTED	3		/**< VALUE is 1 on connect, 0 on disconnect */
+#define BLUEZ_EVENT_DEVICE_RSSI			4		/**< VALUE is the RSSI of the last coalescing window */
+#define BLUEZ_EVENT_ADAPTER_POWERED		5		/**< VALUE is 1 when powered */
+#define BLUEZ_EVENT_ADAPTER_DISCOVERING	6		/**< VALUE is 1 while scanning */
+#define BLUEZ_EVENT_PLAYER_CONNECTED	7		/**< VALUE is 1 when a media player is connected */
+#define BLUEZ_EVENT_PLAYER_STATUS		8		/**< VALUE is a BLUEZ_EVENT_STATUS_* */
+#define BLUEZ_EVENT_PLAYER_TRACK		9		/**< Track metadata changed, read it with bluez_media_player_print_current_player */
+#define BLUEZ_EVENT_DEVICE_ADVERTISEMENT 10		/**< VALUE is the number of payloads that changed, read them with bluez_advertisement_copy_* */
+
+/*
+ * Player status values
+*/
+#define BLUEZ_EVENT_STATUS_STOPPED		0
+#define BLUEZ_EVENT_STATUS_PLAYING		1
+#define BLUEZ_EVENT_STATUS_PAUSED		2
+#define BLUEZ_EVENT_STATUS_FORWARD_SEEK	3
+#define BLUEZ_EVENT_STATUS_REVERSE_SEEK	4
+#define BLUEZ_EVENT_STATUS_ERROR		5
+
+/**
+	* @brief One event, copied by value through the ring
+**/
+struct _BluezEvent{
+	gint64			TIME_US;		/**< g_get_monotonic_time when it was pushed */
+	guint16			TYPE;			/**< BLUEZ_EVENT_* */
+	gint16			VALUE;			/**< Meaning depends on TYPE */
+	char			PATH[BLUEZ_EVENT_PATH_SIZE];	/**< Object path, copied so the producer may reuse its string, empty if none */
+};
+
+typedef struct _BluezEvent BluezEvent;
+
+/**
+	* @brief Counters of the ring
+**/
+struct _BluezEventQueueStats{
+	guint64	PUSHED;			/**< Events accepted */
+	guint64	POPPED;			/**< Events taken by the consumer */
+	guint64	DROPPED;		/**< Events lost because the ring was full */
+	guint	DEPTH;			/**< Events waiting right now */
+	guint	MAX_DEPTH;		/**< Most events ever waiting at once */
+};
+
+typedef struct _BluezEventQueueStats BluezEventQueueStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Pushes an event, producer side, called from the GMainLoop thread only
+       * @param type BLUEZ_EVENT_*
+	   * @param path object path the event is about, NULL if none
+	   * @param value meaning depends on type
+       * @return boolean True if queued, false if the ring was full and the event was dropped
+       */
+bool bluez_event_queue_push(guint16 type, const char * path, gint16 value);
+
+/**
+       * @brief Takes up to max events off the ring, consumer side, never blocks
+       * @param events filled with the events, oldest first
+	   * @param max size of events
+       * @return guint number of events taken
+       */
+guint bluez_event_queue_pop_batch(BluezEvent * events, guint max);
+
+/**
+       * @brief Sleeps until the ring holds an event, consumer side
+       * @param timeoutMs longest time to sleep
+       * @return boolean True if an event is waiting, false on timeout
+       */
+bool bluez_event_queue_wait(guint timeoutMs);
+
+/**
+       * @brief Wakes a consumer sleeping in bluez_event_queue_wait, used to stop it
+       */
+void bluez_event_queue_wakeup(void);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Copies the counters of the ring
+       * @param stats filled with the counters
+       */
+void bluez_event_queue_get_stats(BluezEventQueueStats * stats);
+
+/**
+       * @brief Prints the counters of the ring
+       */
+void bluez_event_queue_print_stats(void);
+
+/**
+       * @brief Maps a MediaPlayer1 Status string to a BLUEZ_EVENT_STATUS_*
+       * @param status example: "playing"
+       * @return gint16 BLUEZ_EVENT_STATUS_*, BLUEZ_EVENT_STATUS_ERROR if unknown
+       */
+gint16 bluez_event_status_from_string(const char * status);
+
+/**
+       * @brief Prints one event on a single line
+       * @param event popped from the ring
+       */
+void bluez_event_print(const BluezEvent * event);
+
+#endif
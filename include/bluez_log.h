@@ -0,0 +1,128 @@
+#ifndef BLUEZLOG_H
+#define BLUEZLOG_H
+
+/**
+	* @file bluez_log.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file implements a logger that is cheap enough for the hot paths.
+	*
+	* A log call does not format anything. It copies the format pointer, up to BLUEZ_LOG_MAX_ARGS
+	* arguments and the strings of the %s arguments into a ring owned by the calling thread, no lock is taken. A writer thread formats the
+	* records and prints them later. Levels are gated twice, a level above BLUEZ_LOG_COMPILE_LEVEL is
+	* not compiled in at all, a level above the runtime level costs a single compare.
+	*
+	* Because formatting is deferred:
+	* - the format must be a string literal
+	* - %s arguments are copied into the record, together they keep up to BLUEZ_LOG_STRING_SIZE - 1 bytes
+	*   with their terminators, what does not fit is cut
+	* - an integer argument must fit in a pointer, a 64-Bit value is cut to 32 bits on the raspberry pi
+	* - only the d i u o x X c s p conversions are supported, with flags, width and the h l modifiers
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+/*
+ * Levels
+*/
+#define BLUEZ_LOG_LEVEL_ERROR		0
+#define BLUEZ_LOG_LEVEL_WARN		1
+#define BLUEZ_LOG_LEVEL_INFO		2
+#define BLUEZ_LOG_LEVEL_DEBUG		3
+#define BLUEZ_LOG_LEVEL_TRACE		4
+
+#ifndef BLUEZ_LOG_COMPILE_LEVEL
+#define BLUEZ_LOG_COMPILE_LEVEL		BLUEZ_LOG_LEVEL_TRACE		/**< Higher levels are compiled out, set by make LOG_LEVEL= */
+#endif
+
+#define BLUEZ_LOG_MAX_ARGS			4			/**< Arguments kept per record */
+#define BLUEZ_LOG_STRING_SIZE		96			/**< Bytes per record for the copies of the %s arguments, a device path and an alias */
+#define BLUEZ_LOG_RING_SIZE			1024		/**< Records per thread, must be a power of 2 */
+#define BLUEZ_LOG_FLUSH_MS			50			/**< Longest time a record waits for the writer */
+
+extern gint bluez_log_runtime_level;			// read inline by BLUEZ_LOG_ENABLED, set with bluez_log_set_level
+
+/**
+	* @brief True if a record of level would be kept, use it to skip building expensive arguments
+**/
+#define BLUEZ_LOG_ENABLED(level) \
+	((level) <= BLUEZ_LOG_COMPILE_LEVEL && (level) <= g_atomic_int_get(&bluez_log_runtime_level))
+
+#define BLUEZ_LOG_ARG(x)		((guint64)(guintptr)(x))
+
+#define BLUEZ_LOG(level, format, a, b, c, d) \
+	do { \
+		if(BLUEZ_LOG_ENABLED(level)) \
+			bluez_log_write((level), (format), BLUEZ_LOG_ARG(a), BLUEZ_LOG_ARG(b), BLUEZ_LOG_ARG(c), BLUEZ_LOG_ARG(d)); \
+	} while(0)
+
+#define BLUEZ_LOG_ERROR(format, a, b, c, d)		BLUEZ_LOG(BLUEZ_LOG_LEVEL_ERROR, format, a, b, c, d)
+#define BLUEZ_LOG_WARN(format, a, b, c, d)		BLUEZ_LOG(BLUEZ_LOG_LEVEL_WARN, format, a, b, c, d)
+#define BLUEZ_LOG_INFO(format, a, b, c, d)		BLUEZ_LOG(BLUEZ_LOG_LEVEL_INFO, format, a, b, c, d)
+#define BLUEZ_LOG_DEBUG(format, a, b, c, d)		BLUEZ_LOG(BLUEZ_LOG_LEVEL_DEBUG, format, a, b, c, d)
+#define BLUEZ_LOG_TRACE(format, a, b, c, d)		BLUEZ_LOG(BLUEZ_LOG_LEVEL_TRACE, format, a, b, c, d)
+
+/**
+	* @brief Counters of the logger
+**/
+struct _BluezLogStats{
+	guint64	WRITTEN;		/**< Records put in a ring */
+	guint64	PRINTED;		/**< Records formatted by the writer */
+	guint64	DROPPED;		/**< Records lost because the ring of their thread was full */
+	guint	THREADS;		/**< Threads that have a ring */
+};
+
+typedef struct _BluezLogStats BluezLogStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Starts the writer thread, records written before are kept and printed once it runs
+       * @param level runtime level, BLUEZ_LOG_LEVEL_*
+       * @return boolean True if succeed, false if already running
+       */
+bool bluez_log_init(int level);
+
+/**
+       * @brief Prints what is left in the rings and stops the writer thread
+       */
+void bluez_log_deinit(void);
+
+/**
+       * @brief Changes the runtime level, safe from any thread
+       * @param level BLUEZ_LOG_LEVEL_*, levels above BLUEZ_LOG_COMPILE_LEVEL stay compiled out
+       */
+void bluez_log_set_level(int level);
+
+/**
+       * @brief Puts one record in the ring of the calling thread, use the BLUEZ_LOG macros instead
+       * @param level BLUEZ_LOG_LEVEL_*
+	   * @param format string literal, see the restrictions at the top of this file
+	   * @param a first argument, the unused ones are ignored, the string of a %s argument is copied
+       */
+void bluez_log_write(int level, const char * format, guint64 a, guint64 b, guint64 c, guint64 d);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Returns the runtime level
+       * @return int BLUEZ_LOG_LEVEL_*
+       */
+int bluez_log_get_level(void);
+
+/**
+       * @brief Copies the counters of the logger
+       * @param stats filled with the counters
+       */
+void bluez_log_get_stats(BluezLogStats * stats);
+
+/**
+       * @brief Prints the counters of the logger
+       */
+void bluez_log_print_stats(void);
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef BLUEZMATCHRULE_H
+#define BLUEZMATCHRULE_H
+
+/**
+	* @file bluez_match_rule.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file implements signal subscriptions whose filtering happens inside dbus-daemon.
+	*
+	* g_dbus_connection_signal_subscribe can only express an exact object path, so subscriptions made with
+	* a NULL path wake the process for every object bluez exports, other adapters, transports, GATT objects...
+	* Here the match rule is added by hand with path_namespace, and arg0 / arg0path / arg0namespace, so the
+	* daemon only routes the signals we handle. GDBus is told not to add its own, wider, rule.
+	* For more information please refer to https://dbus.freedesktop.org/doc/dbus-specification.html#message-bus-routing-match-rules
+**/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+#define DBUS_DAEMON_NAME				"org.freedesktop.DBus"
+#define DBUS_DAEMON_PATH				"/org/freedesktop/DBus"
+#define DBUS_PROPERTIES_INTERFACE		"org.freedesktop.DBus.Properties"
+
+#define MAX_NUMBER_MATCH_RULES		16		/**< MAX number of subscriptions made through this file at one time. */
+#define MATCH_RULE_SIZE				512		/**< Buffer size for one match rule string. */
+
+/**
+	* @brief Wakeup counters of one subscription
+**/
+struct _BluezMatchRuleStats{
+	char	RULE[MATCH_RULE_SIZE];	/**< Match rule as handed to AddMatch */
+	guint64	WAKEUPS;				/**< Signals delivered to the callback */
+	gint64	SINCE_US;				/**< Monotonic time the subscription was made */
+};
+
+typedef struct _BluezMatchRuleStats BluezMatchRuleStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Function must be called and passed a valid connection handle before using any other methods.
+       * @param GDBusConnection a valid connection to the DBUS
+       * @return Returns 0 on success, -3 if GDBusConnection parameter passed in is NULL
+       */
+int bluez_match_rule_init(GDBusConnection * conn);
+
+/**
+       * @brief Adds a match rule for signals sent by bluez without subscribing to them
+	   * For modules that make one G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE subscription and route the signals of several rules.
+	   * The parameters are the same as bluez_match_rule_subscribe.
+       * @return guint id to pass to bluez_match_rule_unsubscribe, 0 if the rule could not be added
+       */
+guint bluez_match_rule_add(const char * interface,
+				const char * member,
+				const char * pathNamespace,
+				const char * arg0,
+				GDBusSignalFlags flags);
+
+/**
+       * @brief Adds a match rule for signals sent by bluez and subscribes callback to them
+	   * Only G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH and G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE are used from flags,
+	   * they turn arg0 into an arg0path or arg0namespace match.
+       * @param interface interface the signal is emitted on, example: "org.freedesktop.DBus.Properties"
+	   * @param member signal name, example: "PropertiesChanged"
+	   * @param pathNamespace only objects at or below this path, NULL for any path
+	   * @param arg0 first argument of the signal, NULL to not match on it
+	   * @param flags see above
+	   * @param callback called for every matching signal
+	   * @param userData passed to callback
+       * @return guint id to pass to bluez_match_rule_unsubscribe, 0 if the rule could not be added
+       */
+guint bluez_match_rule_subscribe(const char * interface,
+				const char * member,
+				const char * pathNamespace,
+				const char * arg0,
+				GDBusSignalFlags flags,
+				GDBusSignalCallback callback,
+				gpointer userData);
+
+/**
+       * @brief Unsubscribes and removes the match rule from the daemon
+       * @param id returned by bluez_match_rule_subscribe or bluez_match_rule_add, 0 is ignored
+       */
+void bluez_match_rule_unsubscribe(guint id);
+
+/**
+       * @brief Delivers a signal that did not come from the bus to every subscription it matches, used to replay a trace
+       * @param path object path the signal was emitted on
+	   * @param interface interface the signal was emitted on
+	   * @param member signal name
+	   * @param params signal arguments, NULL for none
+       */
+void bluez_match_rule_inject(const char * path, const char * interface, const char * member, GVariant * params);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Copies the counters of a subscription
+       * @param id returned by bluez_match_rule_subscribe
+	   * @param stats filled with the counters
+       * @return boolean True if id is subscribed
+       */
+bool bluez_match_rule_get_stats(guint id, BluezMatchRuleStats * stats);
+
+/**
+       * @brief Prints every subscription with its wakeups and wakeups per second
+       */
+void bluez_match_rule_print_stats(void);
+
+#endif
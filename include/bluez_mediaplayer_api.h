@@ -190,10 +190,24 @@ struct _MediaPlayer{
 
 typedef struct _MediaPlayer MediaPlayer;
 
+/**
+	* @brief Counters kept by the media player about its D-Bus traffic.
+	* The player is kept current from PropertiesChanged deltas, so CALLS_OUT should stay far below SIGNALS_IN.
+**/
+struct _MediaPlayerStats{
+	guint64	SIGNALS_IN;			/**< PropertiesChanged signals received from MediaPlayer1 and MediaControl1 */
+	guint64	CALLS_OUT;			/**< D-Bus method calls sent to the player */
+	guint64	FULL_REFRESHES;		/**< GetAll calls made because a player was new or fell out of sync */
+};
+
+typedef struct _MediaPlayerStats MediaPlayerStats;
+
 /* 
 *	Accessors
 */
 void bluez_media_player_print_current_player(void);							// prints the properties of the current player
+void bluez_media_player_get_stats(MediaPlayerStats * stats);				// copies the signal and call counters
+void bluez_media_player_print_stats(void);									// prints the signal and call counters
 
 /*
 * Modifiers
@@ -207,6 +221,7 @@ int bluez_media_player_init(GDBusConnection * conn);
 
 /**
        * @brief Initializes the MeiaPlayer object strings to "NULL"
+	   * Every player we get signals from keeps its own MediaPlayer, all of them are cleared.
        */
 void bluez_media_player_set_default_properties(void);
 
@@ -223,11 +238,34 @@ void bluez_media_player_init_signals(void);
 void bluez_media_player_mute_signals(void);
 
 /**
-       * @brief This method is called after a PropretiesChanged event has occured.
-	   * This will read the following properties of the remote device: repeat, shuffle, status, name, type
+       * @brief Applies the org.bluez.MediaPlayer1 properties of a player, used by the object manager warm start
+	   * The player at path becomes the current player.
+       * @param path object path of the player
+	   * @param properties GVariant of type a{sv}
+       */
+void bluez_media_player_update_properties(const char * path, GVariant * properties);
+
+/**
+       * @brief Applies the org.bluez.MediaControl1 properties of a device, used by the object manager warm start
+       * @param path object path of the device
+	   * @param properties GVariant of type a{sv}
+       */
+void bluez_media_control_update_properties(const char * path, GVariant * properties);
+
+/**
+       * @brief Reads every property of the current player with a single GetAll
+	   * Only needed when the player changes or its cached properties fell out of sync,
+	   * PropertiesChanged deltas keep the cache current otherwise
        */
 void bluez_media_player_read_remote_player_properties();
 
+/**
+       * @brief Reads a single property of the current player, only for a targeted refresh
+       * @param property one of the PROPERTY_* names above
+       * @return Returns 0 on success, -3 if there is no player
+       */
+int bluez_media_player_refresh_property(const char * property);
+
 /*
 * Control Methods
 */
@@ -0,0 +1,116 @@
+#ifndef BLUEZMETRICS_H
+#define BLUEZMETRICS_H
+
+/**
+	* @file bluez_metrics.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file implements the latency and signal counters of our D-Bus traffic with bluez.
+	*
+	* Every method call gets a latency histogram with fixed buckets and counters for its failures, every signal
+	* type a counter. A sample is a few relaxed atomic adds on the slot of its method, no lock and no allocation.
+	* The counters are written to a plain text file in the Prometheus text format every few seconds, the file
+	* is replaced atomically so a collector never reads half of it.
+	*
+	* Methods and signals are keyed by the last element of their interface, example: Adapter1.StartDiscovery,
+	* Properties.Get, Device1.PropertiesChanged.
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define BLUEZ_METRICS_MAX_METHODS			64			/**< Different methods tracked, must be a power of 2 */
+#define BLUEZ_METRICS_MAX_SIGNALS			32			/**< Different signal types tracked, must be a power of 2 */
+#define BLUEZ_METRICS_BUCKETS				18			/**< Latency buckets, the last one is +Inf */
+#define BLUEZ_METRICS_DEFAULT_PATH			"/tmp/stereo_metrics.prom"
+#define BLUEZ_METRICS_DEFAULT_PERIOD_S		10			/**< Seconds between two writes of the file */
+
+#define BLUEZ_METRICS_NO_METHOD				-1			/**< Returned when the method table is full, ignored when recorded */
+
+/**
+	* @brief Totals over every method and signal
+**/
+struct _BluezMetricsStats{
+	guint	METHODS;		/**< Methods seen */
+	guint	SIGNAL_TYPES;	/**< Signal types seen */
+	guint64	CALLS;			/**< Calls that completed */
+	guint64	FAILED;			/**< Calls bluez answered with an error */
+	guint64	TIMED_OUT;		/**< Calls that passed their deadline */
+	guint64	CANCELLED;		/**< Calls cancelled before the reply */
+	guint64	SIGNALS;		/**< Signals received */
+	guint64	UNTRACKED;		/**< Samples lost because a table was full */
+	guint64	EXPORTS;		/**< Times the file was written */
+};
+
+typedef struct _BluezMetricsStats BluezMetricsStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Writes the counters to path now and then every periodS seconds from the thread default main context
+       * @param path file the collectors read, NULL for BLUEZ_METRICS_DEFAULT_PATH
+	   * @param periodS seconds between two writes
+       * @return boolean True if succeed, false if already exporting
+       */
+bool bluez_metrics_start_export(const char * path, guint periodS);
+
+/**
+       * @brief Stops the periodic writes, the file is written one last time
+       */
+void bluez_metrics_stop_export(void);
+
+/**
+       * @brief Finds the slot of a method, adding it the first time, call it before sending and record with the id
+       * @param interface example: "org.bluez.Adapter1"
+	   * @param method example: "StartDiscovery"
+       * @return int id of the method, BLUEZ_METRICS_NO_METHOD if the table is full
+       */
+int bluez_metrics_method(const char * interface, const char * method);
+
+/**
+       * @brief Records one completed call
+       * @param method id from bluez_metrics_method
+	   * @param latencyUs time from sending the call to its reply
+	   * @param state BLUEZ_COMMAND_SUCCEEDED ... BLUEZ_COMMAND_TIMED_OUT, a cancelled call only counts as cancelled
+       */
+void bluez_metrics_record_call(int method, gint64 latencyUs, int state);
+
+/**
+       * @brief Records a blocking call that was made without a BluezCommand
+       * @param method id from bluez_metrics_method
+	   * @param startUs g_get_monotonic_time() from before the call
+	   * @param error error the call returned, NULL on success
+       */
+void bluez_metrics_record_reply(int method, gint64 startUs, const GError * error);
+
+/**
+       * @brief Counts one received signal
+       * @param interface example: "org.bluez.Device1"
+	   * @param member example: "PropertiesChanged"
+       */
+void bluez_metrics_record_signal(const char * interface, const char * member);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Writes every counter to a file in the Prometheus text format
+       * @param path file to replace
+       * @return boolean True if succeed, false if the file could not be written
+       */
+bool bluez_metrics_write(const char * path);
+
+/**
+       * @brief Copies the totals
+       * @param stats filled with the totals
+       */
+void bluez_metrics_get_stats(BluezMetricsStats * stats);
+
+/**
+       * @brief Prints the totals
+       */
+void bluez_metrics_print_stats(void);
+
+#endif
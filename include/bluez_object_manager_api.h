@@ -0,0 +1,70 @@
+#ifndef BLUEZOBJECTMANAGERAPI_H
+#define BLUEZOBJECTMANAGERAPI_H
+
+/**
+	* @file bluez_object_manager_api.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	* 
+	* @brief This file uses org.freedesktop.DBus.ObjectManager to warm start the registry.
+	* 
+	* Bluez exports every adapter, device and media object under its root path. Instead of waiting
+	* for InterfacesAdded signals and reading each property with its own Properties.Get call, a single
+	* GetManagedObjects call returns every object with all of its properties, which is applied in one pass.
+	* For more information please refer to https://dbus.freedesktop.org/doc/dbus-specification.html#standard-interfaces-objectmanager
+**/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+#define OBJECT_MANAGER_INTERFACE	"org.freedesktop.DBus.ObjectManager"
+
+/**
+	* @brief Result of the last warm start
+**/
+struct _ObjectManagerStats{
+	guint	OBJECTS;			/**< Number of objects returned by bluez */
+	guint	ADAPTERS;			/**< org.bluez.Adapter1 objects */
+	guint	DEVICES;			/**< org.bluez.Device1 objects, added to the device registry */
+	guint	PLAYERS;			/**< org.bluez.MediaPlayer1 objects */
+	guint	CONTROLS;			/**< org.bluez.MediaControl1 objects */
+	guint	ROUND_TRIPS;		/**< D-Bus calls made, always 1 */
+	guint	ROUND_TRIPS_SAVED;	/**< Properties.Get calls the same information would have taken */
+	gint64	ELAPSED_US;			/**< Time from the call until every object was applied */
+};
+
+typedef struct _ObjectManagerStats ObjectManagerStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Function must be called and passed a valid connection handle before using any other methods.
+       * @param GDBusConnection a valid connection to the DBUS
+       * @return Returns 0 on success, -3 if GDBusConnection parameter passed in is NULL
+       */
+int bluez_object_manager_init(GDBusConnection * conn);
+
+/**
+       * @brief Calls GetManagedObjects once and applies every adapter, device, media player and media control object
+	   * Should be called after the other bluez_*_init functions and before any signal is expected.
+       * @return Returns the number of objects, -1 if the call failed
+       */
+int bluez_object_manager_populate(void);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Copies the counters of the last bluez_object_manager_populate
+       * @param stats filled with the counters
+       */
+void bluez_object_manager_get_stats(ObjectManagerStats * stats);
+
+/**
+       * @brief Prints the counters of the last bluez_object_manager_populate
+       */
+void bluez_object_manager_print_stats(void);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef BLUEZPAIRING_H
+#define BLUEZPAIRING_H
+
+/**
+	* @file bluez_pairing.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file implements a pipeline that provisions a batch of devices at once.
+	*
+	* Each device goes through trust -> pair -> connect as its own small state machine. Up to MAX_SESSIONS
+	* devices are worked on at the same time, the others wait in a queue. Every stage has its own deadline and
+	* is retried on failure, the time each stage took is kept per device and reported when the batch is done.
+	* An agent must be registered before a batch is started, bluez needs it to answer pairing requests.
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define MAX_NUMBER_PAIRING_DEVICES	32		/**< MAX number of devices in one batch. */
+#define PAIRING_PATH_SIZE			100		/**< Buffer size for a device object path. */
+#define PAIRING_ERROR_SIZE			128		/**< Buffer size for the last error of a device. */
+
+/*
+ * Stages, a device moves through them in this order
+*/
+#define PAIRING_STAGE_QUEUED		0		/**< Waiting for a free session */
+#define PAIRING_STAGE_TRUST			1		/**< Setting Trusted */
+#define PAIRING_STAGE_PAIR			2		/**< Pair is pending */
+#define PAIRING_STAGE_CONNECT		3		/**< Connect is pending */
+#define PAIRING_STAGE_DONE			4		/**< Trusted, paired and connected */
+#define PAIRING_STAGE_FAILED		5		/**< A stage ran out of attempts, see PairingResult.FAILED_STAGE */
+#define PAIRING_STAGE_CANCELLED		6		/**< bluez_pairing_cancel was called first */
+
+#define PAIRING_NUMBER_OF_STAGES	3		/**< trust, pair and connect */
+
+/**
+	* @brief How a batch runs
+**/
+struct _PairingConfig{
+	guint	MAX_SESSIONS;			/**< Devices worked on at the same time */
+	guint	RETRIES;				/**< Extra attempts of a stage after its first one failed */
+	int		TRUST_TIMEOUT_MS;		/**< Deadline of Set Trusted */
+	int		PAIR_TIMEOUT_MS;		/**< Deadline of Pair */
+	int		CONNECT_TIMEOUT_MS;		/**< Deadline of Connect */
+};
+
+typedef struct _PairingConfig PairingConfig;
+
+/**
+	* @brief Outcome of one device
+**/
+struct _PairingResult{
+	char	PATH[PAIRING_PATH_SIZE];					/**< Device object path */
+	int		STAGE;										/**< PAIRING_STAGE_*, final once the batch is done */
+	int		FAILED_STAGE;								/**< Stage that gave up, when STAGE is PAIRING_STAGE_FAILED */
+	guint	ATTEMPTS[PAIRING_NUMBER_OF_STAGES];			/**< Attempts made by trust, pair and connect */
+	gint64	STAGE_US[PAIRING_NUMBER_OF_STAGES];			/**< Time spent in trust, pair and connect, retries included */
+	char	ERROR[PAIRING_ERROR_SIZE];					/**< Last error reported by bluez */
+};
+
+typedef struct _PairingResult PairingResult;
+
+/**
+	* @brief Called once on the GMainLoop thread when every device of the batch is done or failed
+	* @param results one per device, in the order they were given
+	* @param count number of devices
+	* @param userData passed to bluez_pairing_start
+**/
+typedef void (*bluez_pairing_done)(const PairingResult * results, guint count, gpointer userData);
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Fills config with the defaults, 4 sessions, 2 retries, and the bluez_command deadlines
+       * @param config filled with the defaults
+       */
+void bluez_pairing_default_config(PairingConfig * config);
+
+/**
+       * @brief Starts provisioning a batch of devices, returns at once
+	   * Only one batch runs at a time. The state machine runs on the GMainLoop thread.
+       * @param paths device object paths
+	   * @param count number of paths, at most MAX_NUMBER_PAIRING_DEVICES
+	   * @param config how the batch runs, NULL for the defaults
+	   * @param callback called when the batch is done, NULL to only print the report
+	   * @param userData passed to callback
+       * @return boolean True if the batch was started, false if one is already running or count is out of range
+       */
+bool bluez_pairing_start(const char * const * paths, guint count, const PairingConfig * config, bluez_pairing_done callback, gpointer userData);
+
+/**
+       * @brief Cancels the running batch, devices not done yet end as PAIRING_STAGE_CANCELLED
+       */
+void bluez_pairing_cancel(void);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Is a batch running
+       * @return boolean True until the done callback of the batch has run
+       */
+bool bluez_pairing_is_running(void);
+
+/**
+       * @brief Prints every device of the last batch with its stage and the latency of each stage
+       */
+void bluez_pairing_print_results(void);
+
+#endif
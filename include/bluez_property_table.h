@@ -0,0 +1,69 @@
+#ifndef BLUEZPROPERTYTABLE_H
+#define BLUEZPROPERTYTABLE_H
+
+/**
+	* @file bluez_property_table.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	* 
+	* @brief This file implements a dispatch table from bluez property names to typed handlers.
+	* 
+	* Every a{sv} dictionary bluez sends is applied one key at a time. Instead of running each key
+	* through a chain of strcmp calls, a module describes the properties it knows once, with the
+	* GVariant type each one must have, and the table finds the handler with a single hash lookup.
+	* Unknown keys are rejected by the same lookup, values of the wrong type never reach a handler.
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+typedef struct _BluezProperty BluezProperty;
+typedef struct _BluezPropertyTable BluezPropertyTable;
+
+/**
+	* @brief Applies value to target
+	* @param target the object the table was built for, for example a BluetoothDevice
+	* @param value already checked against BluezProperty.TYPE
+	* @return guint bits the caller defines, for example which field changed
+**/
+typedef guint (*bluez_property_handler)(gpointer target, GVariant * value);
+
+/**
+	* @brief One known property, tables are built from static arrays of these
+**/
+struct _BluezProperty{
+	const char *			NAME;		/**< Property name as bluez sends it, example: "RSSI" */
+	const char *			TYPE;		/**< GVariant type string the value must have, example: "n" */
+	bluez_property_handler	HANDLER;	/**< Called with the value */
+};
+
+/**
+       * @brief Builds a table over a static array of properties
+	   * The array is not copied and must outlive the table, tables are meant to live for the whole process.
+       * @param properties array of known properties
+	   * @param numberOfProperties size of properties
+       * @return BluezPropertyTable ready for lookups
+       */
+BluezPropertyTable * bluez_property_table_new(const BluezProperty * properties, guint numberOfProperties);
+
+/**
+       * @brief Finds the handler of key and calls it with value
+	   * A value that does not match the expected type is logged and skipped.
+       * @param table built by bluez_property_table_new
+	   * @param target passed to the handler
+	   * @param key property name
+	   * @param value property value
+       * @return guint what the handler returned, 0 if key is unknown or value has the wrong type
+       */
+guint bluez_property_table_dispatch(BluezPropertyTable * table, gpointer target, const char * key, GVariant * value);
+
+/**
+       * @brief Dispatches every entry of an a{sv} dictionary
+       * @param table built by bluez_property_table_new
+	   * @param target passed to the handlers
+	   * @param properties GVariant of type a{sv}
+       * @return guint every handler result or'ed together
+       */
+guint bluez_property_table_apply(BluezPropertyTable * table, gpointer target, GVariant * properties);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef BLUEZRSSICOALESCER_H
+#define BLUEZRSSICOALESCER_H
+
+/**
+	* @file bluez_rssi_coalescer.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file coalesces the RSSI updates bluez sends while discovering.
+	*
+	* With DuplicateData set in the discovery filter bluez emits a PropertiesChanged for RSSI on every
+	* advertisement it hears, thousands per second in a busy room. RSSI updates are collected per device
+	* for a short window and a single batch, one value per device, is written to the device registry
+	* and handed to the observer when the window closes.
+**/
+
+#include <glib.h>
+#include <stdbool.h>
+
+/*
+ * Coalescing policies, which value of a window is delivered
+*/
+#define RSSI_COALESCE_LATEST			0		/**< Last value received */
+#define RSSI_COALESCE_MAX				1		/**< Strongest value received */
+#define RSSI_COALESCE_MEAN				2		/**< Average of every value received */
+
+#define RSSI_COALESCE_DEFAULT_WINDOW_MS	100		/**< Window used by bluez_device_api */
+
+/**
+	* @brief Called once per window with every device whose RSSI was updated
+	* @param paths object paths of the devices
+	* @param rssi value of each device, picked by the policy
+	* @param count number of devices
+	* @param userData passed to bluez_rssi_coalescer_set_observer
+**/
+typedef void (*bluez_rssi_observer)(const char * const * paths, const gint16 * rssi, guint count, gpointer userData);
+
+/**
+	* @brief Counters of the coalescer
+**/
+struct _RssiCoalescerStats{
+	guint64	EVENTS;			/**< RSSI updates pushed */
+	guint64	UPDATES;		/**< Device updates delivered after coalescing */
+	guint64	FLUSHES;		/**< Windows closed */
+};
+
+typedef struct _RssiCoalescerStats RssiCoalescerStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Sets up the coalescer, must be called before the first push
+	   * Pushes are expected on the thread running the default GMainContext, the window timer runs there too.
+       * @param windowMs length of a window, 0 writes every update through without coalescing
+	   * @param policy RSSI_COALESCE_LATEST, RSSI_COALESCE_MAX or RSSI_COALESCE_MEAN
+       */
+void bluez_rssi_coalescer_init(guint windowMs, int policy);
+
+/**
+       * @brief Changes the policy, used from the next window on
+       * @param policy RSSI_COALESCE_LATEST, RSSI_COALESCE_MAX or RSSI_COALESCE_MEAN
+       */
+void bluez_rssi_coalescer_set_policy(int policy);
+
+/**
+       * @brief Registers the one observer that gets every batch, NULL to remove it
+       * @param observer called after the registry was updated
+	   * @param userData passed to observer
+       */
+void bluez_rssi_coalescer_set_observer(bluez_rssi_observer observer, gpointer userData);
+
+/**
+       * @brief Adds an RSSI update of a device to the current window
+       * @param path object path of the device
+	   * @param rssi value bluez sent
+       */
+void bluez_rssi_coalescer_push(const char * path, gint16 rssi);
+
+/**
+       * @brief Drops what was collected for a device
+	   * Used when a newer RSSI reached the registry another way, or the device went away.
+       * @param path object path of the device
+       */
+void bluez_rssi_coalescer_discard(const char * path);
+
+/**
+       * @brief Closes the current window now
+       */
+void bluez_rssi_coalescer_flush(void);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Copies the counters of the coalescer
+       * @param stats filled with the counters
+       */
+void bluez_rssi_coalescer_get_stats(RssiCoalescerStats * stats);
+
+/**
+       * @brief Prints the counters of the coalescer
+       */
+void bluez_rssi_coalescer_print_stats(void);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef BLUEZSIGNALROUTER_H
+#define BLUEZSIGNALROUTER_H
+
+/**
+	* @file bluez_signal_router.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file routes every org.freedesktop.DBus.Properties.PropertiesChanged signal from bluez.
+	*
+	* There is a single GDBus subscription for the signal. Its (sa{sv}as) envelope is checked and taken apart
+	* once, then the interface name picks the handler out of a table. Modules register a handler per
+	* interface instead of subscribing on their own, each registration only adds a match rule for its interface
+	* so the daemon still drops the interfaces nobody handles.
+**/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+#define MAX_NUMBER_SIGNAL_ROUTES	16		/**< MAX number of interfaces that can be routed at one time. */
+
+/**
+	* @brief Called with one PropertiesChanged signal of the interface the handler was registered for
+	* @param path object path the signal was emitted on
+	* @param changed GVariant of type a{sv}, borrowed for the duration of the call
+	* @param invalidated GVariant of type as, properties that changed without their value being sent
+	* @param userData passed to bluez_signal_router_register
+**/
+typedef void (*bluez_signal_handler)(const char * path, GVariant * changed, GVariant * invalidated, gpointer userData);
+
+/**
+	* @brief Counters of the router
+**/
+struct _SignalRouterStats{
+	guint64	SIGNALS;		/**< PropertiesChanged signals received */
+	guint64	DISPATCHED;		/**< Signals handed to a handler */
+	guint64	UNROUTED;		/**< Signals of an interface or path nobody registered */
+	guint64	INVALID;		/**< Signals with the wrong signature */
+};
+
+typedef struct _SignalRouterStats SignalRouterStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Function must be called and passed a valid connection handle before using any other methods.
+	   * Makes the one PropertiesChanged subscription, bluez_match_rule_init must have been called.
+       * @param GDBusConnection a valid connection to the DBUS
+       * @return Returns 0 on success, -3 if GDBusConnection parameter passed in is NULL
+       */
+int bluez_signal_router_init(GDBusConnection * conn);
+
+/**
+       * @brief Routes PropertiesChanged of interface to handler
+	   * Registering an interface again replaces its handler.
+       * @param interface bluez interface, example: "org.bluez.Device1"
+	   * @param pathNamespace only objects at or below this path, NULL for any path
+	   * @param handler called for every matching signal
+	   * @param userData passed to handler
+       * @return boolean True if succeed, false if the table is full or the match rule could not be added
+       */
+bool bluez_signal_router_register(const char * interface, const char * pathNamespace, bluez_signal_handler handler, gpointer userData);
+
+/**
+       * @brief Stops routing interface and removes its match rule
+       * @param interface bluez interface passed to bluez_signal_router_register
+       */
+void bluez_signal_router_unregister(const char * interface);
+
+/**
+       * @brief Routes a PropertiesChanged signal that did not come from the bus, used to replay a trace
+       * @param path object path the signal was emitted on
+	   * @param params signal arguments, (sa{sv}as)
+       */
+void bluez_signal_router_inject(const char * path, GVariant * params);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Returns the PropertiesChanged signals received so far, cheap enough to poll, nothing is printed
+       */
+guint64 bluez_signal_router_get_signal_count(void);
+
+/**
+       * @brief Copies the counters of the router
+       * @param stats filled with the counters
+       */
+void bluez_signal_router_get_stats(SignalRouterStats * stats);
+
+/**
+       * @brief Prints the counters of the router
+       */
+void bluez_signal_router_print_stats(void);
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef BLUEZTRACE_H
+#define BLUEZTRACE_H
+
+/**
+	* @file bluez_trace.h
+	* @author Kyle Van Cleave
+	* @date March 14, 2020
+	*
+	* @brief This file records the D-Bus traffic we receive from bluez into a trace file and replays it.
+	*
+	* Recording keeps every signal that reaches the connection and every method reply a BluezCommand gets,
+	* with the time it arrived. Replaying feeds the signals into the same handlers the live subscriptions
+	* call, either as fast as possible or at the pace they were recorded, and answers every BluezCommand with
+	* the next reply recorded for its path, interface and method instead of asking bluez. Live signals are
+	* ignored while a trace is loaded so a run only depends on the trace.
+	*
+	* The file is a header followed by records, numbers are LEB128 varints and names are sent once:
+	* - header: "BZTR", version byte, byte order of the bodies ('l' or 'B'), wall clock start in us
+	* - string: 1, id, length, bytes
+	* - signal: 2, us since the last record, path id, interface id, member id, body
+	* - reply:  3, us since the last record, path id, interface id, method id, state, error name id, message id, body
+	* - body:   type string id, length, serialized GVariant, id 0 is no body
+**/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+#define BLUEZ_TRACE_VERSION				1
+#define BLUEZ_TRACE_REPLAY_BATCH		64			/**< Signals delivered per main loop dispatch by the replay */
+
+/*
+ * Replay modes
+*/
+#define BLUEZ_TRACE_REPLAY_FAST			0			/**< Every signal as soon as the previous one was handled */
+#define BLUEZ_TRACE_REPLAY_PACED		1			/**< Every signal at the time it was recorded */
+
+/**
+	* @brief Called once on the thread default main context of bluez_trace_replay_start when every signal was delivered
+	* @param userData passed to bluez_trace_replay_start
+**/
+typedef void (*bluez_trace_done_callback)(gpointer userData);
+
+/**
+	* @brief Counters of the recording, or of the replay
+**/
+struct _BluezTraceStats{
+	guint64	SIGNALS;		/**< Signals recorded, or delivered by the replay */
+	guint64	REPLIES;		/**< Method replies recorded, or served by the replay */
+	guint64	MISSES;			/**< Calls the replay had no recorded reply for */
+	guint64	DROPPED;		/**< Records lost because the file could not be written */
+	guint64	BYTES;			/**< Size of the trace */
+	gint64	ELAPSED_US;		/**< Time recorded, or time the replay took */
+};
+
+typedef struct _BluezTraceStats BluezTraceStats;
+
+/*
+* Modifiers
+*/
+/**
+       * @brief Function must be called and passed a valid connection handle before using any other methods.
+       * @param GDBusConnection a valid connection to the DBUS
+       * @return Returns 0 on success, -3 if GDBusConnection parameter passed in is NULL
+       */
+int bluez_trace_init(GDBusConnection * conn);
+
+/**
+       * @brief Stops a recording or a replay and frees the trace
+       */
+void bluez_trace_deinit(void);
+
+/**
+       * @brief Starts writing every signal and method reply to a new trace file
+       * @param path trace file, replaced if it exists
+       * @return boolean True if succeed, false if the file could not be created or a trace is already in use
+       */
+bool bluez_trace_record_start(const char * path);
+
+/**
+       * @brief Writes what is left and closes the trace file
+       */
+void bluez_trace_record_stop(void);
+
+/**
+       * @brief Records the reply of one method call, does nothing unless recording, called by bluez_command
+       * @param path object path of the call
+	   * @param interface interface of the call
+	   * @param method method of the call
+	   * @param state BLUEZ_COMMAND_SUCCEEDED ... BLUEZ_COMMAND_TIMED_OUT
+	   * @param result reply of a call that succeeded, NULL otherwise
+	   * @param errorName D-Bus error name of a failed call, NULL otherwise
+	   * @param message error message, NULL on success
+       */
+void bluez_trace_record_reply(const char * path,
+				const char * interface,
+				const char * method,
+				int state,
+				GVariant * result,
+				const char * errorName,
+				const char * message);
+
+/**
+       * @brief Loads a trace, from now on method calls are answered from it and live signals are ignored
+       * @param path trace file written by bluez_trace_record_start
+       * @return boolean True if succeed, false if the file can not be read or is not a valid trace
+       */
+bool bluez_trace_replay_load(const char * path);
+
+/**
+       * @brief Starts delivering the signals of the loaded trace from the thread default main context
+       * @param mode BLUEZ_TRACE_REPLAY_FAST or BLUEZ_TRACE_REPLAY_PACED
+	   * @param callback called once every signal was delivered, NULL for none
+	   * @param userData passed to callback
+       * @return boolean True if succeed, false if no trace is loaded or the replay already started
+       */
+bool bluez_trace_replay_start(int mode, bluez_trace_done_callback callback, gpointer userData);
+
+/**
+       * @brief Takes the next recorded reply of a method, safe from any thread, called by bluez_command
+       * @param path object path of the call
+	   * @param interface interface of the call
+	   * @param method method of the call
+	   * @param state set to the BLUEZ_COMMAND_* the call ended with
+	   * @param result set to a new reference of the reply, NULL unless it succeeded
+	   * @param errorName set to the D-Bus error name, owned by the trace, NULL unless it failed
+	   * @param message set to the error message, owned by the trace, NULL on success
+       * @return boolean True if succeed, false if the trace has no reply left for the method
+       */
+bool bluez_trace_take_reply(const char * path,
+				const char * interface,
+				const char * method,
+				int * state,
+				GVariant ** result,
+				const char ** errorName,
+				const char ** message);
+
+/*
+* Accessors
+*/
+/**
+       * @brief Returns true while a trace is being recorded
+       */
+bool bluez_trace_is_recording(void);
+
+/**
+       * @brief Returns true while a trace is loaded, bluez is neither called nor listened to then
+       */
+bool bluez_trace_is_replaying(void);
+
+/**
+       * @brief Copies the counters
+       * @param stats filled with the counters
+       */
+void bluez_trace_get_stats(BluezTraceStats * stats);
+
+/**
+       * @brief Prints whether a trace is recorded or replayed, and its counters
+       */
+void bluez_trace_print_stats(void);
+
+#endif
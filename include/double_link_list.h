@@ -11,88 +11,210 @@
 
 #include "bluetooth_device.h"
 
+#define LIST_MIN_NUMBER_BUCKETS	16		/**< Number of hash buckets allocated on the first insert, must be a power of two. */
+#define LIST_MIN_CAPACITY		16		/**< Number of Nodes (and positional array slots) allocated on the first insert. */
+
 typedef struct _Node Node;							// structure for Double Linked List
+typedef struct _LinkedList LinkedList;				// list head plus hash index over the device part of BluetoothDevice.PATH
+typedef struct _NodeSlab NodeSlab;					// block of Nodes owned by a LinkedList
 
 struct _Node
 {
 	BluetoothDevice device;		/**< BluetoothDevice struct, holds information of the bluetooth device. */
 	Node * next;				/**< Pointer to next Node in the list. */
 	Node * prev;				/**< Pointer to Node behind current Node. */
+	Node * hashNext;			/**< Pointer to next Node in the same hash bucket. */
+	guint  hash;				/**< Cached hash of the last element of device.PATH, example: dev_XX_XX_XX_XX_XX_XX, the same for every adapter. */
+	guint  position;			/**< Zero based index of this Node inside LinkedList.nodes. */
+};
+
+/**
+	* @brief Counters kept by a LinkedList about its memory use.
+	* After the list is warmed up inserting and deleting Nodes should leave heapAllocations unchanged.
+**/
+struct _NodePoolStats
+{
+	guint64	heapAllocations;	/**< Number of times the list asked the heap for memory (slabs, hash buckets, positional array). */
+	guint64	heapFrees;			/**< Number of blocks the list gave back to the heap. */
+	guint64	nodeAllocations;	/**< Number of Nodes handed out by the pool. */
+	guint64	nodeReleases;		/**< Number of Nodes returned to the pool. */
+	guint	nodesInUse;			/**< Nodes currently in the list. */
+	guint	nodesAvailable;		/**< Nodes on the free list, ready to be used without touching the heap. */
+};
+
+/**
+	* @brief Double linked list of Nodes with a hash index keyed by the last element of BluetoothDevice.PATH.
+	* The adapter part of the path is ignored, a remote device seen by several adapters is a single Node.
+	* The index is chained through Node.hashNext, so lookups, inserts and deletes by path are O(1)
+	* on average and never walk the list. The list also keeps a tail pointer and a dense array of
+	* Nodes in index order, so inserts, deletes and access by index are O(1) as well. New Nodes get the
+	* next index wherever they go in the list, a deleted Node hands its index to the Node with the last one.
+	* Index order is the order the devices were added in until the first delete, walk next for list order.
+	* Nodes come from fixed size slabs owned by the list, deleted Nodes go on a free list and are
+	* reused, so once the list is warmed up inserts and deletes do not touch the heap.
+	* Initialize with LINKED_LIST_INIT, optionally preallocate with initList, release with freeList.
+	* Only one thread may modify the list at a time, the read* accessors may run concurrently with it.
+**/
+struct _LinkedList
+{
+	Node *	head;				/**< First Node in the list, NULL if empty. */
+	Node *	tail;				/**< Last Node in the list, NULL if empty. */
+	Node **	buckets;			/**< Hash buckets, allocated on first insert. */
+	guint	numberOfBuckets;	/**< Size of buckets, always a power of two. */
+	Node **	nodes;				/**< Nodes in index order, nodes[i]->position == i. */
+	guint	capacity;			/**< Number of slots allocated in nodes. */
+	guint	size;				/**< Number of Nodes in the list. */
+	NodeSlab *	slabs;			/**< Every slab of Nodes allocated for this list. */
+	GSList *	retired;		/**< Hash buckets and positional arrays replaced while growing, kept for concurrent readers until freeList. */
+	Node *	freeNodes;			/**< Unused Nodes, chained through Node.next. */
+	guint	slabSize;			/**< Number of Nodes allocated when the free list runs empty. */
+	NodePoolStats stats;		/**< Allocation counters. */
 };
 
+#define LINKED_LIST_INIT { 0 }		/**< Static initializer for an empty LinkedList. */
+
 /**
  * Modifiers.
 **/
 
+/**
+       * @brief Preallocates room for capacity Nodes, their hash buckets and positional array slots
+	   * Later slabs are allocated with the same size when the pool runs empty.
+       * @param list the LinkedList to prepare
+	   * @param capacity number of Nodes to preallocate
+       * @return Returns true on success, false if capacity is 0
+       */
+bool initList(LinkedList * list, guint capacity);
+
+/**
+       * @brief Removes all nodes from list and gives every slab, the hash index and positional array back to the heap
+       * @param list the LinkedList to release
+       */
+void freeList(LinkedList * list);
+
 /**
        * @brief Inserts a Node at beginning of list
-       * @param Node that is a reference to head of list
+       * @param list the LinkedList to insert into
        * @return Returns true on success, false if node already exists
        */
-bool push(Node ** headRef, BluetoothDevice * newDevice);
+bool push(LinkedList * list, BluetoothDevice * newDevice);
 
 /**
        * @brief Inserts a new Node at end of list
-       * @param Node that is a reference to head of list
+       * @param list the LinkedList to insert into
 	   * @param BluetoothDevice 
        * @return Returns true on success, false if node already exists
        */
-bool append(Node ** headRef, BluetoothDevice * newDevice);
+bool append(LinkedList * list, BluetoothDevice * newDevice);
 
 /**
        * @brief Inserts a new Node in the list before Node specified in second paramater
-       * @param head an Node that is a reference to head of list
+       * @param list the LinkedList to insert into
 	   * @param next an Node that we insert our new Node in front of
        * @return Returns true on success, false if node already exists
        */
-bool insertBefore(Node ** headRef, Node* nextNode, BluetoothDevice * newDevice);
+bool insertBefore(LinkedList * list, Node* nextNode, BluetoothDevice * newDevice);
 
 /**
        * @brief Deletes the Node that contains the BluetoothDevice with path from list
-       * @param start an Node that is a reference to head of list
+       * @param list the LinkedList to remove from
 	   * @param path
-       * @return Returns true on success, false if start is NULL, or BluetoothDevice with path is not found
+       * @return Returns true on success, false if the list is empty, or BluetoothDevice with path is not found
        */
-bool deleteNode(Node **start, const char * path);												// removes a node at the given char address, returns false if node does not exist
+bool deleteNode(LinkedList * list, const char * path);												// removes a node at the given char address, returns false if node does not exist
 
 /**
-       * @brief Removes all nodes from list, unallocates all the memory
-       * @param start an Node that is a reference to head of list
-       * @return Returns true on success, false start is NULL
+       * @brief Removes all nodes from list, the Nodes go back to the pool for reuse
+       * @param list the LinkedList to clear
+       * @return Returns true on success, false if the list is empty
        */
-bool clearList(Node **start);
+bool clearList(LinkedList * list);
+
+/**
+       * @brief Stores device into node, the only way to change the device of a Node in the list
+	   * Concurrent readers copy the device while it is stored, see the Concurrent Accessors.
+       * @param node the Node to change
+	   * @param device the new contents, usually a copy of node->device that was changed
+       */
+void writeNode(Node * node, const BluetoothDevice * device);
+
+/**
+       * @brief Removes every Node whose BluetoothDevice matches filter in a single pass over the list
+	   * Remaining Nodes keep their relative index order. filter gets a copy, changes to a kept device are stored back.
+       * @param list the LinkedList to remove from
+	   * @param filter called once per Node, returns true if the Node should be removed
+	   * @param userData passed through to filter
+       * @return Returns the number of Nodes removed
+       */
+int removeNodesIf(LinkedList * list, bluetooth_device_filter filter, gpointer userData);
 
 /**
 	* Accessors.
 **/
 /**
-       * @brief Prints contents of the linked list staring from the given node
-       * @param start Node that is a reference to where begin printing list from
+       * @brief Prints contents of the linked list in index order
+	   * Every device is numbered with its index, the number scanList takes.
+       * @param list the LinkedList to print
        */
-void printList(Node * start);
+void printList(LinkedList * list);
 
 /**
        * @brief Searches for a node contains a BluetoothDevice with given path
-       * @param start an Node that is a reference to head of list
+       * @param list the LinkedList to search
 	   * @param path used to compare a BluetoothDevice path to
        * @return Returns a reference to the Node with the BluetoothDevice with given path, NULL otherwise
        */
-Node * doesNodeExist(Node *head, const char * path);
+Node * doesNodeExist(LinkedList * list, const char * path);
 
 /**
        * @brief Searches for a node at a given index
-       * @param start an Node that is a reference to head of list
+	   * Reads the positional array, so the cost does not depend on index.
+       * @param list the LinkedList to search
 	   * @param index an integer that is the index we want
        * @return Returns a reference to the Node at index, or NULL otherwise
        */				
-Node * scanList(Node *start, int index);							
+Node * scanList(LinkedList * list, int index);							
 
 /**
        * @brief Searches for a Node that contains a BluetoothDevice with given path
-       * @param start an Node that is a reference to head of list
+	   * Uses the hash index, so the cost does not depend on the number of devices in the list.
+       * @param list the LinkedList to search
 	   * param path a string that is the path we are looking for
        * @return Returns a reference to the Node that contains a Bluetooth Device with given path, or NULL if not found
        */
-Node * scanListByPath(Node *start, const char * path);				
+Node * scanListByPath(LinkedList * list, const char * path);				
+
+/**
+	* Concurrent Accessors.
+	* Safe to call while another thread modifies the list, they never touch freed memory.
+	* The copy is not guaranteed to be consistent, the caller must detect a concurrent change
+	* (for example with a sequence counter) and retry.
+**/
+/**
+       * @brief Copies the BluetoothDevice of the Node at a given index
+       * @param list the LinkedList to read
+	   * @param index 1 based, like scanList
+	   * @param device filled with a copy of the BluetoothDevice
+       * @return Returns true if index was in range
+       */
+bool readNodeAt(LinkedList * list, int index, BluetoothDevice * device);
+
+/**
+       * @brief Copies the BluetoothDevice with given path
+       * @param list the LinkedList to read
+	   * @param path of the BluetoothDevice
+	   * @param device filled with a copy of the BluetoothDevice
+       * @return Returns true if found
+       */
+bool readNodeByPath(LinkedList * list, const char * path, BluetoothDevice * device);
+
+/**
+       * @brief Copies the BluetoothDevices of the list in index order
+       * @param list the LinkedList to read
+	   * @param devices array filled with up to maxDevices copies
+	   * @param maxDevices size of devices
+       * @return Returns the number of Nodes in the list, which may be larger than maxDevices
+       */
+guint readNodes(LinkedList * list, BluetoothDevice * devices, guint maxDevices);
 #endif
 
@@ -1,47 +1,283 @@
 /*
  * Author Kyle Van Cleave
 */
+/**
+	* @file bluetooth_device.c
+	* @brief Device registry shared by the gdbus main loop thread and the interactive thread
+	*
+	*	- Writers are serialized by mWriteLock and bump mSequence before and after every change,
+	*	  so the sequence is odd while the registry is being modified.
+	*	- Readers never take the lock on the fast path, they copy the devices they need and retry
+	*	  if the sequence was odd or changed meanwhile (a seqlock). After REGISTRY_READ_RETRIES
+	*	  failed attempts they fall back to the lock, so a busy writer cannot starve them.
+	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "bluetooth_device.h"
 #include "double_link_list.h"
+#include "bluez_property_table.h"
+#include "bluez_log.h"
+#define REGISTRY_READ_RETRIES	64		// optimistic reads before a reader falls back to the lock
+
 /**
 * Private Function Declerations
 */
+static void registry_write_begin(void);
+static void registry_write_end(void);
+static guint registry_read_begin(void);
+static bool registry_read_retry(guint sequence);
+static BluezPropertyTable * bluetooth_device_get_property_table(bool withUuids);
+// org.bluez.Device1 property handlers, each returns the BLUETOOTH_DEVICE_DIRTY_* bit it changed
+static guint bluetooth_device_set_alias(gpointer device, GVariant * value);
+static guint bluetooth_device_set_address(gpointer device, GVariant * value);
+static guint bluetooth_device_set_rssi(gpointer device, GVariant * value);
+static guint bluetooth_device_set_paired(gpointer device, GVariant * value);
+static guint bluetooth_device_set_connected(gpointer device, GVariant * value);
+static guint bluetooth_device_set_trusted(gpointer device, GVariant * value);
+static guint bluetooth_device_set_uuids(gpointer device, GVariant * value);
+static guint8 bluetooth_device_intern_uuids(const char * path, GVariant * value, BluetoothUuid * uuids);
+static guint bluetooth_device_replace_uuids(BluetoothDevice * device, const BluetoothUuid * uuids, guint8 count);
+static guint bluetooth_device_set_flag(bool * field, GVariant * value, guint dirty);
+static guint bluetooth_device_set_adapter_rssi(BluetoothDevice * device, const char * path, gint16 rssi);
+static void bluetooth_device_pick_best_adapter(BluetoothDevice * device);
+static bool bluetooth_device_release_adapter(BluetoothDevice * device, gpointer userData);
 
 
 /** 
 * Private Variables
 **/
-static Node * mHead = NULL;
+static LinkedList mDevices = LINKED_LIST_INIT;		// device list with a hash index over BluetoothDevice.PATH
+
+static GMutex mWriteLock;							// serializes writers
+static guint mSequence = 0;							// odd while a writer is changing mDevices
+
+static __thread BluetoothDevice tDevice;			// copy bluetooth_get_device_path_at_index returns the path of
+static __thread char tAddress[BT_ADDRESS_STRING_SIZE];	// what bluetooth_device_get_property_address returns
 
 int mNumberOfDevices = 0;
 
+static const BluezProperty mDeviceProperties[] = {
+	{ "Alias",		"s",	bluetooth_device_set_alias },
+	{ "Address",	"s",	bluetooth_device_set_address },
+	{ "RSSI",		"n",	bluetooth_device_set_rssi },
+	{ "Paired",		"b",	bluetooth_device_set_paired },
+	{ "Connected",	"b",	bluetooth_device_set_connected },
+	{ "Trusted",	"b",	bluetooth_device_set_trusted },
+	{ "UUIDs",		"as",	bluetooth_device_set_uuids },		// kept last, the registry writer interns them before it locks
+};
+
+bool bluetooth_device_init(int capacity)
+{
+	bool result;
+	
+	if(capacity <= 0)
+		return false;
+	
+	registry_write_begin();
+	result = initList(&mDevices, capacity);
+	registry_write_end();
+	
+	return result;
+}
+
+void bluetooth_device_init_properties(BluetoothDevice * device, const char * path)
+{
+	int adapter = bluetooth_device_get_adapter_index(path);
+	
+	memset(device, 0, sizeof(BluetoothDevice));
+	
+	g_strlcpy(device->PATH, path, sizeof(device->PATH));
+	
+	if(adapter >= 0)
+	{
+		device->ADAPTERS = 1u << adapter;
+		device->BEST_ADAPTER = adapter;
+	}
+}
+
+int bluetooth_device_get_adapter_index(const char * path)
+{
+	const char * number;
+	char * end;
+	long index;
+	
+	if(!g_str_has_prefix(path, BLUEZ_HCI_PATH_PREFIX))
+		return -1;
+	
+	/*1. hciN must be followed by the end of the path or the next element */
+	number = path + strlen(BLUEZ_HCI_PATH_PREFIX);
+	index = strtol(number, &end, 10);
+	
+	if(end == number || (*end != '\0' && *end != '/') || index < 0 || index >= BLUEZ_MAX_ADAPTERS)
+		return -1;
+	
+	return (int)index;
+}
+
+bool bluetooth_device_parse_address(const char * address, guint64 * value)
+{
+	int i;
+	guint64 result = 0;
+	
+	for(i = 0; i < BT_ADDRESS_STRING_SIZE - 1; i += 3)
+	{
+		int high = g_ascii_xdigit_value(address[i]);
+		int low = high < 0 ? -1 : g_ascii_xdigit_value(address[i + 1]);
+		
+		// octets are separated by ':' and the last one ends the string
+		if(low < 0 || address[i + 2] != (i == BT_ADDRESS_STRING_SIZE - 3 ? '\0' : ':'))
+			return false;
+		
+		result = (result << 8) | (guint64)((high << 4) | low);
+	}
+	
+	*value = result;
+	
+	return true;
+}
+
+void bluetooth_device_format_address(guint64 value, char * address)
+{
+	sprintf(address, "%02X:%02X:%02X:%02X:%02X:%02X",
+			(unsigned)(value >> 40) & 0xFF, (unsigned)(value >> 32) & 0xFF, (unsigned)(value >> 24) & 0xFF,
+			(unsigned)(value >> 16) & 0xFF, (unsigned)(value >> 8) & 0xFF, (unsigned)value & 0xFF);
+}
+
+guint bluetooth_device_apply_properties(BluetoothDevice * device, GVariant * properties)
+{
+	return bluez_property_table_apply(bluetooth_device_get_property_table(true), device, properties);
+}
+
 /* 
 *	Accessors
 */
 
+void bluetooth_device_get_allocation_stats(NodePoolStats * stats)
+{
+	g_mutex_lock(&mWriteLock);
+	*stats = mDevices.stats;
+	g_mutex_unlock(&mWriteLock);
+}
+
 int bluetooth_device_get_number_devices(void)
 {
-	g_print("Number of Devices: %d\n", mNumberOfDevices);
-	return mNumberOfDevices;
+	return g_atomic_int_get(&mNumberOfDevices);
+}
+
+bool bluetooth_device_copy_at_index(int index, BluetoothDevice * device)
+{
+	int attempt;
+	bool found = false;
+	
+	for(attempt = 0; attempt < REGISTRY_READ_RETRIES; attempt++)
+	{
+		guint sequence = registry_read_begin();
+		
+		found = readNodeAt(&mDevices, index, device);
+		
+		if(!registry_read_retry(sequence))
+			return found;
+	}
+	
+	g_mutex_lock(&mWriteLock);
+	found = readNodeAt(&mDevices, index, device);
+	g_mutex_unlock(&mWriteLock);
+	
+	return found;
+}
+
+bool bluetooth_device_copy_by_path(const char * path, BluetoothDevice * device)
+{
+	int attempt;
+	bool found = false;
+	
+	for(attempt = 0; attempt < REGISTRY_READ_RETRIES; attempt++)
+	{
+		guint sequence = registry_read_begin();
+		
+		found = readNodeByPath(&mDevices, path, device);
+		
+		if(!registry_read_retry(sequence))
+			return found;
+	}
+	
+	g_mutex_lock(&mWriteLock);
+	found = readNodeByPath(&mDevices, path, device);
+	g_mutex_unlock(&mWriteLock);
+	
+	return found;
+}
+
+BluetoothDevice * bluetooth_device_snapshot(int * numberOfDevices)
+{
+	guint size = g_atomic_int_get(&mDevices.size);
+	guint allocated = size ? size : 1;
+	BluetoothDevice * devices = g_new(BluetoothDevice, allocated);
+	int attempt;
+	
+	for(attempt = 0; attempt < REGISTRY_READ_RETRIES; attempt++)
+	{
+		guint sequence = registry_read_begin();
+		
+		size = readNodes(&mDevices, devices, allocated);
+		
+		if(registry_read_retry(sequence))
+			continue;
+		
+		/*1. Consistent and everything fit */
+		if(size <= allocated)
+		{
+			*numberOfDevices = size;
+			return devices;
+		}
+		
+		/*2. Devices were added since we sized the array, grow it and read again */
+		allocated = size;
+		devices = g_renew(BluetoothDevice, devices, allocated);
+	}
+	
+	g_mutex_lock(&mWriteLock);
+	size = g_atomic_int_get(&mDevices.size);
+	if(size > allocated)
+	{
+		allocated = size;
+		devices = g_renew(BluetoothDevice, devices, allocated);
+	}
+	*numberOfDevices = readNodes(&mDevices, devices, allocated);
+	g_mutex_unlock(&mWriteLock);
+	
+	return devices;
 }
 
 void bluetooth_device_print_properties(BluetoothDevice * device)
 {
 	int i;
+	char address[BT_ADDRESS_STRING_SIZE];
+	char uuid[UUID_STRING_SIZE];
+	
+	bluetooth_device_format_address(device->MAC_ADDRESS, address);
 	 
 	g_print("\n***\t\t Device Properties \t\t***\n\n");
 	g_print("\t-Path:\t %s\n",device->PATH);
 	g_print("\t-Alias:\t %s\n",device->ALIAS);
 	g_print("\t-RSSI:\t %d\n",device->RSSI);
-	g_print("\t-Address:\t %s\n",device->MAC_ADDRESS);
+	g_print("\t-Adapters:\t");
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+		if(device->ADAPTERS & (1u << i))
+			g_print(" hci%d (%d)%s", i, device->ADAPTER_RSSI[i], i == device->BEST_ADAPTER ? "*" : "");
+	g_print("\n");
+	g_print("\t-Address:\t %s\n",address);
 	g_print("\t-Paired:\t \"%s\"\n", device->PAIRED ? "True" : "False");
 	g_print("\t-Trusted:\t \"%s\"\n", device->TRUSTED ? "True" : "False");
 	g_print("\t-Connected:\t \"%s\"\n", device->CONNECTED ? "True" : "False");
 	g_print("\t-UUIDs: {\n");
 	
 	for(i = 0; i < device->NUMBER_OF_UUIDS; i ++)
-		g_print("\t\t%s\n",device->SERVICE_UUIDS[i]);
+		if(bluetooth_uuid_to_string(device->SERVICE_UUIDS[i], uuid))
+			g_print("\t\t%s\n",uuid);
 	
 	g_print("\t\t}\n");
 	g_print("\n***\t\t Device Properites \t\t***\n");
@@ -51,30 +287,47 @@ void bluetooth_device_print_properties(BluetoothDevice * device)
 void bluetooth_device_print_all(void)
 {
 	//printList(mHead);
-	Node * temp = mHead;
+	int i;
+	int numberOfDevices;
+	BluetoothDevice * devices = bluetooth_device_snapshot(&numberOfDevices);
 	
-	while(temp != NULL)
+	// printing is slow, so it works on a copy instead of holding up the writer
+	// the snapshot is in index order, each device is numbered the way the menu asks for it
+	for(i = 0; i < numberOfDevices; i++)
 	{
-		bluetooth_device_print_properties(&temp->device);
-		temp = temp->next;
+		g_print("\n[ Device %d ]", i + 1);
+		bluetooth_device_print_properties(&devices[i]);
 	}
+	
+	if(numberOfDevices == 0)
+		g_print("No Devices\n");
+	
+	g_free(devices);
 }
 
 char * bluetooth_get_device_path_at_index(int index)
 {
-	Node * dev = scanList(mHead,index);
-	
-	if(dev != NULL)
-	{
-		return dev->device.PATH;
-	}
-	else
+	// the path of a copy, a device removed after this returns does not take the string with it
+	if(!bluetooth_device_copy_at_index(index, &tDevice))
 		return NULL;
+	
+	return tDevice.PATH;
+}
+
+bool bluetooth_device_copy_path_at_index(int index, char * path)
+{
+	BluetoothDevice device;
+	
+	if(!bluetooth_device_copy_at_index(index, &device))
+		return false;
+	
+	g_strlcpy(path, device.PATH, BLUETOOTH_DEVICE_PATH_SIZE);
+	return true;
 }
 
 BluetoothDevice * bluetooth_get_device_at_index(int index)
 {
-	Node * dev = scanList(mHead,index);
+	Node * dev = scanList(&mDevices,index);
 	
 	if(dev != NULL)
 		return &dev->device;
@@ -86,7 +339,7 @@ BluetoothDevice * bluetooth_get_device_by_path(const char * path)
 {
 	Node * deviceFound = NULL;
 	
-	deviceFound = scanListByPath(mHead,path);
+	deviceFound = scanListByPath(&mDevices,path);
 	
 	return &deviceFound->device;
 }
@@ -107,203 +360,654 @@ const char * bluetooth_device_get_property_alias(BluetoothDevice * device)
 }
 const char * bluetooth_device_get_property_address(BluetoothDevice * device)
 {
-	return device->MAC_ADDRESS;
+	return bluetooth_device_copy_property_address(device, tAddress);
+}
+const char * bluetooth_device_copy_property_address(BluetoothDevice * device, char * address)
+{
+	bluetooth_device_format_address(device->MAC_ADDRESS, address);
+	
+	return address;
 }
 /*
 *	Modifiers
 */
 bool bluetooth_device_add_device(BluetoothDevice * newDevice)
 {
-	if(append(&mHead, newDevice))
+	bool added;
+	
+	if(newDevice->ADAPTERS != 0 && newDevice->RSSI != 0)
+		newDevice->ADAPTER_RSSI[newDevice->BEST_ADAPTER] = newDevice->RSSI;
+	
+	registry_write_begin();
+	added = append(&mDevices, newDevice);
+	if(added)
+		g_atomic_int_inc(&mNumberOfDevices);
+	else
 	{
-		g_print("\nDevice:\t Adding Device %s\n",newDevice->PATH);
-		mNumberOfDevices++;
-		return true;
+		/*1. Another adapter has it already, merge this adapter into the same device */
+		Node * dev = scanListByPath(&mDevices, newDevice->PATH);
+		
+		if(dev != NULL)
+		{
+			BluetoothDevice device = dev->device;
+			
+			device.ADAPTERS |= newDevice->ADAPTERS;
+			bluetooth_device_set_adapter_rssi(&device, newDevice->PATH, newDevice->RSSI);
+			writeNode(dev, &device);
+		}
 	}
+	registry_write_end();
 	
-	return false;
+	if(added)
+		BLUEZ_LOG_INFO("\nDevice:\t Adding Device %s\n", newDevice->PATH, 0, 0, 0);
+	
+	return added;
 }
 
 bool bluetooth_device_remove_device_by_index(int index)
 {
-	Node * nodeToDelete = scanList(mHead,index);
+	bool removed = false;
+	
+	registry_write_begin();
+	Node * nodeToDelete = scanList(&mDevices,index);
 	
 	if(nodeToDelete != NULL)
 	{
-		if(deleteNode(&mHead,nodeToDelete->device.PATH))
+		if(deleteNode(&mDevices,nodeToDelete->device.PATH))
 		{
-			mNumberOfDevices--;		// decrement the number of devices
-			return true;
+			g_atomic_int_add(&mNumberOfDevices, -1);		// decrement the number of devices
+			removed = true;
 		}
 	}
+	registry_write_end();
 
-	return false;
+	return removed;
 }
 
 bool bluetooth_device_remove_device_by_path(const char * path)
 {
-	if(deleteNode(&mHead,path))
+	bool removed = false;
+	int adapter = bluetooth_device_get_adapter_index(path);
+	
+	registry_write_begin();
+	Node * dev = scanListByPath(&mDevices, path);
+	
+	if(dev != NULL)
 	{
-		mNumberOfDevices--;			// Decrement the number of devices
-		return true;
+		BluetoothDevice device = dev->device;
+		
+		/*1. Only this adapter lets go, the device stays while another adapter has it */
+		if(adapter >= 0)
+		{
+			device.ADAPTERS &= ~(1u << adapter);
+			device.ADAPTER_RSSI[adapter] = 0;
+		}
+		
+		if(device.ADAPTERS != 0)
+		{
+			bluetooth_device_pick_best_adapter(&device);
+			writeNode(dev, &device);
+			removed = true;
+		}
+		else if(deleteNode(&mDevices, path))
+		{
+			g_atomic_int_add(&mNumberOfDevices, -1);			// Decrement the number of devices
+			removed = true;
+		}
 	}
-	else
-		return false;
+	registry_write_end();
+	
+	return removed;
+}
+
+int bluetooth_device_remove_adapter(int adapterIndex)
+{
+	int removed;
+	
+	if(adapterIndex < 0 || adapterIndex >= BLUEZ_MAX_ADAPTERS)
+		return 0;
+	
+	registry_write_begin();
+	removed = removeNodesIf(&mDevices, bluetooth_device_release_adapter, GINT_TO_POINTER(adapterIndex));
+	g_atomic_int_add(&mNumberOfDevices, -removed);
+	registry_write_end();
+	
+	return removed;
 }
 
 bool bluetooth_device_remove_all_devices()
 {
-	if(clearList(&mHead))
-	{
-		mNumberOfDevices = 0;
-		return true;
-	}
+	bool removed;
 	
-	return false;
+	registry_write_begin();
+	removed = clearList(&mDevices);
+	if(removed)
+		g_atomic_int_set(&mNumberOfDevices, 0);
+	registry_write_end();
+	
+	return removed;
+}
+
+int bluetooth_device_remove_devices_if(bluetooth_device_filter filter, gpointer userData)
+{
+	int removed;
+	
+	// filter runs with the write lock held, it must not call back into the registry
+	registry_write_begin();
+	removed = removeNodesIf(&mDevices, filter, userData);
+	g_atomic_int_add(&mNumberOfDevices, -removed);
+	registry_write_end();
+	
+	return removed;
 }
 
 bool bluetooth_get_device_address_at_index(int index, char * addrContainer, bool deleteFlag)
 {
 	bool result = true;
 	
+	registry_write_begin();
+	
 	/*1. Grab the node with the device we want */
-	Node * dev = scanList(mHead,index);
+	Node * dev = scanList(&mDevices,index);
 	
 	if(dev != NULL)
 	{
-		strcpy(addrContainer, dev->device.PATH);
+		g_strlcpy(addrContainer, dev->device.PATH, BLUETOOTH_DEVICE_PATH_SIZE);
 		
 		if(deleteFlag)
-			if(deleteNode(&mHead, dev->device.PATH))
-				mNumberOfDevices--;
+			if(deleteNode(&mDevices, dev->device.PATH))
+				g_atomic_int_add(&mNumberOfDevices, -1);
 	}
 	else
 		result = false;
 	
+	registry_write_end();
+	
 	return result;
 	
 }	
 
 // functions to update the properties of a device
-bool bluetooth_device_property_add_service_UUID(const char * path, const char * uuid)
+guint bluetooth_device_update_properties(const char * path, GVariant * properties)
 {
-	g_print("***\t Device: Updating Property UUID\n"); 
-	Node *dev = scanListByPath(mHead, path);
+	guint dirty = 0;
+	BluetoothUuid uuids[MAX_NUMBER_UUIDS];
+	gint numberOfUuids = -1;			// -1 when the dictionary has no UUIDs
+	GVariant * value;
 	
-	if(dev == NULL)
-		return false;		// device does not exist
+	BLUEZ_LOG_DEBUG("***\t Device: Updating Properties %s\n", path, 0, 0, 0);
 	
-	/*1. Check if we have room to add this UUID */
-	if(dev->device.NUMBER_OF_UUIDS > MAX_NUMBER_UUIDS)
-		return false;
+	/*1. Interning may take the UUID table lock, do it before holding up the readers */
+	value = g_variant_lookup_value(properties, "UUIDs", G_VARIANT_TYPE_STRING_ARRAY);
+	if(value != NULL)
+	{
+		numberOfUuids = bluetooth_device_intern_uuids(path, value, uuids);
+		g_variant_unref(value);
+	}
 	
-	/*2. Check if the UUID already exists */
-	int i;
-	bool alreadyExists = false;
-	for(i = 0; i < dev->device.NUMBER_OF_UUIDS; i++)
+	/*2. One lookup and one registry update for the whole dictionary */
+	registry_write_begin();
+	Node *dev = scanListByPath(&mDevices, path);
+	
+	if(dev != NULL)
 	{
-		if(strcmp(dev->device.SERVICE_UUIDS[i], uuid) == 0)
+		BluetoothDevice device = dev->device;
+		gint16 rssi;
+		
+		dirty = bluez_property_table_apply(bluetooth_device_get_property_table(false), &device, properties);
+		if(numberOfUuids >= 0)
+			dirty |= bluetooth_device_replace_uuids(&device, uuids, (guint8)numberOfUuids);
+		
+		/*3. The table wrote the RSSI of this adapter, it only stays if this adapter is the best */
+		if(g_variant_lookup(properties, "RSSI", "n", &rssi))
 		{
-			alreadyExists = true;
-			break;
+			device.RSSI = dev->device.RSSI;
+			dirty = (dirty & ~BLUETOOTH_DEVICE_DIRTY_RSSI) | bluetooth_device_set_adapter_rssi(&device, path, rssi);
 		}
+		
+		writeNode(dev, &device);
 	}
 	
-	/*3. Add the UUID if it doesn't exist and update the UUID count */
-	if(!alreadyExists)
+	registry_write_end();
+	
+	return dirty;
+}
+
+bool bluetooth_device_property_add_service_UUID(const char * path, const char * uuid)
+{
+	BLUEZ_LOG_DEBUG("***\t Device: Updating Property UUID\n", 0, 0, 0, 0);
+	
+	// interning may take the UUID table lock, do it before holding up the readers
+	BluetoothUuid id = bluetooth_uuid_intern(uuid);
+	if(id == BLUETOOTH_UUID_INVALID)
+		return false;
+	
+	bool added = false;
+	
+	registry_write_begin();
+	Node *dev = scanListByPath(&mDevices, path);
+	
+	bool full = false;
+	
+	/*1. Check the device exists */
+	if(dev != NULL)
 	{
-		strcpy(dev->device.SERVICE_UUIDS[i],uuid);		// add the UUID
-		dev->device.NUMBER_OF_UUIDS += 1;				// Update the Count
-		return true;
+		/*2. Check if the UUID already exists, interned ids compare equal */
+		int i;
+		bool alreadyExists = false;
+		for(i = 0; i < dev->device.NUMBER_OF_UUIDS; i++)
+		{
+			if(dev->device.SERVICE_UUIDS[i] == id)
+			{
+				alreadyExists = true;
+				break;
+			}
+		}
+		
+		/*3. Add the UUID if it doesn't exist and there is room, update the UUID count */
+		full = !alreadyExists && dev->device.NUMBER_OF_UUIDS >= MAX_NUMBER_UUIDS;
+		if(!alreadyExists && !full)
+		{
+			BluetoothDevice device = dev->device;
+			
+			device.SERVICE_UUIDS[i] = id;					// add the UUID
+			device.NUMBER_OF_UUIDS += 1;					// Update the Count
+			writeNode(dev, &device);
+			added = true;
+		}
 	}
+	registry_write_end();
 	
-	return false;
+	if(full)
+		BLUEZ_LOG_WARN("***\t Device: %s holds %u UUIDs, %s is not kept\n", path, MAX_NUMBER_UUIDS, uuid, 0);
+	
+	return added;
 }
 
 bool bluetooth_device_property_update_connection(const char * path, bool isConnected)
 {
-	g_print("***\t Device: Updating Property Connection\n"); 
-	Node *dev = scanListByPath(mHead, path);
-	
-	if(dev == NULL)
-		return false;		// device does not exist
+	BLUEZ_LOG_DEBUG("***\t Device: Updating Property Connection\n", 0, 0, 0, 0);
+	registry_write_begin();
+	Node *dev = scanListByPath(&mDevices, path);
 	
 	// update the property
-	dev->device.CONNECTED = isConnected;
+	if(dev != NULL)
+	{
+		BluetoothDevice device = dev->device;
+		
+		device.CONNECTED = isConnected;
+		writeNode(dev, &device);
+	}
 	
-	return true;
+	registry_write_end();
+	
+	return dev != NULL;		// false if device does not exist
 }
 
 bool bluetooth_device_property_update_paired(const char * path, bool isPaired)
 {
-	g_print("***\t Device: Updating Property Paired\n"); 
-	Node *dev = scanListByPath(mHead, path);
-	
-	if(dev == NULL)
-		return false;		// device does not exist
+	BLUEZ_LOG_DEBUG("***\t Device: Updating Property Paired\n", 0, 0, 0, 0);
+	registry_write_begin();
+	Node *dev = scanListByPath(&mDevices, path);
 	
 	// update the property
-	dev->device.PAIRED = isPaired;
+	if(dev != NULL)
+	{
+		BluetoothDevice device = dev->device;
+		
+		device.PAIRED = isPaired;
+		writeNode(dev, &device);
+	}
 	
-	return true;
+	registry_write_end();
+	
+	return dev != NULL;		// false if device does not exist
 }
 
 bool bluetooth_device_property_update_trusted(const char * path, bool isTrusted)
 {
-	g_print("***\t Device: Updating Property Trusted\n"); 
-	Node *dev = scanListByPath(mHead, path);
-	
-	if(dev == NULL)
-		return false;		// device does not exist
+	BLUEZ_LOG_DEBUG("***\t Device: Updating Property Trusted\n", 0, 0, 0, 0);
+	registry_write_begin();
+	Node *dev = scanListByPath(&mDevices, path);
 	
 	// update the property
-	dev->device.TRUSTED = isTrusted;
+	if(dev != NULL)
+	{
+		BluetoothDevice device = dev->device;
+		
+		device.TRUSTED = isTrusted;
+		writeNode(dev, &device);
+	}
 	
-	return true;
+	registry_write_end();
+	
+	return dev != NULL;		// false if device does not exist
 }
 
 bool bluetooth_device_property_update_RSSI(const char * path, gint16 rssi)
 {
-	g_print("***\t Device: Updating Property RSSI\n"); 
-	Node *dev = scanListByPath(mHead, path);
-	
-	if(dev == NULL)
-		return false;		// device does not exist
+	BLUEZ_LOG_DEBUG("***\t Device: Updating Property RSSI\n", 0, 0, 0, 0);
+	registry_write_begin();
+	Node *dev = scanListByPath(&mDevices, path);
 	
 	// update the property
-	dev->device.RSSI = rssi;
+	if(dev != NULL)
+	{
+		BluetoothDevice device = dev->device;
+		
+		bluetooth_device_set_adapter_rssi(&device, path, rssi);
+		writeNode(dev, &device);
+	}
 	
-	return true;
+	registry_write_end();
+	
+	return dev != NULL;		// false if device does not exist
+}
+
+guint bluetooth_device_property_update_RSSI_batch(const char * const * paths, const gint16 * rssi, guint count)
+{
+	guint updated = 0;
+	guint i;
+	
+	/*1. One registry update for every device of the batch */
+	registry_write_begin();
+	
+	for(i = 0; i < count; i++)
+	{
+		Node *dev = scanListByPath(&mDevices, paths[i]);
+		BluetoothDevice device;
+		
+		if(dev == NULL)
+			continue;
+		
+		// the RSSI of an adapter that is not the best changes too, it is stored either way
+		device = dev->device;
+		if(bluetooth_device_set_adapter_rssi(&device, paths[i], rssi[i]))
+			updated++;
+		writeNode(dev, &device);
+	}
+	
+	registry_write_end();
+	
+	return updated;
 }
 
 bool bluetooth_device_property_update_alias(const char * path, const char * name)
 {
-	g_print("***\t Device: Updating Property Alias\n"); 
-	Node *dev = scanListByPath(mHead, path);
+	BLUEZ_LOG_DEBUG("***\t Device: Updating Property Alias\n", 0, 0, 0, 0);
 	
-	if(dev == NULL)
-		return false;		// device does not exist
+	registry_write_begin();
+	Node *dev = scanListByPath(&mDevices, path);
 	
 	// update the property
-	strcpy(dev->device.ALIAS,name);
+	if(dev != NULL)
+	{
+		BluetoothDevice device = dev->device;
+		
+		g_strlcpy(device.ALIAS, name, sizeof(device.ALIAS));
+		writeNode(dev, &device);
+	}
 	
-	return true;
+	registry_write_end();
+	
+	return dev != NULL;		// false if device does not exist
 }
 
 bool bluetooth_device_property_update_address(const char *path, const char * address)
 {
-	g_print("***\t Device: Updating Property Address\n"); 
-	Node *dev = scanListByPath(mHead, path);
+	BLUEZ_LOG_DEBUG("***\t Device: Updating Property Address\n", 0, 0, 0, 0);
+	guint64 value;
+	
+	if(!bluetooth_device_parse_address(address, &value))
+		return false;		// malformed address
 	
-	if(dev == NULL)
-		return false;		// device does not exist
+	registry_write_begin();
+	Node *dev = scanListByPath(&mDevices, path);
 	
 	// update the property
-	strcpy(dev->device.MAC_ADDRESS,address);
+	if(dev != NULL)
+	{
+		BluetoothDevice device = dev->device;
+		
+		device.MAC_ADDRESS = value;
+		writeNode(dev, &device);
+	}
 	
-	return true;
+	registry_write_end();
+	
+	return dev != NULL;		// false if device does not exist
 }
 
 /*
 * Private Functions
 */
+static void registry_write_begin(void)
+{
+	g_mutex_lock(&mWriteLock);
+	g_atomic_int_inc(&mSequence);
+	
+	// the odd sequence must be visible before any change to the registry
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void registry_write_end(void)
+{
+	// the increment is a full barrier, every change is visible before the even sequence
+	g_atomic_int_inc(&mSequence);
+	g_mutex_unlock(&mWriteLock);
+}
+
+static guint registry_read_begin(void)
+{
+	return g_atomic_int_get(&mSequence);
+}
+
+static bool registry_read_retry(guint sequence)
+{
+	// keep the loads of the copy from moving after the second read of the sequence
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	
+	return (sequence & 1) || g_atomic_int_get(&mSequence) != sequence;
+}
+
+/*
+ * withUuids false leaves out the last entry, UUIDs, for the registry writer
+*/
+static BluezPropertyTable * bluetooth_device_get_property_table(bool withUuids)
+{
+	static BluezPropertyTable * table = NULL;
+	static BluezPropertyTable * tableWithoutUuids = NULL;
+	
+	// built once, by whichever thread applies properties first
+	if(withUuids)
+	{
+		if(g_once_init_enter(&table))
+			g_once_init_leave(&table, bluez_property_table_new(mDeviceProperties, G_N_ELEMENTS(mDeviceProperties)));
+		
+		return table;
+	}
+	
+	if(g_once_init_enter(&tableWithoutUuids))
+		g_once_init_leave(&tableWithoutUuids, bluez_property_table_new(mDeviceProperties, G_N_ELEMENTS(mDeviceProperties) - 1));
+	
+	return tableWithoutUuids;
+}
+
+static guint bluetooth_device_set_alias(gpointer device, GVariant * value)
+{
+	BluetoothDevice * dev = device;
+	const char * alias = g_variant_get_string(value, NULL);
+	
+	// compared as far as it is kept, a long name that only changed past the cut is not a change
+	if(strncmp(dev->ALIAS, alias, sizeof(dev->ALIAS) - 1) == 0)
+		return 0;
+	
+	g_strlcpy(dev->ALIAS, alias, sizeof(dev->ALIAS));
+	return BLUETOOTH_DEVICE_DIRTY_ALIAS;
+}
+
+static guint bluetooth_device_set_address(gpointer device, GVariant * value)
+{
+	BluetoothDevice * dev = device;
+	guint64 address;
+	
+	if(!bluetooth_device_parse_address(g_variant_get_string(value, NULL), &address) || dev->MAC_ADDRESS == address)
+		return 0;
+	
+	dev->MAC_ADDRESS = address;
+	return BLUETOOTH_DEVICE_DIRTY_ADDRESS;
+}
+
+static guint bluetooth_device_set_rssi(gpointer device, GVariant * value)
+{
+	BluetoothDevice * dev = device;
+	gint16 rssi = g_variant_get_int16(value);
+	
+	if(dev->RSSI == rssi)
+		return 0;
+	
+	dev->RSSI = rssi;
+	return BLUETOOTH_DEVICE_DIRTY_RSSI;
+}
+
+static guint bluetooth_device_set_paired(gpointer device, GVariant * value)
+{
+	return bluetooth_device_set_flag(&((BluetoothDevice *)device)->PAIRED, value, BLUETOOTH_DEVICE_DIRTY_PAIRED);
+}
+
+static guint bluetooth_device_set_connected(gpointer device, GVariant * value)
+{
+	return bluetooth_device_set_flag(&((BluetoothDevice *)device)->CONNECTED, value, BLUETOOTH_DEVICE_DIRTY_CONNECTED);
+}
+
+static guint bluetooth_device_set_trusted(gpointer device, GVariant * value)
+{
+	return bluetooth_device_set_flag(&((BluetoothDevice *)device)->TRUSTED, value, BLUETOOTH_DEVICE_DIRTY_TRUSTED);
+}
+
+static guint bluetooth_device_set_uuids(gpointer device, GVariant * value)
+{
+	BluetoothUuid uuids[MAX_NUMBER_UUIDS];
+	guint8 count = bluetooth_device_intern_uuids(((BluetoothDevice *)device)->PATH, value, uuids);
+	
+	return bluetooth_device_replace_uuids(device, uuids, count);
+}
+
+/*
+ * Interns an as of UUIDs of the device at path into uuids, which holds MAX_NUMBER_UUIDS, returns how many it holds
+*/
+static guint8 bluetooth_device_intern_uuids(const char * path, GVariant * value, BluetoothUuid * uuids)
+{
+	GVariantIter iter;
+	const char * uuid;
+	guint8 count = 0;
+	
+	// bluez always sends the whole list
+	g_variant_iter_init(&iter, value);
+	while(count < MAX_NUMBER_UUIDS && g_variant_iter_next(&iter, "&s", &uuid))
+	{
+		uuids[count] = bluetooth_uuid_intern(uuid);
+		if(uuids[count] != BLUETOOTH_UUID_INVALID)
+			count++;
+	}
+	
+	if(count == MAX_NUMBER_UUIDS && g_variant_n_children(value) > MAX_NUMBER_UUIDS)
+		BLUEZ_LOG_WARN("***\t Device: %s has %u UUIDs, only the first %u are kept\n", path,
+				(guint)g_variant_n_children(value), MAX_NUMBER_UUIDS, 0);
+	
+	return count;
+}
+
+static guint bluetooth_device_replace_uuids(BluetoothDevice * device, const BluetoothUuid * uuids, guint8 count)
+{
+	// only if it is different
+	if(count == device->NUMBER_OF_UUIDS && memcmp(uuids, device->SERVICE_UUIDS, count * sizeof(BluetoothUuid)) == 0)
+		return 0;
+	
+	memcpy(device->SERVICE_UUIDS, uuids, count * sizeof(BluetoothUuid));
+	device->NUMBER_OF_UUIDS = count;
+	return BLUETOOTH_DEVICE_DIRTY_UUIDS;
+}
+
+static guint bluetooth_device_set_flag(bool * field, GVariant * value, guint dirty)
+{
+	bool state = g_variant_get_boolean(value);
+	
+	if(*field == state)
+		return 0;
+	
+	*field = state;
+	return dirty;
+}
+
+static guint bluetooth_device_set_adapter_rssi(BluetoothDevice * device, const char * path, gint16 rssi)
+{
+	int adapter = bluetooth_device_get_adapter_index(path);
+	gint16 previous = device->RSSI;
+	
+	/*1. A path without an adapter can only be the device itself */
+	if(adapter < 0)
+	{
+		device->RSSI = rssi;
+		return previous != rssi ? BLUETOOTH_DEVICE_DIRTY_RSSI : 0;
+	}
+	
+	device->ADAPTERS |= 1u << adapter;
+	device->ADAPTER_RSSI[adapter] = rssi;
+	
+	/*2. RSSI always follows the best adapter */
+	bluetooth_device_pick_best_adapter(device);
+	
+	return previous != device->RSSI ? BLUETOOTH_DEVICE_DIRTY_RSSI : 0;
+}
+
+static void bluetooth_device_pick_best_adapter(BluetoothDevice * device)
+{
+	int best = -1;
+	int i;
+	const char * key;
+	char path[BLUETOOTH_DEVICE_PATH_SIZE];
+	
+	// 0 is no RSSI yet, any adapter that reported one is better
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+	{
+		if(!(device->ADAPTERS & (1u << i)))
+			continue;
+		
+		if(best < 0 || (device->ADAPTER_RSSI[best] == 0 && device->ADAPTER_RSSI[i] != 0) ||
+			(device->ADAPTER_RSSI[i] != 0 && device->ADAPTER_RSSI[i] > device->ADAPTER_RSSI[best]))
+			best = i;
+	}
+	
+	if(best < 0)
+		return;
+	
+	device->RSSI = device->ADAPTER_RSSI[best];
+	
+	if(best == device->BEST_ADAPTER && bluetooth_device_get_adapter_index(device->PATH) == best)
+		return;
+	
+	/*1. Move the path below the new adapter, the registry key is the part after it and does not change */
+	device->BEST_ADAPTER = best;
+	key = strrchr(device->PATH, '/');
+	snprintf(path, sizeof(path), BLUEZ_HCI_PATH_PREFIX "%d%s", best, key != NULL ? key : "");
+	memcpy(device->PATH, path, sizeof(path));
+}
+
+static bool bluetooth_device_release_adapter(BluetoothDevice * device, gpointer userData)
+{
+	int adapter = GPOINTER_TO_INT(userData);
+	
+	if(!(device->ADAPTERS & (1u << adapter)))
+		return false;
+	
+	device->ADAPTERS &= ~(1u << adapter);
+	device->ADAPTER_RSSI[adapter] = 0;
+	
+	if(device->ADAPTERS == 0)
+		return true;
+	
+	bluetooth_device_pick_best_adapter(device);
+	
+	return false;
+}
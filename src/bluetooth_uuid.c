@@ -0,0 +1,152 @@
+/**
+	* @file bluetooth_uuid.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the process wide UUID intern table
+	*
+	*	- Ids are indexes into a fixed array that is never reallocated, so readers can
+	*	  look up an id without taking the lock. Only adding a UUID is serialized.
+	*/
+
+#include <stdio.h>
+
+#include "bluetooth_uuid.h"
+
+/*
+ * Private Function Declerations
+*/
+static bool bluetooth_uuid_parse(const char * uuid, guint8 * value);
+static guint bluetooth_uuid_hash(gconstpointer value);
+static gboolean bluetooth_uuid_equal(gconstpointer a, gconstpointer b);
+
+/*
+ * Private Variables
+*/
+static guint8 mUuids[MAX_NUMBER_INTERNED_UUIDS][16];	// id 0 is BLUETOOTH_UUID_INVALID and never used
+static guint mNumberOfUuids = 1;
+static GHashTable * mUuidIndex = NULL;					// binary value -> id
+static GMutex mUuidLock;
+
+BluetoothUuid bluetooth_uuid_intern(const char * uuid)
+{
+	guint8 value[16];
+	gpointer id;
+	BluetoothUuid result = BLUETOOTH_UUID_INVALID;
+
+	if(uuid == NULL || !bluetooth_uuid_parse(uuid, value))
+		return BLUETOOTH_UUID_INVALID;
+
+	g_mutex_lock(&mUuidLock);
+
+	if(mUuidIndex == NULL)
+		mUuidIndex = g_hash_table_new(bluetooth_uuid_hash, bluetooth_uuid_equal);
+
+	/*1. Already interned? */
+	id = g_hash_table_lookup(mUuidIndex, value);
+	if(id != NULL)
+		result = GPOINTER_TO_UINT(id);
+
+	/*2. Add it if there is room */
+	else if(mNumberOfUuids < MAX_NUMBER_INTERNED_UUIDS)
+	{
+		result = mNumberOfUuids;
+		memcpy(mUuids[result], value, sizeof(value));
+		g_hash_table_insert(mUuidIndex, mUuids[result], GUINT_TO_POINTER(result));
+
+		// publish the entry only after it is written, readers check the count
+		g_atomic_int_set(&mNumberOfUuids, mNumberOfUuids + 1);
+	}
+	else
+		g_print("UUID table is full, dropping %s\n", uuid);
+
+	g_mutex_unlock(&mUuidLock);
+
+	return result;
+}
+
+BluetoothUuid bluetooth_uuid_lookup(const char * uuid)
+{
+	guint8 value[16];
+	gpointer id = NULL;
+
+	if(uuid == NULL || !bluetooth_uuid_parse(uuid, value))
+		return BLUETOOTH_UUID_INVALID;
+
+	g_mutex_lock(&mUuidLock);
+	if(mUuidIndex != NULL)
+		id = g_hash_table_lookup(mUuidIndex, value);
+	g_mutex_unlock(&mUuidLock);
+
+	return GPOINTER_TO_UINT(id);
+}
+
+const guint8 * bluetooth_uuid_get_value(BluetoothUuid id)
+{
+	if(id == BLUETOOTH_UUID_INVALID || id >= (guint)g_atomic_int_get(&mNumberOfUuids))
+		return NULL;
+
+	return mUuids[id];
+}
+
+bool bluetooth_uuid_to_string(BluetoothUuid id, char * str)
+{
+	const guint8 * v = bluetooth_uuid_get_value(id);
+
+	if(v == NULL)
+		return false;
+
+	sprintf(str, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+			v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
+			v[8], v[9], v[10], v[11], v[12], v[13], v[14], v[15]);
+
+	return true;
+}
+
+/*
+ * Private Functions
+*/
+static bool bluetooth_uuid_parse(const char * uuid, guint8 * value)
+{
+	int i;
+	int byte = 0;
+
+	for(i = 0; i < UUID_STRING_SIZE - 1; i++)
+	{
+		// dashes are expected after 8, 12, 16 and 20 hex digits
+		if(i == 8 || i == 13 || i == 18 || i == 23)
+		{
+			if(uuid[i] != '-')
+				return false;
+			continue;
+		}
+
+		int high = g_ascii_xdigit_value(uuid[i]);
+		int low = high < 0 ? -1 : g_ascii_xdigit_value(uuid[i + 1]);
+
+		if(low < 0)
+			return false;
+
+		value[byte++] = (guint8)((high << 4) | low);
+		i++;
+	}
+
+	return uuid[UUID_STRING_SIZE - 1] == '\0';
+}
+
+static guint bluetooth_uuid_hash(gconstpointer value)
+{
+	// FNV-1a over the 16 bytes
+	const guint8 * v = value;
+	guint hash = 2166136261u;
+	int i;
+
+	for(i = 0; i < 16; i++)
+		hash = (hash ^ v[i]) * 16777619u;
+
+	return hash;
+}
+
+static gboolean bluetooth_uuid_equal(gconstpointer a, gconstpointer b)
+{
+	return memcmp(a, b, 16) == 0;
+}
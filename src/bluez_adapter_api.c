@@ -8,6 +8,8 @@
 	* 	  appeared in /org/hciX/dev_XX_YY_ZZ_AA_BB_CC, it is monitered using "InterfaceAdded"
 	*	  signal and all the properties of the device are printed
 	*	- Once a device is found a bluetooth_device is created which stores alot of properties aboutthe remote device
+	*	- Adapters live in mAdapters indexed by N of hciN. The *_all functions send one command per adapter on a
+	*	  private GMainContext and only then wait, the round trips overlap instead of adding up.
 	*	  
 	*	- Required flags, and libs for compiling
 	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
@@ -17,15 +19,24 @@
 #include "bluez_adapter_api.h"
 #include "bluez_dbus_names.h"		// holds defines for bluez bus name and interfaces
 #include "bluetooth_device.h"		// holds information about remote devices discovered during scan
+#include "bluez_match_rule.h"
+#include "bluez_signal_router.h"
+#include "bluez_rssi_coalescer.h"
+#include "bluez_command.h"
+#include "bluez_object_manager_api.h"
+#include "bluez_event_queue.h"
+#include "bluez_advertisement.h"
+#include "bluez_log.h"
 
 /**
 * Private Variable Declerations
 **/
 static GDBusConnection *mCon;
-static bool mAdapterOn = false;
+static BluezAdapter mAdapters[BLUEZ_MAX_ADAPTERS];		// indexed by N of hciN
+static DiscoveryFilter mFilter;							// what every scan starts with, see bluez_adapter_set_filter_all
+static bool mFilterSet = false;
 
 // GDBUS signals
-static guint prop_changed;
 static guint iface_added;
 static guint iface_removed;
 
@@ -33,13 +44,7 @@ static guint iface_removed;
 /**
 * Private Function Declerations
 **/
-static void bluez_signal_adapter_changed(GDBusConnection *conn,
-					const gchar *sender,
-					const gchar *path,
-					const gchar *interface,
-					const gchar *signal,
-					GVariant *params,
-					void *userdata);
+static void bluez_signal_adapter_changed(const char *path, GVariant *changed, GVariant *invalidated, gpointer userdata);
 static void bluez_device_appeared(GDBusConnection *sig,
 				const gchar *sender_name,
 				const gchar *object_path,
@@ -54,53 +59,38 @@ static void bluez_device_disappeared(GDBusConnection *sig,
 				const gchar *signal_name,
 				GVariant *parameters,
 				gpointer user_data);
-static int bluez_adapter_call_method( const char *method, GVariant *param);
-static int bluez_adapter_call_method_callback(const char *method, GVariant *param,  bluez_call_method_callback callback);
-static int bluez_adapter_set_property(const char *prop, GVariant *value);
-static void bluez_get_discovery_filter_cb(GObject *con,GAsyncResult *res,gpointer data);
-static void bluez_property_value(const gchar *key, GVariant *value, BluetoothDevice * device);
+static int bluez_adapter_call_method(BluezAdapter * adapter, const char *method, GVariant *param);
+static int bluez_adapter_set_property(BluezAdapter * adapter, const char *prop, GVariant *value);
+static guint8 bluez_adapter_call_all(guint8 adapters, const char * interface, const char * method, GVariant * param);
+static guint8 bluez_adapter_mask(bool powered);
+static void bluez_adapter_mark_powered(guint8 adapters, bool powered);
+static int bluez_adapter_count(guint8 adapters);
+static void bluez_adapter_removed(const char * path);
+static GVariant * bluez_adapter_build_filter(DiscoveryFilter * filterSettings);
+static void bluez_adapter_default_filter(DiscoveryFilter * filter);
+static void bluez_get_discovery_filter_cb(BluezCommand * command, gpointer data);
+static void bluez_property_value(const gchar *key, GVariant *value);
+static bool bluez_property_print_payload(const BluezAdvertisementView * view, gpointer userData);
+static bool bluez_adapter_release_unpaired_device(BluetoothDevice * device, gpointer userData);
 
 /** 
 * Modifiers
 **/
 
-bool bluez_adapter_set_filter_default(void)
+bool bluez_adapter_set_filter_default(BluezAdapter * adapter)
 {
 	DiscoveryFilter filter;
 	
+	bluez_adapter_default_filter(&filter);
 	
-	filter.RSSI = -100;
-	strcpy(filter.TRANSPORT,"auto");
-	filter.DUPLICATE_DATA = true;
-	
-	// add the UUID's we want to filter for
-	strcpy(filter.UUID_ARRAY[0], UUID_AUDIO_SOURCE);
-	filter.NUM_OF_UUIDS = 1;
-	
-	g_print("Filter UUID: %s", filter.UUID_ARRAY[0]);
-	
-	return bluez_adapter_set_filter(&filter);
+	return bluez_adapter_set_filter(adapter, &filter);
 }
 
-bool bluez_adapter_set_filter(DiscoveryFilter * filterSettings)
+bool bluez_adapter_set_filter(BluezAdapter * adapter, DiscoveryFilter * filterSettings)
 {
 	int rc;
-	int i;
-	GVariantBuilder *b = g_variant_builder_new(G_VARIANT_TYPE_VARDICT);
-	g_variant_builder_add(b, "{sv}", "Transport", g_variant_new_string(filterSettings->TRANSPORT));
-	g_variant_builder_add(b, "{sv}", "RSSI", g_variant_new_int16(filterSettings->RSSI));
-	g_variant_builder_add(b, "{sv}", "DuplicateData", g_variant_new_boolean(filterSettings->DUPLICATE_DATA));
-
-	GVariantBuilder *u = g_variant_builder_new(G_VARIANT_TYPE_STRING_ARRAY);
-	for(i = 0; i < filterSettings->NUM_OF_UUIDS; i++)
-		g_variant_builder_add(u, "s", filterSettings->UUID_ARRAY[i]);
 	
-	g_variant_builder_add(b, "{sv}", "UUIDs", g_variant_builder_end(u));
-
-	GVariant *device_dict = g_variant_builder_end(b);
-	g_variant_builder_unref(u);
-	g_variant_builder_unref(b);
-	rc = bluez_adapter_call_method("SetDiscoveryFilter", g_variant_new_tuple(&device_dict, 1));
+	rc = bluez_adapter_call_method(adapter, "SetDiscoveryFilter", bluez_adapter_build_filter(filterSettings));
 	
 	if(rc) {
 		g_print("Not able to set discovery filter\n");
@@ -130,107 +120,172 @@ int bluez_adapter_init(GDBusConnection * conn)
 
 void bluez_adapter_deinit()
 {
+	GPtrArray * paths;
+	guint i;
 	
 	g_print("Adapter Deinitializing...\n");
 	
-	if(!mAdapterOn)
+	if(bluez_adapter_mask(true) == 0)
 		return;
 	
 	bluez_adapter_mute_signals();
 	
-	int numberDevices = bluetooth_device_get_number_devices();
-	int i;
-	char objectPath[MAX_DEVICE_STRING_LEN];
-	BluetoothDevice * device;
+	paths = g_ptr_array_new_with_free_func(g_free);
 	
-	for(i = 1; i <= numberDevices; i++)
-	{
-		// grab the device from the linked list
-		device = bluetooth_get_device_at_index(i);
-		
-		if(device != NULL)
-		{
-			// dont remove the device if we paired with it
-			if(!device->PAIRED)
-			{
-				strcpy(objectPath, device->PATH);
-				
-				// remove the device from the adapter
-				bluez_adapter_remove_device_found(objectPath);
-				
-				bluetooth_device_remove_device_by_index(i);
-			}
-		}
-		
-		
-	}
+	/*1. One pass over the device list, dont remove the devices we paired with, remember what bluez should forget */
+	bluetooth_device_remove_devices_if(bluez_adapter_release_unpaired_device, paths);
+	
+	/*2. The registry is unlocked again, now the blocking RemoveDevice calls */
+	for(i = 0; i < paths->len; i++)
+		bluez_adapter_remove_device_found(g_ptr_array_index(paths, i));
 	
-	bluez_adapter_power_off();
+	g_ptr_array_free(paths, TRUE);
+	
+	bluez_adapter_power_off_all();
 
 }
 
-bool bluez_adapter_power_on(bool setPairable)
+bool bluez_adapter_power_on(BluezAdapter * adapter, bool setPairable)
 {
 	int rc = 0;
 	bool ret = true;
 	
-	if(mAdapterOn)
+	if(adapter->POWERED)
 		return true;
 	
-	rc  = bluez_adapter_set_property("Powered", g_variant_new("b", TRUE));
+	rc  = bluez_adapter_set_property(adapter, "Powered", g_variant_new("b", TRUE));
 	
 	if(rc) {
 		g_print("Not able to Power on the adapter\n");
 		bluez_adapter_mute_signals();
-		mAdapterOn = false;
+		adapter->POWERED = false;
 		ret = false;
 	}
 	
-	mAdapterOn = true;
-	g_print("Adapter is Powered On!\n");
+	adapter->POWERED = true;
+	g_print("Adapter %s is Powered On!\n", adapter->PATH);
 	
 	if(setPairable)
-		return bluez_adapter_pairable(setPairable);
+		return bluez_adapter_pairable(adapter, setPairable);
 	else
 		return ret;
 }	
 
-bool bluez_adapter_power_off(void)
+bool bluez_adapter_power_off(BluezAdapter * adapter)
 {
 	int rc = 0;
 	bool ret = true;
 	
-	if(!mAdapterOn)
+	if(!adapter->POWERED)
 		return true;
 	
-	rc = bluez_adapter_set_property("Powered", g_variant_new("b", FALSE));
+	rc = bluez_adapter_set_property(adapter, "Powered", g_variant_new("b", FALSE));
 	
 	if(rc)
 	{
 		g_print("Not able to Power off the adapter\n");
-		mAdapterOn = false;
+		adapter->POWERED = false;
 		ret = false;
 	}
 	
-	mAdapterOn = false;
+	adapter->POWERED = false;
 	
 	return ret;
 }
 
-bool bluez_adapter_scan_on(void)
+int bluez_adapter_power_on_all(bool setPairable)
+{
+	guint8 powered;
+	
+	/*1. Every adapter that is off, all at once */
+	powered = bluez_adapter_call_all(bluez_adapter_mask(false),
+					"org.freedesktop.DBus.Properties",
+					"Set",
+					g_variant_new("(ssv)", BLUEZ_ADAPTER_INTERFACE, "Powered", g_variant_new_boolean(TRUE)));
+	bluez_adapter_mark_powered(powered, true);
+	
+	g_print("%d Adapter(s) Powered On!\n", bluez_adapter_count(bluez_adapter_mask(true)));
+	
+	/*2. Pairable on every powered adapter, including the ones that were on already */
+	if(setPairable)
+		bluez_adapter_call_all(bluez_adapter_mask(true),
+					"org.freedesktop.DBus.Properties",
+					"Set",
+					g_variant_new("(ssv)", BLUEZ_ADAPTER_INTERFACE, "Pairable", g_variant_new_boolean(TRUE)));
+	
+	return bluez_adapter_count(bluez_adapter_mask(true));
+}
+
+int bluez_adapter_power_off_all(void)
+{
+	guint8 off;
+	
+	off = bluez_adapter_call_all(bluez_adapter_mask(true),
+					"org.freedesktop.DBus.Properties",
+					"Set",
+					g_variant_new("(ssv)", BLUEZ_ADAPTER_INTERFACE, "Powered", g_variant_new_boolean(FALSE)));
+	bluez_adapter_mark_powered(off, false);
+	
+	return bluez_adapter_count(off);
+}
+
+int bluez_adapter_scan_on_all(void)
+{
+	DiscoveryFilter filter;
+	guint8 adapters = bluez_adapter_mask(true);
+	guint8 scanning;
+	
+	printf("Starting Scan on %d Adapter(s)...\n", bluez_adapter_count(adapters));
+	
+	/*1. Same filter on every adapter, then start them together */
+	bluez_adapter_get_filter(&filter);
+	adapters = bluez_adapter_call_all(adapters, BLUEZ_ADAPTER_INTERFACE, "SetDiscoveryFilter", bluez_adapter_build_filter(&filter));
+	scanning = bluez_adapter_call_all(adapters, BLUEZ_ADAPTER_INTERFACE, "StartDiscovery", NULL);
+	
+	return bluez_adapter_count(scanning);
+}
+
+int bluez_adapter_set_filter_all(DiscoveryFilter * filter)
+{
+	guint8 adapters;
+	
+	mFilter = *filter;
+	mFilterSet = true;
+	
+	// bluez takes a new filter while discovering, the scan goes on with it
+	adapters = bluez_adapter_call_all(bluez_adapter_mask(true), BLUEZ_ADAPTER_INTERFACE, "SetDiscoveryFilter", bluez_adapter_build_filter(filter));
+	
+	return bluez_adapter_count(adapters);
+}
+
+int bluez_adapter_scan_off_all(void)
+{
+	guint8 stopped;
+	
+	printf("Stopping Scan...\n");
+	
+	stopped = bluez_adapter_call_all(bluez_adapter_mask(true), BLUEZ_ADAPTER_INTERFACE, "StopDiscovery", NULL);
+	
+	return bluez_adapter_count(stopped);
+}
+
+bool bluez_adapter_scan_on(BluezAdapter * adapter)
 {
+	DiscoveryFilter filter;
 	int rc = 0;
 	bool ret = true;
 	
-	bluez_adapter_print_filter_settings();
+	bluez_adapter_print_filter_settings(adapter);
 	
-	bluez_adapter_set_filter_default();
+	// the filter every scan starts with, like bluez_adapter_scan_on_all
+	bluez_adapter_get_filter(&filter);
+	bluez_adapter_set_filter(adapter, &filter);
 	
-	bluez_adapter_print_filter_settings();
+	bluez_adapter_print_filter_settings(adapter);
 	
 	printf("Starting Scan...\n");
 	
-	rc = bluez_adapter_call_method("StartDiscovery",NULL);
+	rc = bluez_adapter_call_method(adapter, "StartDiscovery",NULL);
 	if(rc) {
 		g_print("Not able to scan for new devices\n");
 		bluez_adapter_mute_signals();
@@ -240,33 +295,31 @@ bool bluez_adapter_scan_on(void)
 	return ret;
 }
 
-bool bluez_adapter_scan_off(void)
+bool bluez_adapter_scan_off(BluezAdapter * adapter)
 {
 	int rc = 0;
 	bool ret = true;
 	
 	printf("Stopping Scan...\n");
 	
-	rc = bluez_adapter_call_method("StopDiscovery",NULL);
+	rc = bluez_adapter_call_method(adapter, "StopDiscovery",NULL);
 	if(rc)
 	{
 		g_print("Not able to stop scanning\n");
 		ret = false;
 	}
-	
-	g_usleep(100);
 
 	return ret;
 }
 
-bool bluez_adapter_pairable(bool value)
+bool bluez_adapter_pairable(BluezAdapter * adapter, bool value)
 {
 	int rc = 0;
 	bool ret = true;
 	
 	g_print("Adapter Pairable set to: \"%s\"\n", value ? "True" : "False");
 	
-	rc = bluez_adapter_set_property("Pairable", g_variant_new("b", value));
+	rc = bluez_adapter_set_property(adapter, "Pairable", g_variant_new("b", value));
 	
 	if(rc) {
 			g_print("Not able to set adapter pairable\n");
@@ -278,83 +331,173 @@ bool bluez_adapter_pairable(bool value)
 
 void bluez_adapter_init_signals(void)
 {
-	prop_changed = g_dbus_connection_signal_subscribe(mCon,
-						BLUEZ_BUS_NAME,						// defined in bluez_dbus_names.h
-						"org.freedesktop.DBus.Properties",
-						"PropertiesChanged",
-						NULL,
-						BLUEZ_ADAPTER_INTERFACE,			// defined in bluez_dbus_names.h
-						G_DBUS_SIGNAL_FLAGS_NONE,
-						bluez_signal_adapter_changed,
-						NULL,
-						NULL);
-
-	iface_added = g_dbus_connection_signal_subscribe(mCon,
-							BLUEZ_BUS_NAME,							// defined in bluez_dbus_names.h
-							"org.freedesktop.DBus.ObjectManager",
+	// every adapter and the objects below them, the daemon drops everything else
+	bluez_signal_router_register(BLUEZ_ADAPTER_INTERFACE, BLUEZ_BASE_PATH, bluez_signal_adapter_changed, NULL);
+
+	// ObjectManager signals come from the root, arg0 is the object path so match on it
+	iface_added = bluez_match_rule_subscribe(OBJECT_MANAGER_INTERFACE,
 							"InterfacesAdded",
 							NULL,
-							NULL,
-							G_DBUS_SIGNAL_FLAGS_NONE,
+							BLUEZ_BASE_PATH "/",				// adapters and every object below them
+							G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH,
 							bluez_device_appeared,
-							NULL,
 							NULL);
 
-	iface_removed = g_dbus_connection_signal_subscribe(mCon,
-							BLUEZ_BUS_NAME,							// defined in bluez_dbus_names.h
-							"org.freedesktop.DBus.ObjectManager",
+	iface_removed = bluez_match_rule_subscribe(OBJECT_MANAGER_INTERFACE,
 							"InterfacesRemoved",
 							NULL,
-							NULL,
-							G_DBUS_SIGNAL_FLAGS_NONE,
+							BLUEZ_BASE_PATH "/",				// adapters and every object below them
+							G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH,
 							bluez_device_disappeared,
-							NULL,
 							NULL);
 }
 
 void bluez_adapter_mute_signals(void)
 {
-	g_dbus_connection_signal_unsubscribe(mCon, prop_changed);
-	g_dbus_connection_signal_unsubscribe(mCon, iface_added);
-	g_dbus_connection_signal_unsubscribe(mCon, iface_removed);
+	bluez_signal_router_unregister(BLUEZ_ADAPTER_INTERFACE);
+	bluez_match_rule_unsubscribe(iface_added);
+	bluez_match_rule_unsubscribe(iface_removed);
+	iface_added = iface_removed = 0;
 }
 
 void bluez_adapter_remove_device_found(const char * objectPath)
 {
+	BluezAdapter * adapter = bluez_adapter_get_by_path(objectPath);
 	
 	g_print("Removing device %s\n",objectPath);
+	
+	// only the adapter the path is below knows the device by that path
+	if(adapter == NULL)
+	{
+		g_print("No adapter for %s\n", objectPath);
+		return;
+	}
 		
-	bluez_adapter_call_method("RemoveDevice", g_variant_new("(o)", objectPath));
+	bluez_adapter_call_method(adapter, "RemoveDevice", g_variant_new("(o)", objectPath));
 	
 }
 
+void bluez_adapter_update_properties(const char * path, GVariant * properties)
+{
+	int index = bluetooth_device_get_adapter_index(path);
+	BluezAdapter * adapter;
+	gboolean value;
+	
+	g_print("[ Adapter %s ]\n", path);
+	
+	// only the adapter object itself, not the objects below it
+	if(index < 0 || strchr(path + strlen(BLUEZ_HCI_PATH_PREFIX), '/') != NULL)
+	{
+		g_print("Adapter %s is not tracked, only hci0 to hci%d are\n", path, BLUEZ_MAX_ADAPTERS - 1);
+		return;
+	}
+	
+	/*1. Its slot is fixed by N, an adapter that returns gets the handle it had */
+	adapter = &mAdapters[index];
+	adapter->PATH = g_intern_string(path);
+	adapter->INDEX = index;
+	adapter->PRESENT = true;
+	
+	if(g_variant_lookup(properties, "Powered", "b", &value))
+	{
+		adapter->POWERED = value;
+		g_print("Adapter is Powered \"%s\"\n", value ? "on" : "off");
+	}
+	
+	if(g_variant_lookup(properties, "Discovering", "b", &value))
+		adapter->DISCOVERING = value;
+}
 
 /*
 * Accessors
 */
-bool bluez_is_adapter_on(void)
+bool bluez_is_adapter_on(BluezAdapter * adapter)
 {
-	return mAdapterOn;
+	return adapter != NULL && adapter->POWERED;
 }
 
-bool bluez_adapter_print_filter_settings(void)
+void bluez_adapter_get_filter(DiscoveryFilter * filter)
 {
-	int rc;
-	bool ret = true;
-	rc = bluez_adapter_call_method_callback("GetDiscoveryFilters",
-			NULL,
-			bluez_get_discovery_filter_cb);
-	if(rc) {
-		g_print("Not able to get discovery filter\n");
-		ret = false;
+	if(!mFilterSet)
+	{
+		bluez_adapter_default_filter(&mFilter);
+		mFilterSet = true;
 	}
-	return ret;
+	
+	*filter = mFilter;
+}
+
+int bluez_adapter_get_count(void)
+{
+	int count = 0;
+	int i;
+	
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+		if(mAdapters[i].PRESENT)
+			count++;
+	
+	return count;
+}
+
+BluezAdapter * bluez_adapter_get(int index)
+{
+	if(index < 0 || index >= BLUEZ_MAX_ADAPTERS || !mAdapters[index].PRESENT)
+		return NULL;
+	
+	return &mAdapters[index];
+}
+
+BluezAdapter * bluez_adapter_get_by_path(const char * path)
+{
+	return bluez_adapter_get(bluetooth_device_get_adapter_index(path));
+}
+
+BluezAdapter * bluez_adapter_get_default(void)
+{
+	int i;
+	
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+		if(mAdapters[i].PRESENT)
+			return &mAdapters[i];
+	
+	return NULL;
+}
+
+void bluez_adapter_print_all(void)
+{
+	int i;
+	
+	g_print("***\t Adapters \t***\n");
+	
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+	{
+		if(!mAdapters[i].PRESENT)
+			continue;
+		
+		g_print("- %s\tPowered: \"%s\"\tDiscovering: \"%s\"\n", mAdapters[i].PATH,
+				mAdapters[i].POWERED ? "on" : "off", mAdapters[i].DISCOVERING ? "on" : "off");
+	}
+	
+	g_print("- %d Adapter(s)\n", bluez_adapter_get_count());
+}
+
+bool bluez_adapter_print_filter_settings(BluezAdapter * adapter)
+{
+	// printed from the callback, nobody waits on the command
+	bluez_command_unref(bluez_command_call(adapter->PATH,
+				BLUEZ_ADAPTER_INTERFACE,
+				"GetDiscoveryFilters",
+				NULL,
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				bluez_get_discovery_filter_cb,
+				NULL));
+	return true;
 }
 
 /** 
 * Private Functions
 **/
-static void bluez_property_value(const gchar *key, GVariant *value,BluetoothDevice * device)
+static void bluez_property_value(const gchar *key, GVariant *value)
 {
 	const gchar *type = g_variant_get_type_string(value);
 	
@@ -362,29 +505,10 @@ static void bluez_property_value(const gchar *key, GVariant *value,BluetoothDevi
 	switch(*type) {
 		case 'o':
 		case 's':
-			if(device != NULL)
-			{
-				if(strcmp(key,"Address") == 0)
-					strcpy(device->MAC_ADDRESS,g_variant_get_string(value, NULL));
-				
-				else if(strcmp(key,"Alias") == 0)
-					strcpy(device->ALIAS,g_variant_get_string(value, NULL));		// note alias is only 100 bytes, may need to bound checking here at somepoint
-			}
-					
 			g_print("%s\n", g_variant_get_string(value, NULL));
 			
 			break;
 		case 'b':
-			if(device != NULL)
-			{
-				if(strcmp(key,"Trusted") == 0)
-					device->TRUSTED = g_variant_get_boolean(value);
-				else if(strcmp(key,"Paired") == 0)
-					device->PAIRED = g_variant_get_boolean(value);
-				else if(strcmp(key,"Connected") == 0)	
-					device->CONNECTED = g_variant_get_boolean(value);
-			}
-					
 			g_print("%d\n", g_variant_get_boolean(value));
 			
 			break;
@@ -395,34 +519,34 @@ static void bluez_property_value(const gchar *key, GVariant *value,BluetoothDevi
 			break;
 			
 		case 'n':
-			if(device != NULL)
-			{
-				if(strcmp(key,"RSSI") == 0)
-					device->RSSI = g_variant_get_int16(value);
-			}
-			
 			g_print("%d\n", g_variant_get_int16(value));
 			
 			break;
 		case 'a':
-		
-		/* TODO Handling only 'as', but not array of dicts */
+			
+			// ManufacturerData and ServiceData, the payloads are printed straight from the message
+			if(g_strcmp0(type, "a{qv}") == 0 || g_strcmp0(type, "a{sv}") == 0)
+			{
+				g_print("\n");
+				if(type[2] == 'q')
+					bluez_advertisement_parse_manufacturer_data(value, bluez_property_print_payload, NULL);
+				else
+					bluez_advertisement_parse_service_data(value, bluez_property_print_payload, NULL);
+				break;
+			}
+			
 			if(g_strcmp0(type, "as"))
+			{
+				g_print("Other\n");
 				break;
+			}
 			
 			g_print("\n");
 			const gchar *uuid;
 			GVariantIter i;
 			g_variant_iter_init(&i, value);
-			int count = 0;
-			while(g_variant_iter_next(&i, "s", &uuid))
-			{
-				if(device != NULL)
-					strcpy(device->SERVICE_UUIDS[count++],uuid);
+			while(g_variant_iter_next(&i, "&s", &uuid))
 				g_print("\t\t%s\n", uuid);
-			}
-			if(device != NULL)
-				device->NUMBER_OF_UUIDS = count;
 			break;
 		
 		default:
@@ -431,6 +555,46 @@ static void bluez_property_value(const gchar *key, GVariant *value,BluetoothDevi
 	}
 }
 
+static bool bluez_property_print_payload(const BluezAdvertisementView * view, gpointer userData)
+{
+	(void)userData;
+	
+	char uuid[UUID_STRING_SIZE];
+	gsize i;
+	
+	if(view->KIND == BLUEZ_ADVERTISEMENT_MANUFACTURER)
+		g_print("\t\t0x%04x :", view->COMPANY);
+	else if(bluetooth_uuid_to_string(view->UUID, uuid))
+		g_print("\t\t%s :", uuid);
+	
+	for(i = 0; i < view->LENGTH; i++)
+		g_print(" %02x", view->DATA[i]);
+	g_print("\n");
+	
+	return true;
+}
+
+static bool bluez_adapter_release_unpaired_device(BluetoothDevice * device, gpointer userData)
+{
+	GPtrArray * paths = userData;
+	const char * key = strrchr(device->PATH, '/');
+	int i;
+	
+	if(device->PAIRED)
+		return false;
+	
+	// the registry is locked, only collect the path on every adapter that has it, the caller removes them from bluez
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+	{
+		if(!(device->ADAPTERS & (1u << i)) || !mAdapters[i].PRESENT)
+			continue;
+		
+		g_ptr_array_add(paths, g_strconcat(mAdapters[i].PATH, key, NULL));
+	}
+	
+	return true;
+}
+
 static void bluez_device_appeared(GDBusConnection *sig,
 				const gchar *sender_name,
 				const gchar *object_path,
@@ -451,32 +615,46 @@ static void bluez_device_appeared(GDBusConnection *sig,
 	const gchar *interface_name;
 	GVariant *properties;
 	
-	g_print("\n****\t Device Appeared \t****\n");
+	BLUEZ_LOG_DEBUG("\n****\t Device Appeared \t****\n", 0, 0, 0, 0);
 	
 	g_variant_get(parameters, "(&oa{sa{sv}})", &object, &interfaces);
 	
 	BluetoothDevice newDevice;
 	
-	strcpy(newDevice.PATH,object);
+	bluetooth_device_init_properties(&newDevice, object);
 	
 	while(g_variant_iter_next(interfaces, "{&s@a{sv}}", &interface_name, &properties)) 
 	{
-		g_print("Interface Name: %s\n",interface_name);
-		if(g_strstr_len(g_ascii_strdown(interface_name, -1), -1, "device")) 
+		BLUEZ_LOG_DEBUG("Interface Name: %s\n", interface_name, 0, 0, 0);
+		if(strcmp(interface_name, BLUEZ_DEVICE_INTERFACE) == 0) 
 		{
-			g_print("[ %s ]\n", object);
 			const gchar *property_name;
 			GVariantIter i;
 			GVariant *prop_val;
-			g_variant_iter_init(&i, properties);
-			while(g_variant_iter_next(&i, "{&sv}", &property_name, &prop_val))
-				bluez_property_value(property_name, prop_val,&newDevice);
-			g_variant_unref(prop_val);
 			
+			// the logger cannot keep GVariants, the dump is printed right away but only when asked for
+			if(BLUEZ_LOG_ENABLED(BLUEZ_LOG_LEVEL_DEBUG))
+			{
+				g_print("[ %s ]\n", object);
+				g_variant_iter_init(&i, properties);
+				while(g_variant_iter_next(&i, "{&sv}", &property_name, &prop_val))
+				{
+					bluez_property_value(property_name, prop_val);
+					g_variant_unref(prop_val);
+				}
+			}
+			
+			// fill in the whole device from the dictionary, then add it in one go
+			bluetooth_device_apply_properties(&newDevice, properties);
 			bluetooth_device_add_device(&newDevice);
+			bluez_advertisement_update(object, properties);
+			bluez_event_queue_push(BLUEZ_EVENT_DEVICE_ADDED, object, 0);
 		}
+		else if(strcmp(interface_name, BLUEZ_ADAPTER_INTERFACE) == 0)
+			bluez_adapter_update_properties(object, properties);		// an adapter was plugged in
 		g_variant_unref(properties);
 	}
+	g_variant_iter_free(interfaces);
 	
 	return;
 }
@@ -501,18 +679,25 @@ static void bluez_device_disappeared(GDBusConnection *sig,
 	const gchar *interface_name;
 	char address[BT_ADDRESS_STRING_SIZE] = {'\0'};
 	
-	g_print("\n****\t Device Disappeared \t****\n");
+	BLUEZ_LOG_DEBUG("\n****\t Device Disappeared \t****\n", 0, 0, 0, 0);
 	
 	g_variant_get(parameters, "(&oas)", &object, &interfaces);
 	
-	// remove the device from the double linked list
-	bluetooth_device_remove_device_by_path(object);
-	
-	while(g_variant_iter_next(interfaces, "s", &interface_name)) {
-		if(g_strstr_len(g_ascii_strdown(interface_name, -1), -1, "device")) {
+	while(g_variant_iter_next(interfaces, "&s", &interface_name)) {
+		if(strcmp(interface_name, BLUEZ_ADAPTER_INTERFACE) == 0) {
+			bluez_adapter_removed(object);
+			continue;
+		}
+		if(strcmp(interface_name, BLUEZ_DEVICE_INTERFACE) == 0) {
 			int i;
 			char *tmp = g_strstr_len(object, -1, "dev_") + 4;
 
+			// the adapter of the path lets go of the device, it leaves the registry once no adapter has it
+			bluez_rssi_coalescer_discard(object);
+			bluez_advertisement_forget(object);
+			bluetooth_device_remove_device_by_path(object);
+			bluez_event_queue_push(BLUEZ_EVENT_DEVICE_REMOVED, object, 0);
+
 			for(i = 0; *tmp != '\0'; i++, tmp++) {
 				if(*tmp == '_') {
 					address[i] = ':';
@@ -520,150 +705,197 @@ static void bluez_device_disappeared(GDBusConnection *sig,
 				}
 				address[i] = *tmp;
 			}
-			g_print("\nDevice %s removed\n", address);
+			BLUEZ_LOG_INFO("\nDevice %s removed\n", address, 0, 0, 0);
 		}
 	}
+	g_variant_iter_free(interfaces);
 	return;
 }
 
-static void bluez_signal_adapter_changed(GDBusConnection *conn,
-					const gchar *sender,
-					const gchar *path,
-					const gchar *interface,
-					const gchar *signal,
-					GVariant *params,
-					void *userdata)
+static void bluez_signal_adapter_changed(const char *path, GVariant *changed, GVariant *invalidated, gpointer userdata)
 {
-	(void)conn;
-	(void)sender;
-	(void)path;
-	(void)interface;
+	(void)invalidated;
 	(void)userdata;
 	
-	g_print("***\t Adapter Properties Changed ***\n");
+	BLUEZ_LOG_DEBUG("***\t Adapter Properties Changed %s ***\n", path, 0, 0, 0);
 
-	GVariantIter *properties = NULL;
-	GVariantIter *unknown = NULL;
-	const char *iface;
-	const char *key;
-	GVariant *value = NULL;
-	const gchar *signature = g_variant_get_type_string(params);
+	gboolean value;
+	BluezAdapter * adapter = bluez_adapter_get_by_path(path);
 
-	if(g_strcmp0(signature, "(sa{sv}as)") != 0) {
-		g_print("Invalid signature for %s: %s != %s", signal, signature, "(sa{sv}as)");
-		goto done;
+	// the router already checked the signature, only read the values we care about
+	if(g_variant_lookup(changed, "Powered", "b", &value))
+	{
+		g_print("Adapter is Powered \"%s\"\n", value ? "on" : "off");
+		if(adapter != NULL)
+			adapter->POWERED = value;
+		bluez_event_queue_push(BLUEZ_EVENT_ADAPTER_POWERED, path, value);
 	}
 
-	g_variant_get(params, "(&sa{sv}as)", &iface, &properties, &unknown);
-	while(g_variant_iter_next(properties, "{&sv}", &key, &value)) {
-		if(!g_strcmp0(key, "Powered")) {
-			if(!g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
-				g_print("Invalid argument type for %s: %s != %s", key,
-						g_variant_get_type_string(value), "b");
-				goto done;
-			}
-			g_print("Adapter is Powered \"%s\"\n", g_variant_get_boolean(value) ? "on" : "off");
-		}
-		if(!g_strcmp0(key, "Discovering")) {
-			if(!g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
-				g_print("Invalid argument type for %s: %s != %s", key,
-						g_variant_get_type_string(value), "b");
-				goto done;
-			}
-			g_print("Adapter scan \"%s\"\n", g_variant_get_boolean(value) ? "on" : "off");
-		}
-	}
-done:
-	if(properties != NULL)
-		g_variant_iter_free(properties);
-	if(value != NULL)
-		g_variant_unref(value);
-}
-
-static int bluez_adapter_call_method( const char *method, GVariant *param)
-{
-	GVariant *result;
-	GError *error = NULL;
-
-	result = g_dbus_connection_call_sync(mCon,
-					     BLUEZ_BUS_NAME,
-					/* TODO Find the adapter path runtime */
-					     BLUEZ_HCI0_PATH,
-					     BLUEZ_ADAPTER_INTERFACE,
-					     method,
-					     param,
-					     NULL,
-					     G_DBUS_CALL_FLAGS_NONE,
-					     -1,
-					     NULL,
-					     &error);
-	if(error != NULL)
+	if(g_variant_lookup(changed, "Discovering", "b", &value))
 	{
-		g_print("Method Call Error: %s",error->message);
-		return -1;
+		g_print("Adapter scan \"%s\"\n", value ? "on" : "off");
+		if(adapter != NULL)
+			adapter->DISCOVERING = value;
+		bluez_event_queue_push(BLUEZ_EVENT_ADAPTER_DISCOVERING, path, value);
 	}
-
-	g_variant_unref(result);
-	return 0;
 }
 
-static int bluez_adapter_call_method_callback(const char *method, GVariant *param,  bluez_call_method_callback callback)
-{
-	GError *error = NULL;
-
-	g_dbus_connection_call(mCon,
-			     BLUEZ_BUS_NAME,
-			/* TODO Find the adapter path runtime */
-				 BLUEZ_HCI0_PATH,
-			     BLUEZ_ADAPTER_INTERFACE,
-			     method,
-			     param,
-			     NULL,
-			     G_DBUS_CALL_FLAGS_NONE,
-			     -1,
-			     NULL,
-			     callback,
-			     &error);
-	if(error != NULL)
-		return 1;
+static int bluez_adapter_call_method(BluezAdapter * adapter, const char *method, GVariant *param)
+{
+	if(!bluez_command_call_sync(adapter->PATH, BLUEZ_ADAPTER_INTERFACE, method, param, BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS, NULL))
+		return -1;
+
 	return 0;
 }
 
-
-static int bluez_adapter_set_property(const char *prop, GVariant *value)
+static int bluez_adapter_set_property(BluezAdapter * adapter, const char *prop, GVariant *value)
 {
-	GVariant *result;
-	GError *error = NULL;
-
-	result = g_dbus_connection_call_sync(mCon,
-					     BLUEZ_BUS_NAME,						// defined in bluez_dbus_names.h
-					     BLUEZ_HCI0_PATH,						// defined in bluez_dbus_names.h
-					     "org.freedesktop.DBus.Properties",
-					     "Set",
-					     g_variant_new("(ssv)", BLUEZ_ADAPTER_INTERFACE, prop, value),
-					     NULL,
-					     G_DBUS_CALL_FLAGS_NONE,
-					     -1,
-					     NULL,
-					     &error);
-	if(error != NULL)
+	if(!bluez_command_call_sync(adapter->PATH,
+				"org.freedesktop.DBus.Properties",
+				"Set",
+				g_variant_new("(ssv)", BLUEZ_ADAPTER_INTERFACE, prop, value),
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				NULL))
 		return -1;
 
-	g_variant_unref(result);
 	return 0;
 }
 
-static void bluez_get_discovery_filter_cb(GObject *con,GAsyncResult *res,gpointer data)
+static void bluez_get_discovery_filter_cb(BluezCommand * command, gpointer data)
 {
 	(void)data;
-	GVariant *result = NULL;
-	result = g_dbus_connection_call_finish((GDBusConnection *)con, res, NULL);
-	if(result == NULL)
-		g_print("Unable to get result for GetDiscoveryFilter\n");
-
-	if(result) {
-		result = g_variant_get_child_value(result, 0);
-		bluez_property_value("GetDiscoveryFilter", result,NULL);
+	GVariant *result = bluez_command_get_result(command);		// borrowed
+	GVariant *filters;
+	if(result == NULL) {
+		g_print("Unable to get result for GetDiscoveryFilter: %s\n", bluez_command_get_error(command));
+		return;
+	}
+
+	filters = g_variant_get_child_value(result, 0);
+	bluez_property_value("GetDiscoveryFilter", filters);
+	g_variant_unref(filters);
+}
+
+static guint8 bluez_adapter_call_all(guint8 adapters, const char * interface, const char * method, GVariant * param)
+{
+	BluezCommand * commands[BLUEZ_MAX_ADAPTERS] = { NULL };
+	GMainContext * context = g_main_context_new();
+	guint8 succeeded = 0;
+	int i;
+	
+	// every call takes its own reference, ours is dropped at the end
+	if(param != NULL)
+		g_variant_ref_sink(param);
+	
+	/*1. Send to every adapter before waiting on any, the replies come back on a private context */
+	g_main_context_push_thread_default(context);
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+		if(adapters & (1u << i))
+			commands[i] = bluez_command_call(mAdapters[i].PATH, interface, method, param, BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS, NULL, NULL);
+	g_main_context_pop_thread_default(context);
+	
+	/*2. Nobody else runs the context, waiting on the first command also dispatches the others */
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+	{
+		if(commands[i] == NULL)
+			continue;
+		
+		if(bluez_command_wait(commands[i]) == BLUEZ_COMMAND_SUCCEEDED)
+			succeeded |= 1u << i;
+		else
+			g_print("%s %s failed: %s\n", mAdapters[i].PATH, method, bluez_command_get_error(commands[i]));
+		
+		bluez_command_unref(commands[i]);
 	}
-	g_variant_unref(result);
+	
+	if(param != NULL)
+		g_variant_unref(param);
+	g_main_context_unref(context);
+	
+	return succeeded;
+}
+
+static guint8 bluez_adapter_mask(bool powered)
+{
+	guint8 adapters = 0;
+	int i;
+	
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+		if(mAdapters[i].PRESENT && mAdapters[i].POWERED == powered)
+			adapters |= 1u << i;
+	
+	return adapters;
+}
+
+static void bluez_adapter_mark_powered(guint8 adapters, bool powered)
+{
+	int i;
+	
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+		if(adapters & (1u << i))
+			mAdapters[i].POWERED = powered;
+}
+
+static int bluez_adapter_count(guint8 adapters)
+{
+	return __builtin_popcount(adapters);
+}
+
+static void bluez_adapter_removed(const char * path)
+{
+	BluezAdapter * adapter = bluez_adapter_get_by_path(path);
+	int removed;
+	
+	if(adapter == NULL)
+		return;
+	
+	/*1. Keep the slot, only mark it gone, handles held elsewhere stay valid */
+	adapter->PRESENT = false;
+	adapter->POWERED = false;
+	adapter->DISCOVERING = false;
+	
+	/*2. Devices only this adapter had go with it, the others move to their next best adapter */
+	removed = bluetooth_device_remove_adapter(adapter->INDEX);
+	
+	g_print("Adapter %s removed, %d device(s) went with it\n", path, removed);
+}
+
+static GVariant * bluez_adapter_build_filter(DiscoveryFilter * filterSettings)
+{
+	int i;
+	GVariantBuilder *b = g_variant_builder_new(G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(b, "{sv}", "Transport", g_variant_new_string(filterSettings->TRANSPORT));
+	
+	// bluez refuses a filter with both thresholds
+	if(filterSettings->PATHLOSS != 0)
+		g_variant_builder_add(b, "{sv}", "Pathloss", g_variant_new_uint16(filterSettings->PATHLOSS));
+	else
+		g_variant_builder_add(b, "{sv}", "RSSI", g_variant_new_int16(filterSettings->RSSI));
+	g_variant_builder_add(b, "{sv}", "DuplicateData", g_variant_new_boolean(filterSettings->DUPLICATE_DATA));
+
+	GVariantBuilder *u = g_variant_builder_new(G_VARIANT_TYPE_STRING_ARRAY);
+	for(i = 0; i < filterSettings->NUM_OF_UUIDS; i++)
+		g_variant_builder_add(u, "s", filterSettings->UUID_ARRAY[i]);
+	
+	g_variant_builder_add(b, "{sv}", "UUIDs", g_variant_builder_end(u));
+
+	GVariant *device_dict = g_variant_builder_end(b);
+	g_variant_builder_unref(u);
+	g_variant_builder_unref(b);
+	
+	return g_variant_new_tuple(&device_dict, 1);
+}
+
+static void bluez_adapter_default_filter(DiscoveryFilter * filter)
+{
+	filter->RSSI = -100;
+	filter->PATHLOSS = 0;
+	strcpy(filter->TRANSPORT,"auto");
+	filter->DUPLICATE_DATA = true;
+	
+	// add the UUID's we want to filter for
+	strcpy(filter->UUID_ARRAY[0], UUID_AUDIO_SOURCE);
+	filter->NUM_OF_UUIDS = 1;
+	
+	g_print("Filter UUID: %s", filter->UUID_ARRAY[0]);
 }
@@ -0,0 +1,434 @@
+/**
+	* @file bluez_advertisement.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the ManufacturerData and ServiceData parsers and the store of the latest payloads
+	*
+	*	- The parsers walk the dictionary with a GVariantIter and take every 'ay' with g_variant_get_fixed_array,
+	*	  the view points into the serialized reply or signal, only the store copies the bytes it keeps.
+	*	- The store is a static array of slots keyed by the device path, kept in the slot with its hash, a lookup
+	*	  compares hashes over BLUEZ_ADVERTISEMENT_MAX_DEVICES slots and the path only when they match. The slot
+	*	  and the payload heard the longest ago are reused once the store is full, nothing is allocated.
+	*	- mLock serializes the GMainLoop thread writing and the readers copying out.
+	*
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_advertisement.h"
+
+#define ADVERTISEMENT_PATH_SIZE		40		// /org/bluez/hciN/dev_XX_XX_XX_XX_XX_XX, longer paths are not kept
+
+/*
+ * Private Types
+*/
+typedef struct _AdvertisementSlot
+{
+	char					PATH[ADVERTISEMENT_PATH_SIZE];		// empty while the slot is free
+	guint					HASH;			// g_str_hash of PATH
+	gint64					TIME_US;		// last update of any payload
+	guint					COUNT;			// payloads in use
+	BluezAdvertisementData	ENTRIES[BLUEZ_ADVERTISEMENT_MAX_ENTRIES];
+} AdvertisementSlot;
+
+typedef struct _AdvertisementUpdate
+{
+	AdvertisementSlot *		SLOT;
+	gint64					TIME_US;
+	guint					CHANGED;
+} AdvertisementUpdate;
+
+/*
+ * Private Function Declerations
+*/
+static bool bluez_advertisement_keep(const BluezAdvertisementView * view, gpointer userData);
+static AdvertisementSlot * bluez_advertisement_find(const char * path, guint hash);
+static AdvertisementSlot * bluez_advertisement_take_slot(const char * path, guint hash);
+static const BluezAdvertisementData * bluez_advertisement_find_entry(const AdvertisementSlot * slot, guint8 kind, guint16 company, BluetoothUuid uuid);
+static void bluez_advertisement_print_data(const BluezAdvertisementData * data, gint64 now);
+
+/*
+ * Private Variables
+*/
+static GMutex mLock;
+static AdvertisementSlot mSlots[BLUEZ_ADVERTISEMENT_MAX_DEVICES];
+static BluezAdvertisementStats mStats;
+
+guint bluez_advertisement_parse_manufacturer_data(GVariant * value, bluez_advertisement_visitor visitor, gpointer userData)
+{
+	BluezAdvertisementView view = { .KIND = BLUEZ_ADVERTISEMENT_MANUFACTURER };
+	GVariantIter i;
+	GVariant * payload;
+	guint visited = 0;
+	bool more = true;
+
+	if(!g_variant_is_of_type(value, G_VARIANT_TYPE("a{qv}")))
+		return 0;
+
+	g_variant_iter_init(&i, value);
+	while(more && g_variant_iter_next(&i, "{qv}", &view.COMPANY, &payload))
+	{
+		// bluez always sends an 'ay', anything else is skipped
+		if(g_variant_is_of_type(payload, G_VARIANT_TYPE_BYTESTRING))
+		{
+			view.DATA = g_variant_get_fixed_array(payload, &view.LENGTH, sizeof(guint8));
+			more = visitor(&view, userData);
+			visited++;
+		}
+		g_variant_unref(payload);
+	}
+
+	return visited;
+}
+
+guint bluez_advertisement_parse_service_data(GVariant * value, bluez_advertisement_visitor visitor, gpointer userData)
+{
+	BluezAdvertisementView view = { .KIND = BLUEZ_ADVERTISEMENT_SERVICE };
+	GVariantIter i;
+	GVariant * payload;
+	const char * uuid;
+	guint visited = 0;
+	bool more = true;
+
+	if(!g_variant_is_of_type(value, G_VARIANT_TYPE_VARDICT))
+		return 0;
+
+	g_variant_iter_init(&i, value);
+	while(more && g_variant_iter_next(&i, "{&sv}", &uuid, &payload))
+	{
+		// the UUID table holds the 128-Bit value, the view only carries its id
+		view.UUID = bluetooth_uuid_intern(uuid);
+		if(view.UUID != BLUETOOTH_UUID_INVALID && g_variant_is_of_type(payload, G_VARIANT_TYPE_BYTESTRING))
+		{
+			view.DATA = g_variant_get_fixed_array(payload, &view.LENGTH, sizeof(guint8));
+			more = visitor(&view, userData);
+			visited++;
+		}
+		g_variant_unref(payload);
+	}
+
+	return visited;
+}
+
+/*
+ * Modifiers
+*/
+guint bluez_advertisement_update(const char * path, GVariant * properties)
+{
+	AdvertisementUpdate update;
+	GVariant * manufacturer;
+	GVariant * service;
+	guint visited = 0;
+	guint total = 0;
+	guint hash;
+
+	if(strlen(path) >= ADVERTISEMENT_PATH_SIZE)
+		return 0;
+
+	/*1. Most dictionaries have neither, they cost two lookups and nothing else */
+	manufacturer = g_variant_lookup_value(properties, "ManufacturerData", G_VARIANT_TYPE("a{qv}"));
+	service = g_variant_lookup_value(properties, "ServiceData", G_VARIANT_TYPE_VARDICT);
+
+	if(manufacturer == NULL && service == NULL)
+		return 0;
+
+	hash = g_str_hash(path);
+
+	update.TIME_US = g_get_monotonic_time();
+	update.CHANGED = 0;
+
+	/*2. Straight from the message into the slot of the device */
+	g_mutex_lock(&mLock);
+	update.SLOT = bluez_advertisement_find(path, hash);
+	if(update.SLOT == NULL)
+		update.SLOT = bluez_advertisement_take_slot(path, hash);
+
+	if(manufacturer != NULL)
+	{
+		visited += bluez_advertisement_parse_manufacturer_data(manufacturer, bluez_advertisement_keep, &update);
+		total += g_variant_n_children(manufacturer);
+	}
+
+	if(service != NULL)
+	{
+		visited += bluez_advertisement_parse_service_data(service, bluez_advertisement_keep, &update);
+		total += g_variant_n_children(service);
+	}
+
+	mStats.INVALID += total - visited;
+	update.SLOT->TIME_US = update.TIME_US;
+	g_mutex_unlock(&mLock);
+
+	if(manufacturer != NULL)
+		g_variant_unref(manufacturer);
+	if(service != NULL)
+		g_variant_unref(service);
+
+	return update.CHANGED;
+}
+
+void bluez_advertisement_forget(const char * path)
+{
+	AdvertisementSlot * slot;
+
+	g_mutex_lock(&mLock);
+
+	slot = bluez_advertisement_find(path, g_str_hash(path));
+	if(slot != NULL)
+	{
+		slot->PATH[0] = '\0';
+		slot->COUNT = 0;
+		mStats.DEVICES--;
+	}
+
+	g_mutex_unlock(&mLock);
+}
+
+/*
+ * Accessors
+*/
+bool bluez_advertisement_copy_manufacturer_data(const char * path, guint16 company, BluezAdvertisementData * data)
+{
+	const BluezAdvertisementData * entry = NULL;
+	AdvertisementSlot * slot;
+
+	g_mutex_lock(&mLock);
+
+	slot = bluez_advertisement_find(path, g_str_hash(path));
+	if(slot != NULL)
+		entry = bluez_advertisement_find_entry(slot, BLUEZ_ADVERTISEMENT_MANUFACTURER, company, BLUETOOTH_UUID_INVALID);
+	if(entry != NULL)
+		*data = *entry;
+
+	g_mutex_unlock(&mLock);
+
+	return entry != NULL;
+}
+
+bool bluez_advertisement_copy_service_data(const char * path, const char * uuid, BluezAdvertisementData * data)
+{
+	const BluezAdvertisementData * entry = NULL;
+	BluetoothUuid id = bluetooth_uuid_lookup(uuid);
+	AdvertisementSlot * slot;
+
+	if(id == BLUETOOTH_UUID_INVALID)
+		return false;
+
+	g_mutex_lock(&mLock);
+
+	slot = bluez_advertisement_find(path, g_str_hash(path));
+	if(slot != NULL)
+		entry = bluez_advertisement_find_entry(slot, BLUEZ_ADVERTISEMENT_SERVICE, 0, id);
+	if(entry != NULL)
+		*data = *entry;
+
+	g_mutex_unlock(&mLock);
+
+	return entry != NULL;
+}
+
+int bluez_advertisement_copy_all(const char * path, BluezAdvertisementData * data)
+{
+	AdvertisementSlot * slot;
+	int count = 0;
+
+	g_mutex_lock(&mLock);
+
+	slot = bluez_advertisement_find(path, g_str_hash(path));
+	if(slot != NULL)
+	{
+		count = slot->COUNT;
+		memcpy(data, slot->ENTRIES, count * sizeof(BluezAdvertisementData));
+	}
+
+	g_mutex_unlock(&mLock);
+
+	return count;
+}
+
+void bluez_advertisement_print_all(void)
+{
+	static AdvertisementSlot slots[BLUEZ_ADVERTISEMENT_MAX_DEVICES];		// only the thread of the menu prints
+	gint64 now = g_get_monotonic_time();
+	guint count = 0;
+	guint i;
+	guint j;
+
+	/*1. Copy what is in use, print without holding up the bus */
+	g_mutex_lock(&mLock);
+	for(i = 0; i < BLUEZ_ADVERTISEMENT_MAX_DEVICES; i++)
+		if(mSlots[i].PATH[0] != '\0')
+			slots[count++] = mSlots[i];
+	g_mutex_unlock(&mLock);
+
+	g_print("***\t Advertisement Data: %u devices \t***\n", count);
+	for(i = 0; i < count; i++)
+	{
+		g_print("[ %s ]\n", slots[i].PATH);
+		for(j = 0; j < slots[i].COUNT; j++)
+			bluez_advertisement_print_data(&slots[i].ENTRIES[j], now);
+	}
+}
+
+void bluez_advertisement_get_stats(BluezAdvertisementStats * stats)
+{
+	g_mutex_lock(&mLock);
+	*stats = mStats;
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_advertisement_print_stats(void)
+{
+	BluezAdvertisementStats stats;
+
+	bluez_advertisement_get_stats(&stats);
+
+	g_print("***\t Advertisement Data \t***\n");
+	g_print("- Devices:\t%u of %u\n", stats.DEVICES, BLUEZ_ADVERTISEMENT_MAX_DEVICES);
+	g_print("- Updates:\t%llu\n", (unsigned long long)stats.UPDATES);
+	g_print("- Unchanged:\t%llu\n", (unsigned long long)stats.UNCHANGED);
+	g_print("- Truncated:\t%llu\n", (unsigned long long)stats.TRUNCATED);
+	g_print("- Evicted:\t%llu\n", (unsigned long long)stats.EVICTED);
+	g_print("- Invalid:\t%llu\n", (unsigned long long)stats.INVALID);
+}
+
+/*
+ * Private Functions
+*/
+// visitor of bluez_advertisement_update, called with mLock held
+static bool bluez_advertisement_keep(const BluezAdvertisementView * view, gpointer userData)
+{
+	AdvertisementUpdate * update = userData;
+	AdvertisementSlot * slot = update->SLOT;
+	BluezAdvertisementData * entry;
+	gsize length = MIN(view->LENGTH, BLUEZ_ADVERTISEMENT_MAX_PAYLOAD);
+	bool truncated = view->LENGTH > BLUEZ_ADVERTISEMENT_MAX_PAYLOAD;
+	guint i;
+
+	entry = (BluezAdvertisementData *)bluez_advertisement_find_entry(slot, view->KIND, view->COMPANY, view->UUID);
+
+	/*1. The same bytes again only refresh the time */
+	if(entry != NULL && entry->LENGTH == length && entry->TRUNCATED == truncated && memcmp(entry->DATA, view->DATA, length) == 0)
+	{
+		entry->TIME_US = update->TIME_US;
+		mStats.UNCHANGED++;
+		return true;
+	}
+
+	/*2. A new company or service takes a free entry, or the one heard the longest ago */
+	if(entry == NULL)
+	{
+		if(slot->COUNT < BLUEZ_ADVERTISEMENT_MAX_ENTRIES)
+			entry = &slot->ENTRIES[slot->COUNT++];
+		else
+		{
+			entry = &slot->ENTRIES[0];
+			for(i = 1; i < slot->COUNT; i++)
+				if(slot->ENTRIES[i].TIME_US < entry->TIME_US)
+					entry = &slot->ENTRIES[i];
+			mStats.EVICTED++;
+		}
+
+		entry->KIND = view->KIND;
+		entry->COMPANY = view->KIND == BLUEZ_ADVERTISEMENT_MANUFACTURER ? view->COMPANY : 0;
+		entry->UUID = view->KIND == BLUEZ_ADVERTISEMENT_SERVICE ? view->UUID : BLUETOOTH_UUID_INVALID;
+	}
+
+	/*3. The only copy of the bytes */
+	memcpy(entry->DATA, view->DATA, length);
+	entry->LENGTH = (guint8)length;
+	entry->TRUNCATED = truncated;
+	entry->TIME_US = update->TIME_US;
+
+	mStats.UPDATES++;
+	if(truncated)
+		mStats.TRUNCATED++;
+	update->CHANGED++;
+
+	return true;
+}
+
+// hash is g_str_hash of path, called with mLock held
+static AdvertisementSlot * bluez_advertisement_find(const char * path, guint hash)
+{
+	guint i;
+
+	for(i = 0; i < BLUEZ_ADVERTISEMENT_MAX_DEVICES; i++)
+		if(mSlots[i].HASH == hash && mSlots[i].PATH[0] != '\0' && strcmp(mSlots[i].PATH, path) == 0)
+			return &mSlots[i];
+
+	return NULL;
+}
+
+// path fits in a slot, called with mLock held
+static AdvertisementSlot * bluez_advertisement_take_slot(const char * path, guint hash)
+{
+	AdvertisementSlot * slot = NULL;
+	guint i;
+
+	/*1. A free slot, otherwise the device heard the longest ago */
+	for(i = 0; i < BLUEZ_ADVERTISEMENT_MAX_DEVICES; i++)
+	{
+		if(mSlots[i].PATH[0] == '\0')
+		{
+			slot = &mSlots[i];
+			break;
+		}
+
+		if(slot == NULL || mSlots[i].TIME_US < slot->TIME_US)
+			slot = &mSlots[i];
+	}
+
+	if(slot->PATH[0] == '\0')
+		mStats.DEVICES++;
+	else
+		mStats.EVICTED++;
+
+	g_strlcpy(slot->PATH, path, sizeof(slot->PATH));
+	slot->HASH = hash;
+	slot->COUNT = 0;
+
+	return slot;
+}
+
+static const BluezAdvertisementData * bluez_advertisement_find_entry(const AdvertisementSlot * slot, guint8 kind, guint16 company, BluetoothUuid uuid)
+{
+	const BluezAdvertisementData * entry;
+	guint i;
+
+	for(i = 0; i < slot->COUNT; i++)
+	{
+		entry = &slot->ENTRIES[i];
+		if(entry->KIND != kind)
+			continue;
+
+		if(kind == BLUEZ_ADVERTISEMENT_MANUFACTURER ? entry->COMPANY == company : entry->UUID == uuid)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void bluez_advertisement_print_data(const BluezAdvertisementData * data, gint64 now)
+{
+	char uuid[UUID_STRING_SIZE];
+	guint i;
+
+	if(data->KIND == BLUEZ_ADVERTISEMENT_MANUFACTURER)
+		g_print("\tManufacturer 0x%04x", data->COMPANY);
+	else
+	{
+		if(!bluetooth_uuid_to_string(data->UUID, uuid))
+			strcpy(uuid, "?");
+		g_print("\tService %s", uuid);
+	}
+
+	g_print(" (%u bytes%s, %.1f s ago):", data->LENGTH, data->TRUNCATED ? ", truncated" : "",
+			(now - data->TIME_US) / (double)G_USEC_PER_SEC);
+
+	for(i = 0; i < data->LENGTH; i++)
+		g_print(" %02x", data->DATA[i]);
+	g_print("\n");
+}
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include "bluez_agent_api.h"
 #include "bluez_dbus_names.h"
+#include "bluez_command.h"
 
 #define AGENT_PATH "/org/bluez/AutoPinAgent"		// freely definable according to agent-api.txt
 
@@ -160,26 +161,11 @@ int bluez_register_agent()
 
 static int bluez_agent_call_method(const gchar *method, GVariant *param)
 {
-        GVariant *result;
-        GError *error = NULL;
-
-        result = g_dbus_connection_call_sync(mCon,
-                                             "org.bluez",
-                                             "/org/bluez",
-                                             "org.bluez.AgentManager1",
-                                             method,
-                                             param,
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NONE,
-                                             -1,
-                                             NULL,
-                                             &error);
-        if(error != NULL) {
-		g_print("Register %s: %s\n", AGENT_PATH, error->message);
+        if(!bluez_command_call_sync("/org/bluez", "org.bluez.AgentManager1", method, param, BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS, NULL)) {
+		g_print("Register %s failed\n", AGENT_PATH);
                 return  1;
 	}
 
-        g_variant_unref(result);
         return 0;
 }
 
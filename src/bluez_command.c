@@ -0,0 +1,370 @@
+/**
+	* @file bluez_command.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement asynchronous bluez method calls with deadlines and cancellation
+	*
+	*	- A command holds two references while it is pending, the caller's and the one of the call in flight,
+	*	  so dropping the handle early never frees memory the reply is still going to use.
+	*	- The reply is dispatched on the GMainContext that was thread default when the command was sent,
+	*	  bluez_command_wait runs that context itself when no other thread is running it.
+	*	- While a trace is replayed the call is not sent, the recorded reply is dispatched the same way from an idle source.
+	*
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_command.h"
+#include "bluez_dbus_names.h"
+#include "bluez_metrics.h"
+#include "bluez_trace.h"
+
+#define METHOD_NAME_SIZE	64
+
+/*
+ * Private Types
+*/
+struct _BluezCommand
+{
+	gint					REF_COUNT;
+	gint					STATE;				// BLUEZ_COMMAND_*
+	char *					PATH;
+	const char *			INTERFACE;			// interned
+	char					METHOD[METHOD_NAME_SIZE];
+	int						METRIC;				// id from bluez_metrics_method
+	gint64					START_US;			// monotonic time the call was sent
+	GCancellable *			CANCELLABLE;
+	GMainContext *			CONTEXT;			// where the reply is dispatched
+	GVariant *				RESULT;
+	GError *				ERROR;
+	char *					ERROR_NAME;			// D-Bus error name bluez replied with, example: org.bluez.Error.AlreadyExists
+	bluez_command_callback	CALLBACK;
+	gpointer				USER_DATA;
+	GMutex					LOCK;
+	GCond					DONE;
+};
+
+/*
+ * Private Function Declerations
+*/
+static void bluez_command_done(GObject *con, GAsyncResult *res, gpointer userData);
+static gboolean bluez_command_replayed(gpointer userData);
+static void bluez_command_complete(BluezCommand * command, GVariant * result, GError * error, int state, char * errorName);
+static void bluez_command_free(BluezCommand * command);
+
+/*
+ * Private Variables
+*/
+static GDBusConnection * mCon;
+static gint mInFlight = 0;
+
+/*
+ * Modifiers
+*/
+int bluez_command_init(GDBusConnection * conn)
+{
+	mCon = conn;
+
+	if(mCon == NULL) {
+		g_printerr("Not able to get connection to system bus\n");
+		/**TODO Need to organize Error Codes */
+		return -3;
+	}
+
+	return 0;
+}
+
+BluezCommand * bluez_command_call(const char * path,
+				const char * interface,
+				const char * method,
+				GVariant * param,
+				int timeoutMs,
+				bluez_command_callback callback,
+				gpointer userData)
+{
+	BluezCommand * command = g_new0(BluezCommand, 1);
+	GSource * source;
+
+	/*1. One reference for the caller, one for the call in flight */
+	command->REF_COUNT = 2;
+	command->STATE = BLUEZ_COMMAND_PENDING;
+	command->PATH = g_strdup(path);
+	command->INTERFACE = g_intern_string(interface);
+	g_strlcpy(command->METHOD, method, sizeof(command->METHOD));
+	command->METRIC = bluez_metrics_method(interface, method);
+	command->CANCELLABLE = g_cancellable_new();
+	command->CONTEXT = g_main_context_ref_thread_default();
+	command->CALLBACK = callback;
+	command->USER_DATA = userData;
+	g_mutex_init(&command->LOCK);
+	g_cond_init(&command->DONE);
+
+	g_atomic_int_inc(&mInFlight);
+	command->START_US = g_get_monotonic_time();
+
+	/*2. A loaded trace answers instead of bluez */
+	if(bluez_trace_is_replaying())
+	{
+		if(param != NULL)
+			g_variant_unref(g_variant_ref_sink(param));
+
+		source = g_idle_source_new();
+		g_source_set_callback(source, bluez_command_replayed, command, NULL);
+		g_source_attach(source, command->CONTEXT);
+		g_source_unref(source);
+		return command;
+	}
+
+	/*3. Send it, the deadline is enforced by GDBus */
+	g_dbus_connection_call(mCon,
+			     BLUEZ_BUS_NAME,						// defined in bluez_dbus_names.h
+			     path,
+			     interface,
+			     method,
+			     param,
+			     NULL,
+			     G_DBUS_CALL_FLAGS_NONE,
+			     timeoutMs,
+			     command->CANCELLABLE,
+			     bluez_command_done,
+			     command);
+
+	return command;
+}
+
+BluezCommand * bluez_command_set_property(const char * path,
+				const char * interface,
+				const char * property,
+				GVariant * value,
+				int timeoutMs,
+				bluez_command_callback callback,
+				gpointer userData)
+{
+	return bluez_command_call(path,
+				"org.freedesktop.DBus.Properties",
+				"Set",
+				g_variant_new("(ssv)", interface, property, value),
+				timeoutMs,
+				callback,
+				userData);
+}
+
+bool bluez_command_call_sync(const char * path,
+				const char * interface,
+				const char * method,
+				GVariant * param,
+				int timeoutMs,
+				GVariant ** result)
+{
+	GMainContext * context = g_main_context_new();
+	BluezCommand * command;
+	bool succeed;
+
+	/*1. A private context, waiting on it never runs anyone else's callbacks */
+	g_main_context_push_thread_default(context);
+	command = bluez_command_call(path, interface, method, param, timeoutMs, NULL, NULL);
+	g_main_context_pop_thread_default(context);
+
+	/*2. Nobody else runs this context, so wait iterates it */
+	succeed = bluez_command_wait(command) == BLUEZ_COMMAND_SUCCEEDED;
+
+	if(!succeed)
+		g_print("%s %s failed: %s\n", path, method, bluez_command_get_error(command));
+	else if(result != NULL)
+		*result = g_variant_ref(command->RESULT);
+
+	bluez_command_unref(command);
+	g_main_context_unref(context);
+
+	return succeed;
+}
+
+void bluez_command_cancel(BluezCommand * command)
+{
+	g_cancellable_cancel(command->CANCELLABLE);
+}
+
+int bluez_command_wait(BluezCommand * command)
+{
+	/*1. Run the context ourselves if it is free, this is also the only way on the thread that owns it */
+	if(g_main_context_acquire(command->CONTEXT))
+	{
+		while(bluez_command_get_state(command) == BLUEZ_COMMAND_PENDING)
+			g_main_context_iteration(command->CONTEXT, TRUE);
+
+		g_main_context_release(command->CONTEXT);
+	}
+	/*2. Another thread runs it, sleep until the reply was handled there */
+	else
+	{
+		g_mutex_lock(&command->LOCK);
+		while(command->STATE == BLUEZ_COMMAND_PENDING)
+			g_cond_wait(&command->DONE, &command->LOCK);
+		g_mutex_unlock(&command->LOCK);
+	}
+
+	return bluez_command_get_state(command);
+}
+
+BluezCommand * bluez_command_ref(BluezCommand * command)
+{
+	g_atomic_int_inc(&command->REF_COUNT);
+	return command;
+}
+
+void bluez_command_unref(BluezCommand * command)
+{
+	if(command != NULL && g_atomic_int_dec_and_test(&command->REF_COUNT))
+		bluez_command_free(command);
+}
+
+/*
+ * Accessors
+*/
+int bluez_command_get_state(BluezCommand * command)
+{
+	return g_atomic_int_get(&command->STATE);
+}
+
+GVariant * bluez_command_get_result(BluezCommand * command)
+{
+	return bluez_command_get_state(command) == BLUEZ_COMMAND_SUCCEEDED ? command->RESULT : NULL;
+}
+
+const char * bluez_command_get_error(BluezCommand * command)
+{
+	if(bluez_command_get_state(command) == BLUEZ_COMMAND_PENDING || command->ERROR == NULL)
+		return NULL;
+
+	return command->ERROR->message;
+}
+
+bool bluez_command_error_is(BluezCommand * command, const char * errorName)
+{
+	if(bluez_command_get_state(command) != BLUEZ_COMMAND_FAILED || command->ERROR_NAME == NULL)
+		return false;
+
+	return strcmp(command->ERROR_NAME, errorName) == 0;
+}
+
+const char * bluez_command_get_method(BluezCommand * command)
+{
+	return command->METHOD;
+}
+
+guint bluez_command_get_in_flight(void)
+{
+	return (guint)g_atomic_int_get(&mInFlight);
+}
+
+/*
+ * Private Functions
+*/
+static void bluez_command_done(GObject *con, GAsyncResult *res, gpointer userData)
+{
+	BluezCommand * command = userData;
+	GError * error = NULL;
+	GVariant * result;
+	int state = BLUEZ_COMMAND_SUCCEEDED;
+	char * errorName = NULL;
+
+	result = g_dbus_connection_call_finish((GDBusConnection *)con, res, &error);
+
+	/*1. Tell the reasons apart, the caller may retry a timeout but not a cancellation */
+	if(result == NULL)
+	{
+		if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			state = BLUEZ_COMMAND_CANCELLED;
+		else if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+			state = BLUEZ_COMMAND_TIMED_OUT;
+		else
+		{
+			state = BLUEZ_COMMAND_FAILED;
+			errorName = g_dbus_error_get_remote_error(error);
+		}
+
+		g_dbus_error_strip_remote_error(error);
+	}
+
+	// cancelled is our own doing, a replay decides that again
+	if(state != BLUEZ_COMMAND_CANCELLED)
+		bluez_trace_record_reply(command->PATH, command->INTERFACE, command->METHOD, state, result, errorName, error != NULL ? error->message : NULL);
+
+	bluez_command_complete(command, result, error, state, errorName);
+}
+
+static gboolean bluez_command_replayed(gpointer userData)
+{
+	BluezCommand * command = userData;
+	GError * error = NULL;
+	GVariant * result = NULL;
+	int state;
+	const char * errorName;
+	const char * message;
+
+	/*1. Cancelled before the idle ran, same as a cancelled call */
+	if(g_cancellable_is_cancelled(command->CANCELLABLE))
+	{
+		g_set_error_literal(&error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Operation was cancelled");
+		bluez_command_complete(command, NULL, error, BLUEZ_COMMAND_CANCELLED, NULL);
+		return G_SOURCE_REMOVE;
+	}
+
+	/*2. The next reply recorded for the method, a call the trace never saw fails */
+	if(!bluez_trace_take_reply(command->PATH, command->INTERFACE, command->METHOD, &state, &result, &errorName, &message))
+	{
+		state = BLUEZ_COMMAND_FAILED;
+		errorName = NULL;
+		message = "Not in trace";
+	}
+
+	if(state == BLUEZ_COMMAND_TIMED_OUT)
+		g_set_error_literal(&error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, message != NULL ? message : "Timeout was reached");
+	else if(state != BLUEZ_COMMAND_SUCCEEDED)
+		g_set_error_literal(&error, G_IO_ERROR, G_IO_ERROR_FAILED, message != NULL ? message : "Failed");
+
+	bluez_command_complete(command, result, error, state, g_strdup(errorName));
+
+	return G_SOURCE_REMOVE;
+}
+
+static void bluez_command_complete(BluezCommand * command, GVariant * result, GError * error, int state, char * errorName)
+{
+	// every call of every module ends here, this is the one place they are timed
+	bluez_metrics_record_call(command->METRIC, g_get_monotonic_time() - command->START_US, state);
+
+	/*1. Publish, fields are written before the state so a reader that sees the state sees them too */
+	g_mutex_lock(&command->LOCK);
+	command->RESULT = result;
+	command->ERROR = error;
+	command->ERROR_NAME = errorName;
+	g_atomic_int_set(&command->STATE, state);
+	g_cond_broadcast(&command->DONE);
+	g_mutex_unlock(&command->LOCK);
+
+	g_atomic_int_add(&mInFlight, -1);
+
+	if(command->CALLBACK != NULL)
+		command->CALLBACK(command, command->USER_DATA);
+
+	/*2. Drop the reference of the call in flight */
+	bluez_command_unref(command);
+}
+
+static void bluez_command_free(BluezCommand * command)
+{
+	if(command->RESULT != NULL)
+		g_variant_unref(command->RESULT);
+	if(command->ERROR != NULL)
+		g_error_free(command->ERROR);
+	g_free(command->ERROR_NAME);
+	g_free(command->PATH);
+
+	g_object_unref(command->CANCELLABLE);
+	g_main_context_unref(command->CONTEXT);
+	g_mutex_clear(&command->LOCK);
+	g_cond_clear(&command->DONE);
+	g_free(command);
+}
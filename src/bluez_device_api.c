@@ -17,39 +17,63 @@
 #include "bluez_device_api.h"
 #include "bluez_dbus_names.h"
 #include "bluetooth_device.h"
+#include "bluez_signal_router.h"
+#include "bluez_rssi_coalescer.h"
+#include "bluez_event_queue.h"
+#include "bluez_advertisement.h"
+#include "bluez_log.h"
 
 /*
 * Private Function Declerations
 */
-static void bluez_signal_device_changed(GDBusConnection *conn,
-                    const gchar *sender,
-                    const gchar *path,
-                    const gchar *interface,
-                    const gchar *signal,
-                    GVariant *params,
-                    void *userdata);
-static void bluez_device_parse_properties(const char* path, const char * key, GVariant * propertyValue);
-static void bluez_device_read_property(const char * path, const char *property);
-static void bluez_device_get_property_cb(GObject *con,GAsyncResult *res,gpointer data);
+static void bluez_signal_device_changed(const char *path, GVariant *changed, GVariant *invalidated, gpointer userdata);
+static void bluez_device_parse_properties(const char* path, GVariant * properties);
+static void bluez_device_apply_properties(const char * path, GVariant * properties);
+static void bluez_device_get_property_cb(BluezCommand * command, gpointer userData);
+static void bluez_device_get_all_properties_cb(BluezCommand * command, gpointer userData);
+static void bluez_device_trusted_cb(BluezCommand * command, gpointer userData);
+static void bluez_device_rssi_flushed(const char * const * paths, const gint16 * rssi, guint count, gpointer userData);
 /*
 *	Private Variables
 */
 GDBusConnection * mCon;
 
 // GDBUS signals
-static guint device_changed;
 
 /*
 * Accessors
 */
 void bluez_device_read_remote_device_properties(const char * devicePath)
 {
-	bluez_device_read_property(devicePath, PROPERTY_ADDRESS);
-	bluez_device_read_property(devicePath, PROPERTY_NAME);
-	bluez_device_read_property(devicePath, PROPERTY_ICON);
-	bluez_device_read_property(devicePath, PROPERTY_PAIRED);
-	bluez_device_read_property(devicePath, PROPERTY_TRUSTED);
-	bluez_device_read_property(devicePath, PROPERTY_ALIAS);
+	// one GetAll instead of a Get per property, the reply holds every property of org.bluez.Device1
+	bluez_command_unref(bluez_command_call(devicePath,
+				"org.freedesktop.DBus.Properties",
+				"GetAll",
+				g_variant_new("(s)", BLUEZ_DEVICE_INTERFACE),
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				bluez_device_get_all_properties_cb,
+				g_strdup(devicePath)));
+}
+
+void bluez_device_refresh_property(const char * path, const char *property)
+{
+
+	GVariant *userData;
+	
+	GVariantBuilder *u = g_variant_builder_new(G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(u, "{sv}", "Path", g_variant_new_string(path));
+	g_variant_builder_add(u, "{sv}", "Property", g_variant_new_string(property));
+	userData = g_variant_builder_end(u);
+	g_variant_builder_unref(u);
+
+	bluez_command_unref(bluez_command_call(path,
+				"org.freedesktop.DBus.Properties",
+				"Get",
+				g_variant_new("(ss)", BLUEZ_DEVICE_INTERFACE, property),
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				bluez_device_get_property_cb,
+				g_variant_ref_sink(g_variant_new_tuple(&userData,1))));
+	
 }
 
 /*
@@ -58,20 +82,15 @@ void bluez_device_read_remote_device_properties(const char * devicePath)
 */
 void bluez_device_init_signals(void)
 {
-	device_changed = g_dbus_connection_signal_subscribe(mCon,
-						BLUEZ_BUS_NAME,						// defined in bluez_dbus_names.h
-						"org.freedesktop.DBus.Properties",
-						"PropertiesChanged",
-						NULL,
-						BLUEZ_DEVICE_INTERFACE,				// defined in bluez_dbus_names.h
-						G_DBUS_SIGNAL_FLAGS_NONE,
-						bluez_signal_device_changed,
-						NULL,
-						NULL);
+	bluez_rssi_coalescer_init(RSSI_COALESCE_DEFAULT_WINDOW_MS, RSSI_COALESCE_LATEST);
+	bluez_rssi_coalescer_set_observer(bluez_device_rssi_flushed, NULL);
+	
+	// devices of every adapter, the daemon drops non device interfaces
+	bluez_signal_router_register(BLUEZ_DEVICE_INTERFACE, BLUEZ_BASE_PATH, bluez_signal_device_changed, NULL);
 }
 void bluez_device_mute_signals(void)
 {
-	g_dbus_connection_signal_unsubscribe(mCon, device_changed);
+	bluez_signal_router_unregister(BLUEZ_DEVICE_INTERFACE);
 }
 
 /*
@@ -94,287 +113,221 @@ int bluez_device_init(GDBusConnection * conn)
 
 bool bluez_device_trust_device(const char * objectPath)
 {
-	GVariant *result;
-	GError *error = NULL;
-	bool succeed = true;
-
 	printf("Trusting Device: %s\n", objectPath);
 	
-	result = g_dbus_connection_call_sync(mCon,
-					     BLUEZ_BUS_NAME,
-					     objectPath,
-					     "org.freedesktop.DBus.Properties",
-					     "Set",
-					     g_variant_new("(ssv)", BLUEZ_DEVICE_INTERFACE, "Trusted", g_variant_new("b", TRUE)),
-					     NULL,
-					     G_DBUS_CALL_FLAGS_NONE,
-					     -1,
-					     NULL,
-					     &error);
-						 
-	g_variant_unref(result);
-	
-	if(error != NULL)
-	{
-		g_print("Error: Device Trust. Message: %s", error->message);
-		g_error_free(error);
-		succeed = false;
-	}
+	// waits on a private context, nothing else runs meanwhile
+	return bluez_command_call_sync(objectPath,
+				"org.freedesktop.DBus.Properties",
+				"Set",
+				g_variant_new("(ssv)", BLUEZ_DEVICE_INTERFACE, "Trusted", g_variant_new_boolean(TRUE)),
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				NULL);
+}
+
+BluezCommand * bluez_device_trust_device_async(const char * objectPath, bluez_command_callback callback, gpointer userData)
+{
+	printf("Trusting Device: %s\n", objectPath);
 	
-	return succeed;
+	return bluez_command_set_property(objectPath,
+				BLUEZ_DEVICE_INTERFACE,
+				"Trusted",
+				g_variant_new("b", TRUE),
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				callback,
+				userData);
 }
 
 bool bluez_device_pair_device(const char *objectPath)
 {
-	GVariant *result;
-	GError *error = NULL;
-	bool succeed = true;
-
 	printf("Pairing Device: %s\n", objectPath);
 	
-	result = g_dbus_connection_call_sync(mCon,
-					     BLUEZ_BUS_NAME,
-					     objectPath,
-					     BLUEZ_DEVICE_INTERFACE,
-					     "Pair",
-					     NULL,
-					     NULL,
-					     G_DBUS_CALL_FLAGS_NONE,
-					     -1,
-					     NULL,
-					     &error);
-						 
-	g_variant_unref(result);
-	
-	if(error != NULL)
-	{
-		g_print("Error:Device Pair. Message: %s", error->message);
-		g_error_free(error);
-		succeed = false;
-	}
+	// Pair waits for the user to accept on the remote device
+	return bluez_command_call_sync(objectPath,
+				BLUEZ_DEVICE_INTERFACE,
+				"Pair",
+				NULL,
+				BLUEZ_COMMAND_PAIR_TIMEOUT_MS,
+				NULL);
+}
+
+BluezCommand * bluez_device_pair_device_async(const char * objectPath, bluez_command_callback callback, gpointer userData)
+{
+	printf("Pairing Device: %s\n", objectPath);
 	
-	return succeed;
+	// Pair waits for the user to accept on the remote device
+	return bluez_command_call(objectPath,
+				BLUEZ_DEVICE_INTERFACE,
+				"Pair",
+				NULL,
+				BLUEZ_COMMAND_PAIR_TIMEOUT_MS,
+				callback,
+				userData);
 }
 
 /*
  * Private Functions
 */
-static void bluez_signal_device_changed(GDBusConnection *conn,
-                    const gchar *sender,
-                    const gchar *path,
-                    const gchar *interface,
-                    const gchar *signal,
-                    GVariant *params,
-                    void *userdata)
+static void bluez_signal_device_changed(const char *path, GVariant *changed, GVariant *invalidated, gpointer userdata)
 {
-    //(void)conn;
-    //(void)sender;
-    (void)path;
-    (void)interface;
-    //(void)userdata;
-    GVariantIter *properties = NULL;
-    GVariantIter *unknown = NULL;
-    const char *iface;
-    const char *key;
-    GVariant *value = NULL;
-    const gchar *signature = g_variant_get_type_string(params);
-	
-	g_print("***\tDevice Signal Properties Changed\t***\n");
-	g_print("- Path:\t%s\n", path);
-	g_print("- Interface:\t%s\n", interface); 
-
-    if(strcmp(signature, "(sa{sv}as)") != 0) {
-        g_print("Invalid signature for %s: %s != %s", signal, signature, "(sa{sv}as)");
-        goto done;
-    }
-
-    g_variant_get(params, "(&sa{sv}as)", &iface, &properties, &unknown);
-    while(g_variant_iter_next(properties, "{&sv}", &key, &value))
-		bluez_device_parse_properties(path,key, value);
-
-	g_print("***\tDevice Signal Properties Changed\t***\n");
+	(void)invalidated;
+	(void)userdata;
 	
-	done:
-		if(properties != NULL)
-			g_variant_iter_free(properties);
-		if(value != NULL)
-			g_variant_unref(value);
+	gint16 rssi;
+	
+	/*1. RSSI on its own is the advertisement storm, it goes to the coalescer without any logging */
+	if(g_variant_lookup(changed, "RSSI", "n", &rssi))
+	{
+		if(g_variant_n_children(changed) == 1)
+		{
+			bluez_rssi_coalescer_push(path, rssi);
+			return;
+		}
+		
+		// this value is newer than what the window holds
+		bluez_rssi_coalescer_discard(path);
+	}
+	
+	BLUEZ_LOG_DEBUG("***\tDevice Signal Properties Changed\t***\n- Path:\t%s\n", path, 0, 0, 0);
+	
+	/*2. the whole dictionary is applied at once */
+	bluez_device_parse_properties(path, changed);
 }
 
-static void bluez_device_read_property(const char * path, const char *property)
+static void bluez_device_rssi_flushed(const char * const * paths, const gint16 * rssi, guint count, gpointer userData)
 {
-
-	GVariant *userData;
-	
-	GVariantBuilder *u = g_variant_builder_new(G_VARIANT_TYPE_VARDICT);
-	g_variant_builder_add(u, "{sv}", "Path", g_variant_new_string(path));
-	g_variant_builder_add(u, "{sv}", "Property", g_variant_new_string(property));
-	userData = g_variant_builder_end(u);
-
-	g_dbus_connection_call(mCon,
-					     BLUEZ_BUS_NAME,						// defined in bluez_dbus_names.h
-					     path,						// defined in bluez_dbus_names.h
-					     "org.freedesktop.DBus.Properties",
-					     "Get",
-					     g_variant_new("(ss)", BLUEZ_DEVICE_INTERFACE, property),
-					     NULL,
-					     G_DBUS_CALL_FLAGS_NONE,
-					     -1,
-						 NULL,
-					     bluez_device_get_property_cb,
-					     g_variant_new_tuple(&userData,1));
+	(void)userData;
+	guint i;
 	
+	// one event per device and window, not per advertisement
+	for(i = 0; i < count; i++)
+		bluez_event_queue_push(BLUEZ_EVENT_DEVICE_RSSI, paths[i], rssi[i]);
 }
 
-static void bluez_device_get_property_cb(GObject *con,GAsyncResult *res,gpointer  userData)
+static void bluez_device_get_property_cb(BluezCommand * command, gpointer userData)
 {
-	GVariant *result = NULL;
 	GVariant * propertyValue = NULL;
-	GVariant *userDataValue;
-	GVariantIter *params = NULL;
-	GError * error = NULL;
-	char path[100];
-	char property[100];
-	char * key;
+	GVariant *request;
+	const char * path = "NULL";
+	const char * property = "NULL";
 	
 	g_print("***\t Inside Property Callback\t***\n");
 	
-	// initialize the values to null
-	strcpy(path,"NULL");
-	strcpy(property,"NULL");
+	// userData is a tuple containing the path and the property we asked to get,
+	// both strings are borrowed from it so it is held until we are done
+	request = g_variant_get_child_value((GVariant *)userData, 0);
+	g_variant_lookup(request, "Path", "&s", &path);
+	g_variant_lookup(request, "Property", "&s", &property);
 	
-	// userData is a tuple containing the path and the property we asked to get
-	g_variant_get((GVariant *)userData, "(a{sv})",&params);
-	
-	// grab the user data
-    while(g_variant_iter_next(params, "{sv}", &key, &userDataValue))
+	// was the call successful?
+	if(bluez_command_get_state(command) != BLUEZ_COMMAND_SUCCEEDED)
 	{
-		if(strcmp(key,"Path") == 0)
-			strcpy(path,g_variant_get_string(userDataValue,NULL));
-		else if(strcmp(key,"Property") == 0)
-			strcpy(property,g_variant_get_string(userDataValue,NULL));		
+		g_print("\t- Unable to get result for Property: %s\n", property);
+		g_print("\t- Error Reason: %s\n", bluez_command_get_error(command));
+		goto done;
 	}
 	
-	if(strcmp(path,"NULL") == 0 || strcmp(property,"NULL") == 0)
+	// okay lets update the property we asked for, the reply stays owned by the command
+	g_variant_get(bluez_command_get_result(command), "(v)", &propertyValue);
+	g_print("\t- Updating <%s>, Type <%s>\n",property,g_variant_get_type_string(propertyValue));
+	
+	// a dictionary with a single entry goes through the same path as GetAll
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&builder, "{sv}", property, propertyValue);
+	bluez_device_apply_properties(path, g_variant_ref_sink(g_variant_builder_end(&builder)));
+	
+	g_variant_unref(propertyValue);
+	
+	done:
+		g_variant_unref(request);
+		g_variant_unref((GVariant *)userData);
+}
+
+static void bluez_device_get_all_properties_cb(BluezCommand * command, gpointer userData)
+{
+	GVariant *result = bluez_command_get_result(command);		// borrowed
+	GVariant *properties;
+	char * path = userData;
+	
+	g_print("***\t Inside GetAll Callback %s\t***\n", path);
+	
+	if(result == NULL || !g_variant_is_of_type(result, G_VARIANT_TYPE("(a{sv})")))
 	{
-		g_print("\t- Error: Invalid path or property\n");
-		g_variant_unref(userDataValue);
+		g_print("\t- Unable to get properties of %s\n", path);
+		g_print("\t- Error Reason: %s\n", result == NULL ? bluez_command_get_error(command) : "Unexpected reply type");
+		g_free(path);
 		return;
 	}
 	
-	// was the call successful?
-	result = g_dbus_connection_call_finish((GDBusConnection *)con, res, &error);
-	if(result == NULL)
-	{
-		g_print("\t- Unable to get result for Property: %s\n", property);
-		g_print("\t- Error Reason: %s\n",error->message);
-		g_error_free(error);
-	}
+	// every property of the device in one dictionary
+	g_variant_get(result, "(@a{sv})", &properties);
+	bluez_device_apply_properties(path, properties);
 	
-	// okay lets update the property we asked for
-	if(result) {
-		result = g_variant_get_child_value(result, 0);
-		if(g_variant_n_children(result) > 0)
-			propertyValue = g_variant_get_child_value(result,0);
-		
-		if(propertyValue)
-		{
-			g_print("\t- Updating <%s>, Value <%s>\n",property,g_variant_print(propertyValue,FALSE));
-			bluez_device_parse_properties(path, property, propertyValue);
-		}
-	}
-	g_variant_unref(result);
-	g_variant_unref(userDataValue);
-	g_variant_unref(propertyValue);
+	g_free(path);
 }
 
-static void bluez_device_parse_properties(const char * path, const char * propertyKey, GVariant * propertyValue)
+static void bluez_device_parse_properties(const char * path, GVariant * properties)
 {
-	g_print("[ Property: '%s'  value: '%s']\n", propertyKey, g_variant_print(propertyValue,TRUE));
-	
-	GVariantIter iter;
-	GVariant *uuid;
+	gboolean connected;
 	BluetoothDevice currentDevice;
 	
-	strcpy(currentDevice.PATH,path);
+	BLUEZ_LOG_DEBUG("[ Properties: %u changed on '%s' ]\n", g_variant_n_children(properties), path, 0, 0);
 	
-	if(strcmp(propertyKey, "Connected") == 0)
-	{
-		if(!g_variant_is_of_type(propertyValue, G_VARIANT_TYPE_BOOLEAN))
-            g_print("Invalid argument type for %s: %s != %s", propertyKey,g_variant_get_type_string(propertyValue), "b");
-		else
-		{
-			// Did we receive a disconnect event
-			if(!g_variant_get_boolean(propertyValue))
-			{
-				bluetooth_device_remove_device_by_path(path);		
-			}
-			else
-			{
-				// device will only get appended if it is new, and currenlty does not exist
-				bluetooth_device_add_device(&currentDevice);
-				bluetooth_device_property_update_connection(path,true);
-				bluez_device_read_remote_device_properties(path);
-			}
-		}
-	}
-	else if(strcmp(propertyKey, "Address") == 0)
-	{
-		if(!g_variant_is_of_type(propertyValue, G_VARIANT_TYPE_STRING))
-            g_print("Invalid argument type for %s: %s != %s", propertyKey,g_variant_get_type_string(propertyValue), "s");
-		else
-			bluetooth_device_property_update_address(path,g_variant_get_string(propertyValue,NULL));
-	}
-	else if(strcmp(propertyKey, "Paired") == 0)
-	{
-		if(!g_variant_is_of_type(propertyValue, G_VARIANT_TYPE_BOOLEAN))
-            g_print("Invalid argument type for %s: %s != %s", propertyKey,g_variant_get_type_string(propertyValue), "b");
-		else
-			bluetooth_device_property_update_paired(path,g_variant_get_boolean(propertyValue));
-	}
-	else if(strcmp(propertyKey, "Trusted") == 0)
+	/*1. Connected decides if the device is in the registry at all */
+	if(g_variant_lookup(properties, "Connected", "b", &connected))
 	{
-		if(!g_variant_is_of_type(propertyValue, G_VARIANT_TYPE_BOOLEAN))
-            g_print("Invalid argument type for %s: %s != %s", propertyKey,g_variant_get_type_string(propertyValue), "b");
-		else
+		bluez_event_queue_push(BLUEZ_EVENT_DEVICE_CONNECTED, path, connected);
+		
+		// Did we receive a disconnect event
+		if(!connected)
 		{
-			if(!g_variant_get_boolean(propertyValue))
-			{
-				// we want to Trust a device we have paired with
-				// find device
-				BluetoothDevice * device = NULL;
-				device = bluetooth_get_device_by_path(path);
-				if(device != NULL)
-					if(bluetooth_device_get_property_paired(device))
-						bluez_device_trust_device(path);
-			}
-			
-			bluetooth_device_property_update_trusted(path,g_variant_get_boolean(propertyValue));
+			bluez_rssi_coalescer_discard(path);
+			bluetooth_device_remove_device_by_path(path);
+			return;
 		}
+		
+		// device will only get appended if it is new, and currenlty does not exist
+		bluetooth_device_init_properties(&currentDevice, path);
+		bluetooth_device_add_device(&currentDevice);
+		bluez_device_read_remote_device_properties(path);
 	}
-	else if(strcmp(propertyKey, "Alias") == 0)
-	{
-		if(!g_variant_is_of_type(propertyValue, G_VARIANT_TYPE_STRING))
-            g_print("Invalid argument type for %s: %s != %s", propertyKey,g_variant_get_type_string(propertyValue), "s");
-		else
-			bluetooth_device_property_update_alias(path,g_variant_get_string(propertyValue,NULL));
-	}
-	else if(strcmp(propertyKey, "RSSI") == 0)
-	{
-		if(!g_variant_is_of_type(propertyValue, G_VARIANT_TYPE_INT16))
-            g_print("Invalid argument type for %s: %s != %s", propertyKey,g_variant_get_type_string(propertyValue), "n");
-		else
-			bluetooth_device_property_update_RSSI(path,g_variant_get_int16(propertyValue));
-	}
-	else if(strcmp(propertyKey, "UUIDs") == 0)
+	
+	/*2. Apply every property with a single lookup */
+	bluez_device_apply_properties(path, g_variant_ref(properties));
+}
+
+// takes ownership of properties
+static void bluez_device_apply_properties(const char * path, GVariant * properties)
+{
+	guint dirty;
+	guint payloads;
+	BluetoothDevice currentDevice;
+	
+	dirty = bluetooth_device_update_properties(path, properties);
+	
+	// ManufacturerData and ServiceData are kept outside the registry, copies of a device stay small
+	payloads = bluez_advertisement_update(path, properties);
+	if(payloads > 0)
+		bluez_event_queue_push(BLUEZ_EVENT_DEVICE_ADVERTISEMENT, path, (gint16)payloads);
+	
+	/*1. We want to Trust a device we have paired with, the reply comes back on the loop, Trusted with a signal */
+	// Paired too, a device that was just paired or is read paired but not trusted only changes that one
+	if(dirty & (BLUETOOTH_DEVICE_DIRTY_PAIRED | BLUETOOTH_DEVICE_DIRTY_TRUSTED))
 	{
-		if(!g_variant_is_of_type(propertyValue,G_VARIANT_TYPE_STRING_ARRAY))
-            g_print("Invalid argument type for %s: %s != %s", propertyKey,g_variant_get_type_string(propertyValue), "as");
-		else
-		{
-			g_variant_iter_init(&iter, propertyValue);
-			while((uuid = g_variant_iter_next_value(&iter)))
-				bluetooth_device_property_add_service_UUID(path,g_variant_get_string(uuid,NULL));
-		}
+		if(bluetooth_device_copy_by_path(path, &currentDevice))
+			if(!currentDevice.TRUSTED && bluetooth_device_get_property_paired(&currentDevice))
+				bluez_command_unref(bluez_device_trust_device_async(path, bluez_device_trusted_cb, g_strdup(path)));
 	}
+	
+	g_variant_unref(properties);
+}
+
+static void bluez_device_trusted_cb(BluezCommand * command, gpointer userData)
+{
+	char * path = userData;
+	
+	if(bluez_command_get_state(command) != BLUEZ_COMMAND_SUCCEEDED)
+		g_print("Error: Device Trust %s. Message: %s\n", path, bluez_command_get_error(command));
+	
+	g_free(path);
 }
@@ -0,0 +1,291 @@
+/**
+	* @file bluez_discovery.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the discovery controller, the filter of the scan follows the signal rate
+	*
+	*	- The rate is the PropertiesChanged count of the signal router over one period, the registry size
+	*	  comes from bluetooth_device. Both are read from a timeout on the main loop, nothing is added to the
+	*	  signal path itself.
+	*	- A step is one SetDiscoveryFilter on every powered adapter through bluez_adapter_set_filter_all,
+	*	  bluez keeps scanning with the new filter. The filter also becomes the one the next scan starts with.
+	*	- A step no adapter takes, a controller without LE for example, is undone and becomes the top of the ladder.
+	*
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_discovery.h"
+#include "bluez_adapter_api.h"
+#include "bluez_signal_router.h"
+#include "bluetooth_device.h"
+#include "bluez_dbus_names.h"
+
+#define TRANSPORT_LEVEL		4			// first step that scans the transport of the targets only
+
+/*
+ * Private Function Declerations
+*/
+static gboolean bluez_discovery_tick(gpointer userData);
+static bool bluez_discovery_apply(guint level);
+static void bluez_discovery_level_filter(guint level, DiscoveryFilter * filter);
+static void bluez_discovery_print_filter(const char * label, const DiscoveryFilter * filter);
+static int bluez_discovery_powered_adapters(void);
+
+/*
+ * Private Variables
+*/
+static const guint8 mThresholds[BLUEZ_DISCOVERY_LEVELS] = { 0, 0, 90, 80, 80, 70, 60 };	// dBm, 0 keeps the one of step 0
+
+static DiscoveryBudget mBudget;
+static DiscoveryFilter mBase;			// step 0
+static DiscoveryStats mStats;
+static guint mSource;
+static guint64 mLastSignals;
+static gint64 mLastUs;
+static guint mCalm;						// calm periods in a row
+static bool mReportPending;				// print the rate after the last step at the next tick
+static double mRateBefore;
+
+/*
+ * Modifiers
+*/
+void bluez_discovery_default_budget(DiscoveryBudget * budget)
+{
+	budget->MAX_RATE = BLUEZ_DISCOVERY_DEFAULT_MAX_RATE;
+	budget->MIN_RATE = BLUEZ_DISCOVERY_DEFAULT_MIN_RATE;
+	budget->MAX_DEVICES = BLUEZ_DISCOVERY_DEFAULT_MAX_DEVICES;
+	budget->PERIOD_MS = BLUEZ_DISCOVERY_DEFAULT_PERIOD_MS;
+	budget->RSSI_LIMIT = BLUEZ_DISCOVERY_DEFAULT_RSSI_LIMIT;
+	budget->USE_PATHLOSS = false;
+
+	// the A2DP sources we look for are phones, they are found by inquiry
+	strcpy(budget->TRANSPORT, "bredr");
+}
+
+bool bluez_discovery_start(const DiscoveryBudget * budget)
+{
+	if(mStats.RUNNING)
+		return false;
+
+	if(budget != NULL)
+		mBudget = *budget;
+	else
+		bluez_discovery_default_budget(&mBudget);
+
+	/*1. Whatever scans start with is step 0 */
+	bluez_adapter_get_filter(&mBase);
+
+	memset(&mStats, 0, sizeof(mStats));
+	mStats.RUNNING = true;
+	mStats.MAX_LEVEL = BLUEZ_DISCOVERY_LEVELS - 1;
+	mCalm = 0;
+	mReportPending = false;
+	mLastSignals = bluez_signal_router_get_signal_count();
+	mLastUs = g_get_monotonic_time();
+
+	mSource = g_timeout_add(mBudget.PERIOD_MS, bluez_discovery_tick, NULL);
+
+	g_print("Discovery: controller started, budget %u..%u signals/s, %u devices, every %u ms\n",
+			mBudget.MIN_RATE, mBudget.MAX_RATE, mBudget.MAX_DEVICES, mBudget.PERIOD_MS);
+
+	return true;
+}
+
+void bluez_discovery_stop(void)
+{
+	DiscoveryFilter filter;
+
+	if(!mStats.RUNNING)
+		return;
+
+	g_source_remove(mSource);
+	mSource = 0;
+
+	/*1. Leave the scan the way it was before us, even if an adapter does not take it the next scan will */
+	if(mStats.LEVEL != 0)
+	{
+		bluez_discovery_level_filter(0, &filter);
+		g_print("Discovery: level %u -> 0\n", mStats.LEVEL);
+		bluez_discovery_print_filter("\tafter: ", &filter);
+		bluez_adapter_set_filter_all(&filter);
+		mStats.LEVEL = 0;
+	}
+
+	mStats.RUNNING = false;
+	g_print("Discovery: controller stopped, %u steps up, %u steps back\n", mStats.TIGHTENED, mStats.RELAXED);
+}
+
+/*
+ * Accessors
+*/
+bool bluez_discovery_is_running(void)
+{
+	return mStats.RUNNING;
+}
+
+void bluez_discovery_get_stats(DiscoveryStats * stats)
+{
+	*stats = mStats;
+}
+
+void bluez_discovery_print_stats(void)
+{
+	DiscoveryStats stats;
+	DiscoveryFilter filter;
+
+	bluez_discovery_get_stats(&stats);
+
+	g_print("***\t Discovery Controller \t***\n");
+	g_print("- Running:\t%s\n", stats.RUNNING ? "yes" : "no");
+	g_print("- Level:\t%u of %u\n", stats.LEVEL, stats.MAX_LEVEL);
+	g_print("- Rate:\t\t%.0f signals/s\n", stats.RATE);
+	g_print("- Devices:\t%d\n", stats.DEVICES);
+	g_print("- Steps:\t%u up, %u back, %u rejected\n", stats.TIGHTENED, stats.RELAXED, stats.REJECTED);
+
+	bluez_adapter_get_filter(&filter);
+	bluez_discovery_print_filter("- Filter:", &filter);
+}
+
+/*
+ * Private Functions
+*/
+static gboolean bluez_discovery_tick(gpointer userData)
+{
+	(void)userData;
+
+	gint64 now = g_get_monotonic_time();
+	guint64 signals = bluez_signal_router_get_signal_count();
+	guint level = mStats.LEVEL;
+	bool busy;
+	bool calm;
+
+	/*1. Measure the period that just ended */
+	mStats.RATE = now > mLastUs ? (signals - mLastSignals) * (double)G_USEC_PER_SEC / (now - mLastUs) : 0.0;
+	mStats.DEVICES = bluetooth_device_get_number_devices();
+	mLastSignals = signals;
+	mLastUs = now;
+
+	// a whole period under the new filter
+	if(mReportPending)
+	{
+		g_print("Discovery: level %u after: %.0f signals/s, was %.0f signals/s\n", mStats.LEVEL, mStats.RATE, mRateBefore);
+		mReportPending = false;
+	}
+
+	/*2. A large registry only counts while the scan is not calm, tightening does not make it smaller */
+	busy = mStats.RATE > mBudget.MAX_RATE || (mStats.DEVICES > (int)mBudget.MAX_DEVICES && mStats.RATE > mBudget.MIN_RATE);
+	calm = mStats.RATE < mBudget.MIN_RATE && mStats.DEVICES <= (int)mBudget.MAX_DEVICES;
+
+	if(busy)
+	{
+		mCalm = 0;
+		if(mStats.LEVEL < mStats.MAX_LEVEL)
+			level = mStats.LEVEL + 1;
+	}
+	else if(calm && mStats.LEVEL > 0)
+	{
+		// step back slowly, a burst that stopped for one period usually comes back
+		if(++mCalm >= BLUEZ_DISCOVERY_RELAX_PERIODS)
+		{
+			level = mStats.LEVEL - 1;
+			mCalm = 0;
+		}
+	}
+	else
+		mCalm = 0;
+
+	/*3. One step at a time */
+	if(level != mStats.LEVEL && bluez_discovery_apply(level))
+	{
+		if(level > mStats.LEVEL)
+			mStats.TIGHTENED++;
+		else
+			mStats.RELAXED++;
+
+		mStats.LEVEL = level;
+		mRateBefore = mStats.RATE;
+		mReportPending = true;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static bool bluez_discovery_apply(guint level)
+{
+	DiscoveryFilter before;
+	DiscoveryFilter after;
+	int powered = bluez_discovery_powered_adapters();
+
+	bluez_discovery_level_filter(mStats.LEVEL, &before);
+	bluez_discovery_level_filter(level, &after);
+
+	g_print("Discovery: level %u -> %u at %.0f signals/s, %d devices, budget %u..%u signals/s, %u devices\n",
+			mStats.LEVEL, level, mStats.RATE, mStats.DEVICES, mBudget.MIN_RATE, mBudget.MAX_RATE, mBudget.MAX_DEVICES);
+	bluez_discovery_print_filter("\tbefore:", &before);
+	bluez_discovery_print_filter("\tafter: ", &after);
+
+	/*1. Nobody powered takes it at the next scan, otherwise at least one adapter must take it */
+	if(bluez_adapter_set_filter_all(&after) > 0 || powered == 0)
+		return true;
+
+	/*2. Rejected, put the old one back and never go this high again */
+	g_print("Discovery: level %u rejected by every adapter, staying at %u\n", level, mStats.LEVEL);
+	bluez_adapter_set_filter_all(&before);
+	mStats.REJECTED++;
+	if(level > mStats.LEVEL)
+		mStats.MAX_LEVEL = mStats.LEVEL;
+
+	return false;
+}
+
+static void bluez_discovery_level_filter(guint level, DiscoveryFilter * filter)
+{
+	gint16 rssi;
+
+	*filter = mBase;
+
+	if(level >= 1)
+		filter->DUPLICATE_DATA = false;
+
+	if(level >= TRANSPORT_LEVEL)
+		g_strlcpy(filter->TRANSPORT, mBudget.TRANSPORT, sizeof(filter->TRANSPORT));
+
+	if(mThresholds[level] == 0)
+		return;
+
+	/*1. Never past the limit, never weaker than step 0 */
+	rssi = MIN(-(gint16)mThresholds[level], mBudget.RSSI_LIMIT);
+	rssi = MAX(rssi, mBase.RSSI);
+
+	if(mBudget.USE_PATHLOSS)
+		filter->PATHLOSS = (guint16)-rssi;
+	else
+		filter->RSSI = rssi;
+}
+
+static void bluez_discovery_print_filter(const char * label, const DiscoveryFilter * filter)
+{
+	if(filter->PATHLOSS != 0)
+		g_print("%s Transport %s, Pathloss %u, DuplicateData %s\n", label, filter->TRANSPORT, filter->PATHLOSS, filter->DUPLICATE_DATA ? "on" : "off");
+	else
+		g_print("%s Transport %s, RSSI %d, DuplicateData %s\n", label, filter->TRANSPORT, filter->RSSI, filter->DUPLICATE_DATA ? "on" : "off");
+}
+
+static int bluez_discovery_powered_adapters(void)
+{
+	BluezAdapter * adapter;
+	int powered = 0;
+	int i;
+
+	for(i = 0; i < BLUEZ_MAX_ADAPTERS; i++)
+	{
+		adapter = bluez_adapter_get(i);
+		if(adapter != NULL && adapter->POWERED)
+			powered++;
+	}
+
+	return powered;
+}
@@ -0,0 +1,220 @@
+/**
+	* @file bluez_event_queue.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the single producer / single consumer event ring
+	*
+	*	- mHead is only written by the producer and mTail only by the consumer, each side publishes its
+	*	  counter after the slots it touched, so no slot is ever read while it is written.
+	*	- Each side keeps a private copy of the other's counter and only reads the shared one when the
+	*	  copy says the ring is full or empty, the two cache lines are not bounced on every event.
+	*	- A consumer with nothing to do sleeps on a GCond, the producer only takes the lock when one does.
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_event_queue.h"
+
+#define BLUEZ_EVENT_QUEUE_MASK		(BLUEZ_EVENT_QUEUE_SIZE - 1)
+#define CACHE_LINE_SIZE				64
+
+#if (BLUEZ_EVENT_QUEUE_SIZE & BLUEZ_EVENT_QUEUE_MASK) != 0
+#error "BLUEZ_EVENT_QUEUE_SIZE must be a power of 2"
+#endif
+
+/*
+ * Private Types
+*/
+// the fields of each side on a cache line of their own, the size is rounded up to it too
+typedef struct _ProducerSide
+{
+	gint		HEAD;				// next slot to write, shared
+	guint		CACHED_TAIL;		// last tail seen
+	guint64		PUSHED;
+	guint64		DROPPED;
+	guint		MAX_DEPTH;
+} __attribute__((aligned(CACHE_LINE_SIZE))) ProducerSide;
+
+typedef struct _ConsumerSide
+{
+	gint		TAIL;				// next slot to read, shared
+	guint		CACHED_HEAD;		// last head seen
+	guint64		POPPED;
+} __attribute__((aligned(CACHE_LINE_SIZE))) ConsumerSide;
+
+/*
+ * Private Variables
+*/
+static BluezEvent mRing[BLUEZ_EVENT_QUEUE_SIZE];
+static ProducerSide mProducer;
+static ConsumerSide mConsumer;
+static gint mWaiting = 0;			// the consumer sleeps in bluez_event_queue_wait
+static bool mWakeup = false;
+static GMutex mLock;
+static GCond mCond;
+
+/*
+ * Modifiers
+*/
+bool bluez_event_queue_push(guint16 type, const char * path, gint16 value)
+{
+	guint head = (guint)mProducer.HEAD;
+	BluezEvent * event;
+
+	/*1. Full by the cached tail, read the real one before giving up */
+	if(head - mProducer.CACHED_TAIL >= BLUEZ_EVENT_QUEUE_SIZE)
+	{
+		mProducer.CACHED_TAIL = (guint)g_atomic_int_get(&mConsumer.TAIL);
+		if(head - mProducer.CACHED_TAIL >= BLUEZ_EVENT_QUEUE_SIZE)
+		{
+			mProducer.DROPPED++;
+			return false;
+		}
+	}
+
+	/*2. Fill the slot, then publish it */
+	event = &mRing[head & BLUEZ_EVENT_QUEUE_MASK];
+	event->TIME_US = g_get_monotonic_time();
+	g_strlcpy(event->PATH, path != NULL ? path : "", sizeof(event->PATH));
+	event->TYPE = type;
+	event->VALUE = value;
+
+	g_atomic_int_set(&mProducer.HEAD, (gint)(head + 1));
+
+	// depth against the cached tail, an upper bound of the real one
+	mProducer.PUSHED++;
+	if(head + 1 - mProducer.CACHED_TAIL > mProducer.MAX_DEPTH)
+		mProducer.MAX_DEPTH = head + 1 - mProducer.CACHED_TAIL;
+
+	/*3. Only a sleeping consumer costs a lock */
+	if(g_atomic_int_get(&mWaiting))
+	{
+		g_mutex_lock(&mLock);
+		g_cond_signal(&mCond);
+		g_mutex_unlock(&mLock);
+	}
+
+	return true;
+}
+
+guint bluez_event_queue_pop_batch(BluezEvent * events, guint max)
+{
+	guint tail = (guint)mConsumer.TAIL;
+	guint count;
+	guint i;
+
+	/*1. Empty by the cached head, read the real one */
+	if(mConsumer.CACHED_HEAD == tail)
+		mConsumer.CACHED_HEAD = (guint)g_atomic_int_get(&mProducer.HEAD);
+
+	count = mConsumer.CACHED_HEAD - tail;
+	if(count > max)
+		count = max;
+
+	/*2. Copy the batch out, then hand the slots back */
+	for(i = 0; i < count; i++)
+		events[i] = mRing[(tail + i) & BLUEZ_EVENT_QUEUE_MASK];
+
+	if(count > 0)
+	{
+		g_atomic_int_set(&mConsumer.TAIL, (gint)(tail + count));
+		mConsumer.POPPED += count;
+	}
+
+	return count;
+}
+
+bool bluez_event_queue_wait(guint timeoutMs)
+{
+	gint64 endTime;
+	bool ready;
+
+	if((guint)g_atomic_int_get(&mProducer.HEAD) != (guint)mConsumer.TAIL)
+		return true;
+
+	endTime = g_get_monotonic_time() + (gint64)timeoutMs * 1000;
+
+	g_mutex_lock(&mLock);
+
+	/*1. Announce the sleep before the last look, a push after it will signal */
+	g_atomic_int_set(&mWaiting, 1);
+
+	while(!mWakeup && (guint)g_atomic_int_get(&mProducer.HEAD) == (guint)mConsumer.TAIL)
+	{
+		if(!g_cond_wait_until(&mCond, &mLock, endTime))
+			break;
+	}
+
+	g_atomic_int_set(&mWaiting, 0);
+	mWakeup = false;
+	ready = (guint)g_atomic_int_get(&mProducer.HEAD) != (guint)mConsumer.TAIL;
+
+	g_mutex_unlock(&mLock);
+
+	return ready;
+}
+
+void bluez_event_queue_wakeup(void)
+{
+	g_mutex_lock(&mLock);
+	mWakeup = true;
+	g_cond_signal(&mCond);
+	g_mutex_unlock(&mLock);
+}
+
+/*
+ * Accessors
+*/
+void bluez_event_queue_get_stats(BluezEventQueueStats * stats)
+{
+	guint head = (guint)g_atomic_int_get(&mProducer.HEAD);
+	guint tail = (guint)g_atomic_int_get(&mConsumer.TAIL);
+
+	// the counters are read without a lock, a snapshot that is off by a few events is good enough here
+	stats->PUSHED = mProducer.PUSHED;
+	stats->POPPED = mConsumer.POPPED;
+	stats->DROPPED = mProducer.DROPPED;
+	stats->DEPTH = head - tail;
+	stats->MAX_DEPTH = mProducer.MAX_DEPTH;
+}
+
+void bluez_event_queue_print_stats(void)
+{
+	BluezEventQueueStats stats;
+
+	bluez_event_queue_get_stats(&stats);
+
+	g_print("***\t Event Queue \t***\n");
+	g_print("- Pushed:\t%llu\n", (unsigned long long)stats.PUSHED);
+	g_print("- Popped:\t%llu\n", (unsigned long long)stats.POPPED);
+	g_print("- Dropped:\t%llu\n", (unsigned long long)stats.DROPPED);
+	g_print("- Depth:\t%u / %u (max %u)\n", stats.DEPTH, BLUEZ_EVENT_QUEUE_SIZE, stats.MAX_DEPTH);
+}
+
+gint16 bluez_event_status_from_string(const char * status)
+{
+	if(strcmp(status, "playing") == 0)
+		return BLUEZ_EVENT_STATUS_PLAYING;
+	if(strcmp(status, "paused") == 0)
+		return BLUEZ_EVENT_STATUS_PAUSED;
+	if(strcmp(status, "stopped") == 0)
+		return BLUEZ_EVENT_STATUS_STOPPED;
+	if(strcmp(status, "forward-seek") == 0)
+		return BLUEZ_EVENT_STATUS_FORWARD_SEEK;
+	if(strcmp(status, "reverse-seek") == 0)
+		return BLUEZ_EVENT_STATUS_REVERSE_SEEK;
+
+	return BLUEZ_EVENT_STATUS_ERROR;
+}
+
+void bluez_event_print(const BluezEvent * event)
+{
+	static const char * const names[] = {
+		"Unknown", "Device Added", "Device Removed", "Device Connected", "Device RSSI",
+		"Adapter Powered", "Adapter Discovering", "Player Connected", "Player Status", "Player Track",
+		"Device Advertisement"
+	};
+	const char * name = event->TYPE < G_N_ELEMENTS(names) ? names[event->TYPE] : names[0];
+
+	g_print("[ Event ] %s\t%s\t%d\n", name, event->PATH[0] != '\0' ? event->PATH : "-", event->VALUE);
+}
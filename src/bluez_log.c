@@ -0,0 +1,409 @@
+/**
+	* @file bluez_log.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the deferred logger used on the hot paths
+	*
+	*	- Every thread that logs gets its own single producer / single consumer ring the first time it logs,
+	*	  the thread is the producer and the writer thread the consumer, so a log call never takes a lock.
+	*	- Rings are kept after their thread exits, records it wrote before are still printed.
+	*	- The format is only walked to find the %s arguments, their strings are copied into the record so
+	*	  the caller may free or reuse them as soon as the log call returns.
+	*	- The writer formats a whole pass into one buffer and prints it with a single call.
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_log.h"
+
+#define BLUEZ_LOG_RING_MASK		(BLUEZ_LOG_RING_SIZE - 1)
+#define CACHE_LINE_SIZE			64
+#define LOG_SPEC_SIZE			16
+#define LOG_SPEC_FLAGS			"-+ #0123456789."		// between % and the length modifier
+
+#if (BLUEZ_LOG_RING_SIZE & BLUEZ_LOG_RING_MASK) != 0
+#error "BLUEZ_LOG_RING_SIZE must be a power of 2"
+#endif
+
+/*
+ * Private Types
+*/
+typedef struct _LogRecord
+{
+	const char *	FORMAT;
+	guint64			ARGS[BLUEZ_LOG_MAX_ARGS];		// a copied %s argument is its offset in STRINGS
+	gint			LEVEL;
+	guint8			COPIED;							// bit n is set if ARGS[n] was copied
+	char			STRINGS[BLUEZ_LOG_STRING_SIZE];
+} LogRecord;
+
+typedef struct _LogRing
+{
+	// owning thread
+	gint				HEAD;				// next record to write, shared
+	guint				CACHED_TAIL;		// last tail seen
+	guint64				WRITTEN;
+	guint64				DROPPED;
+
+	// writer thread
+	gint				TAIL __attribute__((aligned(CACHE_LINE_SIZE)));		// next record to print, shared
+
+	struct _LogRing *	NEXT;				// set once before the ring is published
+	LogRecord			RECORDS[BLUEZ_LOG_RING_SIZE];
+} LogRing;
+
+/*
+ * Private Function Declerations
+*/
+static LogRing * bluez_log_ring_new(void);
+static void bluez_log_copy_strings(LogRecord * record);
+static gpointer bluez_log_writer(gpointer userData);
+static guint bluez_log_drain(GString * out);
+static void bluez_log_format(GString * out, const LogRecord * record);
+
+/*
+ * Private Variables
+*/
+gint bluez_log_runtime_level = BLUEZ_LOG_LEVEL_INFO;
+
+static __thread LogRing * tRing = NULL;		// ring of the calling thread
+static LogRing * mRings = NULL;				// every ring, newest first, only ever prepended to
+static GMutex mLock;
+static GCond mCond;
+static GThread * mWriter = NULL;
+static gint mStop = false;						// atomic, GMutex is a bare futex that ThreadSanitizer can not see
+static guint64 mPrinted = 0;
+
+/*
+ * Modifiers
+*/
+bool bluez_log_init(int level)
+{
+	if(mWriter != NULL)
+		return false;
+
+	bluez_log_set_level(level);
+
+	g_atomic_int_set(&mStop, false);
+	mWriter = g_thread_new("bluez_log", bluez_log_writer, NULL);
+
+	return true;
+}
+
+void bluez_log_deinit(void)
+{
+	if(mWriter == NULL)
+		return;
+
+	/*1. The writer drains every ring one last time before it leaves */
+	g_mutex_lock(&mLock);
+	g_atomic_int_set(&mStop, true);
+	g_cond_signal(&mCond);
+	g_mutex_unlock(&mLock);
+
+	g_thread_join(mWriter);
+	mWriter = NULL;
+}
+
+void bluez_log_set_level(int level)
+{
+	g_atomic_int_set(&bluez_log_runtime_level, level);
+}
+
+void bluez_log_write(int level, const char * format, guint64 a, guint64 b, guint64 c, guint64 d)
+{
+	LogRing * ring = tRing;
+	LogRecord * record;
+	guint head;
+
+	if(ring == NULL)
+		ring = bluez_log_ring_new();
+
+	/*1. Full by the cached tail, read the real one before dropping */
+	head = (guint)ring->HEAD;
+	if(head - ring->CACHED_TAIL >= BLUEZ_LOG_RING_SIZE)
+	{
+		ring->CACHED_TAIL = (guint)g_atomic_int_get(&ring->TAIL);
+		if(head - ring->CACHED_TAIL >= BLUEZ_LOG_RING_SIZE)
+		{
+			ring->DROPPED++;
+			return;
+		}
+	}
+
+	/*2. Copy, nothing is formatted here, then publish */
+	record = &ring->RECORDS[head & BLUEZ_LOG_RING_MASK];
+	record->FORMAT = format;
+	record->ARGS[0] = a;
+	record->ARGS[1] = b;
+	record->ARGS[2] = c;
+	record->ARGS[3] = d;
+	record->LEVEL = level;
+	bluez_log_copy_strings(record);
+
+	g_atomic_int_set(&ring->HEAD, (gint)(head + 1));
+	ring->WRITTEN++;
+}
+
+/*
+ * Accessors
+*/
+int bluez_log_get_level(void)
+{
+	return g_atomic_int_get(&bluez_log_runtime_level);
+}
+
+void bluez_log_get_stats(BluezLogStats * stats)
+{
+	LogRing * ring;
+
+	memset(stats, 0, sizeof(BluezLogStats));
+
+	// the counters of each ring are read without a lock, a snapshot that is off by a few records is good enough here
+	for(ring = g_atomic_pointer_get(&mRings); ring != NULL; ring = ring->NEXT)
+	{
+		stats->WRITTEN += ring->WRITTEN;
+		stats->DROPPED += ring->DROPPED;
+		stats->THREADS++;
+	}
+
+	g_mutex_lock(&mLock);
+	stats->PRINTED = mPrinted;
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_log_print_stats(void)
+{
+	BluezLogStats stats;
+
+	bluez_log_get_stats(&stats);
+
+	g_print("***\t Log \t***\n");
+	g_print("- Level:\t%d (compiled up to %d)\n", bluez_log_get_level(), BLUEZ_LOG_COMPILE_LEVEL);
+	g_print("- Written:\t%llu\n", (unsigned long long)stats.WRITTEN);
+	g_print("- Printed:\t%llu\n", (unsigned long long)stats.PRINTED);
+	g_print("- Dropped:\t%llu\n", (unsigned long long)stats.DROPPED);
+	g_print("- Threads:\t%u\n", stats.THREADS);
+}
+
+/*
+ * Private Functions
+*/
+static LogRing * bluez_log_ring_new(void)
+{
+	LogRing * ring = g_new0(LogRing, 1);
+
+	/*1. Prepend, the writer walks the list without the lock */
+	g_mutex_lock(&mLock);
+	ring->NEXT = mRings;
+	g_atomic_pointer_set(&mRings, ring);
+	g_mutex_unlock(&mLock);
+
+	tRing = ring;
+
+	return ring;
+}
+
+static void bluez_log_copy_strings(LogRecord * record)
+{
+	const char * format = record->FORMAT;
+	const char * string;
+	gsize used = 0;
+	gsize length;
+	int arg = 0;
+
+	record->COPIED = 0;
+
+	/*1. Only the conversions are looked at, the same way bluez_log_format reads them */
+	while(arg < BLUEZ_LOG_MAX_ARGS && (format = strchr(format, '%')) != NULL)
+	{
+		if(format[1] == '%')
+		{
+			format += 2;
+			continue;
+		}
+
+		format += 1 + strspn(format + 1, LOG_SPEC_FLAGS);
+		format += strspn(format, "hl");
+		if(*format == '\0')
+			break;
+
+		/*2. Copy what fits, a NULL stays a NULL */
+		string = (const char *)(guintptr)record->ARGS[arg];
+		if(*format == 's' && string != NULL)
+		{
+			length = used < BLUEZ_LOG_STRING_SIZE ? strnlen(string, BLUEZ_LOG_STRING_SIZE - used - 1) : 0;
+			if(used + length < BLUEZ_LOG_STRING_SIZE)
+			{
+				memcpy(record->STRINGS + used, string, length);
+				record->STRINGS[used + length] = '\0';
+				record->ARGS[arg] = used;
+				record->COPIED |= 1u << arg;
+				used += length + 1;
+			}
+			else
+				record->ARGS[arg] = 0;		// no room left, printed as (null)
+		}
+
+		format++;
+		arg++;
+	}
+}
+
+static gpointer bluez_log_writer(gpointer userData)
+{
+	(void)userData;
+
+	GString * out = g_string_sized_new(4096);
+	gint64 endTime;
+	bool stop = false;
+
+	while(!stop)
+	{
+		/*1. Sleep for a flush period, deinit cuts it short */
+		g_mutex_lock(&mLock);
+		endTime = g_get_monotonic_time() + BLUEZ_LOG_FLUSH_MS * 1000;
+		while(!g_atomic_int_get(&mStop) && g_cond_wait_until(&mCond, &mLock, endTime))
+			;
+		stop = g_atomic_int_get(&mStop);
+		g_mutex_unlock(&mLock);
+
+		/*2. One buffer and one write per pass */
+		if(bluez_log_drain(out) > 0)
+		{
+			fwrite(out->str, 1, out->len, stdout);
+			fflush(stdout);
+			g_string_truncate(out, 0);
+		}
+	}
+
+	g_string_free(out, TRUE);
+
+	return NULL;
+}
+
+static guint bluez_log_drain(GString * out)
+{
+	LogRing * ring;
+	guint printed = 0;
+
+	for(ring = g_atomic_pointer_get(&mRings); ring != NULL; ring = ring->NEXT)
+	{
+		guint tail = (guint)ring->TAIL;
+		guint head = (guint)g_atomic_int_get(&ring->HEAD);
+
+		for(; tail != head; tail++, printed++)
+			bluez_log_format(out, &ring->RECORDS[tail & BLUEZ_LOG_RING_MASK]);
+
+		// hand the records back only once they were formatted
+		g_atomic_int_set(&ring->TAIL, (gint)tail);
+	}
+
+	g_mutex_lock(&mLock);
+	mPrinted += printed;
+	g_mutex_unlock(&mLock);
+
+	return printed;
+}
+
+static void bluez_log_format(GString * out, const LogRecord * record)
+{
+	const char * format = record->FORMAT;
+	char spec[LOG_SPEC_SIZE];
+	int arg = 0;
+
+	// the hot paths log at debug and trace, only problems stand out
+	if(record->LEVEL == BLUEZ_LOG_LEVEL_ERROR)
+		g_string_append(out, "Error: ");
+	else if(record->LEVEL == BLUEZ_LOG_LEVEL_WARN)
+		g_string_append(out, "Warning: ");
+
+	while(*format != '\0')
+	{
+		const char * start = format;
+		int length = 0;
+		guint64 value;
+
+		if(*format != '%')
+		{
+			g_string_append_c(out, *format++);
+			continue;
+		}
+
+		if(format[1] == '%')
+		{
+			g_string_append_c(out, '%');
+			format += 2;
+			continue;
+		}
+
+		/*1. Flags, width and precision are passed through as they are */
+		format++;
+		while(*format != '\0' && strchr(LOG_SPEC_FLAGS, *format) != NULL)
+			format++;
+
+		/*2. h is promoted to int anyway, only l changes the type */
+		while(*format == 'h' || *format == 'l')
+			length += (*format++ == 'l');
+
+		if(*format == '\0' || format - start + 2 > LOG_SPEC_SIZE)
+		{
+			g_string_append(out, start);
+			break;
+		}
+
+		format++;
+		memcpy(spec, start, format - start);
+		spec[format - start] = '\0';
+
+		// a conversion past the last argument is printed as it is
+		if(arg == BLUEZ_LOG_MAX_ARGS)
+		{
+			g_string_append(out, spec);
+			continue;
+		}
+
+		value = record->ARGS[arg++];
+
+		/*3. Hand the argument back with the type the conversion expects */
+		switch(format[-1])
+		{
+			case 'c':
+				if(value != 0)		// a NUL would end the whole pass when it is printed
+					g_string_append_printf(out, spec, (int)value);
+				break;
+			case 'd':
+			case 'i':
+				if(length == 0)
+					g_string_append_printf(out, spec, (int)value);
+				else if(length == 1)
+					g_string_append_printf(out, spec, (long)value);
+				else
+					g_string_append_printf(out, spec, (long long)value);
+				break;
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+				if(length == 0)
+					g_string_append_printf(out, spec, (unsigned int)value);
+				else if(length == 1)
+					g_string_append_printf(out, spec, (unsigned long)value);
+				else
+					g_string_append_printf(out, spec, (unsigned long long)value);
+				break;
+			case 's':
+				if(record->COPIED & (1u << (arg - 1)))
+					g_string_append_printf(out, spec, record->STRINGS + value);
+				else
+					g_string_append_printf(out, spec, "(null)");
+				break;
+			case 'p':
+				g_string_append_printf(out, spec, (gpointer)(guintptr)value);
+				break;
+			default:
+				g_string_append(out, spec);
+				break;
+		}
+	}
+}
@@ -0,0 +1,419 @@
+/**
+	* @file bluez_match_rule.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement signal subscriptions filtered by dbus-daemon match rules
+	*
+	*	- Every subscription owns a slot in a fixed array, the slot is the user data of the GDBus
+	*	  subscription so the callback can be counted without any lookup.
+	*	- The rule is added with AddMatch and the subscription is made with G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+	*	  GDBus still checks interface, member and arg0 locally, the path namespace and arg0path are checked here.
+	*	  Older GDBus only matches arg0 against strings, bluez sends object paths as 'o'.
+	*
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_match_rule.h"
+#include "bluez_dbus_names.h"
+#include "bluez_command.h"
+#include "bluez_metrics.h"
+#include "bluez_trace.h"
+
+/*
+ * Private Types
+*/
+typedef struct _MatchRule
+{
+	bool				IN_USE;
+	guint				SUBSCRIPTION;			// GDBus subscription id
+	const char *		INTERFACE;				// interned, what GDBus matches locally, kept to match injected signals
+	const char *		MEMBER;
+	const char *		ARG0;					// NULL unless arg0 or arg0namespace is matched
+	GDBusSignalFlags	FLAGS;
+	char				PATH_NAMESPACE[MATCH_RULE_SIZE];
+	char				ARG0_PATH[MATCH_RULE_SIZE];		// set for G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH
+	GDBusSignalCallback	CALLBACK;
+	gpointer			USER_DATA;
+	BluezMatchRuleStats	STATS;
+} MatchRule;
+
+/*
+ * Private Function Declerations
+*/
+static bool bluez_match_rule_call_daemon(const char * method, const char * rule);
+static bool bluez_match_rule_in_namespace(const char * path, const char * pathNamespace);
+static bool bluez_match_rule_arg0_path(GVariant * params, const char * arg0Path);
+static bool bluez_match_rule_arg0(GVariant * params, const char * arg0, GDBusSignalFlags flags);
+static void bluez_match_rule_signal(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *signal,
+				GVariant *params,
+				gpointer userData);
+static void bluez_match_rule_deliver(MatchRule * rule,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *signal,
+				GVariant *params);
+
+/*
+ * Private Variables
+*/
+static GDBusConnection * mCon;
+static MatchRule mRules[MAX_NUMBER_MATCH_RULES];	// id is index + 1
+
+/*
+ * Modifiers
+*/
+int bluez_match_rule_init(GDBusConnection * conn)
+{
+	mCon = conn;
+
+	if(mCon == NULL) {
+		g_printerr("Not able to get connection to system bus\n");
+		/**TODO Need to organize Error Codes */
+		return -3;
+	}
+
+	return 0;
+}
+
+guint bluez_match_rule_add(const char * interface,
+				const char * member,
+				const char * pathNamespace,
+				const char * arg0,
+				GDBusSignalFlags flags)
+{
+	MatchRule * rule = NULL;
+	const char * arg0Key = "arg0";
+	gsize length;
+	guint i;
+
+	/*1. Find a free slot */
+	for(i = 0; i < MAX_NUMBER_MATCH_RULES; i++)
+	{
+		if(!mRules[i].IN_USE)
+		{
+			rule = &mRules[i];
+			break;
+		}
+	}
+
+	if(rule == NULL)
+	{
+		g_print("No room for another match rule on %s.%s\n", interface, member);
+		return 0;
+	}
+
+	memset(rule, 0, sizeof(MatchRule));
+
+	/*2. Build the rule, every key narrows what the daemon sends us */
+	if(flags & G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH)
+		arg0Key = "arg0path";
+	else if(flags & G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE)
+		arg0Key = "arg0namespace";
+
+	length = g_snprintf(rule->STATS.RULE, sizeof(rule->STATS.RULE),
+				"type='signal',sender='%s',interface='%s',member='%s'", BLUEZ_BUS_NAME, interface, member);
+
+	if(pathNamespace != NULL && length < sizeof(rule->STATS.RULE))
+	{
+		length += g_snprintf(rule->STATS.RULE + length, sizeof(rule->STATS.RULE) - length, ",path_namespace='%s'", pathNamespace);
+		g_strlcpy(rule->PATH_NAMESPACE, pathNamespace, sizeof(rule->PATH_NAMESPACE));
+	}
+
+	if(arg0 != NULL && length < sizeof(rule->STATS.RULE))
+		length += g_snprintf(rule->STATS.RULE + length, sizeof(rule->STATS.RULE) - length, ",%s='%s'", arg0Key, arg0);
+
+	if(arg0 != NULL && (flags & G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH))
+		g_strlcpy(rule->ARG0_PATH, arg0, sizeof(rule->ARG0_PATH));
+	else if(arg0 != NULL)
+		rule->ARG0 = g_intern_string(arg0);
+
+	rule->INTERFACE = g_intern_string(interface);
+	rule->MEMBER = g_intern_string(member);
+	rule->FLAGS = flags;
+
+	if(length >= sizeof(rule->STATS.RULE))
+	{
+		g_print("Match rule for %s.%s is too long\n", interface, member);
+		return 0;
+	}
+
+	/*3. Hand the rule to the daemon */
+	if(!bluez_match_rule_call_daemon("AddMatch", rule->STATS.RULE))
+		return 0;
+
+	rule->STATS.SINCE_US = g_get_monotonic_time();
+	rule->IN_USE = true;
+
+	g_print("Match rule added: %s\n", rule->STATS.RULE);
+
+	return i + 1;
+}
+
+guint bluez_match_rule_subscribe(const char * interface,
+				const char * member,
+				const char * pathNamespace,
+				const char * arg0,
+				GDBusSignalFlags flags,
+				GDBusSignalCallback callback,
+				gpointer userData)
+{
+	MatchRule * rule;
+	guint id = bluez_match_rule_add(interface, member, pathNamespace, arg0, flags);
+
+	if(id == 0)
+		return 0;
+
+	rule = &mRules[id - 1];
+
+	// arg0path is checked in bluez_match_rule_signal
+	if(rule->ARG0_PATH[0] != '\0')
+	{
+		flags &= ~G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH;
+		arg0 = NULL;
+	}
+
+	/*4. Subscribe without letting GDBus add a second rule without the path namespace */
+	rule->CALLBACK = callback;
+	rule->USER_DATA = userData;
+	rule->SUBSCRIPTION = g_dbus_connection_signal_subscribe(mCon,
+							BLUEZ_BUS_NAME,						// defined in bluez_dbus_names.h
+							interface,
+							member,
+							NULL,
+							arg0,
+							flags | G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+							bluez_match_rule_signal,
+							rule,
+							NULL);
+
+	return id;
+}
+
+void bluez_match_rule_unsubscribe(guint id)
+{
+	MatchRule * rule;
+
+	if(id == 0 || id > MAX_NUMBER_MATCH_RULES || !mRules[id - 1].IN_USE)
+		return;
+
+	rule = &mRules[id - 1];
+
+	if(rule->SUBSCRIPTION != 0)
+		g_dbus_connection_signal_unsubscribe(mCon, rule->SUBSCRIPTION);
+	bluez_match_rule_call_daemon("RemoveMatch", rule->STATS.RULE);
+	rule->IN_USE = false;
+}
+
+void bluez_match_rule_inject(const char * path, const char * interface, const char * member, GVariant * params)
+{
+	MatchRule * rule;
+	guint i;
+
+	/*1. The checks GDBus makes for a live signal */
+	for(i = 0; i < MAX_NUMBER_MATCH_RULES; i++)
+	{
+		rule = &mRules[i];
+
+		if(!rule->IN_USE || rule->CALLBACK == NULL
+			|| strcmp(rule->INTERFACE, interface) != 0 || strcmp(rule->MEMBER, member) != 0)
+			continue;
+
+		if(rule->ARG0 != NULL && (params == NULL || !bluez_match_rule_arg0(params, rule->ARG0, rule->FLAGS)))
+			continue;
+
+		if(rule->ARG0_PATH[0] != '\0' && params == NULL)
+			continue;
+
+		/*2. Then the ones made here */
+		bluez_match_rule_deliver(rule, BLUEZ_BUS_NAME, path, interface, member, params);
+	}
+}
+
+/*
+ * Accessors
+*/
+bool bluez_match_rule_get_stats(guint id, BluezMatchRuleStats * stats)
+{
+	if(id == 0 || id > MAX_NUMBER_MATCH_RULES || !mRules[id - 1].IN_USE)
+		return false;
+
+	*stats = mRules[id - 1].STATS;
+	stats->WAKEUPS = __atomic_load_n(&mRules[id - 1].STATS.WAKEUPS, __ATOMIC_RELAXED);
+
+	return true;
+}
+
+void bluez_match_rule_print_stats(void)
+{
+	gint64 now = g_get_monotonic_time();
+	guint i;
+
+	g_print("***\t Match Rules \t***\n");
+
+	for(i = 0; i < MAX_NUMBER_MATCH_RULES; i++)
+	{
+		if(!mRules[i].IN_USE)
+			continue;
+
+		if(mRules[i].CALLBACK == NULL)
+		{
+			g_print("[ %u ] delivered through a shared subscription\n\t%s\n", i + 1, mRules[i].STATS.RULE);
+			continue;
+		}
+
+		guint64 wakeups = __atomic_load_n(&mRules[i].STATS.WAKEUPS, __ATOMIC_RELAXED);
+		double seconds = (now - mRules[i].STATS.SINCE_US) / (double)G_USEC_PER_SEC;
+
+		g_print("[ %u ] %llu wakeups, %.2f/s\n\t%s\n", i + 1, (unsigned long long)wakeups,
+				seconds > 0 ? wakeups / seconds : 0.0, mRules[i].STATS.RULE);
+	}
+}
+
+/*
+ * Private Functions
+*/
+static bool bluez_match_rule_call_daemon(const char * method, const char * rule)
+{
+	GVariant *result;
+	GError *error = NULL;
+	int metric = bluez_metrics_method(DBUS_DAEMON_NAME, method);
+	gint64 start = g_get_monotonic_time();
+
+	result = g_dbus_connection_call_sync(mCon,
+					     DBUS_DAEMON_NAME,
+					     DBUS_DAEMON_PATH,
+					     DBUS_DAEMON_NAME,
+					     method,
+					     g_variant_new("(s)", rule),
+					     NULL,
+					     G_DBUS_CALL_FLAGS_NONE,
+					     BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,		// on the loop thread, a slow daemon may not hold up the signals for the 25 s default
+					     NULL,
+					     &error);
+
+	bluez_metrics_record_reply(metric, start, error);
+
+	if(error != NULL)
+	{
+		g_print("%s failed for %s\n\t- Error Reason: %s\n", method, rule, error->message);
+		g_error_free(error);
+		return false;
+	}
+
+	g_variant_unref(result);
+	return true;
+}
+
+static bool bluez_match_rule_in_namespace(const char * path, const char * pathNamespace)
+{
+	gsize length = strlen(pathNamespace);
+
+	// same rule as dbus-daemon, the namespace itself or anything below it
+	return strncmp(path, pathNamespace, length) == 0 && (path[length] == '\0' || path[length] == '/');
+}
+
+static bool bluez_match_rule_arg0_path(GVariant * params, const char * arg0Path)
+{
+	GVariant * arg0;
+	const char * value;
+	gsize valueLength;
+	gsize ruleLength = strlen(arg0Path);
+	bool match;
+
+	if(g_variant_n_children(params) == 0)
+		return false;
+
+	arg0 = g_variant_get_child_value(params, 0);
+
+	if(!g_variant_is_of_type(arg0, G_VARIANT_TYPE_STRING) && !g_variant_is_of_type(arg0, G_VARIANT_TYPE_OBJECT_PATH))
+	{
+		g_variant_unref(arg0);
+		return false;
+	}
+
+	value = g_variant_get_string(arg0, &valueLength);
+
+	// same rule as dbus-daemon, equal, or one is a prefix of the other ending with '/', an empty one is no prefix
+	if(valueLength >= ruleLength)
+		match = strncmp(value, arg0Path, ruleLength) == 0 && (valueLength == ruleLength || (ruleLength > 0 && arg0Path[ruleLength - 1] == '/'));
+	else
+		match = valueLength > 0 && strncmp(value, arg0Path, valueLength) == 0 && value[valueLength - 1] == '/';
+
+	g_variant_unref(arg0);
+	return match;
+}
+
+static bool bluez_match_rule_arg0(GVariant * params, const char * arg0, GDBusSignalFlags flags)
+{
+	GVariant * value;
+	const char * string;
+	gsize length = strlen(arg0);
+	bool match;
+
+	if(g_variant_n_children(params) == 0)
+		return false;
+
+	value = g_variant_get_child_value(params, 0);
+
+	if(!g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+	{
+		g_variant_unref(value);
+		return false;
+	}
+
+	string = g_variant_get_string(value, NULL);
+
+	// arg0namespace is the name itself or a name below it
+	if(flags & G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE)
+		match = strncmp(string, arg0, length) == 0 && (string[length] == '\0' || string[length] == '.');
+	else
+		match = strcmp(string, arg0) == 0;
+
+	g_variant_unref(value);
+	return match;
+}
+
+static void bluez_match_rule_signal(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *signal,
+				GVariant *params,
+				gpointer userData)
+{
+	(void)conn;
+
+	// a loaded trace owns the callbacks, see bluez_trace.h
+	if(bluez_trace_is_replaying())
+		return;
+
+	bluez_match_rule_deliver(userData, sender, path, interface, signal, params);
+}
+
+static void bluez_match_rule_deliver(MatchRule * rule,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *signal,
+				GVariant *params)
+{
+	// other rules on the connection can route the same signal for another path
+	if(rule->PATH_NAMESPACE[0] != '\0' && !bluez_match_rule_in_namespace(path, rule->PATH_NAMESPACE))
+		return;
+
+	if(rule->ARG0_PATH[0] != '\0' && !bluez_match_rule_arg0_path(params, rule->ARG0_PATH))
+		return;
+
+	__atomic_fetch_add(&rule->STATS.WAKEUPS, 1, __ATOMIC_RELAXED);
+	bluez_metrics_record_signal(interface, signal);
+
+	rule->CALLBACK(mCon, sender, path, interface, signal, params, rule->USER_DATA);
+}
@@ -14,61 +14,113 @@
 
 #include "bluez_mediaplayer_api.h"
 #include "bluez_dbus_names.h"
+#include "bluez_property_table.h"
+#include "bluez_signal_router.h"
+#include "bluez_command.h"
+#include "bluez_event_queue.h"
+#include "bluez_log.h"
+
+#define MEDIA_PLAYER_MAX_PLAYERS	4		// players kept at once, more than one phone is rare
 
 /*
  * Private Function Declerations
 */
 static int bluez_media_player_call_method( const char *method, GVariant *param);
 static int bluez_media_player_set_property(const char *prop, GVariant *value);
-static int bluez_media_player_read_property(const char * path, const char *property);
-static void bluez_media_player_properties_changed(GDBusConnection *sig,
-				const gchar *sender_name,
-				const gchar *object_path,
-				const gchar *interface,
-				const gchar *signal_name,
-				GVariant *parameters,
-				gpointer user_data);
-static void bluez_media_control_properties_changed(GDBusConnection *sig,
-				const gchar *sender_name,
-				const gchar *object_path,
-				const gchar *interface,
-				const gchar *signal_name,
-				GVariant *parameters,
-				gpointer user_data);
-static void bluez_media_player_read_property_cb(GObject *con,GAsyncResult *res,gpointer data);
-static void bluez_media_player_parse_property_value(const gchar *key, GVariant *value);
-static void bluez_media_control_parse_property_value(const gchar *key, GVariant *value);
-static void bluez_mediaplayer_print_track_data(GVariant * mediadata);
+static void bluez_media_player_command_done(BluezCommand * command, gpointer userData);
+static void bluez_media_player_properties_changed(const char *object_path, GVariant *changed, GVariant *invalidated, gpointer user_data);
+static void bluez_media_control_properties_changed(const char *object_path, GVariant *changed, GVariant *invalidated, gpointer user_data);
+static void bluez_media_player_read_property_cb(BluezCommand * command, gpointer userData);
+static void bluez_media_player_read_all_properties_cb(BluezCommand * command, gpointer userData);
+static void bluez_media_player_parse_property_value(MediaPlayer * player, const gchar *key, GVariant *value);
+static void bluez_media_control_parse_property_value(MediaPlayer * player, const gchar *key, GVariant *value);
+static void bluez_mediaplayer_print_track_data(MediaPlayer * player, GVariant * mediadata);
+static void bluez_media_player_read_all(MediaPlayer * player);
+static void bluez_media_player_reset(MediaPlayer * player);
+static MediaPlayer * bluez_media_player_find(const char * playerPath);
+static MediaPlayer * bluez_media_player_take(const char * playerPath, bool * isNew);
+static MediaPlayer * bluez_media_control_take(const char * devicePath);
+// MediaPlayer1 and MediaControl1 property handlers, each returns 1 if the cached value changed
+static guint bluez_media_player_set_string(char * field, gsize size, GVariant * value);
+static guint bluez_media_player_set_uint32(guint32 * field, GVariant * value);
+static guint bluez_media_player_set_repeat(gpointer player, GVariant * value);
+static guint bluez_media_player_set_shuffle(gpointer player, GVariant * value);
+static guint bluez_media_player_set_status(gpointer player, GVariant * value);
+static guint bluez_media_player_set_name(gpointer player, GVariant * value);
+static guint bluez_media_player_set_type(gpointer player, GVariant * value);
+static guint bluez_media_player_set_title(gpointer player, GVariant * value);
+static guint bluez_media_player_set_artist(gpointer player, GVariant * value);
+static guint bluez_media_player_set_album(gpointer player, GVariant * value);
+static guint bluez_media_player_set_genre(gpointer player, GVariant * value);
+static guint bluez_media_player_set_position(gpointer player, GVariant * value);
+static guint bluez_media_player_set_duration(gpointer player, GVariant * value);
+static guint bluez_media_player_set_track_number(gpointer player, GVariant * value);
+static guint bluez_media_player_set_track(gpointer player, GVariant * value);
+static guint bluez_media_control_set_player(gpointer player, GVariant * value);
+static guint bluez_media_control_set_connected(gpointer player, GVariant * value);
 /*
  * Private Variables
 */
 static GDBusConnection *mCon;
-static MediaPlayer mDefaultPlayer;
-static guint iface_added;
-static guint prop_changed;
-static guint prop_changed_control;
+static MediaPlayer mPlayers[MEDIA_PLAYER_MAX_PLAYERS];		// every player keeps its own state, a free one has no OBJECT_PATH
+static MediaPlayer * mDefaultPlayer = &mPlayers[0];			// the player the control methods go to
+static MediaPlayerStats mStats;
+
+// org.bluez.MediaPlayer1 properties, Track holds the same names for the track metadata
+static const BluezProperty mPlayerProperties[] = {
+	{ PROPERTY_REPEAT,			"s",		bluez_media_player_set_repeat },
+	{ PROPERTY_SHUFFLE,			"s",		bluez_media_player_set_shuffle },
+	{ PROPERTY_STATUS,			"s",		bluez_media_player_set_status },
+	{ PROPERTY_NAME,			"s",		bluez_media_player_set_name },
+	{ PROPERTY_TYPE,			"s",		bluez_media_player_set_type },
+	{ PROPERTY_TRACK_TITLE,		"s",		bluez_media_player_set_title },
+	{ PROPERTY_TRACK_ARTIST,	"s",		bluez_media_player_set_artist },
+	{ PROPERTY_TRACK_ALBUM,		"s",		bluez_media_player_set_album },
+	{ PROPERTY_TRACK_GENRE,		"s",		bluez_media_player_set_genre },
+	{ PROPERTY_POSITION,		"u",		bluez_media_player_set_position },
+	{ PROPERTY_DURATION,		"u",		bluez_media_player_set_duration },
+	{ PROPERTY_TRACK_NUMBER,	"u",		bluez_media_player_set_track_number },
+	{ "Track",					"a{sv}",	bluez_media_player_set_track },
+};
+
+// org.bluez.MediaControl1 properties
+static const BluezProperty mControlProperties[] = {
+	{ "Player",		"o",	bluez_media_control_set_player },
+	{ "Connected",	"b",	bluez_media_control_set_connected },
+};
 
 /*
  * Accessors
  */
  void bluez_media_player_print_current_player(void)
  {
-	 if(!mDefaultPlayer.CONNECTED)
+	 if(!mDefaultPlayer->CONNECTED)
 		 g_print("No Player exists!\n");
 	 else
 	 {
 		 g_print("***\tCurrent Player Info\t***\n");
-		 g_print("\t- Object Path:\t%s\n",mDefaultPlayer.OBJECT_PATH);
-		 g_print("\t- Player Path:\t%s\n",mDefaultPlayer.PLAYER_PATH);
-		 g_print("\t- Repeat:\t%s\n",mDefaultPlayer.REPEAT);
-		 g_print("\t- Shuffle:\t%s\n",mDefaultPlayer.SHUFFLE);
-		 g_print("\t- Status:\t%s\n",mDefaultPlayer.STATUS);
-		 g_print("\t- Player Name:\t%s\n",mDefaultPlayer.PLAYER_NAME);
-		 g_print("\t- Type:\t\t%s\n",mDefaultPlayer.TYPE);
+		 g_print("\t- Object Path:\t%s\n",mDefaultPlayer->OBJECT_PATH);
+		 g_print("\t- Player Path:\t%s\n",mDefaultPlayer->PLAYER_PATH);
+		 g_print("\t- Repeat:\t%s\n",mDefaultPlayer->REPEAT);
+		 g_print("\t- Shuffle:\t%s\n",mDefaultPlayer->SHUFFLE);
+		 g_print("\t- Status:\t%s\n",mDefaultPlayer->STATUS);
+		 g_print("\t- Player Name:\t%s\n",mDefaultPlayer->PLAYER_NAME);
+		 g_print("\t- Type:\t\t%s\n",mDefaultPlayer->TYPE);
 	 }
 	g_print("\n");
  }
  
+void bluez_media_player_get_stats(MediaPlayerStats * stats)
+{
+	*stats = mStats;
+}
+
+void bluez_media_player_print_stats(void)
+{
+	g_print("***\tMediaPlayer: %llu signals in, %llu calls out, %llu full refreshes\n",
+			(unsigned long long)mStats.SIGNALS_IN, (unsigned long long)mStats.CALLS_OUT, (unsigned long long)mStats.FULL_REFRESHES);
+}
+ 
  /*
   * Modifiers
  */ 
@@ -94,65 +146,109 @@ static guint prop_changed_control;
  
  void bluez_media_player_set_default_properties()
  {
-	 // initialize our mediaplayer object with values
-	strcpy(mDefaultPlayer.OBJECT_PATH,"NULL");
-	strcpy(mDefaultPlayer.PLAYER_PATH,"NULL");
-	strcpy(mDefaultPlayer.REPEAT,"off");
-	strcpy(mDefaultPlayer.STATUS,"stopped");
-	strcpy(mDefaultPlayer.PLAYER_NAME,"NULL");
-	strcpy(mDefaultPlayer.TYPE,"Audio");
-	strcpy(mDefaultPlayer.TRACK_TITLE,"--.--");
-	strcpy(mDefaultPlayer.TRACK_ARTIST,"--.--");
-	strcpy(mDefaultPlayer.TRACK_ALBUM,"--.--");
-	strcpy(mDefaultPlayer.TRACK_GENRE,"NULL");
-	mDefaultPlayer.CONNECTED = false;
-	mDefaultPlayer.TRACK_NUMBER = 0;
-	mDefaultPlayer.TRACK_DURATION = 0;
-	mDefaultPlayer.TRACK_POSITION = 0;
+	int i;
+	
+	 // initialize our mediaplayer objects with values
+	for(i = 0; i < MEDIA_PLAYER_MAX_PLAYERS; i++)
+		bluez_media_player_reset(&mPlayers[i]);
+	
+	mDefaultPlayer = &mPlayers[0];
  }
  
 void bluez_media_player_init_signals(void)
 {
-	prop_changed = g_dbus_connection_signal_subscribe(mCon,
-							BLUEZ_BUS_NAME,							// defined in bluez_dbus_names.h
-							"org.freedesktop.DBus.Properties",
-							"PropertiesChanged",
-							NULL,									// NULL so we can listen for all object paths
-							BLUEZ_MediaPlayer_INTERFACE,			// defined in bluez_dbus_names.h
-							G_DBUS_SIGNAL_FLAGS_NONE,
-							bluez_media_player_properties_changed,
-							NULL,
-							NULL);
-							
-	prop_changed_control = g_dbus_connection_signal_subscribe(mCon,
-							BLUEZ_BUS_NAME,							// defined in bluez_dbus_names.h
-							"org.freedesktop.DBus.Properties",
-							"PropertiesChanged",
-							NULL,									// NULL so we can listen for all object paths
-							BLUEZ_MediaController_INTERFACE,			// defined in bluez_dbus_names.h
-							G_DBUS_SIGNAL_FLAGS_NONE,
-							bluez_media_control_properties_changed,
-							NULL,
-							NULL);
+	// players live below the device objects of every adapter
+	bluez_signal_router_register(BLUEZ_MediaPlayer_INTERFACE, BLUEZ_BASE_PATH, bluez_media_player_properties_changed, NULL);
+	bluez_signal_router_register(BLUEZ_MediaController_INTERFACE, BLUEZ_BASE_PATH, bluez_media_control_properties_changed, NULL);
 }
 
 void bluez_media_player_mute_signals(void)
 {
-	g_dbus_connection_signal_unsubscribe(mCon, iface_added);
-	g_dbus_connection_signal_unsubscribe(mCon, prop_changed);
-	g_dbus_connection_signal_unsubscribe(mCon, prop_changed_control);
+	bluez_signal_router_unregister(BLUEZ_MediaPlayer_INTERFACE);
+	bluez_signal_router_unregister(BLUEZ_MediaController_INTERFACE);
 }
  
  
+void bluez_media_player_update_properties(const char * path, GVariant * properties)
+{
+	GVariantIter iter;
+	const char * key;
+	GVariant * value;
+	
+	MediaPlayer * player;
+	bool isNew;
+	
+	g_print("\n****\t MediaPlayer %s \t****\n", path);
+	
+	// the properties come with the path, no refresh needed
+	player = bluez_media_player_take(path, &isNew);
+	if(player == NULL)
+		return;
+	
+	mDefaultPlayer = player;
+	
+	g_variant_iter_init(&iter, properties);
+	while(g_variant_iter_next(&iter, "{&sv}", &key, &value))
+	{
+		bluez_media_player_parse_property_value(player, key, value);
+		g_variant_unref(value);
+	}
+}
+
+void bluez_media_control_update_properties(const char * path, GVariant * properties)
+{
+	GVariantIter iter;
+	const char * key;
+	GVariant * value;
+	
+	MediaPlayer * player;
+	
+	g_print("\n****\t Media Controller %s \t****\n", path);
+	
+	player = bluez_media_control_take(path);
+	if(player == NULL)
+		return;
+	
+	g_variant_iter_init(&iter, properties);
+	while(g_variant_iter_next(&iter, "{&sv}", &key, &value))
+	{
+		bluez_media_control_parse_property_value(player, key, value);
+		g_variant_unref(value);
+	}
+}
+ 
  void bluez_media_player_read_remote_player_properties()
  {
-	 bluez_media_player_read_property(mDefaultPlayer.PLAYER_PATH,PROPERTY_REPEAT);
-	 bluez_media_player_read_property(mDefaultPlayer.PLAYER_PATH,PROPERTY_SHUFFLE);
-	 bluez_media_player_read_property(mDefaultPlayer.PLAYER_PATH,PROPERTY_STATUS);
-	 bluez_media_player_read_property(mDefaultPlayer.PLAYER_PATH,PROPERTY_NAME);
-	 bluez_media_player_read_property(mDefaultPlayer.PLAYER_PATH,PROPERTY_TYPE);
+	if(strcmp(mDefaultPlayer->PLAYER_PATH, "NULL") == 0)
+	{
+		g_print("***\tMedia Player Read Properties Error: Player Path is NULL\n");
+		return;
+	}
+	
+	bluez_media_player_read_all(mDefaultPlayer);
  }
  
+int bluez_media_player_refresh_property(const char *property)
+{
+	if(strcmp(mDefaultPlayer->PLAYER_PATH, "NULL") == 0)
+	{
+		g_print("***\tMedia Player Read Propery Error: Player Path is NULL\n");
+		return -3;
+	}
+	
+	mStats.CALLS_OUT++;
+	
+	bluez_command_unref(bluez_command_call(mDefaultPlayer->PLAYER_PATH,
+				"org.freedesktop.DBus.Properties",
+				"Get",
+				g_variant_new("(ss)", BLUEZ_MediaPlayer_INTERFACE, property),
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				bluez_media_player_read_property_cb,
+				g_variant_ref_sink(g_variant_new("(ss)", mDefaultPlayer->PLAYER_PATH, property))));		// the reply goes to this player
+
+	return 0;
+}
+
  /*
   * Control Methods
  */
@@ -217,333 +313,510 @@ void bluez_mediaplayer_repeat_off()
 
 static int bluez_media_player_call_method( const char *method, GVariant *param)
 {
-	GVariant *result;
-	GError *error = NULL;
-	
 	// only call the method if we have a valid path, meaning we are connected to a phone
-	if(!mDefaultPlayer.CONNECTED)
+	if(!mDefaultPlayer->CONNECTED)
 	{
 		g_print("Error: No valid player\n");
 		g_print("Cannot execute command: %s\n", method);
 		return -2;
 	}
-
-	result = g_dbus_connection_call_sync(mCon,
-					     BLUEZ_BUS_NAME,						// defined in bluez_dbus_names.h
-					     mDefaultPlayer.PLAYER_PATH,
-					     BLUEZ_MediaPlayer_INTERFACE,			// defined in bluez_dbus_names.h
-					     method,
-					     param,
-					     NULL,
-					     G_DBUS_CALL_FLAGS_NONE,
-					     -1,
-					     NULL,
-					     &error);
-	if(error != NULL)
-	{
-		g_print("***\tMediaPlayer Method Call Error: %s",error->message);
-		return -1;
-	}
-
-	g_variant_unref(result);
+	
+	mStats.CALLS_OUT++;
+
+	// media keys do not wait on each other, the reply is only logged
+	bluez_command_unref(bluez_command_call(mDefaultPlayer->PLAYER_PATH,
+					BLUEZ_MediaPlayer_INTERFACE,			// defined in bluez_dbus_names.h
+					method,
+					param,
+					BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+					bluez_media_player_command_done,
+					NULL));
 	return 0;
 }
 
 static int bluez_media_player_set_property(const char *prop, GVariant *value)
 {
-	GVariant *result;
-	GError *error = NULL;
-	
 	// only call the method if we have a valid path, meaning we are connected to a phone
-	if(!mDefaultPlayer.CONNECTED)
+	if(!mDefaultPlayer->CONNECTED)
 	{
 		g_print("Error: No valid player\n");
 		g_print("Cannot update property: %s\n", prop);
 		return -2;
 	}
-
-	result = g_dbus_connection_call_sync(mCon,
-					     BLUEZ_BUS_NAME,						// defined in bluez_dbus_names.h
-					     mDefaultPlayer.PLAYER_PATH,
-					     "org.freedesktop.DBus.Properties",
-					     "Set",
-					     g_variant_new("(ssv)", BLUEZ_MediaPlayer_INTERFACE, prop, value),
-					     NULL,
-					     G_DBUS_CALL_FLAGS_NONE,
-					     -1,
-					     NULL,
-					     &error);
-	if(error != NULL)
-	{
-		g_print("Error: Unbale to set Property %s\tReason: %s\n",prop,error->message);
-		g_error_free(error);
-		return -1;
-	}
-
-	g_variant_unref(result);
+	
+	mStats.CALLS_OUT++;
+
+	bluez_command_unref(bluez_command_set_property(mDefaultPlayer->PLAYER_PATH,
+					BLUEZ_MediaPlayer_INTERFACE,			// defined in bluez_dbus_names.h
+					prop,
+					value,
+					BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+					bluez_media_player_command_done,
+					NULL));
 	return 0;
 }
 
+static void bluez_media_player_command_done(BluezCommand * command, gpointer userData)
+{
+	(void)userData;
+	
+	if(bluez_command_get_state(command) != BLUEZ_COMMAND_SUCCEEDED)
+		g_print("***\tMediaPlayer %s Error: %s\n", bluez_command_get_method(command), bluez_command_get_error(command));
+}
+
 
-static int bluez_media_player_read_property(const char * path, const char *property)
+static void bluez_media_player_properties_changed(const char *object_path, GVariant *changed, GVariant *invalidated, gpointer user_data)
 {
+	(void)user_data;
 
-	if(strcmp(mDefaultPlayer.PLAYER_PATH, "NULL") == 0)
+	GVariantIter intr;
+	const char * key;
+	GVariant * value;
+	MediaPlayer * player;
+	bool desync;
+	
+	// Position changes every second while playing, the signal itself is only worth a debug line
+	BLUEZ_LOG_DEBUG("\n****\t MediaPlayer Properties Changed \t****\n\t- Object Path: %s\n", object_path, 0, 0, 0);
+	
+	mStats.SIGNALS_IN++;
+	
+	/*1. Every player keeps its own state, only a player we have not seen yet is read in full */
+	player = bluez_media_player_take(object_path, &desync);
+	if(player == NULL)
+		return;
+	
+	/*2. The delta is applied to the state of that player as is */
+	g_variant_iter_init(&intr, changed);
+	while(g_variant_iter_next(&intr, "{&sv}", &key, &value)) 
 	{
-		g_print("***\tMedia Player Read Propery Error: Player Path is NULL\n");
-		return -3;
+		bluez_media_player_parse_property_value(player, key, value);
+		g_variant_unref(value);
 	}
 	
-	g_dbus_connection_call(mCon,
-					     BLUEZ_BUS_NAME,							// defined in bluez_dbus_names.h
-					     mDefaultPlayer.PLAYER_PATH,				// defined in bluez_dbus_names.h
-					     "org.freedesktop.DBus.Properties",
-					     "Get",
-					     g_variant_new("(ss)", BLUEZ_MediaPlayer_INTERFACE, property),
-					     NULL,
-					     G_DBUS_CALL_FLAGS_NONE,
-					     -1,
-						 NULL,
-					     bluez_media_player_read_property_cb,
-					     property);
-
-	return 0;
+	/*3. Invalidated properties come without a value, the state can no longer be trusted */
+	if(g_variant_n_children(invalidated) > 0)
+		desync = true;
+	
+	if(desync)
+		bluez_media_player_read_all(player);
 }
 
-static void bluez_media_player_properties_changed(GDBusConnection *sig,
-				const gchar *sender_name,
-				const gchar *object_path,
-				const gchar *interface,
-				const gchar *signal_name,
-				GVariant *parameters,
-				gpointer user_data)
+static void bluez_media_control_properties_changed(const char *object_path, GVariant *changed, GVariant *invalidated, gpointer user_data)
 {
-	//(void)sig;
-	//(void)sender_name;
-	(void)object_path;
-	//(void)interface;
-	//(void)signal_name;
-	//(void)user_data;
+	(void)invalidated;
+	(void)user_data;
 
-	GVariantIter *intr;
-	const char *object;
+	GVariantIter intr;
 	const char * key;
 	GVariant * value;
-	GVariant * unknown;
+	MediaPlayer * player;
+	
+	BLUEZ_LOG_DEBUG("\n****\tMedia Controller Properties Changed \t****\n\t- Object Path: %s\n", object_path, 0, 0, 0);
 	
-	g_print("\n****\t MediaPlayer Properties Changed \t****\n");
-	g_print ("\t- Object Path: %s\n", object_path);
+	mStats.SIGNALS_IN++;
 	
-	g_variant_get(parameters, "(&sa{sv}as)", &object, &intr, &unknown);
+	player = bluez_media_control_take(object_path);
+	if(player == NULL)
+		return;
+	
+	g_variant_iter_init(&intr, changed);
+	while(g_variant_iter_next(&intr, "{&sv}", &key, &value)) 
+	{
+		bluez_media_control_parse_property_value(player, key, value);
+		g_variant_unref(value);
+	}
+}
 
-	while(g_variant_iter_next(intr, "{sv}", &key, &value)) 
-		bluez_media_player_parse_property_value(key,value);
+static void bluez_media_player_parse_property_value(MediaPlayer * player, const gchar *key, GVariant *value)
+{
+	static BluezPropertyTable * table = NULL;
 	
-	// lets grab all properites to be safe
-	bluez_media_player_read_remote_player_properties();
+	if(g_once_init_enter(&table))
+		g_once_init_leave(&table, bluez_property_table_new(mPlayerProperties, G_N_ELEMENTS(mPlayerProperties)));
 	
-	/* Do not unref, it gets cleaned up on its own */
-	//g_variant_unref(intr);
-	//g_variant_unref(value);
+	bluez_property_table_dispatch(table, player, key, value);
 }
 
-static void bluez_media_control_properties_changed(GDBusConnection *sig,
-				const gchar *sender_name,
-				const gchar *object_path,
-				const gchar *interface,
-				const gchar *signal_name,
-				GVariant *parameters,
-				gpointer user_data)
+static void bluez_media_control_parse_property_value(MediaPlayer * player, const gchar *key, GVariant *value)
 {
-	//(void)sig;
-	//(void)sender_name;
-	(void)object_path;
-	//(void)interface;
-	//(void)signal_name;
-	//(void)user_data;
+	static BluezPropertyTable * table = NULL;
+	
+	if(g_once_init_enter(&table))
+		g_once_init_leave(&table, bluez_property_table_new(mControlProperties, G_N_ELEMENTS(mControlProperties)));
+	
+	bluez_property_table_dispatch(table, player, key, value);
+}
 
-	GVariantIter *intr;
-	const char *object;
-	const char * key;
-	GVariant * value;
-	GVariant * unknown;
-	
-	g_print("\n****\tMedia Controller Properties Changed \t****\n");
-	g_print ("\t- Object Path: %s\n", object_path);
-	
-	strcpy(mDefaultPlayer.OBJECT_PATH,object_path);
-	
-	g_variant_get(parameters, "(&sa{sv}as)", &object, &intr, &unknown);
-
-	while(g_variant_iter_next(intr, "{sv}", &key, &value)) 
-		bluez_media_control_parse_property_value(key,value);
-	
-	/* Do not unref, it gets cleaned up on its own */
-	//g_variant_unref(intr);
-	//g_variant_unref(value);
-}
-
-static void bluez_media_player_parse_property_value(const gchar *key, GVariant *value)
-{
-	const gchar *type = g_variant_get_type_string(value);
-	
-	g_print("\t- %s: ", key);
-	switch(*type) {
-		case 'o':
-		case 's':
-					
-			g_print("%s\n", g_variant_get_string(value, NULL));
-			if(strcmp(key,PROPERTY_REPEAT) == 0)
-				strcpy(mDefaultPlayer.REPEAT, g_variant_get_string(value,NULL));
-			else if(strcmp(key,PROPERTY_SHUFFLE) == 0)
-				strcpy(mDefaultPlayer.SHUFFLE, g_variant_get_string(value,NULL));
-			else if(strcmp(key,PROPERTY_STATUS) == 0)
-				strcpy(mDefaultPlayer.STATUS, g_variant_get_string(value,NULL));
-			else if(strcmp(key,PROPERTY_NAME) == 0)
-				strcpy(mDefaultPlayer.PLAYER_NAME, g_variant_get_string(value,NULL));
-			else if(strcmp(key,PROPERTY_TYPE) == 0)
-				strcpy(mDefaultPlayer.TYPE, g_variant_get_string(value,NULL));
-			else if(strcmp(key,PROPERTY_TRACK_TITLE) == 0)
-				strcpy(mDefaultPlayer.TRACK_TITLE, g_variant_get_string(value,NULL));
-			else if(strcmp(key,PROPERTY_TRACK_ARTIST) == 0)
-				strcpy(mDefaultPlayer.TRACK_ARTIST, g_variant_get_string(value,NULL));
-			else if(strcmp(key,PROPERTY_TRACK_ALBUM) == 0)
-				strcpy(mDefaultPlayer.TRACK_ALBUM, g_variant_get_string(value,NULL));
-			else if(strcmp(key,PROPERTY_TRACK_GENRE) == 0)
-				strcpy(mDefaultPlayer.TRACK_GENRE, g_variant_get_string(value,NULL));
-			
-			break;
-		case 'b':		
-			g_print("%d\n", g_variant_get_boolean(value));
-			
-			break;
-		case 'u':
-			
-			g_print("%d\n", g_variant_get_uint32(value));
-			if(strcmp(key,PROPERTY_POSITION) == 0)
-				mDefaultPlayer.TRACK_POSITION = g_variant_get_uint32(value);
-			else if(strcmp(key,PROPERTY_DURATION) == 0)
-				mDefaultPlayer.TRACK_DURATION = g_variant_get_uint32(value);
-			else if(strcmp(key,PROPERTY_TRACK_NUMBER) == 0)
-				mDefaultPlayer.TRACK_NUMBER = g_variant_get_uint32(value);
-			break;
-			
-		case 'n':
-			g_print("%d\n", g_variant_get_int16(value));
-			
-			break;
-		case 'a':
-		
-			bluez_mediaplayer_print_track_data(value);
-			break;
-		
-		default:
-			g_print("Other\n");
-			break;
+static guint bluez_media_player_set_string(char * field, gsize size, GVariant * value)
+{
+	const char * str = g_variant_get_string(value, NULL);
+	
+	// only copy what changed
+	if(strcmp(field, str) == 0)
+		return 0;
+	
+	g_strlcpy(field, str, size);
+	return 1;
+}
+
+static guint bluez_media_player_set_uint32(guint32 * field, GVariant * value)
+{
+	guint32 number = g_variant_get_uint32(value);
+	
+	if(*field == number)
+		return 0;
+	
+	*field = number;
+	return 1;
+}
+
+static guint bluez_media_player_set_repeat(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_string(((MediaPlayer *)player)->REPEAT, sizeof(mDefaultPlayer->REPEAT), value);
+}
+
+static guint bluez_media_player_set_shuffle(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_string(((MediaPlayer *)player)->SHUFFLE, sizeof(mDefaultPlayer->SHUFFLE), value);
+}
+
+static guint bluez_media_player_set_status(gpointer player, GVariant * value)
+{
+	guint changed = bluez_media_player_set_string(((MediaPlayer *)player)->STATUS, sizeof(mDefaultPlayer->STATUS), value);
+	
+	if(changed)
+	{
+		g_print("\t- Status: %s\n", ((MediaPlayer *)player)->STATUS);
+		bluez_event_queue_push(BLUEZ_EVENT_PLAYER_STATUS, ((MediaPlayer *)player)->PLAYER_PATH,
+					bluez_event_status_from_string(((MediaPlayer *)player)->STATUS));
 	}
+	
+	return changed;
+}
+
+static guint bluez_media_player_set_name(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_string(((MediaPlayer *)player)->PLAYER_NAME, sizeof(mDefaultPlayer->PLAYER_NAME), value);
+}
+
+static guint bluez_media_player_set_type(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_string(((MediaPlayer *)player)->TYPE, sizeof(mDefaultPlayer->TYPE), value);
+}
+
+static guint bluez_media_player_set_title(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_string(((MediaPlayer *)player)->TRACK_TITLE, sizeof(mDefaultPlayer->TRACK_TITLE), value);
+}
+
+static guint bluez_media_player_set_artist(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_string(((MediaPlayer *)player)->TRACK_ARTIST, sizeof(mDefaultPlayer->TRACK_ARTIST), value);
+}
+
+static guint bluez_media_player_set_album(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_string(((MediaPlayer *)player)->TRACK_ALBUM, sizeof(mDefaultPlayer->TRACK_ALBUM), value);
+}
+
+static guint bluez_media_player_set_genre(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_string(((MediaPlayer *)player)->TRACK_GENRE, sizeof(mDefaultPlayer->TRACK_GENRE), value);
+}
+
+static guint bluez_media_player_set_position(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_uint32(&((MediaPlayer *)player)->TRACK_POSITION, value);
+}
+
+static guint bluez_media_player_set_duration(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_uint32(&((MediaPlayer *)player)->TRACK_DURATION, value);
+}
+
+static guint bluez_media_player_set_track_number(gpointer player, GVariant * value)
+{
+	return bluez_media_player_set_uint32(&((MediaPlayer *)player)->TRACK_NUMBER, value);
 }
 
-static void bluez_media_control_parse_property_value(const gchar *key, GVariant *value)
-{
-	const gchar *type = g_variant_get_type_string(value);
-	
-	g_print("\t- %s: ", key);
-	switch(*type) {
-		case 'o':
-		case 's':
-					
-			g_print("%s\n", g_variant_get_string(value, NULL));
-			if(strcmp(key,"Player") == 0)
-				strcpy(mDefaultPlayer.PLAYER_PATH, g_variant_get_string(value,NULL));
-			
-			break;
-		case 'b':		
-			g_print("%d\n", g_variant_get_boolean(value));
-			
-			if(strcmp(key, "Connected") == 0)
-			{
-				if(g_variant_get_boolean(value))
-					mDefaultPlayer.CONNECTED = true;		// media player connected!
-				
-				else
-					bluez_media_player_set_default_properties();
-			}
-				
-			
-			break;
-		case 'u':
-			
-			g_print("%d\n", g_variant_get_uint32(value));
-			
-			break;
-			
-		case 'n':
-			g_print("%d\n", g_variant_get_int16(value));
-			
-			break;
-		case 'a':
-			break;
+static guint bluez_media_player_set_track(gpointer player, GVariant * value)
+{
+	MediaPlayer * mp = player;
+	
+	// the track metadata is a dictionary of its own, using the same names
+	bluez_mediaplayer_print_track_data(mp, value);
+	
+	g_print("\t- Track: %s - %s (%s)\n", mp->TRACK_TITLE, mp->TRACK_ARTIST, mp->TRACK_ALBUM);
+	bluez_event_queue_push(BLUEZ_EVENT_PLAYER_TRACK, mp->PLAYER_PATH, 0);
+	
+	return 1;
+}
+
+static guint bluez_media_control_set_player(gpointer player, GVariant * value)
+{
+	MediaPlayer * control = player;
+	MediaPlayer * mp;
+	bool isNew;
+	
+	/*1. The device names its player, a player we already have keeps its state */
+	mp = bluez_media_player_take(g_variant_get_string(value, NULL), &isNew);
+	if(mp == NULL)
+		return 0;
+	
+	mp->CONNECTED |= control->CONNECTED;
+	mDefaultPlayer = mp;
+	
+	/*2. New player, this is the only time every property is read */
+	if(isNew)
+		bluez_media_player_read_all(mp);
+	
+	return 1;
+}
+
+static guint bluez_media_control_set_connected(gpointer player, GVariant * value)
+{
+	MediaPlayer * control = player;
+	bool connected = g_variant_get_boolean(value);
+	char device[sizeof(control->OBJECT_PATH)];
+	int i;
+	
+	g_strlcpy(device, control->OBJECT_PATH, sizeof(device));
+	
+	/*1. Every player of the device comes and goes with the link */
+	for(i = 0; i < MEDIA_PLAYER_MAX_PLAYERS; i++)
+	{
+		if(strcmp(mPlayers[i].OBJECT_PATH, device) != 0)
+			continue;
 		
-		default:
-			g_print("Other\n");
-			break;
+		if(connected)
+			mPlayers[i].CONNECTED = true;		// media player connected!
+		else
+			bluez_media_player_reset(&mPlayers[i]);
 	}
+	
+	/*2. The control methods go to a player that is still there */
+	for(i = 0; !mDefaultPlayer->CONNECTED && i < MEDIA_PLAYER_MAX_PLAYERS; i++)
+	{
+		if(mPlayers[i].CONNECTED)
+			mDefaultPlayer = &mPlayers[i];
+	}
+	
+	g_print("\t- Connected: %d\n", connected);
+	bluez_event_queue_push(BLUEZ_EVENT_PLAYER_CONNECTED, device, connected);
+	
+	return 1;
 }
 
-static void bluez_mediaplayer_print_track_data(GVariant * mediadata)
+static void bluez_mediaplayer_print_track_data(MediaPlayer * player, GVariant * mediadata)
 {
-	GVariantIter *intr;
+	GVariantIter intr;
 	GVariant * trackInfo;
 	const gchar * key;
 	
-	g_variant_get(mediadata, "a{sv}", &intr);
+	g_variant_iter_init(&intr, mediadata);
 	
-	while(g_variant_iter_next(intr, "{sv}", &key, &trackInfo))
+	while(g_variant_iter_next(&intr, "{&sv}", &key, &trackInfo))
 	{
-		g_print("\n\t");
-		bluez_media_player_parse_property_value(key,trackInfo);
+		bluez_media_player_parse_property_value(player, key, trackInfo);
+		g_variant_unref(trackInfo);
 	}
 }
 
-static void bluez_media_player_read_property_cb(GObject *con,GAsyncResult *res,gpointer userData)
+static void bluez_media_player_read_all(MediaPlayer * player)
 {
-	GVariant *result = NULL;
-	GVariant * propertyValue = NULL;
-	char propertyName[100];
-	GError *error = NULL;
+	mStats.CALLS_OUT++;
+	mStats.FULL_REFRESHES++;
+	
+	// one GetAll instead of a Get per property, the reply goes to the player with this path
+	bluez_command_unref(bluez_command_call(player->PLAYER_PATH,
+				"org.freedesktop.DBus.Properties",
+				"GetAll",
+				g_variant_new("(s)", BLUEZ_MediaPlayer_INTERFACE),
+				BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS,
+				bluez_media_player_read_all_properties_cb,
+				g_strdup(player->PLAYER_PATH)));
+}
 
-	g_print("***\t Media Player Inside Property Callback\t***\n");
+static void bluez_media_player_reset(MediaPlayer * player)
+{
+	strcpy(player->OBJECT_PATH,"NULL");
+	strcpy(player->PLAYER_PATH,"NULL");
+	strcpy(player->REPEAT,"off");
+	strcpy(player->STATUS,"stopped");
+	strcpy(player->PLAYER_NAME,"NULL");
+	strcpy(player->TYPE,"Audio");
+	strcpy(player->TRACK_TITLE,"--.--");
+	strcpy(player->TRACK_ARTIST,"--.--");
+	strcpy(player->TRACK_ALBUM,"--.--");
+	strcpy(player->TRACK_GENRE,"NULL");
+	player->CONNECTED = false;
+	player->TRACK_NUMBER = 0;
+	player->TRACK_DURATION = 0;
+	player->TRACK_POSITION = 0;
+}
+
+static MediaPlayer * bluez_media_player_find(const char * playerPath)
+{
+	int i;
 	
-	// copy the name of the property we asked for
-	strcpy(propertyName,userData);
+	for(i = 0; i < MEDIA_PLAYER_MAX_PLAYERS; i++)
+	{
+		if(strcmp(mPlayers[i].PLAYER_PATH, playerPath) == 0)
+			return &mPlayers[i];
+	}
 	
-	// was the call successful?
-	result = g_dbus_connection_call_finish((GDBusConnection *)con, res, &error);
-	if(result == NULL)
+	return NULL;
+}
+
+/*
+ * Returns the player with this path, a new one is set up if there is none, NULL if every slot is taken
+*/
+static MediaPlayer * bluez_media_player_take(const char * playerPath, bool * isNew)
+{
+	MediaPlayer * player = bluez_media_player_find(playerPath);
+	const char * end = strrchr(playerPath, '/');
+	gsize deviceLength = end != NULL ? (gsize)(end - playerPath) : 0;
+	int i;
+	
+	*isNew = player == NULL;
+	if(player != NULL)
+		return player;
+	
+	/*1. A player lives below its device, the MediaControl1 of the device may have come first */
+	for(i = 0; i < MEDIA_PLAYER_MAX_PLAYERS && player == NULL; i++)
 	{
-		g_print("\t- Unable to get result for Property: %s\n", propertyName);
-		
-		if(error != NULL)
+		if(strcmp(mPlayers[i].PLAYER_PATH, "NULL") == 0 && strlen(mPlayers[i].OBJECT_PATH) == deviceLength &&
+			strncmp(mPlayers[i].OBJECT_PATH, playerPath, deviceLength) == 0)
+			player = &mPlayers[i];
+	}
+	
+	/*2. Otherwise a free slot */
+	for(i = 0; i < MEDIA_PLAYER_MAX_PLAYERS && player == NULL; i++)
+	{
+		if(strcmp(mPlayers[i].OBJECT_PATH, "NULL") == 0)
 		{
-			g_print("\t- Error: %s\n",error->message);
-			g_error_free(error);
+			player = &mPlayers[i];
+			g_strlcpy(player->OBJECT_PATH, playerPath, MIN(deviceLength + 1, sizeof(player->OBJECT_PATH)));
 		}
-		return;
 	}
 	
-	// okay lets update the property we asked for
-	if(result) {
-		result = g_variant_get_child_value(result, 0);
-		if(g_variant_n_children(result) > 0)
-			propertyValue = g_variant_get_child_value(result,0);
-		
-		if(propertyValue)
+	if(player == NULL)
+	{
+		BLUEZ_LOG_WARN("***	MediaPlayer: no room for %s\n", playerPath, 0, 0, 0);
+		return NULL;
+	}
+	
+	g_strlcpy(player->PLAYER_PATH, playerPath, sizeof(player->PLAYER_PATH));
+	
+	// the first player becomes the one the control methods go to
+	if(strcmp(mDefaultPlayer->PLAYER_PATH, "NULL") == 0 && !mDefaultPlayer->CONNECTED)
+		mDefaultPlayer = player;
+	
+	return player;
+}
+
+/*
+ * Returns the player of the device with this path, a slot is set up for it if there is none
+*/
+static MediaPlayer * bluez_media_control_take(const char * devicePath)
+{
+	MediaPlayer * control = NULL;
+	int i;
+	
+	if(strcmp(mDefaultPlayer->OBJECT_PATH, devicePath) == 0)
+		return mDefaultPlayer;
+	
+	for(i = 0; i < MEDIA_PLAYER_MAX_PLAYERS && control == NULL; i++)
+	{
+		if(strcmp(mPlayers[i].OBJECT_PATH, devicePath) == 0)
+			control = &mPlayers[i];
+	}
+	
+	for(i = 0; i < MEDIA_PLAYER_MAX_PLAYERS && control == NULL; i++)
+	{
+		if(strcmp(mPlayers[i].OBJECT_PATH, "NULL") == 0)
 		{
-			g_print("\t- Updating <%s>, Value <%s>\n",propertyName,g_variant_print(propertyValue,FALSE));
-			bluez_media_player_parse_property_value(propertyName, propertyValue);
+			control = &mPlayers[i];
+			g_strlcpy(control->OBJECT_PATH, devicePath, sizeof(control->OBJECT_PATH));
 		}
 	}
-	g_variant_unref(result);
-	g_variant_unref(propertyValue);	
+	
+	if(control == NULL)
+		BLUEZ_LOG_WARN("***	MediaPlayer: no room for %s\n", devicePath, 0, 0, 0);
+	
+	return control;
 }
 
+static void bluez_media_player_read_property_cb(BluezCommand * command, gpointer userData)
+{
+	GVariant *result = bluez_command_get_result(command);		// borrowed
+	GVariant * propertyValue = NULL;
+	const char * playerPath;
+	const char * propertyName;
+	MediaPlayer * player;
+
+	// userData is the player and the property we asked for, both borrowed from it until we are done
+	g_variant_get((GVariant *)userData, "(&s&s)", &playerPath, &propertyName);
+
+	g_print("***\t Media Player Inside Property Callback\t***\n");
+	
+	// was the call successful?
+	if(result == NULL)
+	{
+		g_print("\t- Unable to get result for Property: %s\n", propertyName);
+		g_print("\t- Error: %s\n", bluez_command_get_error(command));
+		goto done;
+	}
+	
+	// the player may have gone away while the call was out
+	player = bluez_media_player_find(playerPath);
+	if(player == NULL)
+		goto done;
+	
+	// okay lets update the property we asked for
+	g_variant_get(result, "(v)", &propertyValue);
+	g_print("\t- Updating <%s>, Type <%s>\n",propertyName,g_variant_get_type_string(propertyValue));
+	bluez_media_player_parse_property_value(player, propertyName, propertyValue);
+	
+	g_variant_unref(propertyValue);
+	
+	done:
+		g_variant_unref((GVariant *)userData);
+}
+
+static void bluez_media_player_read_all_properties_cb(BluezCommand * command, gpointer userData)
+{
+	GVariant *result = bluez_command_get_result(command);		// borrowed
+	GVariantIter *properties;
+	const char *key;
+	GVariant *value;
+	char * playerPath = userData;
+	MediaPlayer * player;
+
+	g_print("***\t Media Player Inside GetAll Callback\t***\n");
+	
+	// was the call successful?
+	if(result == NULL || !g_variant_is_of_type(result, G_VARIANT_TYPE("(a{sv})")))
+	{
+		g_print("\t- Unable to get the player properties\n");
+		g_print("\t- Error: %s\n", result == NULL ? bluez_command_get_error(command) : "Unexpected reply type");
+		g_free(playerPath);
+		return;
+	}
+	
+	// the player may have gone away while the call was out
+	player = bluez_media_player_find(playerPath);
+	g_free(playerPath);
+	if(player == NULL)
+		return;
+	
+	// every property of the player in one dictionary
+	g_variant_get(result, "(a{sv})", &properties);
+	while(g_variant_iter_next(properties, "{&sv}", &key, &value))
+	{
+		bluez_media_player_parse_property_value(player, key, value);
+		g_variant_unref(value);
+	}
+	
+	g_variant_iter_free(properties);
+}
@@ -0,0 +1,408 @@
+/**
+	* @file bluez_metrics.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the latency histograms and signal counters of our D-Bus traffic
+	*
+	*	- Methods and signals live in fixed open addressed tables, a slot is only ever added, never removed.
+	*	  The name of a slot is published last, a reader that finds it sees the rest of the key too,
+	*	  so looking up a name never takes the lock, adding one does.
+	*	- Counters are relaxed atomic adds, the exporter reads them without stopping anyone. A snapshot can be
+	*	  off by the samples recorded while it is read, never torn.
+	*	- Buckets are kept per bucket and summed up when written, a sample touches a single bucket.
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_metrics.h"
+#include "bluez_command.h"
+
+#define CACHE_LINE_SIZE			64
+
+#if (BLUEZ_METRICS_MAX_METHODS & (BLUEZ_METRICS_MAX_METHODS - 1)) != 0
+#error "BLUEZ_METRICS_MAX_METHODS must be a power of 2"
+#endif
+
+#if (BLUEZ_METRICS_MAX_SIGNALS & (BLUEZ_METRICS_MAX_SIGNALS - 1)) != 0
+#error "BLUEZ_METRICS_MAX_SIGNALS must be a power of 2"
+#endif
+
+/*
+ * Private Types
+*/
+typedef struct _MetricKey
+{
+	const char *	INTERFACE;		// last element of the interface, interned
+	const char *	NAME;			// method or signal, interned, published last
+	guint			HASH;
+} MetricKey;
+
+typedef struct _MethodMetric
+{
+	guint64		BUCKETS[BLUEZ_METRICS_BUCKETS];
+	guint64		SUM_US;
+	guint64		FAILED;
+	guint64		TIMED_OUT;
+	guint64		CANCELLED;
+} __attribute__((aligned(CACHE_LINE_SIZE))) MethodMetric;
+
+/*
+ * Private Function Declerations
+*/
+static const char * bluez_metrics_short_interface(const char * interface);
+static guint bluez_metrics_hash(const char * interface, const char * name);
+static int bluez_metrics_find(MetricKey * keys, guint size, const char * interface, const char * name);
+static int bluez_metrics_bucket(gint64 latencyUs);
+static gboolean bluez_metrics_export(gpointer userData);
+static guint64 bluez_metrics_get(const guint64 * counter);
+
+/*
+ * Private Variables
+*/
+// upper bound of every bucket but the last, in micro seconds
+static const gint64 mBounds[BLUEZ_METRICS_BUCKETS - 1] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 25000000
+};
+
+static MetricKey mMethodKeys[BLUEZ_METRICS_MAX_METHODS];
+static MethodMetric mMethods[BLUEZ_METRICS_MAX_METHODS];
+static MetricKey mSignalKeys[BLUEZ_METRICS_MAX_SIGNALS];
+static guint64 mSignals[BLUEZ_METRICS_MAX_SIGNALS];
+static guint64 mUntracked = 0;
+static guint64 mExports = 0;
+static GMutex mLock;						// held to add a slot
+static guint mExportSource = 0;
+static char * mExportPath = NULL;
+
+/*
+ * Modifiers
+*/
+bool bluez_metrics_start_export(const char * path, guint periodS)
+{
+	if(mExportSource != 0)
+		return false;
+
+	mExportPath = g_strdup(path != NULL ? path : BLUEZ_METRICS_DEFAULT_PATH);
+
+	/*1. A collector started before the first period already finds a file */
+	bluez_metrics_write(mExportPath);
+	mExportSource = g_timeout_add_seconds(periodS, bluez_metrics_export, NULL);
+
+	g_print("Metrics written to %s every %u s\n", mExportPath, periodS);
+
+	return true;
+}
+
+void bluez_metrics_stop_export(void)
+{
+	if(mExportSource == 0)
+		return;
+
+	g_source_remove(mExportSource);
+	mExportSource = 0;
+
+	bluez_metrics_write(mExportPath);
+	g_free(mExportPath);
+	mExportPath = NULL;
+}
+
+int bluez_metrics_method(const char * interface, const char * method)
+{
+	int id = bluez_metrics_find(mMethodKeys, BLUEZ_METRICS_MAX_METHODS, interface, method);
+
+	if(id < 0)
+		__atomic_fetch_add(&mUntracked, 1, __ATOMIC_RELAXED);
+
+	return id;
+}
+
+void bluez_metrics_record_call(int method, gint64 latencyUs, int state)
+{
+	MethodMetric * metric;
+
+	if(method < 0 || method >= BLUEZ_METRICS_MAX_METHODS)
+		return;
+
+	metric = &mMethods[method];
+
+	/*1. There is no reply to time */
+	if(state == BLUEZ_COMMAND_CANCELLED)
+	{
+		__atomic_fetch_add(&metric->CANCELLED, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	/*2. An error reply is a round trip too, a timeout lands in the buckets of its deadline */
+	if(state == BLUEZ_COMMAND_FAILED)
+		__atomic_fetch_add(&metric->FAILED, 1, __ATOMIC_RELAXED);
+	else if(state == BLUEZ_COMMAND_TIMED_OUT)
+		__atomic_fetch_add(&metric->TIMED_OUT, 1, __ATOMIC_RELAXED);
+
+	if(latencyUs < 0)
+		latencyUs = 0;
+
+	__atomic_fetch_add(&metric->BUCKETS[bluez_metrics_bucket(latencyUs)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&metric->SUM_US, (guint64)latencyUs, __ATOMIC_RELAXED);
+}
+
+void bluez_metrics_record_reply(int method, gint64 startUs, const GError * error)
+{
+	int state = BLUEZ_COMMAND_SUCCEEDED;
+
+	if(error != NULL)
+	{
+		if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+			state = BLUEZ_COMMAND_TIMED_OUT;
+		else if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			state = BLUEZ_COMMAND_CANCELLED;
+		else
+			state = BLUEZ_COMMAND_FAILED;
+	}
+
+	bluez_metrics_record_call(method, g_get_monotonic_time() - startUs, state);
+}
+
+void bluez_metrics_record_signal(const char * interface, const char * member)
+{
+	int id = bluez_metrics_find(mSignalKeys, BLUEZ_METRICS_MAX_SIGNALS, interface, member);
+
+	if(id < 0)
+	{
+		__atomic_fetch_add(&mUntracked, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	__atomic_fetch_add(&mSignals[id], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Accessors
+*/
+bool bluez_metrics_write(const char * path)
+{
+	GString * out = g_string_sized_new(4096);
+	GError * error = NULL;
+	guint64 buckets[BLUEZ_METRICS_BUCKETS];
+	guint64 count;
+	const char * name;
+	bool succeed;
+	guint i;
+	guint b;
+
+	/*1. Latency, buckets are cumulative in the file */
+	g_string_append(out, "# HELP stereo_dbus_call_duration_microseconds Time from sending a method call to bluez to its reply\n");
+	g_string_append(out, "# TYPE stereo_dbus_call_duration_microseconds histogram\n");
+	for(i = 0; i < BLUEZ_METRICS_MAX_METHODS; i++)
+	{
+		name = g_atomic_pointer_get(&mMethodKeys[i].NAME);
+		if(name == NULL)
+			continue;
+
+		count = 0;
+		for(b = 0; b < BLUEZ_METRICS_BUCKETS; b++)
+			buckets[b] = bluez_metrics_get(&mMethods[i].BUCKETS[b]);
+
+		for(b = 0; b < BLUEZ_METRICS_BUCKETS; b++)
+		{
+			count += buckets[b];
+			if(b < BLUEZ_METRICS_BUCKETS - 1)
+				g_string_append_printf(out, "stereo_dbus_call_duration_microseconds_bucket{interface=\"%s\",method=\"%s\",le=\"%lld\"} %llu\n",
+						mMethodKeys[i].INTERFACE, name, (long long)mBounds[b], (unsigned long long)count);
+			else
+				g_string_append_printf(out, "stereo_dbus_call_duration_microseconds_bucket{interface=\"%s\",method=\"%s\",le=\"+Inf\"} %llu\n",
+						mMethodKeys[i].INTERFACE, name, (unsigned long long)count);
+		}
+
+		g_string_append_printf(out, "stereo_dbus_call_duration_microseconds_sum{interface=\"%s\",method=\"%s\"} %llu\n",
+				mMethodKeys[i].INTERFACE, name, (unsigned long long)bluez_metrics_get(&mMethods[i].SUM_US));
+		g_string_append_printf(out, "stereo_dbus_call_duration_microseconds_count{interface=\"%s\",method=\"%s\"} %llu\n",
+				mMethodKeys[i].INTERFACE, name, (unsigned long long)count);
+	}
+
+	/*2. Calls that did not succeed, by reason */
+	g_string_append(out, "# HELP stereo_dbus_call_errors_total Method calls to bluez that did not succeed\n");
+	g_string_append(out, "# TYPE stereo_dbus_call_errors_total counter\n");
+	for(i = 0; i < BLUEZ_METRICS_MAX_METHODS; i++)
+	{
+		name = g_atomic_pointer_get(&mMethodKeys[i].NAME);
+		if(name == NULL)
+			continue;
+
+		g_string_append_printf(out, "stereo_dbus_call_errors_total{interface=\"%s\",method=\"%s\",reason=\"failed\"} %llu\n",
+				mMethodKeys[i].INTERFACE, name, (unsigned long long)bluez_metrics_get(&mMethods[i].FAILED));
+		g_string_append_printf(out, "stereo_dbus_call_errors_total{interface=\"%s\",method=\"%s\",reason=\"timed_out\"} %llu\n",
+				mMethodKeys[i].INTERFACE, name, (unsigned long long)bluez_metrics_get(&mMethods[i].TIMED_OUT));
+		g_string_append_printf(out, "stereo_dbus_call_errors_total{interface=\"%s\",method=\"%s\",reason=\"cancelled\"} %llu\n",
+				mMethodKeys[i].INTERFACE, name, (unsigned long long)bluez_metrics_get(&mMethods[i].CANCELLED));
+	}
+
+	/*3. Signals */
+	g_string_append(out, "# HELP stereo_dbus_signals_total Signals received from bluez and the bus\n");
+	g_string_append(out, "# TYPE stereo_dbus_signals_total counter\n");
+	for(i = 0; i < BLUEZ_METRICS_MAX_SIGNALS; i++)
+	{
+		name = g_atomic_pointer_get(&mSignalKeys[i].NAME);
+		if(name == NULL)
+			continue;
+
+		g_string_append_printf(out, "stereo_dbus_signals_total{interface=\"%s\",member=\"%s\"} %llu\n",
+				mSignalKeys[i].INTERFACE, name, (unsigned long long)bluez_metrics_get(&mSignals[i]));
+	}
+
+	g_string_append(out, "# HELP stereo_dbus_metrics_untracked_total Samples lost because their table was full\n");
+	g_string_append(out, "# TYPE stereo_dbus_metrics_untracked_total counter\n");
+	g_string_append_printf(out, "stereo_dbus_metrics_untracked_total %llu\n", (unsigned long long)bluez_metrics_get(&mUntracked));
+
+	/*4. Written next to the file and renamed over it */
+	succeed = g_file_set_contents(path, out->str, out->len, &error);
+	if(!succeed)
+	{
+		g_print("Error: Metrics not written to %s. Message: %s\n", path, error->message);
+		g_error_free(error);
+	}
+	else
+		__atomic_fetch_add(&mExports, 1, __ATOMIC_RELAXED);
+
+	g_string_free(out, TRUE);
+
+	return succeed;
+}
+
+void bluez_metrics_get_stats(BluezMetricsStats * stats)
+{
+	guint i;
+	guint b;
+
+	memset(stats, 0, sizeof(BluezMetricsStats));
+
+	for(i = 0; i < BLUEZ_METRICS_MAX_METHODS; i++)
+	{
+		if(g_atomic_pointer_get(&mMethodKeys[i].NAME) == NULL)
+			continue;
+
+		stats->METHODS++;
+		for(b = 0; b < BLUEZ_METRICS_BUCKETS; b++)
+			stats->CALLS += bluez_metrics_get(&mMethods[i].BUCKETS[b]);
+		stats->FAILED += bluez_metrics_get(&mMethods[i].FAILED);
+		stats->TIMED_OUT += bluez_metrics_get(&mMethods[i].TIMED_OUT);
+		stats->CANCELLED += bluez_metrics_get(&mMethods[i].CANCELLED);
+	}
+
+	for(i = 0; i < BLUEZ_METRICS_MAX_SIGNALS; i++)
+	{
+		if(g_atomic_pointer_get(&mSignalKeys[i].NAME) == NULL)
+			continue;
+
+		stats->SIGNAL_TYPES++;
+		stats->SIGNALS += bluez_metrics_get(&mSignals[i]);
+	}
+
+	stats->UNTRACKED = bluez_metrics_get(&mUntracked);
+	stats->EXPORTS = bluez_metrics_get(&mExports);
+}
+
+void bluez_metrics_print_stats(void)
+{
+	BluezMetricsStats stats;
+
+	bluez_metrics_get_stats(&stats);
+
+	g_print("***\t Metrics \t***\n");
+	g_print("- Methods:\t%u\n", stats.METHODS);
+	g_print("- Calls:\t%llu\n", (unsigned long long)stats.CALLS);
+	g_print("- Failed:\t%llu\n", (unsigned long long)stats.FAILED);
+	g_print("- Timed Out:\t%llu\n", (unsigned long long)stats.TIMED_OUT);
+	g_print("- Cancelled:\t%llu\n", (unsigned long long)stats.CANCELLED);
+	g_print("- Signal Types:\t%u\n", stats.SIGNAL_TYPES);
+	g_print("- Signals:\t%llu\n", (unsigned long long)stats.SIGNALS);
+	g_print("- Untracked:\t%llu\n", (unsigned long long)stats.UNTRACKED);
+	g_print("- Exports:\t%llu\n", (unsigned long long)stats.EXPORTS);
+}
+
+/*
+ * Private Functions
+*/
+static const char * bluez_metrics_short_interface(const char * interface)
+{
+	const char * dot = strrchr(interface, '.');
+
+	// org.bluez.Adapter1 -> Adapter1
+	return dot != NULL ? dot + 1 : interface;
+}
+
+static guint bluez_metrics_hash(const char * interface, const char * name)
+{
+	return g_str_hash(interface) * 31 + g_str_hash(name);
+}
+
+static int bluez_metrics_find(MetricKey * keys, guint size, const char * interface, const char * name)
+{
+	const char * shortInterface = bluez_metrics_short_interface(interface);
+	guint hash = bluez_metrics_hash(shortInterface, name);
+	guint mask = size - 1;
+	guint i;
+	guint slot;
+	const char * published;
+
+	/*1. Without the lock, the slots seen here are complete */
+	for(i = 0, slot = hash & mask; i < size; i++, slot = (slot + 1) & mask)
+	{
+		published = g_atomic_pointer_get(&keys[slot].NAME);
+		if(published == NULL)
+			break;
+
+		if(keys[slot].HASH == hash && strcmp(published, name) == 0 && strcmp(keys[slot].INTERFACE, shortInterface) == 0)
+			return (int)slot;
+	}
+
+	if(i == size)
+		return BLUEZ_METRICS_NO_METHOD;
+
+	/*2. Not there yet, probe again with the lock, another thread may have just added it */
+	g_mutex_lock(&mLock);
+
+	for(i = 0, slot = hash & mask; i < size; i++, slot = (slot + 1) & mask)
+	{
+		published = keys[slot].NAME;
+		if(published == NULL)
+		{
+			keys[slot].INTERFACE = g_intern_string(shortInterface);
+			keys[slot].HASH = hash;
+			g_atomic_pointer_set(&keys[slot].NAME, g_intern_string(name));
+			break;
+		}
+
+		if(keys[slot].HASH == hash && strcmp(published, name) == 0 && strcmp(keys[slot].INTERFACE, shortInterface) == 0)
+			break;
+	}
+
+	g_mutex_unlock(&mLock);
+
+	return i < size ? (int)slot : BLUEZ_METRICS_NO_METHOD;
+}
+
+static int bluez_metrics_bucket(gint64 latencyUs)
+{
+	int b;
+
+	for(b = 0; b < BLUEZ_METRICS_BUCKETS - 1; b++)
+		if(latencyUs <= mBounds[b])
+			break;
+
+	return b;
+}
+
+static gboolean bluez_metrics_export(gpointer userData)
+{
+	(void)userData;
+
+	bluez_metrics_write(mExportPath);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static guint64 bluez_metrics_get(const guint64 * counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
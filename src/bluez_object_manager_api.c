@@ -0,0 +1,153 @@
+/**
+	* @file bluez_object_manager_api.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to populate the application state from a single ObjectManager.GetManagedObjects call
+	*
+	*	- The reply is a{oa{sa{sv}}}, every object path with every interface and all of its properties
+	*	- Each interface is handed to the module that owns it, the device registry, the adapter, or the media player
+	*	  
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+
+#include "bluez_object_manager_api.h"
+#include "bluez_dbus_names.h"
+#include "bluez_adapter_api.h"
+#include "bluez_mediaplayer_api.h"
+#include "bluetooth_device.h"
+#include "bluez_advertisement.h"
+#include "bluez_command.h"
+
+#define DEVICE_PROPERTIES_READ	6		// Properties.Get calls made by bluez_device_read_remote_device_properties
+#define PLAYER_PROPERTIES_READ	5		// Properties.Get calls made by bluez_media_player_read_remote_player_properties
+
+/*
+ * Private Function Declerations
+*/
+static void bluez_object_manager_apply_object(const char * path, GVariant * interfaces);
+
+/*
+ * Private Variables
+*/
+static GDBusConnection * mCon;
+static ObjectManagerStats mStats;
+
+/*
+ * Modifiers
+*/
+int bluez_object_manager_init(GDBusConnection * conn)
+{
+	g_print("Initializing Object Manager...\n");
+	
+	mCon = conn;
+	
+	if(mCon == NULL) {
+		g_printerr("Not able to get connection to system bus\n");
+		/**TODO Need to organize Error Codes */
+		return -3;
+	}
+	
+	return 0;
+}
+
+int bluez_object_manager_populate(void)
+{
+	GVariant *result;
+	GVariant *objects;
+	GVariant *interfaces;
+	GVariantIter iter;
+	const char *path;
+	gint64 start = g_get_monotonic_time();
+	
+	memset(&mStats, 0, sizeof(mStats));
+	
+	/*1. One round trip for the whole object tree, a command so it is timed and can be recorded and replayed */
+	mStats.ROUND_TRIPS = 1;
+	if(!bluez_command_call_sync(BLUEZ_ROOT_PATH, OBJECT_MANAGER_INTERFACE, "GetManagedObjects", NULL, -1, &result))
+		return -1;
+	
+	if(!g_variant_is_of_type(result, G_VARIANT_TYPE("(a{oa{sa{sv}}})")))
+	{
+		g_print("Error: GetManagedObjects. Type: %s\n", g_variant_get_type_string(result));
+		g_variant_unref(result);
+		return -1;
+	}
+	
+	/*2. Apply every object */
+	objects = g_variant_get_child_value(result, 0);
+	g_variant_iter_init(&iter, objects);
+	while(g_variant_iter_next(&iter, "{&o@a{sa{sv}}}", &path, &interfaces))
+	{
+		bluez_object_manager_apply_object(path, interfaces);
+		g_variant_unref(interfaces);
+		mStats.OBJECTS++;
+	}
+	
+	g_variant_unref(objects);
+	g_variant_unref(result);
+	
+	mStats.ELAPSED_US = g_get_monotonic_time() - start;
+	mStats.ROUND_TRIPS_SAVED = mStats.DEVICES * DEVICE_PROPERTIES_READ + mStats.PLAYERS * PLAYER_PROPERTIES_READ;
+	
+	return mStats.OBJECTS;
+}
+
+/*
+ * Accessors
+*/
+void bluez_object_manager_get_stats(ObjectManagerStats * stats)
+{
+	*stats = mStats;
+}
+
+void bluez_object_manager_print_stats(void)
+{
+	g_print("***\tObject Manager: %u objects (%u adapters, %u devices, %u players, %u controls) in %u round trip, %lld us\n",
+			mStats.OBJECTS, mStats.ADAPTERS, mStats.DEVICES, mStats.PLAYERS, mStats.CONTROLS,
+			mStats.ROUND_TRIPS, (long long)mStats.ELAPSED_US);
+	g_print("***\tObject Manager: saved %u Properties.Get round trips\n", mStats.ROUND_TRIPS_SAVED);
+}
+
+/*
+ * Private Functions
+*/
+static void bluez_object_manager_apply_object(const char * path, GVariant * interfaces)
+{
+	GVariantIter iter;
+	const char *interface;
+	GVariant *properties;
+	BluetoothDevice newDevice;
+	
+	g_variant_iter_init(&iter, interfaces);
+	while(g_variant_iter_next(&iter, "{&s@a{sv}}", &interface, &properties))
+	{
+		if(strcmp(interface, BLUEZ_DEVICE_INTERFACE) == 0)
+		{
+			// fill in the whole device, then add it with a single registry update
+			bluetooth_device_init_properties(&newDevice, path);
+			bluetooth_device_apply_properties(&newDevice, properties);
+			bluetooth_device_add_device(&newDevice);
+			bluez_advertisement_update(path, properties);
+			mStats.DEVICES++;
+		}
+		else if(strcmp(interface, BLUEZ_ADAPTER_INTERFACE) == 0)
+		{
+			bluez_adapter_update_properties(path, properties);
+			mStats.ADAPTERS++;
+		}
+		else if(strcmp(interface, BLUEZ_MediaPlayer_INTERFACE) == 0)
+		{
+			bluez_media_player_update_properties(path, properties);
+			mStats.PLAYERS++;
+		}
+		else if(strcmp(interface, BLUEZ_MediaController_INTERFACE) == 0)
+		{
+			bluez_media_control_update_properties(path, properties);
+			mStats.CONTROLS++;
+		}
+		
+		g_variant_unref(properties);
+	}
+}
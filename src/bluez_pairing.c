@@ -0,0 +1,343 @@
+/**
+	* @file bluez_pairing.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the trust -> pair -> connect pipeline for a batch of devices
+	*
+	*	- Everything after bluez_pairing_start runs on the GMainLoop thread, the commands complete there and
+	*	  the state machine is only ever advanced from their callbacks, so it needs no locking.
+	*	- A device holds a session from its first stage until it is done or failed, the next queued device
+	*	  takes the session as soon as it is free.
+	*
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_pairing.h"
+#include "bluez_command.h"
+#include "bluez_dbus_names.h"
+
+#define PAIRING_DEFAULT_SESSIONS		4
+#define PAIRING_DEFAULT_RETRIES			2
+#define PAIRING_CONNECT_TIMEOUT_MS		15000		// Connect brings up every profile, A2DP included
+#define PAIRING_RETRY_DELAY_MS			500			// lets bluez settle after a failed attempt
+
+/*
+ * Private Function Declerations
+*/
+static gboolean bluez_pairing_launch(gpointer userData);
+static void bluez_pairing_start_stage(guint device, int stage);
+static void bluez_pairing_stage_done(BluezCommand * command, gpointer userData);
+static gboolean bluez_pairing_retry(gpointer userData);
+static void bluez_pairing_finish(guint device, int stage);
+static void bluez_pairing_advance(void);
+static gboolean bluez_pairing_cancel_all(gpointer userData);
+static const char * bluez_pairing_stage_name(int stage);
+
+/*
+ * Private Variables
+*/
+static PairingResult mResults[MAX_NUMBER_PAIRING_DEVICES];
+static BluezCommand * mCommands[MAX_NUMBER_PAIRING_DEVICES];		// pending command of each device
+static guint mRetryTimers[MAX_NUMBER_PAIRING_DEVICES];				// pending retry of each device
+static gint64 mStageStart[MAX_NUMBER_PAIRING_DEVICES];
+static bool mSession[MAX_NUMBER_PAIRING_DEVICES];					// device holds a session
+static guint mCount = 0;
+static guint mNext = 0;			// first device still queued
+static guint mActive = 0;		// devices holding a session
+static guint mFinished = 0;
+static bool mCancelled = false;
+static gint mRunning = 0;
+static PairingConfig mConfig;
+static bluez_pairing_done mCallback = NULL;
+static gpointer mUserData = NULL;
+
+/*
+ * Modifiers
+*/
+void bluez_pairing_default_config(PairingConfig * config)
+{
+	config->MAX_SESSIONS = PAIRING_DEFAULT_SESSIONS;
+	config->RETRIES = PAIRING_DEFAULT_RETRIES;
+	config->TRUST_TIMEOUT_MS = BLUEZ_COMMAND_DEFAULT_TIMEOUT_MS;
+	config->PAIR_TIMEOUT_MS = BLUEZ_COMMAND_PAIR_TIMEOUT_MS;
+	config->CONNECT_TIMEOUT_MS = PAIRING_CONNECT_TIMEOUT_MS;
+}
+
+bool bluez_pairing_start(const char * const * paths, guint count, const PairingConfig * config, bluez_pairing_done callback, gpointer userData)
+{
+	guint i;
+
+	if(count == 0 || count > MAX_NUMBER_PAIRING_DEVICES)
+	{
+		g_print("Pairing batch of %u devices is out of range\n", count);
+		return false;
+	}
+
+	/*1. One batch at a time */
+	if(!g_atomic_int_compare_and_exchange(&mRunning, 0, 1))
+	{
+		g_print("A pairing batch is already running\n");
+		return false;
+	}
+
+	/*2. Every device starts queued */
+	if(config != NULL)
+		mConfig = *config;
+	else
+		bluez_pairing_default_config(&mConfig);
+
+	if(mConfig.MAX_SESSIONS == 0)
+		mConfig.MAX_SESSIONS = 1;
+
+	memset(mResults, 0, sizeof(mResults));
+	for(i = 0; i < count; i++)
+	{
+		g_strlcpy(mResults[i].PATH, paths[i], sizeof(mResults[i].PATH));
+		mResults[i].STAGE = PAIRING_STAGE_QUEUED;
+		mCommands[i] = NULL;
+		mRetryTimers[i] = 0;
+		mSession[i] = false;
+	}
+
+	mCount = count;
+	mNext = 0;
+	mActive = 0;
+	mFinished = 0;
+	mCancelled = false;
+	mCallback = callback;
+	mUserData = userData;
+
+	g_print("Pairing %u devices, %u at a time\n", count, mConfig.MAX_SESSIONS);
+
+	/*3. The state machine runs on the GMainLoop thread from here on */
+	g_main_context_invoke(NULL, bluez_pairing_launch, NULL);
+
+	return true;
+}
+
+void bluez_pairing_cancel(void)
+{
+	if(bluez_pairing_is_running())
+		g_main_context_invoke(NULL, bluez_pairing_cancel_all, NULL);
+}
+
+/*
+ * Accessors
+*/
+bool bluez_pairing_is_running(void)
+{
+	return g_atomic_int_get(&mRunning) != 0;
+}
+
+void bluez_pairing_print_results(void)
+{
+	guint i;
+
+	g_print("***\t Pairing Results \t***\n");
+
+	for(i = 0; i < mCount; i++)
+	{
+		PairingResult * result = &mResults[i];
+
+		g_print("[ %u ] %s\t%s", i + 1, result->PATH, bluez_pairing_stage_name(result->STAGE));
+		if(result->STAGE == PAIRING_STAGE_FAILED)
+			g_print(" at %s", bluez_pairing_stage_name(result->FAILED_STAGE));
+		g_print("\n");
+
+		g_print("\t- Trust:\t%lld ms (%u attempts)\n", (long long)(result->STAGE_US[0] / 1000), result->ATTEMPTS[0]);
+		g_print("\t- Pair:\t\t%lld ms (%u attempts)\n", (long long)(result->STAGE_US[1] / 1000), result->ATTEMPTS[1]);
+		g_print("\t- Connect:\t%lld ms (%u attempts)\n", (long long)(result->STAGE_US[2] / 1000), result->ATTEMPTS[2]);
+
+		if(result->ERROR[0] != '\0')
+			g_print("\t- Last Error:\t%s\n", result->ERROR);
+	}
+}
+
+/*
+ * Private Functions
+*/
+static gboolean bluez_pairing_launch(gpointer userData)
+{
+	(void)userData;
+
+	/*1. A cancelled batch never starts another device */
+	while(mCancelled && mNext < mCount)
+	{
+		mResults[mNext++].STAGE = PAIRING_STAGE_CANCELLED;
+		mFinished++;
+	}
+
+	/*2. Fill every free session from the queue */
+	while(mActive < mConfig.MAX_SESSIONS && mNext < mCount)
+	{
+		mSession[mNext] = true;
+		mActive++;
+		bluez_pairing_start_stage(mNext++, PAIRING_STAGE_TRUST);
+	}
+
+	return FALSE;
+}
+
+static void bluez_pairing_start_stage(guint device, int stage)
+{
+	PairingResult * result = &mResults[device];
+	gpointer userData = GUINT_TO_POINTER(device);
+
+	result->STAGE = stage;
+	result->ATTEMPTS[stage - PAIRING_STAGE_TRUST]++;
+	mStageStart[device] = g_get_monotonic_time();
+
+	switch(stage)
+	{
+		case PAIRING_STAGE_TRUST:
+			mCommands[device] = bluez_command_set_property(result->PATH, BLUEZ_DEVICE_INTERFACE, "Trusted",
+									g_variant_new("b", TRUE), mConfig.TRUST_TIMEOUT_MS, bluez_pairing_stage_done, userData);
+		break;
+		case PAIRING_STAGE_PAIR:
+			mCommands[device] = bluez_command_call(result->PATH, BLUEZ_DEVICE_INTERFACE, "Pair",
+									NULL, mConfig.PAIR_TIMEOUT_MS, bluez_pairing_stage_done, userData);
+		break;
+		case PAIRING_STAGE_CONNECT:
+			mCommands[device] = bluez_command_call(result->PATH, BLUEZ_DEVICE_INTERFACE, "Connect",
+									NULL, mConfig.CONNECT_TIMEOUT_MS, bluez_pairing_stage_done, userData);
+		break;
+	}
+}
+
+static void bluez_pairing_stage_done(BluezCommand * command, gpointer userData)
+{
+	guint device = GPOINTER_TO_UINT(userData);
+	PairingResult * result = &mResults[device];
+	int stage = result->STAGE;
+	int state = bluez_command_get_state(command);
+	bool succeed = state == BLUEZ_COMMAND_SUCCEEDED;
+
+	/*1. Account the attempt */
+	result->STAGE_US[stage - PAIRING_STAGE_TRUST] += g_get_monotonic_time() - mStageStart[device];
+
+	// a device that is already paired or connected has reached the goal of the stage
+	if(stage == PAIRING_STAGE_PAIR && bluez_command_error_is(command, "org.bluez.Error.AlreadyExists"))
+		succeed = true;
+	if(stage == PAIRING_STAGE_CONNECT && bluez_command_error_is(command, "org.bluez.Error.AlreadyConnected"))
+		succeed = true;
+
+	if(!succeed && bluez_command_get_error(command) != NULL)
+		g_strlcpy(result->ERROR, bluez_command_get_error(command), sizeof(result->ERROR));
+
+	bluez_command_unref(mCommands[device]);
+	mCommands[device] = NULL;
+
+	/*2. Next stage, retry, or give up */
+	if(state == BLUEZ_COMMAND_CANCELLED || mCancelled)
+		bluez_pairing_finish(device, PAIRING_STAGE_CANCELLED);
+	else if(succeed && stage == PAIRING_STAGE_CONNECT)
+		bluez_pairing_finish(device, PAIRING_STAGE_DONE);
+	else if(succeed)
+	{
+		bluez_pairing_start_stage(device, stage + 1);
+		return;
+	}
+	else if(result->ATTEMPTS[stage - PAIRING_STAGE_TRUST] <= mConfig.RETRIES)
+	{
+		g_print("%s %s failed, retrying: %s\n", result->PATH, bluez_pairing_stage_name(stage), result->ERROR);
+		mRetryTimers[device] = g_timeout_add(PAIRING_RETRY_DELAY_MS, bluez_pairing_retry, userData);
+		return;
+	}
+	else
+	{
+		result->FAILED_STAGE = stage;
+		bluez_pairing_finish(device, PAIRING_STAGE_FAILED);
+	}
+
+	bluez_pairing_advance();
+}
+
+static gboolean bluez_pairing_retry(gpointer userData)
+{
+	guint device = GPOINTER_TO_UINT(userData);
+
+	mRetryTimers[device] = 0;
+	bluez_pairing_start_stage(device, mResults[device].STAGE);
+
+	return FALSE;
+}
+
+static void bluez_pairing_finish(guint device, int stage)
+{
+	mResults[device].STAGE = stage;
+	mFinished++;
+
+	if(mSession[device])
+	{
+		mSession[device] = false;
+		mActive--;
+	}
+
+	g_print("%s %s\n", mResults[device].PATH, bluez_pairing_stage_name(stage));
+}
+
+static void bluez_pairing_advance(void)
+{
+	/*1. Hand the free sessions to the next devices */
+	bluez_pairing_launch(NULL);
+
+	/*2. Last device of the batch reports it */
+	if(mFinished == mCount && bluez_pairing_is_running())
+	{
+		bluez_pairing_print_results();
+
+		if(mCallback != NULL)
+			mCallback(mResults, mCount, mUserData);
+
+		g_atomic_int_set(&mRunning, 0);
+	}
+}
+
+static gboolean bluez_pairing_cancel_all(gpointer userData)
+{
+	(void)userData;
+	guint i;
+
+	if(!bluez_pairing_is_running())
+		return FALSE;
+
+	mCancelled = true;
+
+	for(i = 0; i < mNext && i < mCount; i++)
+	{
+		/*1. A pending command completes as cancelled and finishes its device */
+		if(mCommands[i] != NULL)
+			bluez_command_cancel(mCommands[i]);
+
+		/*2. A device waiting to retry has nothing in flight, finish it here */
+		else if(mRetryTimers[i] != 0)
+		{
+			g_source_remove(mRetryTimers[i]);
+			mRetryTimers[i] = 0;
+			bluez_pairing_finish(i, PAIRING_STAGE_CANCELLED);
+		}
+	}
+
+	/*3. Queued devices */
+	bluez_pairing_advance();
+
+	return FALSE;
+}
+
+static const char * bluez_pairing_stage_name(int stage)
+{
+	switch(stage)
+	{
+		case PAIRING_STAGE_QUEUED:		return "Queued";
+		case PAIRING_STAGE_TRUST:		return "Trust";
+		case PAIRING_STAGE_PAIR:		return "Pair";
+		case PAIRING_STAGE_CONNECT:		return "Connect";
+		case PAIRING_STAGE_DONE:		return "Done";
+		case PAIRING_STAGE_FAILED:		return "Failed";
+		case PAIRING_STAGE_CANCELLED:	return "Cancelled";
+		default:						return "Unknown";
+	}
+}
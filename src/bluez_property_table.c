@@ -0,0 +1,70 @@
+/**
+	* @file bluez_property_table.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the property name to handler dispatch table
+	*
+	*	- The table is a GHashTable from name to BluezProperty, filled once and only read afterwards,
+	*	  so any number of threads can dispatch through it at the same time.
+	*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_property_table.h"
+
+/*
+ * Private Types
+*/
+struct _BluezPropertyTable
+{
+	GHashTable * index;		// name -> const BluezProperty *
+};
+
+BluezPropertyTable * bluez_property_table_new(const BluezProperty * properties, guint numberOfProperties)
+{
+	BluezPropertyTable * table = g_new(BluezPropertyTable, 1);
+	guint i;
+	
+	table->index = g_hash_table_new(g_str_hash, g_str_equal);
+	
+	for(i = 0; i < numberOfProperties; i++)
+		g_hash_table_insert(table->index, (gpointer)properties[i].NAME, (gpointer)&properties[i]);
+	
+	return table;
+}
+
+guint bluez_property_table_dispatch(BluezPropertyTable * table, gpointer target, const char * key, GVariant * value)
+{
+	/*1. One lookup finds the handler or rejects the key */
+	const BluezProperty * property = g_hash_table_lookup(table->index, key);
+	
+	if(property == NULL)
+		return 0;
+	
+	/*2. Handlers can trust the type of value */
+	if(!g_variant_is_of_type(value, G_VARIANT_TYPE(property->TYPE)))
+	{
+		g_print("Invalid argument type for %s: %s != %s\n", key, g_variant_get_type_string(value), property->TYPE);
+		return 0;
+	}
+	
+	return property->HANDLER(target, value);
+}
+
+guint bluez_property_table_apply(BluezPropertyTable * table, gpointer target, GVariant * properties)
+{
+	GVariantIter iter;
+	const char * key;
+	GVariant * value;
+	guint result = 0;
+	
+	g_variant_iter_init(&iter, properties);
+	while(g_variant_iter_next(&iter, "{&sv}", &key, &value))
+	{
+		result |= bluez_property_table_dispatch(table, target, key, value);
+		g_variant_unref(value);
+	}
+	
+	return result;
+}
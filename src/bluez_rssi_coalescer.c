@@ -0,0 +1,267 @@
+/**
+	* @file bluez_rssi_coalescer.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the per device RSSI window and its batched delivery
+	*
+	*	- Every device that sent an RSSI has an entry in a GHashTable keyed by its path, the entry is kept
+	*	  between windows so a busy device does not allocate on every advertisement.
+	*	- Entries with a value in the current window are also in mPending, a window only visits those.
+	*	- A window starts with the first push after a flush, a one shot timer closes it.
+	*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_rssi_coalescer.h"
+#include "bluetooth_device.h"
+
+/*
+ * Private Types
+*/
+typedef struct _RssiEntry
+{
+	char *		PATH;			// key of mEntries
+	bool		PENDING;		// holds a value of the current window
+	gint16		LATEST;
+	gint16		MAX;
+	gint32		SUM;
+	guint		COUNT;
+} RssiEntry;
+
+/*
+ * Private Function Declerations
+*/
+static gint16 bluez_rssi_coalescer_value(const RssiEntry * entry, int policy);
+static gboolean bluez_rssi_coalescer_window_closed(gpointer userData);
+static void bluez_rssi_coalescer_free_entry(gpointer entry);
+
+/*
+ * Private Variables
+*/
+static GMutex mLock;
+static GHashTable * mEntries = NULL;		// path -> RssiEntry
+static GPtrArray * mPending = NULL;			// RssiEntry with a value in the current window
+static guint mWindowMs = RSSI_COALESCE_DEFAULT_WINDOW_MS;
+static int mPolicy = RSSI_COALESCE_LATEST;
+static guint mTimer = 0;
+static bluez_rssi_observer mObserver = NULL;
+static gpointer mObserverData = NULL;
+static RssiCoalescerStats mStats;
+
+/*
+ * Modifiers
+*/
+void bluez_rssi_coalescer_init(guint windowMs, int policy)
+{
+	g_mutex_lock(&mLock);
+
+	if(mEntries == NULL)
+	{
+		mEntries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, bluez_rssi_coalescer_free_entry);
+		mPending = g_ptr_array_new();
+	}
+
+	mWindowMs = windowMs;
+	mPolicy = policy;
+
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_rssi_coalescer_set_policy(int policy)
+{
+	g_mutex_lock(&mLock);
+	mPolicy = policy;
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_rssi_coalescer_set_observer(bluez_rssi_observer observer, gpointer userData)
+{
+	g_mutex_lock(&mLock);
+	mObserver = observer;
+	mObserverData = userData;
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_rssi_coalescer_push(const char * path, gint16 rssi)
+{
+	RssiEntry * entry;
+	bluez_rssi_observer observer;
+	gpointer observerData;
+
+	g_mutex_lock(&mLock);
+
+	mStats.EVENTS++;
+
+	/*1. No window, write it through, the observer gets a batch of one */
+	if(mWindowMs == 0 || mEntries == NULL)
+	{
+		mStats.UPDATES++;
+		observer = mObserver;
+		observerData = mObserverData;
+		g_mutex_unlock(&mLock);
+
+		bluetooth_device_property_update_RSSI_batch(&path, &rssi, 1);
+		if(observer != NULL)
+			observer(&path, &rssi, 1, observerData);
+		return;
+	}
+
+	/*2. Find the entry of the device, first RSSI of a device allocates it */
+	entry = g_hash_table_lookup(mEntries, path);
+	if(entry == NULL)
+	{
+		entry = g_new0(RssiEntry, 1);
+		entry->PATH = g_strdup(path);
+		g_hash_table_insert(mEntries, entry->PATH, entry);
+	}
+
+	/*3. Fold the value into the window */
+	if(!entry->PENDING)
+	{
+		entry->PENDING = true;
+		entry->MAX = rssi;
+		entry->SUM = 0;
+		entry->COUNT = 0;
+		g_ptr_array_add(mPending, entry);
+	}
+
+	entry->LATEST = rssi;
+	entry->SUM += rssi;
+	entry->COUNT++;
+	if(rssi > entry->MAX)
+		entry->MAX = rssi;
+
+	/*4. First value of the window starts its timer */
+	if(mTimer == 0)
+		mTimer = g_timeout_add(mWindowMs, bluez_rssi_coalescer_window_closed, NULL);
+
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_rssi_coalescer_discard(const char * path)
+{
+	RssiEntry * entry;
+
+	g_mutex_lock(&mLock);
+
+	entry = mEntries != NULL ? g_hash_table_lookup(mEntries, path) : NULL;
+	if(entry != NULL)
+	{
+		if(entry->PENDING)
+			g_ptr_array_remove_fast(mPending, entry);
+		g_hash_table_remove(mEntries, path);
+	}
+
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_rssi_coalescer_flush(void)
+{
+	const char ** paths;
+	gint16 * rssi;
+	bluez_rssi_observer observer;
+	gpointer observerData;
+	guint count;
+	guint i;
+
+	g_mutex_lock(&mLock);
+
+	count = mPending != NULL ? mPending->len : 0;
+	if(count == 0)
+	{
+		g_mutex_unlock(&mLock);
+		return;
+	}
+
+	/*1. One value per device, picked by the policy */
+	paths = g_new(const char *, count);
+	rssi = g_new(gint16, count);
+
+	for(i = 0; i < count; i++)
+	{
+		RssiEntry * entry = g_ptr_array_index(mPending, i);
+
+		paths[i] = g_strdup(entry->PATH);		// the entry can be discarded once the lock is released
+		rssi[i] = bluez_rssi_coalescer_value(entry, mPolicy);
+		entry->PENDING = false;
+	}
+
+	g_ptr_array_set_size(mPending, 0);
+	mStats.UPDATES += count;
+	mStats.FLUSHES++;
+	observer = mObserver;
+	observerData = mObserverData;
+
+	g_mutex_unlock(&mLock);
+
+	/*2. One registry update for the whole window, then the observer */
+	bluetooth_device_property_update_RSSI_batch(paths, rssi, count);
+
+	if(observer != NULL)
+		observer(paths, rssi, count, observerData);
+
+	for(i = 0; i < count; i++)
+		g_free((char *)paths[i]);
+	g_free(paths);
+	g_free(rssi);
+}
+
+/*
+ * Accessors
+*/
+void bluez_rssi_coalescer_get_stats(RssiCoalescerStats * stats)
+{
+	g_mutex_lock(&mLock);
+	*stats = mStats;
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_rssi_coalescer_print_stats(void)
+{
+	RssiCoalescerStats stats;
+
+	bluez_rssi_coalescer_get_stats(&stats);
+
+	g_print("***\t RSSI Coalescer \t***\n");
+	g_print("- Events:\t%llu\n", (unsigned long long)stats.EVENTS);
+	g_print("- Updates:\t%llu\n", (unsigned long long)stats.UPDATES);
+	g_print("- Windows:\t%llu\n", (unsigned long long)stats.FLUSHES);
+}
+
+/*
+ * Private Functions
+*/
+static gint16 bluez_rssi_coalescer_value(const RssiEntry * entry, int policy)
+{
+	switch(policy)
+	{
+		case RSSI_COALESCE_MAX:
+			return entry->MAX;
+		case RSSI_COALESCE_MEAN:
+			return (gint16)(entry->SUM / (gint32)entry->COUNT);
+		case RSSI_COALESCE_LATEST:
+		default:
+			return entry->LATEST;
+	}
+}
+
+static gboolean bluez_rssi_coalescer_window_closed(gpointer userData)
+{
+	(void)userData;
+
+	g_mutex_lock(&mLock);
+	mTimer = 0;
+	g_mutex_unlock(&mLock);
+
+	bluez_rssi_coalescer_flush();
+
+	// one shot, the next push starts the next window
+	return FALSE;
+}
+
+static void bluez_rssi_coalescer_free_entry(gpointer entry)
+{
+	g_free(((RssiEntry *)entry)->PATH);
+	g_free(entry);
+}
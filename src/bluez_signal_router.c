@@ -0,0 +1,395 @@
+/**
+	* @file bluez_signal_router.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement the one PropertiesChanged subscription and its interface to handler table
+	*
+	*	- Routes live in a fixed array published like the device registry: writers are serialized by
+	*	  mRouteLock and bump mSequence before and after a change, so it is odd while a route is written.
+	*	- A signal never takes the lock. Its interface is hashed once, the route with the same hash is copied
+	*	  and the copy is kept if the sequence did not move meanwhile (a seqlock), then the names are compared
+	*	  on the copy. After ROUTER_READ_RETRIES failed attempts the reader falls back to the lock.
+	*	- The counters are relaxed atomics, a handler never runs with the lock held.
+	*
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_signal_router.h"
+#include "bluez_match_rule.h"
+#include "bluez_dbus_names.h"
+#include "bluez_metrics.h"
+#include "bluez_trace.h"
+
+#define ROUTER_READ_RETRIES			64		// optimistic reads before a signal falls back to the lock
+#define SIGNAL_ROUTE_INTERFACE_SIZE	64
+#define SIGNAL_ROUTE_PATH_SIZE		128
+
+/*
+ * Private Types
+*/
+typedef struct _SignalRoute
+{
+	bool					IN_USE;
+	guint					INTERFACE_HASH;						// g_str_hash of INTERFACE
+	guint					PATH_LENGTH;
+	guint					MATCH_RULE;							// id from bluez_match_rule_add
+	bluez_signal_handler	HANDLER;
+	gpointer				USER_DATA;
+	char					INTERFACE[SIGNAL_ROUTE_INTERFACE_SIZE];
+	char					PATH_NAMESPACE[SIGNAL_ROUTE_PATH_SIZE];	// empty for any path
+} SignalRoute;
+
+typedef guint64 __attribute__((may_alias)) RouteWord;		// a SignalRoute is copied as these
+
+G_STATIC_ASSERT(sizeof(SignalRoute) % sizeof(RouteWord) == 0);
+
+/*
+ * Private Function Declerations
+*/
+static bool bluez_signal_router_find(const char * interface, SignalRoute * route);
+static bool bluez_signal_router_find_locked(const char * interface, guint hash, SignalRoute * route);
+static void bluez_signal_router_write(guint slot, const SignalRoute * route);
+static void route_load(SignalRoute * route, const SignalRoute * from);
+static void route_store(SignalRoute * route, const SignalRoute * from);
+static void bluez_signal_router_count(guint64 * counter);
+static void bluez_signal_router_properties_changed(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *signal,
+				GVariant *params,
+				gpointer userData);
+static void bluez_signal_router_dispatch(const char * path, const char * signal, GVariant * params);
+
+/*
+ * Private Variables
+*/
+static GDBusConnection * mCon;
+static guint mSubscription;
+static SignalRoute mRoutes[MAX_NUMBER_SIGNAL_ROUTES];
+static GMutex mRouteLock;				// serializes the writers only
+static guint mSequence;					// odd while a route is written
+static SignalRouterStats mStats;
+
+/*
+ * Modifiers
+*/
+int bluez_signal_router_init(GDBusConnection * conn)
+{
+	g_print("Initializing Signal Router...\n");
+
+	mCon = conn;
+
+	if(mCon == NULL) {
+		g_printerr("Not able to get connection to system bus\n");
+		/**TODO Need to organize Error Codes */
+		return -3;
+	}
+
+	// the match rules are added per interface in bluez_signal_router_register
+	mSubscription = g_dbus_connection_signal_subscribe(mCon,
+							BLUEZ_BUS_NAME,							// defined in bluez_dbus_names.h
+							DBUS_PROPERTIES_INTERFACE,				// defined in bluez_match_rule.h
+							"PropertiesChanged",
+							NULL,
+							NULL,
+							G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+							bluez_signal_router_properties_changed,
+							NULL,
+							NULL);
+
+	return 0;
+}
+
+bool bluez_signal_router_register(const char * interface, const char * pathNamespace, bluez_signal_handler handler, gpointer userData)
+{
+	SignalRoute route;
+	guint slot = MAX_NUMBER_SIGNAL_ROUTES;
+	guint matchRule;
+	guint i;
+
+	if(pathNamespace == NULL)
+		pathNamespace = "";
+
+	if(strlen(interface) >= sizeof(route.INTERFACE) || strlen(pathNamespace) >= sizeof(route.PATH_NAMESPACE))
+	{
+		g_print("Not able to route %s, the name or path is too long\n", interface);
+		return false;
+	}
+
+	/*1. A second registration replaces the first */
+	bluez_signal_router_unregister(interface);
+
+	/*2. Let the daemon send this interface */
+	matchRule = bluez_match_rule_add(DBUS_PROPERTIES_INTERFACE, "PropertiesChanged", pathNamespace[0] != '\0' ? pathNamespace : NULL,
+			interface, G_DBUS_SIGNAL_FLAGS_NONE);
+	if(matchRule == 0)
+		return false;
+
+	memset(&route, 0, sizeof(route));
+	route.IN_USE = true;
+	route.INTERFACE_HASH = g_str_hash(interface);
+	route.PATH_LENGTH = strlen(pathNamespace);
+	route.MATCH_RULE = matchRule;
+	route.HANDLER = handler;
+	route.USER_DATA = userData;
+	g_strlcpy(route.INTERFACE, interface, sizeof(route.INTERFACE));
+	g_strlcpy(route.PATH_NAMESPACE, pathNamespace, sizeof(route.PATH_NAMESPACE));
+
+	/*3. Publish the route in a free slot */
+	g_mutex_lock(&mRouteLock);
+
+	for(i = 0; i < MAX_NUMBER_SIGNAL_ROUTES && slot == MAX_NUMBER_SIGNAL_ROUTES; i++)
+	{
+		if(!mRoutes[i].IN_USE)
+			slot = i;
+	}
+
+	if(slot < MAX_NUMBER_SIGNAL_ROUTES)
+		bluez_signal_router_write(slot, &route);
+
+	g_mutex_unlock(&mRouteLock);
+
+	if(slot == MAX_NUMBER_SIGNAL_ROUTES)
+	{
+		g_print("No room to route %s\n", interface);
+		bluez_match_rule_unsubscribe(matchRule);
+		return false;
+	}
+
+	return true;
+}
+
+void bluez_signal_router_unregister(const char * interface)
+{
+	SignalRoute route;
+	guint hash = g_str_hash(interface);
+	guint matchRule = 0;
+	guint i;
+
+	g_mutex_lock(&mRouteLock);
+
+	for(i = 0; i < MAX_NUMBER_SIGNAL_ROUTES; i++)
+	{
+		if(mRoutes[i].IN_USE && mRoutes[i].INTERFACE_HASH == hash && strcmp(mRoutes[i].INTERFACE, interface) == 0)
+		{
+			matchRule = mRoutes[i].MATCH_RULE;
+			memset(&route, 0, sizeof(route));
+			bluez_signal_router_write(i, &route);
+			break;
+		}
+	}
+
+	g_mutex_unlock(&mRouteLock);
+
+	// daemon call is made without holding the lock
+	bluez_match_rule_unsubscribe(matchRule);
+}
+
+void bluez_signal_router_inject(const char * path, GVariant * params)
+{
+	bluez_signal_router_dispatch(path, "PropertiesChanged", params);
+}
+
+/*
+ * Accessors
+*/
+guint64 bluez_signal_router_get_signal_count(void)
+{
+	return __atomic_load_n(&mStats.SIGNALS, __ATOMIC_RELAXED);
+}
+
+void bluez_signal_router_get_stats(SignalRouterStats * stats)
+{
+	// each counter is read on its own, a snapshot that is off by a few signals is good enough here
+	stats->SIGNALS = __atomic_load_n(&mStats.SIGNALS, __ATOMIC_RELAXED);
+	stats->DISPATCHED = __atomic_load_n(&mStats.DISPATCHED, __ATOMIC_RELAXED);
+	stats->UNROUTED = __atomic_load_n(&mStats.UNROUTED, __ATOMIC_RELAXED);
+	stats->INVALID = __atomic_load_n(&mStats.INVALID, __ATOMIC_RELAXED);
+}
+
+void bluez_signal_router_print_stats(void)
+{
+	SignalRouterStats stats;
+
+	bluez_signal_router_get_stats(&stats);
+
+	g_print("***\t Signal Router \t***\n");
+	g_print("- Signals:\t%llu\n", (unsigned long long)stats.SIGNALS);
+	g_print("- Dispatched:\t%llu\n", (unsigned long long)stats.DISPATCHED);
+	g_print("- Unrouted:\t%llu\n", (unsigned long long)stats.UNROUTED);
+	g_print("- Invalid:\t%llu\n", (unsigned long long)stats.INVALID);
+}
+
+/*
+ * Private Functions
+*/
+/*
+ * Copies the route of interface without the lock, returns false if nobody registered it
+*/
+static bool bluez_signal_router_find(const char * interface, SignalRoute * route)
+{
+	guint hash = g_str_hash(interface);
+	guint sequence;
+	guint attempt;
+	guint i;
+	bool found;
+
+	for(attempt = 0; attempt < ROUTER_READ_RETRIES; attempt++)
+	{
+		sequence = g_atomic_int_get(&mSequence);
+		found = false;
+
+		for(i = 0; i < MAX_NUMBER_SIGNAL_ROUTES && !found; i++)
+		{
+			if(!__atomic_load_n(&mRoutes[i].IN_USE, __ATOMIC_RELAXED)
+					|| __atomic_load_n(&mRoutes[i].INTERFACE_HASH, __ATOMIC_RELAXED) != hash)
+				continue;
+
+			// the name is compared on the copy, a torn one is thrown away below
+			route_load(route, &mRoutes[i]);
+			route->INTERFACE[sizeof(route->INTERFACE) - 1] = '\0';
+			found = strcmp(route->INTERFACE, interface) == 0;
+		}
+
+		// keep the loads of the copy from moving after the second read of the sequence
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if(!(sequence & 1) && g_atomic_int_get(&mSequence) == sequence)
+			return found;
+	}
+
+	return bluez_signal_router_find_locked(interface, hash, route);
+}
+
+static bool bluez_signal_router_find_locked(const char * interface, guint hash, SignalRoute * route)
+{
+	bool found = false;
+	guint i;
+
+	g_mutex_lock(&mRouteLock);
+
+	for(i = 0; i < MAX_NUMBER_SIGNAL_ROUTES && !found; i++)
+	{
+		if(mRoutes[i].IN_USE && mRoutes[i].INTERFACE_HASH == hash && strcmp(mRoutes[i].INTERFACE, interface) == 0)
+		{
+			*route = mRoutes[i];
+			found = true;
+		}
+	}
+
+	g_mutex_unlock(&mRouteLock);
+
+	return found;
+}
+
+/*
+ * Stores route in slot, mRouteLock must be held
+*/
+static void bluez_signal_router_write(guint slot, const SignalRoute * route)
+{
+	g_atomic_int_inc(&mSequence);
+
+	// the odd sequence must be visible before any change to the route
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	route_store(&mRoutes[slot], route);
+
+	// the increment is a full barrier, the route is visible before the even sequence
+	g_atomic_int_inc(&mSequence);
+}
+
+static void route_load(SignalRoute * route, const SignalRoute * from)
+{
+	const RouteWord * source = (const RouteWord *)from;
+	RouteWord * target = (RouteWord *)route;
+	gsize i;
+
+	for(i = 0; i < sizeof(SignalRoute) / sizeof(RouteWord); i++)
+		target[i] = __atomic_load_n(&source[i], __ATOMIC_RELAXED);
+}
+
+static void route_store(SignalRoute * route, const SignalRoute * from)
+{
+	const RouteWord * source = (const RouteWord *)from;
+	RouteWord * target = (RouteWord *)route;
+	gsize i;
+
+	for(i = 0; i < sizeof(SignalRoute) / sizeof(RouteWord); i++)
+		__atomic_store_n(&target[i], source[i], __ATOMIC_RELAXED);
+}
+
+static void bluez_signal_router_count(guint64 * counter)
+{
+	__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void bluez_signal_router_properties_changed(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *signal,
+				GVariant *params,
+				gpointer userData)
+{
+	(void)conn;
+	(void)sender;
+	(void)interface;
+	(void)userData;
+
+	// a loaded trace owns the handlers, see bluez_trace.h
+	if(bluez_trace_is_replaying())
+		return;
+
+	bluez_signal_router_dispatch(path, signal, params);
+}
+
+static void bluez_signal_router_dispatch(const char * path, const char * signal, GVariant * params)
+{
+	SignalRoute route;
+	const char *iface;
+	GVariant *changed;
+	GVariant *invalidated;
+	bool found;
+
+	bluez_signal_router_count(&mStats.SIGNALS);
+
+	/*1. The envelope is checked once for every handler */
+	if(params == NULL || !g_variant_is_of_type(params, G_VARIANT_TYPE("(sa{sv}as)")))
+	{
+		bluez_signal_router_count(&mStats.INVALID);
+		g_print("Invalid signature for %s: %s != %s\n", signal, params != NULL ? g_variant_get_type_string(params) : "()", "(sa{sv}as)");
+		return;
+	}
+
+	g_variant_get_child(params, 0, "&s", &iface);
+	bluez_metrics_record_signal(iface, signal);		// by the interface that changed, example: Device1.PropertiesChanged
+
+	/*2. One lookup copies the route, the handler runs from the copy */
+	found = bluez_signal_router_find(iface, &route);
+
+	// same rule as dbus-daemon, the namespace itself or anything below it
+	if(found && route.PATH_LENGTH != 0)
+		found = strncmp(path, route.PATH_NAMESPACE, route.PATH_LENGTH) == 0
+				&& (path[route.PATH_LENGTH] == '\0' || path[route.PATH_LENGTH] == '/');
+
+	if(!found)
+	{
+		bluez_signal_router_count(&mStats.UNROUTED);
+		return;
+	}
+
+	bluez_signal_router_count(&mStats.DISPATCHED);
+
+	/*3. Handlers get the dictionaries as they are, borrowed from params */
+	changed = g_variant_get_child_value(params, 1);
+	invalidated = g_variant_get_child_value(params, 2);
+
+	route.HANDLER(path, changed, invalidated, route.USER_DATA);
+
+	g_variant_unref(changed);
+	g_variant_unref(invalidated);
+}
@@ -0,0 +1,765 @@
+/**
+	* @file bluez_trace.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement recording and deterministic replay of the D-Bus traffic we receive from bluez
+	*
+	*	- Signals are recorded by a connection filter, it runs on the GDBus worker thread before any
+	*	  subscription sees the message. Replies are recorded by bluez_command on the context of the caller.
+	*	  Both write through one lock, a record is encoded in a buffer and written with one fwrite.
+	*	- Every name is written once as a string record and then referred to by its id.
+	*	- A loaded trace is parsed completely before the replay starts, the signals are kept in recorded order
+	*	  and the replies in one queue per path, interface and method, so a call takes the reply it got when
+	*	  recorded no matter when in the replay it is made.
+	*
+	*	- Required flags, and libs for compiling
+	* 		gcc `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+#include <string.h>
+
+#include "bluez_trace.h"
+#include "bluez_dbus_names.h"
+#include "bluez_command.h"
+#include "bluez_match_rule.h"
+#include "bluez_signal_router.h"
+
+#define TRACE_MAGIC				"BZTR"
+#define TRACE_BYTE_ORDER		(G_BYTE_ORDER == G_LITTLE_ENDIAN ? 'l' : 'B')
+#define TRACE_FILE_BUFFER		(64 * 1024)
+#define TRACE_VARINT_MAX		10			// bytes of a 64-Bit LEB128 varint
+
+/*
+ * Record types
+*/
+#define TRACE_RECORD_STRING		1
+#define TRACE_RECORD_SIGNAL		2
+#define TRACE_RECORD_REPLY		3
+
+/*
+ * Private Types
+*/
+typedef struct _TraceRecord
+{
+	gint64			TIME_US;		// since the trace started
+	const char *	PATH;			// strings are owned by mStrings
+	const char *	INTERFACE;
+	const char *	MEMBER;			// signal name, or method of a reply
+	GVariant *		BODY;			// signal arguments or reply, NULL for none
+	int				STATE;			// BLUEZ_COMMAND_* of a reply
+	const char *	ERROR_NAME;
+	const char *	MESSAGE;
+} TraceRecord;
+
+/*
+ * Private Function Declerations
+*/
+static GDBusMessage * bluez_trace_filter(GDBusConnection *conn, GDBusMessage *message, gboolean incoming, gpointer userData);
+static guint bluez_trace_string_id(const char * string);
+static void bluez_trace_put_varint(guint64 value);
+static void bluez_trace_put_body(guint typeId, GVariant * body);
+static void bluez_trace_write_record(void);
+static bool bluez_trace_get_varint(const guint8 ** pos, const guint8 * end, guint64 * value);
+static bool bluez_trace_get_string(const guint8 ** pos, const guint8 * end, const char ** string);
+static bool bluez_trace_get_body(const guint8 ** pos, const guint8 * end, bool byteswap, GVariant ** body);
+static bool bluez_trace_parse(const guint8 * data, gsize length);
+static char * bluez_trace_reply_key(const char * path, const char * interface, const char * method);
+static void bluez_trace_record_free(gpointer data);
+static void bluez_trace_deliver(const TraceRecord * record);
+static gboolean bluez_trace_replay_step(gpointer userData);
+static void bluez_trace_replay_schedule(gint64 delayUs);
+
+/*
+ * Private Variables
+*/
+static GDBusConnection * mCon;
+static GMutex mLock;
+static BluezTraceStats mStats;
+
+// recording
+static gint mRecording = 0;
+static FILE * mFile;
+static guint mFilter;
+static GHashTable * mStringIds;			// string -> id
+static guint mNextStringId;
+static GByteArray * mRecord;			// record being encoded
+static gint64 mStartUs;
+static gint64 mLastUs;
+
+// replay
+static gint mReplaying = 0;
+static GPtrArray * mStrings;			// id -> string, id 0 is NULL
+static GPtrArray * mRecords;			// owns every TraceRecord
+static GPtrArray * mSignals;			// signals in recorded order
+static GHashTable * mReplies;			// path\1interface\1method -> GQueue of replies
+static guint mNextSignal;
+static int mMode;
+static gint64 mReplayStartUs;
+static GMainContext * mReplayContext;
+static GSource * mReplaySource;
+static bluez_trace_done_callback mDoneCallback;
+static gpointer mDoneUserData;
+
+/*
+ * Modifiers
+*/
+int bluez_trace_init(GDBusConnection * conn)
+{
+	mCon = conn;
+
+	if(mCon == NULL) {
+		g_printerr("Not able to get connection to system bus\n");
+		/**TODO Need to organize Error Codes */
+		return -3;
+	}
+
+	return 0;
+}
+
+void bluez_trace_deinit(void)
+{
+	bluez_trace_record_stop();
+
+	if(!g_atomic_int_get(&mReplaying))
+		return;
+
+	if(mReplaySource != NULL)
+	{
+		g_source_destroy(mReplaySource);
+		g_source_unref(mReplaySource);
+		mReplaySource = NULL;
+	}
+
+	g_mutex_lock(&mLock);
+	g_atomic_int_set(&mReplaying, 0);
+	g_hash_table_destroy(mReplies);
+	g_ptr_array_free(mSignals, TRUE);
+	g_ptr_array_free(mRecords, TRUE);
+	g_ptr_array_free(mStrings, TRUE);
+	mReplies = NULL;
+	mSignals = NULL;
+	mRecords = NULL;
+	mStrings = NULL;
+	g_mutex_unlock(&mLock);
+
+	if(mReplayContext != NULL)
+		g_main_context_unref(mReplayContext);
+	mReplayContext = NULL;
+}
+
+bool bluez_trace_record_start(const char * path)
+{
+	guint8 header[6] = { 'B', 'Z', 'T', 'R', BLUEZ_TRACE_VERSION, TRACE_BYTE_ORDER };
+
+	if(g_atomic_int_get(&mRecording) || g_atomic_int_get(&mReplaying))
+	{
+		g_print("Trace: already in use\n");
+		return false;
+	}
+
+	mFile = fopen(path, "wb");
+	if(mFile == NULL)
+	{
+		g_print("Trace: can not create %s\n", path);
+		return false;
+	}
+
+	/*1. Bursts are absorbed by the stdio buffer, a record is a few dozen bytes */
+	setvbuf(mFile, NULL, _IOFBF, TRACE_FILE_BUFFER);
+
+	memset(&mStats, 0, sizeof(mStats));
+	mStringIds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	mNextStringId = 1;
+	mRecord = g_byte_array_new();
+	mStartUs = g_get_monotonic_time();
+	mLastUs = mStartUs;
+
+	/*2. Header */
+	g_byte_array_append(mRecord, header, sizeof(header));
+	bluez_trace_put_varint((guint64)g_get_real_time());
+	bluez_trace_write_record();
+
+	/*3. Every signal passes the filter before it is dispatched */
+	g_atomic_int_set(&mRecording, 1);
+	mFilter = g_dbus_connection_add_filter(mCon, bluez_trace_filter, NULL, NULL);
+
+	g_print("Trace: recording to %s\n", path);
+
+	return true;
+}
+
+void bluez_trace_record_stop(void)
+{
+	if(!g_atomic_int_get(&mRecording))
+		return;
+
+	g_dbus_connection_remove_filter(mCon, mFilter);
+
+	/*1. The filter may still be running on the worker thread, the lock waits for it */
+	g_mutex_lock(&mLock);
+	g_atomic_int_set(&mRecording, 0);
+	mStats.ELAPSED_US = g_get_monotonic_time() - mStartUs;
+
+	if(fclose(mFile) != 0)
+		g_print("Trace: the end of the trace could not be written\n");
+	mFile = NULL;
+
+	g_byte_array_unref(mRecord);
+	g_hash_table_destroy(mStringIds);
+	mRecord = NULL;
+	mStringIds = NULL;
+	g_mutex_unlock(&mLock);
+
+	g_print("Trace: recorded %llu signals and %llu replies, %llu bytes\n",
+			(unsigned long long)mStats.SIGNALS, (unsigned long long)mStats.REPLIES, (unsigned long long)mStats.BYTES);
+}
+
+void bluez_trace_record_reply(const char * path,
+				const char * interface,
+				const char * method,
+				int state,
+				GVariant * result,
+				const char * errorName,
+				const char * message)
+{
+	guint pathId, interfaceId, methodId, errorId, messageId, typeId;
+	gint64 now;
+
+	if(!g_atomic_int_get(&mRecording))
+		return;
+
+	g_mutex_lock(&mLock);
+
+	if(!g_atomic_int_get(&mRecording))
+	{
+		g_mutex_unlock(&mLock);
+		return;
+	}
+
+	/*1. New names are written before the record that uses them */
+	pathId = bluez_trace_string_id(path);
+	interfaceId = bluez_trace_string_id(interface);
+	methodId = bluez_trace_string_id(method);
+	errorId = bluez_trace_string_id(errorName);
+	messageId = bluez_trace_string_id(message);
+	typeId = result != NULL ? bluez_trace_string_id(g_variant_get_type_string(result)) : 0;
+
+	/*2. The record */
+	now = g_get_monotonic_time();
+	g_byte_array_append(mRecord, (const guint8 *)"\3", 1);
+	bluez_trace_put_varint(now - mLastUs);
+	bluez_trace_put_varint(pathId);
+	bluez_trace_put_varint(interfaceId);
+	bluez_trace_put_varint(methodId);
+	bluez_trace_put_varint(state);
+	bluez_trace_put_varint(errorId);
+	bluez_trace_put_varint(messageId);
+	bluez_trace_put_body(typeId, result);
+	bluez_trace_write_record();
+
+	mLastUs = now;
+	mStats.REPLIES++;
+	g_mutex_unlock(&mLock);
+}
+
+bool bluez_trace_replay_load(const char * path)
+{
+	GError * error = NULL;
+	gchar * data;
+	gsize length;
+	bool succeed;
+
+	if(g_atomic_int_get(&mRecording) || g_atomic_int_get(&mReplaying))
+	{
+		g_print("Trace: already in use\n");
+		return false;
+	}
+
+	if(!g_file_get_contents(path, &data, &length, &error))
+	{
+		g_print("Trace: %s\n", error->message);
+		g_error_free(error);
+		return false;
+	}
+
+	memset(&mStats, 0, sizeof(mStats));
+	mStrings = g_ptr_array_new_with_free_func(g_free);
+	mRecords = g_ptr_array_new_with_free_func(bluez_trace_record_free);
+	mSignals = g_ptr_array_new();
+	mReplies = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_queue_free);
+	g_ptr_array_add(mStrings, NULL);
+
+	/*1. Everything is parsed up front, the replay itself does not touch the file */
+	succeed = bluez_trace_parse((const guint8 *)data, length);
+	g_free(data);
+
+	if(!succeed)
+	{
+		g_hash_table_destroy(mReplies);
+		g_ptr_array_free(mSignals, TRUE);
+		g_ptr_array_free(mRecords, TRUE);
+		g_ptr_array_free(mStrings, TRUE);
+		mReplies = NULL;
+		mSignals = NULL;
+		mRecords = NULL;
+		mStrings = NULL;
+		return false;
+	}
+
+	mStats.BYTES = length;
+	mNextSignal = 0;
+	g_atomic_int_set(&mReplaying, 1);
+
+	g_print("Trace: loaded %s, %u signals and %u replies\n", path, mSignals->len, mRecords->len - mSignals->len);
+
+	return true;
+}
+
+bool bluez_trace_replay_start(int mode, bluez_trace_done_callback callback, gpointer userData)
+{
+	if(!g_atomic_int_get(&mReplaying) || mReplayContext != NULL)
+		return false;
+
+	mMode = mode;
+	mDoneCallback = callback;
+	mDoneUserData = userData;
+	mReplayContext = g_main_context_ref_thread_default();
+	mReplayStartUs = g_get_monotonic_time();
+
+	g_print("Trace: replaying %u signals %s\n", mSignals->len, mode == BLUEZ_TRACE_REPLAY_PACED ? "at recorded pace" : "as fast as possible");
+
+	bluez_trace_replay_schedule(0);
+
+	return true;
+}
+
+bool bluez_trace_take_reply(const char * path,
+				const char * interface,
+				const char * method,
+				int * state,
+				GVariant ** result,
+				const char ** errorName,
+				const char ** message)
+{
+	TraceRecord * record = NULL;
+	char * key = bluez_trace_reply_key(path, interface, method);
+	GQueue * replies;
+
+	g_mutex_lock(&mLock);
+
+	if(mReplies != NULL && (replies = g_hash_table_lookup(mReplies, key)) != NULL)
+		record = g_queue_pop_head(replies);
+
+	if(record == NULL)
+		mStats.MISSES++;
+	else
+		mStats.REPLIES++;
+
+	g_mutex_unlock(&mLock);
+	g_free(key);
+
+	if(record == NULL)
+		return false;
+
+	// the record stays in mRecords, only the queue entry is gone
+	*state = record->STATE;
+	*result = record->BODY != NULL ? g_variant_ref(record->BODY) : NULL;
+	*errorName = record->ERROR_NAME;
+	*message = record->MESSAGE;
+
+	return true;
+}
+
+/*
+ * Accessors
+*/
+bool bluez_trace_is_recording(void)
+{
+	return g_atomic_int_get(&mRecording);
+}
+
+bool bluez_trace_is_replaying(void)
+{
+	return g_atomic_int_get(&mReplaying);
+}
+
+void bluez_trace_get_stats(BluezTraceStats * stats)
+{
+	g_mutex_lock(&mLock);
+	*stats = mStats;
+	if(g_atomic_int_get(&mRecording))
+		stats->ELAPSED_US = g_get_monotonic_time() - mStartUs;
+	g_mutex_unlock(&mLock);
+}
+
+void bluez_trace_print_stats(void)
+{
+	BluezTraceStats stats;
+
+	bluez_trace_get_stats(&stats);
+
+	g_print("***\tTrace: %s\n", g_atomic_int_get(&mRecording) ? "recording" : g_atomic_int_get(&mReplaying) ? "replaying" : "off");
+	g_print("***\tTrace: %llu signals, %llu replies, %llu misses, %llu dropped, %llu bytes, %lld us\n",
+			(unsigned long long)stats.SIGNALS, (unsigned long long)stats.REPLIES, (unsigned long long)stats.MISSES,
+			(unsigned long long)stats.DROPPED, (unsigned long long)stats.BYTES, (long long)stats.ELAPSED_US);
+}
+
+/*
+ * Private Functions
+*/
+static GDBusMessage * bluez_trace_filter(GDBusConnection *conn, GDBusMessage *message, gboolean incoming, gpointer userData)
+{
+	(void)conn;
+	(void)userData;
+
+	GVariant * body;
+	guint pathId, interfaceId, memberId, typeId;
+	gint64 now;
+
+	// NameAcquired and the like come from the daemon, not from bluez
+	if(!incoming || g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_SIGNAL
+		|| g_strcmp0(g_dbus_message_get_sender(message), DBUS_DAEMON_NAME) == 0)
+		return message;
+
+	body = g_dbus_message_get_body(message);
+
+	g_mutex_lock(&mLock);
+
+	if(!g_atomic_int_get(&mRecording))
+	{
+		g_mutex_unlock(&mLock);
+		return message;
+	}
+
+	/*1. New names are written before the record that uses them */
+	pathId = bluez_trace_string_id(g_dbus_message_get_path(message));
+	interfaceId = bluez_trace_string_id(g_dbus_message_get_interface(message));
+	memberId = bluez_trace_string_id(g_dbus_message_get_member(message));
+	typeId = body != NULL ? bluez_trace_string_id(g_variant_get_type_string(body)) : 0;
+
+	/*2. The record, timed when it is written so deltas are never negative */
+	now = g_get_monotonic_time();
+	g_byte_array_append(mRecord, (const guint8 *)"\2", 1);
+	bluez_trace_put_varint(now - mLastUs);
+	bluez_trace_put_varint(pathId);
+	bluez_trace_put_varint(interfaceId);
+	bluez_trace_put_varint(memberId);
+	bluez_trace_put_body(typeId, body);
+	bluez_trace_write_record();
+
+	mLastUs = now;
+	mStats.SIGNALS++;
+	g_mutex_unlock(&mLock);
+
+	return message;
+}
+
+static guint bluez_trace_string_id(const char * string)
+{
+	guint id;
+	gsize length;
+
+	if(string == NULL)
+		return 0;
+
+	id = GPOINTER_TO_UINT(g_hash_table_lookup(mStringIds, string));
+	if(id != 0)
+		return id;
+
+	/*1. First time, write it as its own record */
+	id = mNextStringId++;
+	length = strlen(string);
+	g_hash_table_insert(mStringIds, g_strdup(string), GUINT_TO_POINTER(id));
+
+	g_byte_array_append(mRecord, (const guint8 *)"\1", 1);
+	bluez_trace_put_varint(id);
+	bluez_trace_put_varint(length);
+	g_byte_array_append(mRecord, (const guint8 *)string, length);
+	bluez_trace_write_record();
+
+	return id;
+}
+
+static void bluez_trace_put_varint(guint64 value)
+{
+	guint8 bytes[TRACE_VARINT_MAX];
+	guint length = 0;
+
+	// 7 bits per byte, the high bit tells another byte follows
+	do {
+		bytes[length] = value & 0x7F;
+		value >>= 7;
+		if(value != 0)
+			bytes[length] |= 0x80;
+		length++;
+	} while(value != 0);
+
+	g_byte_array_append(mRecord, bytes, length);
+}
+
+static void bluez_trace_put_body(guint typeId, GVariant * body)
+{
+	gsize size;
+
+	bluez_trace_put_varint(typeId);
+	if(typeId == 0)
+		return;
+
+	size = g_variant_get_size(body);
+	bluez_trace_put_varint(size);
+	g_byte_array_append(mRecord, g_variant_get_data(body), size);
+}
+
+static void bluez_trace_write_record(void)
+{
+	if(fwrite(mRecord->data, 1, mRecord->len, mFile) == mRecord->len)
+		mStats.BYTES += mRecord->len;
+	else
+		mStats.DROPPED++;
+
+	g_byte_array_set_size(mRecord, 0);
+}
+
+static bool bluez_trace_get_varint(const guint8 ** pos, const guint8 * end, guint64 * value)
+{
+	const guint8 * p = *pos;
+	guint shift = 0;
+
+	*value = 0;
+	while(p < end && shift < 7 * TRACE_VARINT_MAX)
+	{
+		*value |= (guint64)(*p & 0x7F) << shift;
+		if((*p++ & 0x80) == 0)
+		{
+			*pos = p;
+			return true;
+		}
+		shift += 7;
+	}
+
+	return false;
+}
+
+static bool bluez_trace_get_string(const guint8 ** pos, const guint8 * end, const char ** string)
+{
+	guint64 id;
+
+	if(!bluez_trace_get_varint(pos, end, &id) || id >= mStrings->len)
+		return false;
+
+	*string = g_ptr_array_index(mStrings, id);
+	return true;
+}
+
+static bool bluez_trace_get_body(const guint8 ** pos, const guint8 * end, bool byteswap, GVariant ** body)
+{
+	const char * type;
+	guint64 size;
+	GVariant * value;
+	gpointer copy;
+
+	*body = NULL;
+
+	if(!bluez_trace_get_string(pos, end, &type))
+		return false;
+	if(type == NULL)
+		return true;
+
+	if(!g_variant_type_string_is_valid(type) || !bluez_trace_get_varint(pos, end, &size) || size > (guint64)(end - *pos))
+		return false;
+
+	/*1. A copy, the file contents are freed once the trace is parsed */
+	copy = g_malloc(size);
+	memcpy(copy, *pos, size);
+	value = g_variant_new_from_data(G_VARIANT_TYPE(type), copy, size, FALSE, g_free, copy);
+	*pos += size;
+
+	// recorded on a machine of the other byte order
+	if(byteswap)
+	{
+		*body = g_variant_ref_sink(g_variant_byteswap(value));
+		g_variant_unref(g_variant_ref_sink(value));
+	}
+	else
+		*body = g_variant_ref_sink(value);
+
+	return true;
+}
+
+static bool bluez_trace_parse(const guint8 * data, gsize length)
+{
+	const guint8 * pos = data;
+	const guint8 * end = data + length;
+	TraceRecord * record;
+	GQueue * replies;
+	char * key;
+	guint64 type, value, id, size;
+	gint64 time = 0;
+	bool byteswap;
+
+	/*1. Header */
+	if(length < 6 || memcmp(data, TRACE_MAGIC, 4) != 0 || data[4] != BLUEZ_TRACE_VERSION || (data[5] != 'l' && data[5] != 'B'))
+	{
+		g_print("Trace: not a version %d trace\n", BLUEZ_TRACE_VERSION);
+		return false;
+	}
+
+	byteswap = data[5] != TRACE_BYTE_ORDER;
+	pos += 6;
+	if(!bluez_trace_get_varint(&pos, end, &value))
+		goto corrupt;
+
+	/*2. Records */
+	while(pos < end)
+	{
+		type = *pos++;
+
+		if(type == TRACE_RECORD_STRING)
+		{
+			// ids are handed out in order, a gap means a lost record
+			if(!bluez_trace_get_varint(&pos, end, &id) || id != mStrings->len
+				|| !bluez_trace_get_varint(&pos, end, &size) || size > (guint64)(end - pos))
+				goto corrupt;
+
+			g_ptr_array_add(mStrings, g_strndup((const char *)pos, size));
+			pos += size;
+			continue;
+		}
+
+		if(type != TRACE_RECORD_SIGNAL && type != TRACE_RECORD_REPLY)
+			goto corrupt;
+
+		record = g_new0(TraceRecord, 1);
+		g_ptr_array_add(mRecords, record);
+
+		if(!bluez_trace_get_varint(&pos, end, &value)
+			|| !bluez_trace_get_string(&pos, end, &record->PATH)
+			|| !bluez_trace_get_string(&pos, end, &record->INTERFACE)
+			|| !bluez_trace_get_string(&pos, end, &record->MEMBER))
+			goto corrupt;
+
+		time += value;
+		record->TIME_US = time;
+
+		if(type == TRACE_RECORD_REPLY)
+		{
+			if(!bluez_trace_get_varint(&pos, end, &value)
+				|| !bluez_trace_get_string(&pos, end, &record->ERROR_NAME)
+				|| !bluez_trace_get_string(&pos, end, &record->MESSAGE))
+				goto corrupt;
+			record->STATE = (int)value;
+		}
+
+		if(!bluez_trace_get_body(&pos, end, byteswap, &record->BODY))
+			goto corrupt;
+
+		if(record->PATH == NULL || record->INTERFACE == NULL || record->MEMBER == NULL)
+			goto corrupt;
+
+		if(type == TRACE_RECORD_SIGNAL)
+		{
+			g_ptr_array_add(mSignals, record);
+			continue;
+		}
+
+		/*3. Replies wait in the queue of their method */
+		key = bluez_trace_reply_key(record->PATH, record->INTERFACE, record->MEMBER);
+		replies = g_hash_table_lookup(mReplies, key);
+		if(replies == NULL)
+			g_hash_table_insert(mReplies, key, replies = g_queue_new());
+		else
+			g_free(key);
+		g_queue_push_tail(replies, record);
+	}
+
+	return true;
+
+corrupt:
+	g_print("Trace: corrupt at byte %ld\n", (long)(pos - data));
+	return false;
+}
+
+static char * bluez_trace_reply_key(const char * path, const char * interface, const char * method)
+{
+	return g_strconcat(path, "\1", interface, "\1", method, NULL);
+}
+
+static void bluez_trace_record_free(gpointer data)
+{
+	TraceRecord * record = data;
+
+	if(record->BODY != NULL)
+		g_variant_unref(record->BODY);
+	g_free(record);
+}
+
+static void bluez_trace_deliver(const TraceRecord * record)
+{
+	// PropertiesChanged has one subscription, everything else goes through the match rules
+	if(strcmp(record->MEMBER, "PropertiesChanged") == 0 && strcmp(record->INTERFACE, "org.freedesktop.DBus.Properties") == 0)
+		bluez_signal_router_inject(record->PATH, record->BODY);
+	else
+		bluez_match_rule_inject(record->PATH, record->INTERFACE, record->MEMBER, record->BODY);
+}
+
+static gboolean bluez_trace_replay_step(gpointer userData)
+{
+	(void)userData;
+
+	const TraceRecord * record;
+	gint64 due = 0;
+	guint delivered = 0;
+
+	g_source_unref(mReplaySource);
+	mReplaySource = NULL;
+
+	/*1. A batch per dispatch, the rest of the main loop keeps running between batches */
+	while(mNextSignal < mSignals->len && delivered < BLUEZ_TRACE_REPLAY_BATCH)
+	{
+		record = g_ptr_array_index(mSignals, mNextSignal);
+
+		if(mMode == BLUEZ_TRACE_REPLAY_PACED)
+		{
+			due = mReplayStartUs + record->TIME_US - g_get_monotonic_time();
+			if(due > 0)
+				break;
+		}
+
+		bluez_trace_deliver(record);
+		mNextSignal++;
+		delivered++;
+	}
+
+	g_mutex_lock(&mLock);
+	mStats.SIGNALS += delivered;
+	g_mutex_unlock(&mLock);
+
+	// paced and early, or the batch is full
+	if(mNextSignal < mSignals->len)
+	{
+		bluez_trace_replay_schedule(due);
+		return G_SOURCE_REMOVE;
+	}
+
+	/*2. Done */
+	g_mutex_lock(&mLock);
+	mStats.ELAPSED_US = g_get_monotonic_time() - mReplayStartUs;
+	g_mutex_unlock(&mLock);
+
+	g_print("Trace: replayed %llu signals in %lld us, %.0f signals/s\n",
+			(unsigned long long)mStats.SIGNALS, (long long)mStats.ELAPSED_US,
+			mStats.ELAPSED_US > 0 ? mStats.SIGNALS * 1e6 / mStats.ELAPSED_US : 0.0);
+
+	if(mDoneCallback != NULL)
+		mDoneCallback(mDoneUserData);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void bluez_trace_replay_schedule(gint64 delayUs)
+{
+	// a timeout has ms resolution, round up so a paced signal is never early
+	mReplaySource = delayUs > 0 ? g_timeout_source_new((delayUs + 999) / 1000) : g_idle_source_new();
+	g_source_set_callback(mReplaySource, bluez_trace_replay_step, NULL, NULL);
+	g_source_attach(mReplaySource, mReplayContext);
+}
@@ -7,6 +7,19 @@
 	* @date March 14,2020
 	* @brief Is meant to implement the funcionality of the doube linked list
 	*
+	*	- Next to the list every Node is chained into a hash index keyed by the device part of
+	*	  BluetoothDevice.PATH, so finding a device by path does not depend on the number of devices in the list.
+	*	  /org/bluez/hci0/dev_XX and /org/bluez/hci1/dev_XX are the same remote device and find the same Node.
+	*	- A tail pointer and a dense array of Nodes in index order make appends and access by index O(1).
+	*	  A new Node takes the next index, a deleted one is filled with the last Node, so nothing is shifted.
+	*	- Nodes are carved out of slabs and recycled through a free list instead of malloc/free per device.
+	*	- The read* functions may run on another thread while one writer changes the list. Hash buckets
+	*	  and the positional array are published atomically and retired instead of freed when they grow,
+	*	  slabs are only freed by freeList, so a concurrent reader never touches freed memory.
+	*	  What it copies can still be torn, the caller validates the copy (see bluetooth_device.c).
+	*	- Everything a reader may look at while the writer changes it, the devices, hashes, links and slots,
+	*	  is loaded and stored with atomics, relaxed a word at a time for the devices. A torn copy is thrown
+	*	  away by the caller, it is never a data race, so the registry runs clean under ThreadSanitizer.
 	*/
 
 #include <glib.h>
@@ -14,55 +27,152 @@
 #include <stdbool.h>
 
 #include "double_link_list.h"
+#include "bluez_log.h"
+
+/*
+ * Private Types
+*/
+typedef guint64 __attribute__((may_alias)) DeviceWord;		// a BluetoothDevice is copied as these
+
+G_STATIC_ASSERT(sizeof(BluetoothDevice) % sizeof(DeviceWord) == 0);
+
+struct _NodeSlab
+{
+	NodeSlab * next;		// next slab owned by the same list
+	Node nodes[];			// slabSize Nodes
+};
 
 /*
  * Private Helpers
 */
 // transfers the BluetoothDevice data into the new node
 static void transfer_bluetooth_device_data(Node * new_node, BluetoothDevice * newDevice);
+// copies a BluetoothDevice that the other side may change at the same time
+static void device_load(BluetoothDevice * device, const BluetoothDevice * from);
+static void device_store(BluetoothDevice * device, const BluetoothDevice * from);
+// hash index helpers
+static Node * index_lookup(LinkedList * list, const char * path, guint hash);
+static const char * device_key(const char * path);
+static void index_insert(LinkedList * list, Node * node);
+static void index_remove(LinkedList * list, Node * node);
+static void index_grow(LinkedList * list);
+// positional array helpers
+static void position_append(LinkedList * list, Node * node);
+static void position_remove(LinkedList * list, Node * node);
+static void position_grow(LinkedList * list, guint capacity);
+// keeps a block that concurrent readers may still hold until freeList
+static void retire_block(LinkedList * list, gpointer block);
+// unlinks a node from the list, the hash index and the positional array, then frees it
+static void unlink_node(LinkedList * list, Node * node);
+// node pool helpers
+static Node * node_alloc(LinkedList * list);
+static void node_release(LinkedList * list, Node * node);
+static void node_pool_grow(LinkedList * list, guint count);
+
+bool initList(LinkedList * list, guint capacity)
+{
+	if(capacity == 0)
+		return false;
+	
+	/*1. Nodes, later slabs are allocated with the same size */
+	if(list->stats.nodesAvailable < capacity)
+	{
+		list->slabSize = capacity;
+		node_pool_grow(list, capacity - list->stats.nodesAvailable);
+	}
+	
+	/*2. Hash buckets, one per node keeps index_insert from growing */
+	while(list->numberOfBuckets < capacity)
+		index_grow(list);
+	
+	/*3. Positional array */
+	if(list->capacity < capacity)
+		position_grow(list, capacity);
+	
+	return true;
+}
+
+void freeList(LinkedList * list)
+{
+	NodeSlab * slab;
+	
+	clearList(list);
+	
+	while(list->slabs != NULL)
+	{
+		slab = list->slabs;
+		list->slabs = slab->next;
+		g_free(slab);
+		list->stats.heapFrees++;
+	}
+	
+	if(list->buckets != NULL)
+		list->stats.heapFrees++;
+	if(list->nodes != NULL)
+		list->stats.heapFrees++;
+	
+	g_free(list->buckets);
+	g_free(list->nodes);
+	
+	while(list->retired != NULL)
+	{
+		g_free(list->retired->data);
+		list->retired = g_slist_delete_link(list->retired, list->retired);
+		list->stats.heapFrees++;
+	}
+	
+	list->size = 0;
+	list->buckets = NULL;
+	list->numberOfBuckets = 0;
+	list->nodes = NULL;
+	list->capacity = 0;
+	list->freeNodes = NULL;
+	list->slabSize = 0;
+	list->stats.nodesAvailable = 0;
+}
 
 /* 
-	* Given a reference (pointer to pointer) to the head of a list  
-	* inserts a new node on the front of the list. 
+	* Given a list inserts a new node on the front of the list. 
  */
-bool push(Node** head_ref, BluetoothDevice * newDevice)  
+bool push(LinkedList * list, BluetoothDevice * newDevice)  
 {  
-	g_print("Double Linked List Push Method\n");
+	BLUEZ_LOG_TRACE("Double Linked List Push Method\n", 0, 0, 0, 0);
 	
 	/* 1. Check if node already exists */
-	if(doesNodeExist((*head_ref), newDevice->PATH) != NULL)
+	if(doesNodeExist(list, newDevice->PATH) != NULL)
 		return false;	// Node already exists
 	
 	/* 2. allocate node */
-    Node* new_node = (Node*)malloc(sizeof(Node));  
+    Node* new_node = node_alloc(list);  
 	
 	/* 3. transfer the new device contents into Node->device */
 	transfer_bluetooth_device_data(new_node,newDevice);
+	index_insert(list, new_node);
+	position_append(list, new_node);
 	
-    new_node->next = (*head_ref);  
+    new_node->next = list->head;  
     new_node->prev = NULL;  
   
-    if ((*head_ref) != NULL)  
-        (*head_ref)->prev = new_node;  
+    if (list->head != NULL)  
+        list->head->prev = new_node;  
+	else
+		list->tail = new_node;
   
-    (*head_ref) = new_node; 
+    list->head = new_node; 
 	
 	return true;
 } 
 
-/* Given a reference (pointer to pointer) to the head 
-   of a DLL and an int, appends a new node at the end  */
-bool append(Node** head_ref, BluetoothDevice * newDevice) 
+/* Given a list, appends a new node at the end  */
+bool append(LinkedList * list, BluetoothDevice * newDevice) 
 { 
-	g_print("Double Linked List Append Method\n");
+	BLUEZ_LOG_TRACE("Double Linked List Append Method\n", 0, 0, 0, 0);
 	/* 1. Check if node already exists */
-	if(doesNodeExist((*head_ref), newDevice->PATH) != NULL)
+	if(doesNodeExist(list, newDevice->PATH) != NULL)
 		return false;	// Node already exists
 
     /* 2. allocate node */
-	Node* new_node = (Node*)malloc(sizeof(Node)); 
-  
-    Node* last = *head_ref; /* used in step 5*/
+	Node* new_node = node_alloc(list); 
   
     /* 3. put in the data  */
     transfer_bluetooth_device_data(new_node, newDevice);
@@ -70,46 +180,48 @@ bool append(Node** head_ref, BluetoothDevice * newDevice)
     /* 4. This new node is going to be the last node, so 
           make next of it as NULL*/
     new_node->next = NULL; 
+	index_insert(list, new_node);
+	position_append(list, new_node);
   
     /* 5. If the Linked List is empty, then make the new 
           node as head */
-    if (*head_ref == NULL) { 
+    if (list->head == NULL) { 
         new_node->prev = NULL; 
-        *head_ref = new_node; 
+        list->head = new_node; 
+        list->tail = new_node; 
         return true; 
     } 
   
-    /* 6. Else traverse till the last node */
-    while (last->next != NULL) 
-        last = last->next; 
+    /* 6. Change the next of last node, no need to traverse since we keep the tail */
+    list->tail->next = new_node; 
   
-    /* 7. Change the next of last node */
-    last->next = new_node; 
-  
-    /* 8. Make last node as previous of new node */
-    new_node->prev = last; 
+    /* 7. Make last node as previous of new node */
+    new_node->prev = list->tail; 
+    list->tail = new_node; 
   
     return true; 
 } 
 
 /* Given a node as next_node, insert a new node before the given node */
-bool insertBefore(Node** head_ref, Node* next_node, BluetoothDevice * newDevice)  
+bool insertBefore(LinkedList * list, Node* next_node, BluetoothDevice * newDevice)  
 {  
     /*1. check if the given next_node is NULL */
     if (next_node == NULL) {  
-        g_print("The given next node cannot be NULL");  
+        BLUEZ_LOG_WARN("The given next node cannot be NULL\n", 0, 0, 0, 0);  
         return false;  
     } 
 	
 	/* 2. Check if node already exists */
-	if(doesNodeExist((*head_ref), newDevice->PATH) != NULL)
+	if(doesNodeExist(list, newDevice->PATH) != NULL)
 		return false;	// Node already exists
   
     /* 3. allocate new node */
-    Node* new_node = (Node*)malloc(sizeof(Node));  
+    Node* new_node = node_alloc(list);  
   
     /* 4. put in the data */
    transfer_bluetooth_device_data(new_node, newDevice);  
+   index_insert(list, new_node);
+   position_append(list, new_node);
   
     /* 5. Make prev of new node as prev of next_node */
     new_node->prev = next_node->prev;  
@@ -127,144 +239,197 @@ bool insertBefore(Node** head_ref, Node* next_node, BluetoothDevice * newDevice)
 	/* 9. If the prev of new_node is NULL, it will be 
        the new head node */
 	else
-		(*head_ref) = new_node; 
+		list->head = new_node; 
 	
 	return true; 
 }  
 
- bool deleteNode(Node ** start, const char * path)
+ bool deleteNode(LinkedList * list, const char * path)
  {
 	 // removes the Node that the device->Path matches the path given as parameter
-	 g_print("Double Linked List Delete Method %s\n",path);
+	 BLUEZ_LOG_TRACE("Double Linked List Delete Method %s\n", path, 0, 0, 0);
 	 
 	 /*1. The list is empty */
-	 if(*start == NULL)
+	 if(list->head == NULL)
 		 return false;
 	 
-	 /*2. The node we want to remove is the head node */
-	 if(strcmp((*start)->device.PATH,path) == 0)
-	 {
-		 // Move head pointer to next node
-		 Node * temp = *start;
-		 *start = (*start)->next;
-		 
-		 // set the new head prev to NULL if not NULL
-		 if(*start != NULL)
-			(*start)->prev = NULL;
-		 
-		 // unallocate the memory
-		 free(temp);
-		 
-		 return true;
-	 }
+	 /*2. Find the node through the hash index */
+	 Node * current = index_lookup(list, path, g_str_hash(device_key(path)));
 	 
-	 /* 3. The node we want to remove is not at the front */
-	 Node * current = (*start)->next;
-	 Node * previous = *start;
+	 if(current == NULL)
+		 return false;
 	 
-	 while(current != NULL)
-	 {
-		 if(strcmp(current->device.PATH,path) == 0)
-		 {
-			 // found the node to delete
-			previous->next = current->next;
-			
-			// change the next only if node to be deleted is not the last node
-			if(previous->next != NULL)
-				current->next->prev = previous->next;
-			
-			free(current);
-			
-			return true;
-		 }
-		 previous = current;
-		 current = current->next;
-	 }
+	 /*3. Unlink it and unallocate the memory */
+	 unlink_node(list, current);
 	 
-	 return false;
+	 return true;
  }
 
-/* unallocates all the memory of the list */
-bool clearList(Node **start)
+/* gives every node of the list back to the pool */
+bool clearList(LinkedList * list)
  {
-	  g_print("Double Linked List Clear List\n");
+	  BLUEZ_LOG_TRACE("Double Linked List Clear List\n", 0, 0, 0, 0);
 	  
-	 if(*start == NULL)
+	 if(list->head == NULL)
 		 return false;
 	 
-	 Node * current = (*start)->next;
+	 Node * current = list->head->next;
 	 Node * temp = NULL;
 	 
-	 g_print("***\tRemoving %s\n",(*start)->device.PATH);
+	 BLUEZ_LOG_TRACE("***\tRemoving %s\n", list->head->device.PATH, 0, 0, 0);
 	 
-	 free(*start);
+	 node_release(list, list->head);
 	 
 	 while(current != NULL)
 	 {
 		temp = current->next;
-		g_print("***\tRemoving %s\n",current->device.PATH);
-		free(current);
+		BLUEZ_LOG_TRACE("***\tRemoving %s\n", current->device.PATH, 0, 0, 0);
+		node_release(list, current);
 		current = temp;
 	 }
 	
-	*start = NULL;
+	list->head = NULL;
+	list->tail = NULL;
+	
+	// keep the hash buckets and positional array around for the next devices
+	for(guint i = 0; i < list->numberOfBuckets; i++)
+		g_atomic_pointer_set(&list->buckets[i], NULL);
+	g_atomic_int_set(&list->size, 0);
 	
 	 return true;
 	 
  }
+
+int removeNodesIf(LinkedList * list, bluetooth_device_filter filter, gpointer userData)
+{
+	guint i;
+	guint kept = 0;
+	int removed = 0;
+	
+	// compact the positional array while we walk it, so this stays a single pass
+	for(i = 0; i < list->size; i++)
+	{
+		Node * current = list->nodes[i];
+		BluetoothDevice device = current->device;
+		
+		// filter may change the device it keeps, it works on a copy that is stored back
+		if(filter(&device, userData))
+		{
+			if(current->prev != NULL)
+				current->prev->next = current->next;
+			else
+				list->head = current->next;
+			
+			if(current->next != NULL)
+				current->next->prev = current->prev;
+			else
+				list->tail = current->prev;
+			
+			index_remove(list, current);
+			node_release(list, current);
+			removed++;
+		}
+		else
+		{
+			device_store(&current->device, &device);
+			current->position = kept;
+			g_atomic_pointer_set(&list->nodes[kept++], current);
+		}
+	}
+	
+	g_atomic_int_set(&list->size, kept);
+	
+	return removed;
+}
  
  /*
   * Accessors
 */
 // This function prints contents of linked list starting from the given node  
-void printList(Node* start)  
+void printList(LinkedList * list)  
 {  
-	int index = 1; 
+	guint i;
+	
+	// index order, a delete moves the last Node into the hole so list order is not the order of the numbers
 	g_print("\nList of devices\n");  
-    while (start != NULL) 
-	{  
-        g_print("%d. %s\n", index, start->device.PATH);  
-        start = start->next;
-		index++;
-    }  
+	for(i = 0; i < list->size; i++)
+		g_print("%u. %s\n", i + 1, list->nodes[i]->device.PATH);  
 }  
 
-Node * scanList(Node *start, int index)
+Node * scanList(LinkedList * list, int index)
+{
+	// index is 1 based, like the numbers printed by printList
+	if(index < 1 || (guint)index > list->size)
+		return NULL;
+	
+	return list->nodes[index - 1];
+}
+
+Node * scanListByPath(LinkedList * list, const char * path)
 {
-	if(start == NULL)
+	if(list->head == NULL)
 		return NULL;
 	
-	int count = 1;
+	return index_lookup(list, path, g_str_hash(device_key(path)));
+}
+
+bool readNodeAt(LinkedList * list, int index, BluetoothDevice * device)
+{
+	/*1. size first, any nodes array published before it holds at least size slots */
+	guint size = g_atomic_int_get(&list->size);
+	Node ** nodes = g_atomic_pointer_get(&list->nodes);
+	
+	if(index < 1 || (guint)index > size)
+		return false;
 	
-	Node *previous, *current;
-	current = start->next;
-	previous = start;
+	/*2. The slot always points into a slab, even if the Node was released meanwhile */
+	device_load(device, &((Node *)g_atomic_pointer_get(&nodes[index - 1]))->device);
 	
-	while(current != NULL && count != index)
+	return true;
+}
+
+bool readNodeByPath(LinkedList * list, const char * path, BluetoothDevice * device)
+{
+	guint numberOfBuckets = g_atomic_int_get(&list->numberOfBuckets);
+	Node ** buckets = g_atomic_pointer_get(&list->buckets);
+	guint size = g_atomic_int_get(&list->size);
+	const char * key = device_key(path);
+	guint hash = g_str_hash(key);
+	guint steps;
+	
+	if(buckets == NULL)
+		return false;
+	
+	Node * current = g_atomic_pointer_get(&buckets[hash & (numberOfBuckets - 1)]);
+	
+	// a Node recycled under us could chain back into this bucket, so the walk is bounded
+	for(steps = 0; current != NULL && steps <= size; steps++)
 	{
-		previous = current;
-		current = current->next;
-		count++;
+		if(g_atomic_int_get(&current->hash) == hash)
+		{
+			/*1. The path of a Node being written may be torn, only compare it once copied and terminated */
+			device_load(device, &current->device);
+			device->PATH[BLUETOOTH_DEVICE_PATH_SIZE - 1] = '\0';
+			
+			if(strcmp(device_key(device->PATH), key) == 0)
+				return true;
+		}
+		current = g_atomic_pointer_get(&current->hashNext);
 	}
 	
-	// did we find the node we were looking for?
-	if(count != index)
-		previous = NULL;
-	
-	return previous;
+	return false;
 }
 
-Node * scanListByPath(Node *start, const char * path)
+guint readNodes(LinkedList * list, BluetoothDevice * devices, guint maxDevices)
 {
-	if(start == NULL)
-		return NULL;
-	
-	Node *current = start;
+	guint size = g_atomic_int_get(&list->size);
+	Node ** nodes = g_atomic_pointer_get(&list->nodes);
+	guint i;
 	
-	while(current != NULL && strcmp(current->device.PATH, path) != 0)
-		current = current->next;
+	for(i = 0; i < size && i < maxDevices; i++)
+		device_load(&devices[i], &((Node *)g_atomic_pointer_get(&nodes[i]))->device);
 	
-	return current;
+	return size;
 }
 
 /*
@@ -272,51 +437,248 @@ Node * scanListByPath(Node *start, const char * path)
 */
 static void transfer_bluetooth_device_data(Node * new_node, BluetoothDevice * newDevice)
 {
-	int i;
+	// the device holds its strings and ids, so a copy is enough, a reader may still be copying the Node it was before
+	device_store(&new_node->device, newDevice);
 	
-	// need to copy over all contents of newDevie into Nodes->device
-	strcpy(new_node->device.PATH,newDevice->PATH);
-	strcpy(new_node->device.MAC_ADDRESS,newDevice->MAC_ADDRESS);
-	strcpy(new_node->device.ALIAS,newDevice->ALIAS);
+	// the hash is computed once here, lookups only compare keys when the hashes match
+	g_atomic_int_set(&new_node->hash, g_str_hash(device_key(newDevice->PATH)));
+	g_atomic_pointer_set(&new_node->hashNext, NULL);
+}
+
+void writeNode(Node * node, const BluetoothDevice * device)
+{
+	device_store(&node->device, device);
+}
+
+static void device_load(BluetoothDevice * device, const BluetoothDevice * from)
+{
+	const DeviceWord * source = (const DeviceWord *)from;
+	DeviceWord * target = (DeviceWord *)device;
+	gsize i;
 	
-	new_node->device.PAIRED = newDevice->PAIRED;
-	new_node->device.TRUSTED = newDevice->TRUSTED;
-	new_node->device.CONNECTED = newDevice->CONNECTED;
-	new_node->device.RSSI = newDevice->RSSI;
-	new_node->device.NUMBER_OF_UUIDS = newDevice->NUMBER_OF_UUIDS;
+	for(i = 0; i < sizeof(BluetoothDevice) / sizeof(DeviceWord); i++)
+		target[i] = __atomic_load_n(&source[i], __ATOMIC_RELAXED);
+}
+
+static void device_store(BluetoothDevice * device, const BluetoothDevice * from)
+{
+	const DeviceWord * source = (const DeviceWord *)from;
+	DeviceWord * target = (DeviceWord *)device;
+	gsize i;
 	
-	for(i = 0; i < new_node->device.NUMBER_OF_UUIDS; i++)
-		strcpy(new_node->device.SERVICE_UUIDS[i],newDevice->SERVICE_UUIDS[i]);
+	for(i = 0; i < sizeof(BluetoothDevice) / sizeof(DeviceWord); i++)
+		__atomic_store_n(&target[i], source[i], __ATOMIC_RELAXED);
 }
 
-Node * doesNodeExist(Node *head, const char * path)
+Node * doesNodeExist(LinkedList * list, const char * path)
 {
 	
-	g_print("Double Linked List doesNodeExist Method\n");
+	BLUEZ_LOG_TRACE("Double Linked List doesNodeExist Method\n", 0, 0, 0, 0);
+	
+	Node *current = NULL;
+	
+	if(list->head != NULL)
+		current = index_lookup(list, path, g_str_hash(device_key(path)));
 	
-	if(head == NULL)
+	if(current != NULL)
 	{
-		g_print("%s Not found in Linked List\n",path);
-		return NULL;
+		BLUEZ_LOG_TRACE("%s Found!\n", path, 0, 0, 0);
+		return current;
 	}
 	
-	Node *current;
-	current = head->next;
+	BLUEZ_LOG_TRACE("%s Not found in Linked List\n", path, 0, 0, 0);
 	
-	if(strcmp(head->device.PATH,path) == 0)
-		return head;
+	return NULL;
+}
 
+static Node * index_lookup(LinkedList * list, const char * path, guint hash)
+{
+	if(list->buckets == NULL)
+		return NULL;
+	
+	Node *current = list->buckets[hash & (list->numberOfBuckets - 1)];
+	
 	while(current != NULL)
 	{
-		if(strcmp(current->device.PATH,path) == 0)
-		{
-			g_print("%s Found!\n", path);
+		if(current->hash == hash && strcmp(device_key(current->device.PATH), device_key(path)) == 0)
 			return current;
+		current = current->hashNext;
+	}
+	
+	return NULL;
+}
+
+static const char * device_key(const char * path)
+{
+	// the last element of the path, the adapter in front of it does not matter
+	const char * key = strrchr(path, '/');
+	
+	return key != NULL ? key + 1 : path;
+}
+
+static void index_insert(LinkedList * list, Node * node)
+{
+	/*1. Keep the load factor at or below one node per bucket */
+	if(list->size >= list->numberOfBuckets)
+		index_grow(list);
+	
+	/*2. Chain the node at the front of its bucket */
+	guint bucket = node->hash & (list->numberOfBuckets - 1);
+	g_atomic_pointer_set(&node->hashNext, list->buckets[bucket]);
+	g_atomic_pointer_set(&list->buckets[bucket], node);
+}
+
+static void index_remove(LinkedList * list, Node * node)
+{
+	Node **link = &list->buckets[node->hash & (list->numberOfBuckets - 1)];
+	
+	while(*link != NULL)
+	{
+		if(*link == node)
+		{
+			g_atomic_pointer_set(link, node->hashNext);
+			return;
 		}
-		current = current->next;
+		link = &(*link)->hashNext;
 	}
+}
+
+static void index_grow(LinkedList * list)
+{
+	guint numberOfBuckets = list->numberOfBuckets ? list->numberOfBuckets * 2 : LIST_MIN_NUMBER_BUCKETS;
+	Node **buckets = g_new0(Node *, numberOfBuckets);
+	Node *current, *next;
+	guint i;
 	
-	g_print("%s Not found in Linked List\n",path);
+	// move every chained node into the new buckets, the hash is cached so no path is read
+	for(i = 0; i < list->numberOfBuckets; i++)
+	{
+		for(current = list->buckets[i]; current != NULL; current = next)
+		{
+			guint bucket = current->hash & (numberOfBuckets - 1);
+			next = current->hashNext;
+			g_atomic_pointer_set(&current->hashNext, buckets[bucket]);		// still reachable from the published buckets
+			buckets[bucket] = current;
+		}
+	}
 	
-	return NULL;
+	// readers load numberOfBuckets before buckets, so publish the larger array first
+	retire_block(list, list->buckets);
+	g_atomic_pointer_set(&list->buckets, buckets);
+	g_atomic_int_set(&list->numberOfBuckets, numberOfBuckets);
+	list->stats.heapAllocations++;
+}
+
+static void position_append(LinkedList * list, Node * node)
+{
+	/*1. Make room, doubling keeps appends amortized O(1) */
+	if(list->size == list->capacity)
+		position_grow(list, list->capacity ? list->capacity * 2 : LIST_MIN_CAPACITY);
+	
+	/*2. Every new node takes the next index, where it sits in the list does not matter */
+	node->position = list->size;
+	g_atomic_pointer_set(&list->nodes[list->size], node);
+	g_atomic_int_set(&list->size, list->size + 1);
+}
+
+static void position_remove(LinkedList * list, Node * node)
+{
+	Node * last = list->nodes[list->size - 1];
+	
+	// the last node takes the freed index, nothing behind it has to move
+	last->position = node->position;
+	g_atomic_pointer_set(&list->nodes[node->position], last);
+	
+	g_atomic_int_set(&list->size, list->size - 1);
+}
+
+static void position_grow(LinkedList * list, guint capacity)
+{
+	Node ** nodes = g_new(Node *, capacity);
+	
+	if(list->size > 0)
+		memcpy(nodes, list->nodes, list->size * sizeof(Node *));
+	
+	// readers load size before nodes, and size only grows after the new array is published
+	retire_block(list, list->nodes);
+	g_atomic_pointer_set(&list->nodes, nodes);
+	list->capacity = capacity;
+	list->stats.heapAllocations++;
+}
+
+static void retire_block(LinkedList * list, gpointer block)
+{
+	if(block != NULL)
+		list->retired = g_slist_prepend(list->retired, block);
+}
+
+static void unlink_node(LinkedList * list, Node * node)
+{
+	// moving the head pointer if it is the head node
+	if(node->prev != NULL)
+		node->prev->next = node->next;
+	else
+		list->head = node->next;
+	
+	// and the tail pointer if it is the last node
+	if(node->next != NULL)
+		node->next->prev = node->prev;
+	else
+		list->tail = node->prev;
+	
+	index_remove(list, node);
+	position_remove(list, node);
+	node_release(list, node);
+}
+
+static Node * node_alloc(LinkedList * list)
+{
+	Node * node;
+	
+	/*1. Only touch the heap when the free list is empty */
+	if(list->freeNodes == NULL)
+		node_pool_grow(list, list->slabSize ? list->slabSize : LIST_MIN_CAPACITY);
+	
+	/*2. Pop a node from the free list */
+	node = list->freeNodes;
+	list->freeNodes = node->next;
+	
+	list->stats.nodeAllocations++;
+	list->stats.nodesInUse++;
+	list->stats.nodesAvailable--;
+	
+	return node;
+}
+
+static void node_release(LinkedList * list, Node * node)
+{
+	node->next = list->freeNodes;
+	list->freeNodes = node;
+	
+	list->stats.nodeReleases++;
+	list->stats.nodesInUse--;
+	list->stats.nodesAvailable++;
+}
+
+static void node_pool_grow(LinkedList * list, guint count)
+{
+	NodeSlab * slab = g_malloc(sizeof(NodeSlab) + count * sizeof(Node));
+	guint i;
+	
+	list->stats.heapAllocations++;
+	
+	slab->next = list->slabs;
+	list->slabs = slab;
+	
+	// thread the new nodes onto the free list
+	for(i = 0; i < count; i++)
+	{
+		slab->nodes[i].next = list->freeNodes;
+		list->freeNodes = &slab->nodes[i];
+	}
+	
+	if(list->slabSize == 0)
+		list->slabSize = count;
+	
+	list->stats.nodesAvailable += count;
 }
@@ -4,8 +4,10 @@
 
 #include <stdlib.h>				// used for system
 #include <stdio.h>				// for printf
+#include <string.h>				// for strcmp
 #include <stdbool.h> 
 #include <pthread.h>
+#include <unistd.h>				// for STDIN_FILENO
 
 #include "file_reader.h"
 #include "bluez_adapter_api.h"
@@ -13,25 +15,49 @@
 #include "bluez_agent_api.h"
 #include "bluez_device_api.h"
 #include "bluez_mediaplayer_api.h"
+#include "bluez_object_manager_api.h"
+#include "bluez_match_rule.h"
+#include "bluez_signal_router.h"
+#include "bluez_rssi_coalescer.h"
+#include "bluez_command.h"
+#include "bluez_pairing.h"
+#include "bluez_event_queue.h"
+#include "bluez_log.h"
+#include "bluez_metrics.h"
+#include "bluez_trace.h"
+#include "bluez_discovery.h"
+#include "bluez_advertisement.h"
 // includes to use glib and dbus
 #include <glib.h>
 #include <gio/gio.h>
 #include <dbus/dbus.h>
 
-#define BLUEZ_BUS_NAME 						(gchar*)"org.bluez"
 #define BLUEZ_OBJ_PATH 						(gchar*)"/org/bluez"
 #define BLUEZ_OBJ_ADAPTER PATH 				(gchar*) "/org/bluez/hci0"
-#define BLUEZ_ADAPTER_INTERFACE 			(gchar*) "/org.bluez.Adapter1"
-#define BLUEZ_AGENT_INTERFACE 				(gchar*) "org.bluez.AgentManager1"
 #define OBJ_MANANAGER_INTERFACE 			(gchar*)"org.freedesktop.DBus.ObjectManager"
 #define OBJ_PROPERTY_INTERFACE 				(gchar*)"org.freedesktop.DBus.Properties.Set"
 
 
+/*
+ * Menu states, what the next line typed on stdin is
+*/
+#define MENU_STATE_COMMAND		0		// an option of printOptions
+#define MENU_STATE_PAIR			1		// a device number to pair with, 0 ends the list
+#define MENU_STATE_REMOVE		2		// a device number to remove
+
+#define INPUT_LINE_SIZE			256		// longest line read from stdin, a longer one is cut
+
 /*
 * Private Function Decleartions
 */
 static void printOptions(void);
-static void* gdbusMainLoopThread(void* aArg);
+static gboolean stdinReady(GIOChannel *channel, GIOCondition condition, gpointer userData);
+static void handleLine(const char * line);
+static void handleInput(int userInput);
+static void handleCommand(int userInput);
+static void handlePairInput(int userInput);
+static void* eventConsumerThread(void* aArg);
+static void replayDone(gpointer userData);
 
 /* 
 * Private Variables
@@ -39,145 +65,120 @@ static void* gdbusMainLoopThread(void* aArg);
 static GDBusConnection * connection;
 //static GDBusProxy *deviceProxy;		/* Must be freed with g_object_unref when done with it */
 static GError *error;
+static gint mConsumerRun = 1;
+static GMainLoop * mLoop;
+static int mMenuState = MENU_STATE_COMMAND;
+static char mPairPaths[MAX_NUMBER_PAIRING_DEVICES][BLUETOOTH_DEVICE_PATH_SIZE];		// collected in MENU_STATE_PAIR
+static guint mPairCount = 0;
+static bool mReplaying = false;		// signals of a trace are still being delivered
+static bool mInputEnded = false;	// stdin is closed, quit once the replay is done
+static char mInput[INPUT_LINE_SIZE];	// what stdin sent after the last complete line
+static gsize mInputLength = 0;
 
 int main( int argc, char** argv )
 {
-	
-	bool run = true;
-	int userInput = 99;
-	//int option = 99;
 	//char path[100];
 	//char fileArray[MAX_NUMBER_FILES][MAX_STRING_LEN];		// defined in file_reader.h
 	
 	//sprintf(path,"%s","/var/lib/bluetooth/DC:A6:32:36:5C:D2/cache");
 	//listFiles(path, fileArray,false);
 
-	pthread_t gdbusThread;
-	pthread_attr_t gdbusThreadAttr;
+	pthread_t consumerThread;
+	GIOChannel * input;
+	const char * recordPath = NULL;		// --record FILE
+	const char * replayPath = NULL;		// --replay FILE
+	int replayMode = BLUEZ_TRACE_REPLAY_FAST;		// --paced
+	int i;
+	
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			recordPath = argv[++i];
+		else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replayPath = argv[++i];
+		else if(strcmp(argv[i], "--paced") == 0)
+			replayMode = BLUEZ_TRACE_REPLAY_PACED;
+		else
+		{
+			g_print("Usage: %s [--record FILE | --replay FILE [--paced]]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	// the hot paths log through the writer thread, debug and trace are switched on from the menu
+	bluez_log_init(BLUEZ_LOG_LEVEL_INFO);
 	
 	connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM,NULL,&error);
 	g_assert(connection);
 	
+	bluetooth_device_init(BLUETOOTH_DEVICE_DEFAULT_CAPACITY);
+	bluez_match_rule_init(connection);
+	bluez_signal_router_init(connection);
+	bluez_command_init(connection);
 	bluez_adapter_init(connection);
 	bluez_agent_init(connection);
 	bluez_device_init(connection);
 	bluez_device_init_signals();
 	bluez_media_player_init(connection);
+	bluez_trace_init(connection);
 	
-	 
-	  
-	//create thread for g_main_loop
-	pthread_attr_init( &gdbusThreadAttr );
-	pthread_attr_setdetachstate( &gdbusThreadAttr, PTHREAD_CREATE_JOINABLE );
-	pthread_create( &gdbusThread, &gdbusThreadAttr, gdbusMainLoopThread, NULL );
-	pthread_attr_destroy( &gdbusThreadAttr );
-	sleep( 1 );
-	
-	//sprintf(userInput, "%s","Run");
-	while(run)
-	  {
-		  
-		 printOptions();
-		  
-		  scanf("%d", &userInput);
-		  usleep(200);
-		 
-		 switch(userInput)
-		  {
-				case 0:
-					run = false;
-				break;
-				case 1:
-					bluez_adapter_power_on(true);
-				break;
-				case 2:
-					bluez_adapter_power_off();
-				break;
-				case 3:
-					if(bluez_adapter_power_on(true))
-						bluez_adapter_scan_on();
-				break;
-				case 4:
-					bluez_adapter_scan_off();
-				break;
-				case 5:
-					bluetooth_device_print_all();
-				break;
-				case 6:
-					g_print("Enter the device number you want to pair with...\n");
-					bluetooth_device_print_all();
-					
-					scanf("%d",&userInput);
-					
-					//bluez_register_autopair_agent();
-					bluez_register_agent();
-			 
-					bluez_device_trust_device(bluetooth_get_device_path_at_index(userInput));
-					bluez_device_pair_device(bluetooth_get_device_path_at_index(userInput));
-				break;
-				case 7:
-					bluez_adapter_init_signals();
-				break;
-				case 8:
-					bluez_adapter_mute_signals();
-				break;
-				case 9:
-					g_print("Enter the device number you want to remove...\n");
-					bluetooth_device_print_all();
-					
-					scanf("%d",&userInput);
-					
-					bluetooth_device_remove_device_by_index(userInput);
-					
-				break;
-				case 10:
-					bluez_register_agent();
-				break;
-				case 11:
-					bluez_media_player_print_current_player();
-				break;
-				case 12:
-					bluez_mediaplayer_play();
-					break;
-				case 13:
-					bluez_mediaplayer_pause();
-					break;
-				case 14:
-					bluez_mediaplayer_next();
-				break;
-				case 15:
-					bluez_mediaplayer_previous();
-				break;
-				case 16:
-					bluez_mediaplayer_shuffle_on();
-					break;
-				case 17:
-					bluez_mediaplayer_shuffle_off();
-					break;
-				case 18:
-					bluez_mediaplayer_repeat_singletrack();
-					break;
-				case 19:
-					bluez_mediaplayer_repeat_alltracks();
-				break;
-				case 20:
-					bluez_mediaplayer_repeat_off();
-				break;
-				default:
-					printf("Unsupported Command\n");
-		  }
-	  }	// end of while
-	  
-	  bluez_adapter_deinit();
-	  
-	 // clean up thread
-	pthread_cancel(gdbusThread);
-	int returnValue = pthread_join(gdbusThread,NULL);
-	g_print("Return Value: %d\n",returnValue);
+	// a trace starts before the first call, so a replay answers GetManagedObjects from it too
+	if(recordPath != NULL && !bluez_trace_record_start(recordPath))
+		return 1;
+	if(replayPath != NULL && !bluez_trace_replay_load(replayPath))
+		return 1;
+	
+	// what is recorded is what our match rules let through, so every handler listens from the start
+	if(recordPath != NULL || replayPath != NULL)
+		bluez_adapter_init_signals();
+	
+	// pick up every object bluez already knows about with one call
+	bluez_object_manager_init(connection);
+	bluez_object_manager_populate();
+	bluez_object_manager_print_stats();
+	
+	pthread_create( &consumerThread, NULL, eventConsumerThread, NULL );
+	
+	/*1. stdin is one more source of the loop, commands run on the same thread as the signals */
+	mLoop = g_main_loop_new(NULL, FALSE);
+	input = g_io_channel_unix_new(STDIN_FILENO);
+	// raw and nonblocking, a line typed halfway never holds up the loop, stdinReady splits the lines
+	g_io_channel_set_encoding(input, NULL, NULL);
+	g_io_channel_set_buffered(input, FALSE);
+	g_io_channel_set_flags(input, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_add_watch(input, G_IO_IN | G_IO_HUP | G_IO_ERR, stdinReady, NULL);
+	
+	// the collectors scrape this file, it is rewritten from the loop
+	bluez_metrics_start_export(BLUEZ_METRICS_DEFAULT_PATH, BLUEZ_METRICS_DEFAULT_PERIOD_S);
+	
+	if(replayPath != NULL)
+		mReplaying = bluez_trace_replay_start(replayMode, replayDone, NULL);
+	
+	printOptions();
+	g_main_loop_run(mLoop);
+	
+	/*2. Option 0 or the end of stdin quit the loop, nothing is running behind our back anymore */
+	// the terminal is shared with the shell, leave it blocking again
+	g_io_channel_set_flags(input, (GIOFlags)0, NULL);
+	g_io_channel_unref(input);
+	
+	bluez_discovery_stop();
+	bluez_adapter_deinit();
+	bluez_metrics_stop_export();
+	bluez_trace_deinit();
+	
+	 // the consumer leaves on its own once woken up
+	g_atomic_int_set(&mConsumerRun, 0);
+	bluez_event_queue_wakeup();
+	pthread_join(consumerThread, NULL);
+	
+	g_main_loop_unref(mLoop);
 	
 	// clean up GDBusConnection
 	g_object_unref(connection);
 	
+	bluez_log_deinit();
+	
 	return 0;
 	  
 } 
@@ -186,12 +187,12 @@ int main( int argc, char** argv )
 static void printOptions()
 {
 	g_print("***\t Options \t***\n");
-	g_print(" 1:\tPower: On\n");
-	g_print(" 2:\tPower: Off\n");
-	g_print(" 3:\tStart scan\n");
-	g_print(" 4:\tStop scan\n");
+	g_print(" 1:\tPower: On (all adapters)\n");
+	g_print(" 2:\tPower: Off (all adapters)\n");
+	g_print(" 3:\tStart scan (all adapters)\n");
+	g_print(" 4:\tStop scan (all adapters)\n");
 	g_print(" 5:\tList Devices\n");
-	g_print(" 6:\tAgent On\n");
+	g_print(" 6:\tPair Devices\n");
 	g_print(" 7:\tInit Signals\n");
 	g_print(" 8:\tMute Signals\n");
 	g_print(" 9:\tRemove Device\n");
@@ -206,13 +207,267 @@ static void printOptions()
 	g_print(" 18:\tRepeat Single\n");
 	g_print(" 19:\tRepeat All\n");
 	g_print(" 20:\tRepeat Off\n");
+	g_print(" 21:\tSignal Wakeups\n");
+	g_print(" 22:\tPairing Results\n");
+	g_print(" 23:\tCancel Pairing\n");
+	g_print(" 24:\tList Adapters\n");
+	g_print(" 25:\tToggle Debug Log\n");
+	g_print(" 26:\tToggle Discovery Controller\n");
+	g_print(" 27:\tAdvertisement Data\n");
+}
+
+static gboolean stdinReady(GIOChannel *channel, GIOCondition condition, gpointer userData)
+{
+	(void)userData;
+	
+	GIOStatus status;
+	gsize bytesRead = 0;
+	gsize length;
+	char * newline;
+	
+	/*1. Take what arrived, G_IO_STATUS_AGAIN leaves a partial line for the next G_IO_IN */
+	status = g_io_channel_read_chars(channel, mInput + mInputLength, sizeof(mInput) - 1 - mInputLength, &bytesRead, NULL);
+	mInputLength += bytesRead;
+	
+	/*2. Every complete line, several can arrive in one read */
+	while(g_main_loop_is_running(mLoop) && (newline = memchr(mInput, '\n', mInputLength)) != NULL)
+	{
+		*newline = '\0';
+		handleLine(mInput);
+		
+		length = newline + 1 - mInput;
+		memmove(mInput, newline + 1, mInputLength - length);
+		mInputLength -= length;
+	}
+	
+	// a line that does not fit is taken as it is, so is the last one without a newline
+	if(g_main_loop_is_running(mLoop) && (mInputLength == sizeof(mInput) - 1 || (status == G_IO_STATUS_EOF && mInputLength > 0)))
+	{
+		mInput[mInputLength] = '\0';
+		handleLine(mInput);
+		mInputLength = 0;
+	}
+	
+	/*3. End of input is the same as option 0, a replay fed from a script runs to its end first */
+	// a hang up with data left is read first, the next read returns EOF
+	if(status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR || (condition & G_IO_ERR))
+	{
+		mInputEnded = true;
+		if(!mReplaying)
+			g_main_loop_quit(mLoop);
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static void handleLine(const char * line)
+{
+	char * end;
+	long userInput = strtol(line, &end, 10);
+	
+	if(end == line)
+		printf("Unsupported Command\n");
+	else
+		handleInput((int)userInput);
+}
+
+static void handleInput(int userInput)
+{
+	switch(mMenuState)
+	{
+		case MENU_STATE_PAIR:
+			handlePairInput(userInput);
+		break;
+		case MENU_STATE_REMOVE:
+			bluetooth_device_remove_device_by_index(userInput);
+			mMenuState = MENU_STATE_COMMAND;
+		break;
+		default:
+			handleCommand(userInput);
+		break;
+	}
+	
+	if(mMenuState == MENU_STATE_COMMAND && g_main_loop_is_running(mLoop))
+		printOptions();
+}
+
+static void handleCommand(int userInput)
+{
+	switch(userInput)
+	{
+		case 0:
+			g_main_loop_quit(mLoop);
+		break;
+		case 1:
+			bluez_adapter_power_on_all(true);
+		break;
+		case 2:
+			bluez_adapter_power_off_all();
+		break;
+		case 3:
+			// every adapter scans, what they find ends up in the same device list
+			if(bluez_adapter_power_on_all(true) > 0)
+				bluez_adapter_scan_on_all();
+		break;
+		case 4:
+			bluez_adapter_scan_off_all();
+		break;
+		case 5:
+			bluetooth_device_print_all();
+		break;
+		case 6:
+			g_print("Enter the numbers of the devices you want to pair with, 0 when done...\n");
+			bluetooth_device_print_all();
+			mPairCount = 0;
+			mMenuState = MENU_STATE_PAIR;
+		break;
+		case 7:
+			bluez_adapter_init_signals();
+		break;
+		case 8:
+			bluez_adapter_mute_signals();
+		break;
+		case 9:
+			g_print("Enter the device number you want to remove...\n");
+			bluetooth_device_print_all();
+			mMenuState = MENU_STATE_REMOVE;
+		break;
+		case 10:
+			bluez_register_agent();
+		break;
+		case 11:
+			bluez_media_player_print_current_player();
+		break;
+		case 12:
+			bluez_mediaplayer_play();
+			break;
+		case 13:
+			bluez_mediaplayer_pause();
+			break;
+		case 14:
+			bluez_mediaplayer_next();
+		break;
+		case 15:
+			bluez_mediaplayer_previous();
+		break;
+		case 16:
+			bluez_mediaplayer_shuffle_on();
+			break;
+		case 17:
+			bluez_mediaplayer_shuffle_off();
+			break;
+		case 18:
+			bluez_mediaplayer_repeat_singletrack();
+			break;
+		case 19:
+			bluez_mediaplayer_repeat_alltracks();
+		break;
+		case 20:
+			bluez_mediaplayer_repeat_off();
+		break;
+		case 21:
+			bluez_match_rule_print_stats();
+			bluez_signal_router_print_stats();
+			bluez_rssi_coalescer_print_stats();
+			bluez_event_queue_print_stats();
+			bluez_log_print_stats();
+			bluez_metrics_print_stats();
+			bluez_trace_print_stats();
+			bluez_discovery_print_stats();
+			bluez_advertisement_print_stats();
+			bluez_media_player_print_stats();
+			bluez_object_manager_print_stats();
+		break;
+		case 22:
+			bluez_pairing_print_results();
+		break;
+		case 23:
+			bluez_pairing_cancel();
+		break;
+		case 24:
+			bluez_adapter_print_all();
+		break;
+		case 25:
+			bluez_log_set_level(bluez_log_get_level() < BLUEZ_LOG_LEVEL_DEBUG ? BLUEZ_LOG_LEVEL_TRACE : BLUEZ_LOG_LEVEL_INFO);
+			g_print("Log Level: %d\n", bluez_log_get_level());
+		break;
+		case 26:
+			// keeps the scan of a busy venue within the default signal budget
+			if(bluez_discovery_is_running())
+				bluez_discovery_stop();
+			else
+				bluez_discovery_start(NULL);
+		break;
+		case 27:
+			bluez_advertisement_print_all();
+		break;
+		default:
+			printf("Unsupported Command\n");
+	}
 }
 
-static void* gdbusMainLoopThread(void* aArg)
+static void handlePairInput(int userInput)
 {
-	GMainLoop *loop;
-	loop = g_main_loop_new (NULL, FALSE);
-	g_main_loop_run (loop);
+	const char * paths[MAX_NUMBER_PAIRING_DEVICES];
+	guint i;
+	
+	/*1. Collect device numbers until 0 */
+	if(userInput != 0)
+	{
+		if(bluetooth_device_copy_path_at_index(userInput, mPairPaths[mPairCount]))
+			mPairCount++;
+		else
+			g_print("No device %d\n", userInput);
+		
+		if(mPairCount < MAX_NUMBER_PAIRING_DEVICES)
+			return;
+	}
+	
+	mMenuState = MENU_STATE_COMMAND;
+	
+	//bluez_register_autopair_agent();
+	bluez_register_agent();
+	
+	/*2. trust -> pair -> connect runs on this loop, the menu stays usable */
+	for(i = 0; i < mPairCount; i++)
+		paths[i] = mPairPaths[i];
+	
+	if(mPairCount > 0)
+		bluez_pairing_start(paths, mPairCount, NULL, NULL, NULL);
+}
+
+static void* eventConsumerThread(void* aArg)
+{
+	BluezEvent events[BLUEZ_EVENT_BATCH_SIZE];
+	guint count;
+	guint i;
+	
+	// the bus thread never waits on us, whatever we do here only delays the events behind
+	while(g_atomic_int_get(&mConsumerRun))
+	{
+		if(!bluez_event_queue_wait(1000))
+			continue;
+		
+		count = bluez_event_queue_pop_batch(events, BLUEZ_EVENT_BATCH_SIZE);
+		for(i = 0; i < count; i++)
+		{
+			// RSSI and beacon payloads are already stored, they would flood the console
+			if(events[i].TYPE != BLUEZ_EVENT_DEVICE_RSSI && events[i].TYPE != BLUEZ_EVENT_DEVICE_ADVERTISEMENT)
+				bluez_event_print(&events[i]);
+		}
+	}
+	
 	return 0;
 }
 
+static void replayDone(gpointer userData)
+{
+	(void)userData;
+	
+	mReplaying = false;
+	bluez_trace_print_stats();
+	
+	if(mInputEnded)
+		g_main_loop_quit(mLoop);
+}
@@ -0,0 +1,1460 @@
+/**
+	* @file mock_bluetoothd.c
+	* @author Kyle Van Cleave
+	* @date March 14,2020
+	* @brief Is meant to implement a scriptable stand in for bluetoothd, so Stereo can be run and measured without a radio
+	*
+	*	- Owns org.bluez on the bus it is started on and exports the objects bluez would:
+	*	  ObjectManager on /, AgentManager1 on /org/bluez, Adapter1 on /org/bluez/hciN, Device1 and MediaControl1
+	*	  on /org/bluez/hciN/dev_XX_XX_XX_XX_XX_XX and MediaPlayer1 on .../player0 while a device is connected.
+	*	- A script drives it, one command per line, see mock_script_run for the commands. Generators run on the
+	*	  main loop and emit in batches every MOCK_TICK_MS, a storm of several thousand signals a second is fine.
+	*	- Everything it did and every call it received is printed by the stats command, on quit and on SIGINT.
+	*	- SetDiscoveryFilter is honored by the RSSI generator the way bluez reports devices: Transport, UUIDs,
+	*	  RSSI or Pathloss, and DuplicateData off drops changes smaller than MOCK_RSSI_DELTA.
+	*	- Every device advertises as a beacon, an iBeacon in ManufacturerData and an Eddystone TLM in ServiceData,
+	*	  the beacon generator changes the payloads the way a beacon counts its advertisements.
+	*	- The noise generator sends the PropertiesChanged Stereo does not handle, GATT notifications, transport
+	*	  volume and battery level of the devices, from objects that are not exported, only the signals matter.
+	*
+	*	- Running Stereo against it on a private bus
+	*		dbus-run-session -- sh -c './mock_bluetoothd --script storm.txt & sleep 1;
+	*			DBUS_SYSTEM_BUS_ADDRESS=$DBUS_SESSION_BUS_ADDRESS ./Stereo'
+	*	  The D-Bus latencies Stereo saw are in its metrics file, see bluez_metrics.h.
+	*
+	*	- Required flags, and libs for compiling
+	* 		make mock, or gcc -Iinclude `pkg-config --cflags glib-2.0 gio-2.0` `pkg-config --libs glib-2.0 gio-2.0`
+	*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+
+#include "bluez_dbus_names.h"
+
+#define MOCK_MAX_ADAPTERS			BLUEZ_MAX_ADAPTERS
+#define MOCK_MAX_DEVICES			1024
+#define MOCK_MAX_INTERFACES			2			// Device1 and MediaControl1 share a path
+#define MOCK_TICK_MS				10			// generators emit what is due every tick
+#define MOCK_PATH_SIZE				64
+#define MOCK_RSSI_DELTA				5			// dBm, smallest change reported with DuplicateData off
+#define MOCK_TX_POWER				0			// dBm every device advertises, Pathloss is MOCK_TX_POWER - RSSI
+#define MOCK_COMPANY_APPLE			0x004c		// company id of the iBeacon ManufacturerData
+#define MOCK_EDDYSTONE_UUID			"0000feaa-0000-1000-8000-00805f9b34fb"
+#define MOCK_GATT_INTERFACE			"org.bluez.GattCharacteristic1"
+#define MOCK_BATTERY_INTERFACE		"org.bluez.Battery1"
+
+#define DBUS_PROPERTIES_NAME		"org.freedesktop.DBus.Properties"
+#define DBUS_OBJECT_MANAGER_NAME	"org.freedesktop.DBus.ObjectManager"
+
+#define MOCK_DEFAULT_SCRIPT \
+	"appear 10 0\n" \
+	"wait 1000\n" \
+	"rssi 1000 5000\n" \
+	"wait 5000\n" \
+	"stats\n"
+
+/*
+ * Private Types
+*/
+typedef struct _MockObject MockObject;
+
+typedef struct _MockInterface
+{
+	GDBusInterfaceInfo *	INFO;
+	GHashTable *			PROPERTIES;			// name -> GVariant
+	guint					REGISTRATION;
+	MockObject *			OBJECT;
+} MockInterface;
+
+struct _MockObject
+{
+	char					PATH[MOCK_PATH_SIZE];
+	int						ADAPTER;			// N of the hciN the object lives under
+	bool					PRESENT;
+	MockInterface			INTERFACES[MOCK_MAX_INTERFACES];
+	guint					INTERFACE_COUNT;
+	MockObject *			PLAYER;				// device only, while connected
+	GDBusMethodInvocation *	PAIRING;			// device only, Pair waiting for its reply
+	guint					PAIR_SOURCE;
+	const char *			TRANSPORT;			// device only, "bredr" or "le"
+};
+
+typedef struct _MockFilter
+{
+	bool					SET;				// SetDiscoveryFilter was called, otherwise everything is reported
+	gint16					RSSI;
+	guint16					PATHLOSS;			// 0 when not set
+	char					TRANSPORT[8];
+	bool					DUPLICATE_DATA;
+	gchar **				UUIDS;				// NULL or empty for any
+} MockFilter;
+
+typedef struct _MockStats
+{
+	guint64		SIGNALS;
+	guint64		RSSI;
+	guint64		TRACKS;
+	guint64		BEACONS;
+	guint64		NOISE;
+	guint64		APPEARED;
+	guint64		DISAPPEARED;
+	guint64		CALLS;
+	guint64		PAIRED;
+	guint64		PAIR_FAILED;
+	guint64		FILTERED;
+} MockStats;
+
+/*
+ * Private Function Declerations
+*/
+static MockObject * mock_object_new(const char * path, int adapter);
+static MockInterface * mock_object_add_interface(MockObject * object, const char * name, GVariant * properties);
+static MockInterface * mock_object_find_interface(MockObject * object, const char * name);
+static void mock_object_remove(MockObject * object);
+static GVariant * mock_object_interfaces(MockObject * object, guint from);
+static void mock_set_property(MockInterface * iface, const char * name, GVariant * value);
+static void mock_emit(const char * path, const char * interface, const char * member, GVariant * params);
+
+static void mock_adapter_add(int index);
+static void mock_adapter_remove(int index);
+static MockObject * mock_device_appear(void);
+static void mock_device_disappear(MockObject * device);
+static void mock_device_connect(MockObject * device, bool connected);
+static MockObject * mock_device_find(const char * path);
+static gboolean mock_pair_done(gpointer userData);
+static void mock_player_next_track(MockObject * player);
+static GVariant * mock_beacon_manufacturer_data(guint n, guint16 count);
+static GVariant * mock_beacon_service_data(guint16 count);
+static bool mock_filter_set(int adapter, GVariant * filter);
+static bool mock_filter_reports(MockObject * device, gint16 oldRssi, gint16 newRssi);
+
+static gboolean mock_appear_tick(gpointer userData);
+static gboolean mock_rssi_tick(gpointer userData);
+static gboolean mock_track_tick(gpointer userData);
+static gboolean mock_beacon_tick(gpointer userData);
+static gboolean mock_noise_tick(gpointer userData);
+static void mock_noise_emit(MockObject * device, guint kind);
+static gboolean mock_script_step(gpointer userData);
+static int mock_script_run(const char * line);
+static void mock_print_stats(void);
+static GDBusMessage * mock_count_call(GDBusConnection *conn, GDBusMessage *message, gboolean incoming, gpointer userData);
+static gboolean mock_quit(gpointer userData);
+
+static void mock_method_call(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *method,
+				GVariant *params,
+				GDBusMethodInvocation *invocation,
+				gpointer userData);
+static GVariant * mock_get_property(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *property,
+				GError **error,
+				gpointer userData);
+static gboolean mock_set_property_call(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *property,
+				GVariant *value,
+				GError **error,
+				gpointer userData);
+
+/*
+ * Private Variables
+*/
+static const gchar mIntrospectionXml[] =
+	"<node>"
+	"  <interface name='" DBUS_OBJECT_MANAGER_NAME "'>"
+	"    <method name='GetManagedObjects'>"
+	"      <arg type='a{oa{sa{sv}}}' name='objects' direction='out'/>"
+	"    </method>"
+	"  </interface>"
+	"  <interface name='" BLUEZ_AgentManager_INTERFACE "'>"
+	"    <method name='RegisterAgent'><arg type='o' direction='in'/><arg type='s' direction='in'/></method>"
+	"    <method name='UnregisterAgent'><arg type='o' direction='in'/></method>"
+	"    <method name='RequestDefaultAgent'><arg type='o' direction='in'/></method>"
+	"  </interface>"
+	"  <interface name='" BLUEZ_ADAPTER_INTERFACE "'>"
+	"    <method name='StartDiscovery'/>"
+	"    <method name='StopDiscovery'/>"
+	"    <method name='SetDiscoveryFilter'><arg type='a{sv}' direction='in'/></method>"
+	"    <method name='GetDiscoveryFilters'><arg type='as' direction='out'/></method>"
+	"    <method name='RemoveDevice'><arg type='o' direction='in'/></method>"
+	"    <property name='Address' type='s' access='read'/>"
+	"    <property name='Name' type='s' access='read'/>"
+	"    <property name='Alias' type='s' access='readwrite'/>"
+	"    <property name='Powered' type='b' access='readwrite'/>"
+	"    <property name='Discoverable' type='b' access='readwrite'/>"
+	"    <property name='Pairable' type='b' access='readwrite'/>"
+	"    <property name='Discovering' type='b' access='read'/>"
+	"  </interface>"
+	"  <interface name='" BLUEZ_DEVICE_INTERFACE "'>"
+	"    <method name='Connect'/>"
+	"    <method name='Disconnect'/>"
+	"    <method name='Pair'/>"
+	"    <method name='CancelPairing'/>"
+	"    <property name='Address' type='s' access='read'/>"
+	"    <property name='Name' type='s' access='read'/>"
+	"    <property name='Alias' type='s' access='readwrite'/>"
+	"    <property name='Adapter' type='o' access='read'/>"
+	"    <property name='Icon' type='s' access='read'/>"
+	"    <property name='Class' type='u' access='read'/>"
+	"    <property name='Paired' type='b' access='read'/>"
+	"    <property name='Trusted' type='b' access='readwrite'/>"
+	"    <property name='Connected' type='b' access='read'/>"
+	"    <property name='RSSI' type='n' access='read'/>"
+	"    <property name='UUIDs' type='as' access='read'/>"
+	"    <property name='ManufacturerData' type='a{qv}' access='read'/>"
+	"    <property name='ServiceData' type='a{sv}' access='read'/>"
+	"  </interface>"
+	"  <interface name='" BLUEZ_MediaController_INTERFACE "'>"
+	"    <method name='Play'/><method name='Pause'/><method name='Stop'/>"
+	"    <method name='Next'/><method name='Previous'/>"
+	"    <property name='Connected' type='b' access='read'/>"
+	"    <property name='Player' type='o' access='read'/>"
+	"  </interface>"
+	"  <interface name='" BLUEZ_MediaPlayer_INTERFACE "'>"
+	"    <method name='Play'/><method name='Pause'/><method name='Stop'/>"
+	"    <method name='Next'/><method name='Previous'/>"
+	"    <method name='FastForward'/><method name='Rewind'/>"
+	"    <property name='Name' type='s' access='read'/>"
+	"    <property name='Type' type='s' access='read'/>"
+	"    <property name='Status' type='s' access='read'/>"
+	"    <property name='Position' type='u' access='read'/>"
+	"    <property name='Shuffle' type='s' access='readwrite'/>"
+	"    <property name='Repeat' type='s' access='readwrite'/>"
+	"    <property name='Track' type='a{sv}' access='read'/>"
+	"    <property name='Device' type='o' access='read'/>"
+	"  </interface>"
+	"</node>";
+
+static const GDBusInterfaceVTable mVTable = {
+	.method_call = mock_method_call,
+	.get_property = mock_get_property,
+	.set_property = mock_set_property_call,
+};
+
+static GDBusConnection * mCon;
+static GDBusNodeInfo * mNode;
+static GMainLoop * mLoop;
+static GRand * mRand;
+static MockStats mStats;
+static GHashTable * mCalls;						// interned method name -> calls received
+static GMutex mCallsLock;						// mCalls is counted on the GDBus worker thread
+static gint64 mStartUs;
+
+static MockObject * mRoot;						// ObjectManager
+static MockObject * mBluez;						// AgentManager1
+static MockObject * mAdapters[MOCK_MAX_ADAPTERS];
+static MockFilter mFilters[MOCK_MAX_ADAPTERS];		// discovery filter of each adapter
+static int mAdapterCount;						// hci0 .. hciN-1 created so far
+static MockObject * mDevices[MOCK_MAX_DEVICES];
+static guint mDeviceCount;						// devices that ever appeared, the index names the device
+
+static guint mPairDelayMs = 100;
+static guint mPairFailPercent = 0;
+
+// generators, one of each kind runs at a time
+static guint mAppearLeft;
+static guint mAppearSource;
+static guint mRssiRate;
+static gint64 mRssiStartUs;
+static gint64 mRssiEndUs;
+static gint64 mRssiLastUs;
+static double mRssiDue;
+static guint mRssiNext;
+static guint mRssiSource;
+static guint64 mRssiSent;
+static gint64 mTrackEndUs;
+static guint mTrackSource;
+static gint64 mBeaconEndUs;
+static guint mBeaconSource;
+static guint16 mBeaconCount;					// advertisements every beacon sent so far
+static guint mNoiseRate;
+static gint64 mNoiseEndUs;
+static gint64 mNoiseLastUs;
+static double mNoiseDue;
+static guint mNoiseNext;
+static guint mNoiseSource;
+
+static gchar ** mScript;
+static guint mScriptLine;
+
+int main(int argc, char ** argv)
+{
+	GError * error = NULL;
+	GVariant * reply;
+	char * script = NULL;
+	const char * scriptPath = NULL;
+	int adapters = 1;
+	guint32 seed = 1;
+	bool systemBus = false;
+	int i;
+
+	/*1. Options, everything else comes from the script */
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--adapters") == 0 && i + 1 < argc)
+		{
+			adapters = atoi(argv[++i]);
+			adapters = CLAMP(adapters, 0, MOCK_MAX_ADAPTERS);
+		}
+		else if(strcmp(argv[i], "--script") == 0 && i + 1 < argc)
+			scriptPath = argv[++i];
+		else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			seed = (guint32)strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--system") == 0)
+			systemBus = true;
+		else
+		{
+			g_print("usage: %s [--adapters N] [--script FILE] [--seed N] [--system]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(scriptPath != NULL && !g_file_get_contents(scriptPath, &script, NULL, &error))
+	{
+		g_print("Error: Script %s. Message: %s\n", scriptPath, error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	mScript = g_strsplit(script != NULL ? script : MOCK_DEFAULT_SCRIPT, "\n", -1);
+	g_free(script);
+
+	mRand = g_rand_new_with_seed(seed);
+	mCalls = g_hash_table_new(g_direct_hash, g_direct_equal);
+	mNode = g_dbus_node_info_new_for_xml(mIntrospectionXml, &error);
+	g_assert(mNode);
+
+	mCon = g_bus_get_sync(systemBus ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION, NULL, &error);
+	if(mCon == NULL)
+	{
+		g_print("Error: No bus. Message: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	// Properties.Get and GetAll are answered inside GDBus, every call is counted before it is dispatched
+	g_dbus_connection_add_filter(mCon, mock_count_call, NULL, NULL);
+
+	/*2. The tree is in place before anyone can see the name */
+	mRoot = mock_object_new(BLUEZ_ROOT_PATH, -1);
+	mock_object_add_interface(mRoot, DBUS_OBJECT_MANAGER_NAME, NULL);
+	mBluez = mock_object_new(BLUEZ_BASE_PATH, -1);
+	mock_object_add_interface(mBluez, BLUEZ_AgentManager_INTERFACE, NULL);
+
+	for(i = 0; i < adapters; i++)
+		mock_adapter_add(i);
+
+	reply = g_dbus_connection_call_sync(mCon,
+					     "org.freedesktop.DBus",
+					     "/org/freedesktop/DBus",
+					     "org.freedesktop.DBus",
+					     "RequestName",
+					     g_variant_new("(su)", BLUEZ_BUS_NAME, 4),		// DBUS_NAME_FLAG_DO_NOT_QUEUE
+					     G_VARIANT_TYPE("(u)"),
+					     G_DBUS_CALL_FLAGS_NONE,
+					     -1,
+					     NULL,
+					     &error);
+	if(reply == NULL)
+	{
+		g_print("Error: RequestName. Message: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	g_variant_get(reply, "(u)", &i);
+	g_variant_unref(reply);
+	if(i != 1)			// DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER
+	{
+		g_print("Error: %s is owned by someone else\n", BLUEZ_BUS_NAME);
+		return 1;
+	}
+
+	g_print("Mock bluetoothd: %d adapter(s), seed %u\n", adapters, seed);
+
+	/*3. Run the script from the loop, the calls of the client are served in between */
+	mStartUs = g_get_monotonic_time();
+	mLoop = g_main_loop_new(NULL, FALSE);
+	g_unix_signal_add(SIGINT, mock_quit, NULL);
+	g_unix_signal_add(SIGTERM, mock_quit, NULL);
+	g_idle_add(mock_script_step, NULL);
+	g_main_loop_run(mLoop);
+
+	mock_print_stats();
+
+	g_main_loop_unref(mLoop);
+	g_object_unref(mCon);
+	g_dbus_node_info_unref(mNode);
+	g_strfreev(mScript);
+	g_rand_free(mRand);
+
+	return 0;
+}
+
+/*
+ * Objects
+*/
+static MockObject * mock_object_new(const char * path, int adapter)
+{
+	MockObject * object = g_new0(MockObject, 1);
+
+	g_strlcpy(object->PATH, path, sizeof(object->PATH));
+	object->ADAPTER = adapter;
+	object->PRESENT = true;
+
+	return object;
+}
+
+// takes ownership of properties, an a{sv} or NULL
+static MockInterface * mock_object_add_interface(MockObject * object, const char * name, GVariant * properties)
+{
+	MockInterface * iface = &object->INTERFACES[object->INTERFACE_COUNT];
+	GError * error = NULL;
+	GVariantIter iter;
+	gchar * key;
+	GVariant * value;
+
+	g_assert(object->INTERFACE_COUNT < MOCK_MAX_INTERFACES);
+
+	iface->INFO = g_dbus_node_info_lookup_interface(mNode, name);
+	iface->PROPERTIES = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+	iface->OBJECT = object;
+
+	if(properties != NULL)
+	{
+		g_variant_iter_init(&iter, g_variant_ref_sink(properties));
+		while(g_variant_iter_next(&iter, "{sv}", &key, &value))
+			g_hash_table_insert(iface->PROPERTIES, key, value);
+		g_variant_unref(properties);
+	}
+
+	iface->REGISTRATION = g_dbus_connection_register_object(mCon, object->PATH, iface->INFO, &mVTable, iface, NULL, &error);
+	if(iface->REGISTRATION == 0)
+	{
+		g_print("Error: Export %s on %s. Message: %s\n", name, object->PATH, error->message);
+		g_error_free(error);
+		g_hash_table_unref(iface->PROPERTIES);
+		return NULL;
+	}
+
+	object->INTERFACE_COUNT++;
+
+	return iface;
+}
+
+static MockInterface * mock_object_find_interface(MockObject * object, const char * name)
+{
+	guint i;
+
+	for(i = 0; i < object->INTERFACE_COUNT; i++)
+		if(strcmp(object->INTERFACES[i].INFO->name, name) == 0)
+			return &object->INTERFACES[i];
+
+	return NULL;
+}
+
+static void mock_object_remove(MockObject * object)
+{
+	GVariantBuilder names;
+	guint i;
+
+	if(!object->PRESENT)
+		return;
+
+	/*1. Gone from the bus before the signal says so */
+	g_variant_builder_init(&names, G_VARIANT_TYPE("as"));
+	for(i = 0; i < object->INTERFACE_COUNT; i++)
+	{
+		g_variant_builder_add(&names, "s", object->INTERFACES[i].INFO->name);
+		g_dbus_connection_unregister_object(mCon, object->INTERFACES[i].REGISTRATION);
+		g_hash_table_unref(object->INTERFACES[i].PROPERTIES);
+	}
+
+	object->INTERFACE_COUNT = 0;
+	object->PRESENT = false;
+
+	mock_emit(BLUEZ_ROOT_PATH, DBUS_OBJECT_MANAGER_NAME, "InterfacesRemoved",
+			g_variant_new("(o@as)", object->PATH, g_variant_builder_end(&names)));
+}
+
+// a{sa{sv}} of the interfaces from index from on
+static GVariant * mock_object_interfaces(MockObject * object, guint from)
+{
+	GVariantBuilder interfaces;
+	GVariantBuilder properties;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	guint i;
+
+	g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+	for(i = from; i < object->INTERFACE_COUNT; i++)
+	{
+		g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+		g_hash_table_iter_init(&iter, object->INTERFACES[i].PROPERTIES);
+		while(g_hash_table_iter_next(&iter, &key, &value))
+			g_variant_builder_add(&properties, "{sv}", key, value);
+
+		g_variant_builder_add(&interfaces, "{sa{sv}}", object->INTERFACES[i].INFO->name, &properties);
+	}
+
+	return g_variant_builder_end(&interfaces);
+}
+
+// takes ownership of value
+static void mock_set_property(MockInterface * iface, const char * name, GVariant * value)
+{
+	GVariantBuilder changed;
+
+	g_variant_take_ref(value);
+	g_hash_table_replace(iface->PROPERTIES, g_strdup(name), g_variant_ref(value));
+
+	g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&changed, "{sv}", name, value);
+	g_variant_unref(value);
+
+	mock_emit(iface->OBJECT->PATH, DBUS_PROPERTIES_NAME, "PropertiesChanged",
+			g_variant_new("(sa{sv}as)", iface->INFO->name, &changed, NULL));
+}
+
+static void mock_emit(const char * path, const char * interface, const char * member, GVariant * params)
+{
+	mStats.SIGNALS++;
+	g_dbus_connection_emit_signal(mCon, NULL, path, interface, member, params, NULL);
+}
+
+/*
+ * Adapters and Devices
+*/
+static void mock_adapter_add(int index)
+{
+	MockObject * adapter;
+	GVariantBuilder properties;
+	char path[MOCK_PATH_SIZE];
+	char address[18];
+
+	if(index < 0 || index >= MOCK_MAX_ADAPTERS || (mAdapters[index] != NULL && mAdapters[index]->PRESENT))
+		return;
+
+	g_snprintf(path, sizeof(path), "%s%d", BLUEZ_HCI_PATH_PREFIX, index);
+	g_snprintf(address, sizeof(address), "DC:A6:32:00:00:%02X", index);
+
+	g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&properties, "{sv}", "Address", g_variant_new_string(address));
+	g_variant_builder_add(&properties, "{sv}", "Name", g_variant_new_string("mock"));
+	g_variant_builder_add(&properties, "{sv}", "Alias", g_variant_new_string("mock"));
+	g_variant_builder_add(&properties, "{sv}", "Powered", g_variant_new_boolean(FALSE));
+	g_variant_builder_add(&properties, "{sv}", "Discoverable", g_variant_new_boolean(FALSE));
+	g_variant_builder_add(&properties, "{sv}", "Pairable", g_variant_new_boolean(FALSE));
+	g_variant_builder_add(&properties, "{sv}", "Discovering", g_variant_new_boolean(FALSE));
+
+	// an adapter plugged back in is a new object
+	g_free(mAdapters[index]);
+	adapter = mAdapters[index] = mock_object_new(path, index);
+	g_strfreev(mFilters[index].UUIDS);
+	memset(&mFilters[index], 0, sizeof(MockFilter));
+	mock_object_add_interface(adapter, BLUEZ_ADAPTER_INTERFACE, g_variant_builder_end(&properties));
+
+	if(index >= mAdapterCount)
+		mAdapterCount = index + 1;
+
+	mock_emit(BLUEZ_ROOT_PATH, DBUS_OBJECT_MANAGER_NAME, "InterfacesAdded",
+			g_variant_new("(o@a{sa{sv}})", path, mock_object_interfaces(adapter, 0)));
+}
+
+static void mock_adapter_remove(int index)
+{
+	guint i;
+
+	if(index < 0 || index >= MOCK_MAX_ADAPTERS || mAdapters[index] == NULL)
+		return;
+
+	// its devices go first, like bluez does
+	for(i = 0; i < mDeviceCount; i++)
+		if(mDevices[i]->PRESENT && mDevices[i]->ADAPTER == index)
+			mock_device_disappear(mDevices[i]);
+
+	mock_object_remove(mAdapters[index]);
+}
+
+static MockObject * mock_device_appear(void)
+{
+	MockObject * device;
+	GVariantBuilder properties;
+	const char * uuids[] = { "0000110a-0000-1000-8000-00805f9b34fb", "0000110e-0000-1000-8000-00805f9b34fb", NULL };
+	char path[MOCK_PATH_SIZE];
+	char address[18];
+	char name[16];
+	int adapter;
+	guint n;
+
+	/*1. Devices are spread over the adapters that are there */
+	for(n = 0, adapter = -1; n < (guint)mAdapterCount; n++)
+	{
+		adapter = (mDeviceCount + n) % mAdapterCount;
+		if(mAdapters[adapter] != NULL && mAdapters[adapter]->PRESENT)
+			break;
+		adapter = -1;
+	}
+
+	if(adapter < 0 || mDeviceCount == MOCK_MAX_DEVICES)
+		return NULL;
+
+	n = mDeviceCount;
+	g_snprintf(address, sizeof(address), "00:11:22:33:%02X:%02X", (n >> 8) & 0xFF, n & 0xFF);
+	g_snprintf(path, sizeof(path), "%s/dev_00_11_22_33_%02X_%02X", mAdapters[adapter]->PATH, (n >> 8) & 0xFF, n & 0xFF);
+	g_snprintf(name, sizeof(name), "Phone %u", n);
+
+	g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&properties, "{sv}", "Address", g_variant_new_string(address));
+	g_variant_builder_add(&properties, "{sv}", "Name", g_variant_new_string(name));
+	g_variant_builder_add(&properties, "{sv}", "Alias", g_variant_new_string(name));
+	g_variant_builder_add(&properties, "{sv}", "Adapter", g_variant_new_object_path(mAdapters[adapter]->PATH));
+	g_variant_builder_add(&properties, "{sv}", "Icon", g_variant_new_string("phone"));
+	g_variant_builder_add(&properties, "{sv}", "Class", g_variant_new_uint32(0x5a020c));
+	g_variant_builder_add(&properties, "{sv}", "Paired", g_variant_new_boolean(FALSE));
+	g_variant_builder_add(&properties, "{sv}", "Trusted", g_variant_new_boolean(FALSE));
+	g_variant_builder_add(&properties, "{sv}", "Connected", g_variant_new_boolean(FALSE));
+	g_variant_builder_add(&properties, "{sv}", "RSSI", g_variant_new_int16((gint16)g_rand_int_range(mRand, -90, -30)));
+	g_variant_builder_add(&properties, "{sv}", "UUIDs", g_variant_new_strv(uuids, -1));
+	g_variant_builder_add(&properties, "{sv}", "ManufacturerData", mock_beacon_manufacturer_data(n, mBeaconCount));
+	g_variant_builder_add(&properties, "{sv}", "ServiceData", mock_beacon_service_data(mBeaconCount));
+
+	device = mDevices[mDeviceCount++] = mock_object_new(path, adapter);
+	device->TRANSPORT = "bredr";
+	mock_object_add_interface(device, BLUEZ_DEVICE_INTERFACE, g_variant_builder_end(&properties));
+	mStats.APPEARED++;
+
+	mock_emit(BLUEZ_ROOT_PATH, DBUS_OBJECT_MANAGER_NAME, "InterfacesAdded",
+			g_variant_new("(o@a{sa{sv}})", path, mock_object_interfaces(device, 0)));
+
+	return device;
+}
+
+static void mock_device_disappear(MockObject * device)
+{
+	if(!device->PRESENT)
+		return;
+
+	if(device->PAIRING != NULL)
+	{
+		g_source_remove(device->PAIR_SOURCE);
+		g_dbus_method_invocation_return_dbus_error(device->PAIRING, "org.bluez.Error.AuthenticationCanceled", "Device removed");
+		device->PAIRING = NULL;
+	}
+
+	mock_device_connect(device, false);
+	mock_object_remove(device);
+	mStats.DISAPPEARED++;
+}
+
+static void mock_device_connect(MockObject * device, bool connected)
+{
+	MockInterface * iface = mock_object_find_interface(device, BLUEZ_DEVICE_INTERFACE);
+	MockObject * player;
+	GVariantBuilder properties;
+	char path[MOCK_PATH_SIZE];
+
+	if(iface == NULL || (device->PLAYER != NULL) == connected)
+		return;
+
+	/*1. Disconnect, the player and the control go away with the link */
+	if(!connected)
+	{
+		mock_object_remove(device->PLAYER);
+		g_free(device->PLAYER);
+		device->PLAYER = NULL;
+
+		// MediaControl1 is always the last interface of the device
+		if(device->INTERFACE_COUNT > 1)
+		{
+			device->INTERFACE_COUNT--;
+			g_dbus_connection_unregister_object(mCon, device->INTERFACES[1].REGISTRATION);
+			g_hash_table_unref(device->INTERFACES[1].PROPERTIES);
+			mock_emit(BLUEZ_ROOT_PATH, DBUS_OBJECT_MANAGER_NAME, "InterfacesRemoved",
+					g_variant_new("(o^as)", device->PATH, (const char *[]){ BLUEZ_MediaController_INTERFACE, NULL }));
+		}
+
+		mock_set_property(iface, "Connected", g_variant_new_boolean(FALSE));
+		return;
+	}
+
+	/*2. Connect, the phone brings a player with it */
+	mock_set_property(iface, "Connected", g_variant_new_boolean(TRUE));
+
+	g_snprintf(path, sizeof(path), "%s/player0", device->PATH);
+	player = device->PLAYER = mock_object_new(path, device->ADAPTER);
+
+	g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&properties, "{sv}", "Name", g_variant_new_string("Music"));
+	g_variant_builder_add(&properties, "{sv}", "Type", g_variant_new_string("Audio"));
+	g_variant_builder_add(&properties, "{sv}", "Status", g_variant_new_string("paused"));
+	g_variant_builder_add(&properties, "{sv}", "Position", g_variant_new_uint32(0));
+	g_variant_builder_add(&properties, "{sv}", "Shuffle", g_variant_new_string("off"));
+	g_variant_builder_add(&properties, "{sv}", "Repeat", g_variant_new_string("off"));
+	g_variant_builder_add(&properties, "{sv}", "Device", g_variant_new_object_path(device->PATH));
+	g_variant_builder_add(&properties, "{sv}", "Track", g_variant_new_parsed("@a{sv} {'Title': <'Track 0'>, 'Artist': <'Mock'>, "
+				"'Album': <'Bench'>, 'Genre': <'Noise'>, 'Duration': <uint32 180000>, 'TrackNumber': <uint32 0>}"));
+	mock_object_add_interface(player, BLUEZ_MediaPlayer_INTERFACE, g_variant_builder_end(&properties));
+
+	g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&properties, "{sv}", "Connected", g_variant_new_boolean(TRUE));
+	g_variant_builder_add(&properties, "{sv}", "Player", g_variant_new_object_path(path));
+	mock_object_add_interface(device, BLUEZ_MediaController_INTERFACE, g_variant_builder_end(&properties));
+
+	mock_emit(BLUEZ_ROOT_PATH, DBUS_OBJECT_MANAGER_NAME, "InterfacesAdded",
+			g_variant_new("(o@a{sa{sv}})", path, mock_object_interfaces(player, 0)));
+	mock_emit(BLUEZ_ROOT_PATH, DBUS_OBJECT_MANAGER_NAME, "InterfacesAdded",
+			g_variant_new("(o@a{sa{sv}})", device->PATH, mock_object_interfaces(device, 1)));
+}
+
+static MockObject * mock_device_find(const char * path)
+{
+	guint i;
+
+	for(i = 0; i < mDeviceCount; i++)
+		if(mDevices[i]->PRESENT && strcmp(mDevices[i]->PATH, path) == 0)
+			return mDevices[i];
+
+	return NULL;
+}
+
+static gboolean mock_pair_done(gpointer userData)
+{
+	MockObject * device = userData;
+	GDBusMethodInvocation * invocation = device->PAIRING;
+
+	device->PAIRING = NULL;
+	device->PAIR_SOURCE = 0;
+
+	if((guint)g_rand_int_range(mRand, 0, 100) < mPairFailPercent)
+	{
+		mStats.PAIR_FAILED++;
+		g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.AuthenticationFailed", "Mock pairing failure");
+		return G_SOURCE_REMOVE;
+	}
+
+	mStats.PAIRED++;
+	mock_set_property(mock_object_find_interface(device, BLUEZ_DEVICE_INTERFACE), "Paired", g_variant_new_boolean(TRUE));
+	g_dbus_method_invocation_return_value(invocation, NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void mock_player_next_track(MockObject * player)
+{
+	MockInterface * iface = mock_object_find_interface(player, BLUEZ_MediaPlayer_INTERFACE);
+	GVariantBuilder track;
+	char title[32];
+
+	mStats.TRACKS++;
+	g_snprintf(title, sizeof(title), "Track %llu", (unsigned long long)mStats.TRACKS);
+
+	g_variant_builder_init(&track, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&track, "{sv}", "Title", g_variant_new_string(title));
+	g_variant_builder_add(&track, "{sv}", "Artist", g_variant_new_string("Mock"));
+	g_variant_builder_add(&track, "{sv}", "Album", g_variant_new_string("Bench"));
+	g_variant_builder_add(&track, "{sv}", "Genre", g_variant_new_string("Noise"));
+	g_variant_builder_add(&track, "{sv}", "Duration", g_variant_new_uint32(180000));
+	g_variant_builder_add(&track, "{sv}", "TrackNumber", g_variant_new_uint32((guint32)mStats.TRACKS));
+
+	mock_set_property(iface, "Track", g_variant_builder_end(&track));
+	mock_set_property(iface, "Position", g_variant_new_uint32(0));
+}
+
+// iBeacon: type, length, proximity UUID, major is the device, minor the advertisement count, measured power
+static GVariant * mock_beacon_manufacturer_data(guint n, guint16 count)
+{
+	guint8 data[23] = { 0x02, 0x15,
+			0xe2, 0xc5, 0x6d, 0xb5, 0xdf, 0xfb, 0x48, 0xd2, 0xb0, 0x60, 0xd0, 0xf5, 0xa7, 0x10, 0x96, 0xe0 };
+	GVariantBuilder builder;
+
+	data[18] = (n >> 8) & 0xFF;
+	data[19] = n & 0xFF;
+	data[20] = count >> 8;
+	data[21] = count & 0xFF;
+	data[22] = 0xc5;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{qv}"));
+	g_variant_builder_add(&builder, "{qv}", (guint16)MOCK_COMPANY_APPLE,
+			g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data, sizeof(data), sizeof(guint8)));
+
+	return g_variant_builder_end(&builder);
+}
+
+// Eddystone TLM: frame type, version, battery mV, temperature, advertisement count, time since boot
+static GVariant * mock_beacon_service_data(guint16 count)
+{
+	guint8 data[14] = { 0x20, 0x00, 0x0b, 0xb8, 0x15, 0x00, 0, 0, 0, 0, 0, 0, 0, 0 };
+	GVariantBuilder builder;
+
+	data[8] = count >> 8;
+	data[9] = count & 0xFF;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&builder, "{sv}", MOCK_EDDYSTONE_UUID,
+			g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data, sizeof(data), sizeof(guint8)));
+
+	return g_variant_builder_end(&builder);
+}
+
+static bool mock_filter_set(int adapter, GVariant * filter)
+{
+	MockFilter * current = &mFilters[adapter];
+	MockFilter next = { .SET = true, .RSSI = -127, .TRANSPORT = "auto", .DUPLICATE_DATA = true };
+	GVariantIter iter;
+	const char * key;
+	GVariant * value;
+	bool valid = true;
+	bool rssiSet = false;
+
+	/*1. Same checks as bluez, unknown keys are ignored */
+	g_variant_iter_init(&iter, filter);
+	while(g_variant_iter_next(&iter, "{&sv}", &key, &value))
+	{
+		if(strcmp(key, "RSSI") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_INT16))
+		{
+			next.RSSI = g_variant_get_int16(value);
+			rssiSet = true;
+		}
+		else if(strcmp(key, "Pathloss") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_UINT16))
+			next.PATHLOSS = g_variant_get_uint16(value);
+		else if(strcmp(key, "Transport") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+			g_strlcpy(next.TRANSPORT, g_variant_get_string(value, NULL), sizeof(next.TRANSPORT));
+		else if(strcmp(key, "DuplicateData") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN))
+			next.DUPLICATE_DATA = g_variant_get_boolean(value);
+		else if(strcmp(key, "UUIDs") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_STRING_ARRAY))
+		{
+			g_strfreev(next.UUIDS);
+			next.UUIDS = g_variant_dup_strv(value, NULL);
+		}
+		g_variant_unref(value);
+	}
+	g_variant_unref(filter);
+
+	// RSSI and Pathloss can not be used together
+	if((rssiSet && next.PATHLOSS != 0)
+		|| (strcmp(next.TRANSPORT, "auto") != 0 && strcmp(next.TRANSPORT, "bredr") != 0 && strcmp(next.TRANSPORT, "le") != 0))
+		valid = false;
+
+	if(!valid)
+	{
+		g_strfreev(next.UUIDS);
+		return false;
+	}
+
+	g_strfreev(current->UUIDS);
+	*current = next;
+
+	g_print("hci%d filter: Transport %s, RSSI %d, Pathloss %u, DuplicateData %s\n", adapter, next.TRANSPORT,
+			next.RSSI, next.PATHLOSS, next.DUPLICATE_DATA ? "on" : "off");
+
+	return true;
+}
+
+static bool mock_filter_reports(MockObject * device, gint16 oldRssi, gint16 newRssi)
+{
+	MockFilter * filter = &mFilters[device->ADAPTER];
+	GVariant * uuids;
+	const char * uuid;
+	GVariantIter iter;
+	bool match;
+	guint i;
+
+	if(!filter->SET)
+		return true;
+
+	if(strcmp(filter->TRANSPORT, "auto") != 0 && strcmp(filter->TRANSPORT, device->TRANSPORT) != 0)
+		return false;
+
+	/*1. Any of the UUIDs of the filter */
+	if(filter->UUIDS != NULL && filter->UUIDS[0] != NULL)
+	{
+		match = false;
+		uuids = g_hash_table_lookup(device->INTERFACES[0].PROPERTIES, "UUIDs");
+		for(i = 0; uuids != NULL && !match && filter->UUIDS[i] != NULL; i++)
+		{
+			g_variant_iter_init(&iter, uuids);
+			while(!match && g_variant_iter_next(&iter, "&s", &uuid))
+				match = g_ascii_strcasecmp(uuid, filter->UUIDS[i]) == 0;
+		}
+
+		if(!match)
+			return false;
+	}
+
+	/*2. Thresholds, then duplicates */
+	if(filter->PATHLOSS != 0 ? MOCK_TX_POWER - newRssi > filter->PATHLOSS : newRssi < filter->RSSI)
+		return false;
+
+	return filter->DUPLICATE_DATA || ABS(newRssi - oldRssi) >= MOCK_RSSI_DELTA;
+}
+
+/*
+ * Generators
+*/
+static gboolean mock_appear_tick(gpointer userData)
+{
+	(void)userData;
+
+	if(mAppearLeft > 0 && mock_device_appear() != NULL)
+		mAppearLeft--;
+	else
+		mAppearLeft = 0;
+
+	if(mAppearLeft == 0)
+	{
+		mAppearSource = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean mock_rssi_tick(gpointer userData)
+{
+	(void)userData;
+
+	gint64 now = g_get_monotonic_time();
+	MockObject * device;
+	guint tries;
+	gint16 rssi;
+
+	/*1. What the rate owes since the last tick, a late tick catches up */
+	mRssiDue += mRssiRate * (now - mRssiLastUs) / 1000000.0;
+	mRssiLastUs = now;
+
+	/*2. Round robin over the devices that are there */
+	while(mRssiDue >= 1.0 && mDeviceCount > 0)
+	{
+		for(tries = 0, device = NULL; tries < mDeviceCount; tries++)
+		{
+			device = mDevices[mRssiNext++ % mDeviceCount];
+			if(device->PRESENT)
+				break;
+			device = NULL;
+		}
+
+		if(device == NULL)
+			break;
+
+		rssi = (gint16)g_rand_int_range(mRand, -90, -30);
+		mRssiDue -= 1.0;
+
+		// bluez heard it, but the filter keeps it from us
+		if(!mock_filter_reports(device, g_variant_get_int16(g_hash_table_lookup(device->INTERFACES[0].PROPERTIES, "RSSI")), rssi))
+		{
+			mStats.FILTERED++;
+			continue;
+		}
+
+		mock_set_property(&device->INTERFACES[0], "RSSI", g_variant_new_int16(rssi));
+		mRssiSent++;
+		mStats.RSSI++;
+	}
+
+	if(now < mRssiEndUs)
+		return G_SOURCE_CONTINUE;
+
+	g_print("RSSI storm done: %llu signals, %.0f/s\n", (unsigned long long)mRssiSent,
+			now > mRssiStartUs ? mRssiSent * 1000000.0 / (now - mRssiStartUs) : 0.0);
+	mRssiSource = 0;
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean mock_track_tick(gpointer userData)
+{
+	(void)userData;
+
+	guint i;
+
+	for(i = 0; i < mDeviceCount; i++)
+		if(mDevices[i]->PRESENT && mDevices[i]->PLAYER != NULL)
+			mock_player_next_track(mDevices[i]->PLAYER);
+
+	if(g_get_monotonic_time() < mTrackEndUs)
+		return G_SOURCE_CONTINUE;
+
+	mTrackSource = 0;
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean mock_beacon_tick(gpointer userData)
+{
+	(void)userData;
+
+	guint i;
+
+	/*1. Every beacon advertises once more, the iBeacon every time and the TLM every other time */
+	mBeaconCount++;
+	for(i = 0; i < mDeviceCount; i++)
+	{
+		if(!mDevices[i]->PRESENT)
+			continue;
+
+		mock_set_property(&mDevices[i]->INTERFACES[0], "ManufacturerData", mock_beacon_manufacturer_data(i, mBeaconCount));
+		if(mBeaconCount % 2 == 0)
+			mock_set_property(&mDevices[i]->INTERFACES[0], "ServiceData", mock_beacon_service_data(mBeaconCount));
+		mStats.BEACONS++;
+	}
+
+	if(g_get_monotonic_time() < mBeaconEndUs)
+		return G_SOURCE_CONTINUE;
+
+	mBeaconSource = 0;
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean mock_noise_tick(gpointer userData)
+{
+	(void)userData;
+
+	gint64 now = g_get_monotonic_time();
+	MockObject * device;
+	guint next;
+
+	/*1. What the rate owes since the last tick, like the RSSI generator */
+	mNoiseDue += mNoiseRate * (now - mNoiseLastUs) / 1000000.0;
+	mNoiseLastUs = now;
+
+	/*2. Round robin over the devices that are there, the kind changes with every signal */
+	while(mNoiseDue >= 1.0 && mDeviceCount > 0)
+	{
+		next = mNoiseNext++;
+		device = mDevices[next % mDeviceCount];
+		mNoiseDue -= 1.0;
+
+		if(device->PRESENT)
+			mock_noise_emit(device, next / mDeviceCount);
+	}
+
+	if(now < mNoiseEndUs)
+		return G_SOURCE_CONTINUE;
+
+	mNoiseSource = 0;
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Half are GATT notifications, the rest transport volume and battery level
+*/
+static void mock_noise_emit(MockObject * device, guint kind)
+{
+	GVariantBuilder changed;
+	char path[MOCK_PATH_SIZE + 32];
+	const char * interface;
+	guint8 value[] = {(guint8)kind, (guint8)(kind >> 8)};
+
+	g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+
+	switch(kind % 4)
+	{
+		case 0:
+		case 1:
+			g_snprintf(path, sizeof(path), "%s/service000a/char000b", device->PATH);
+			interface = MOCK_GATT_INTERFACE;
+			g_variant_builder_add(&changed, "{sv}", "Value",
+					g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, value, sizeof(value), 1));
+			break;
+		case 2:
+			g_snprintf(path, sizeof(path), "%s/fd0", device->PATH);
+			interface = BLUEZ_MediaTrasnport_INTERFACE;
+			g_variant_builder_add(&changed, "{sv}", "Volume", g_variant_new_uint16(kind % 128));
+			break;
+		default:
+			g_snprintf(path, sizeof(path), "%s", device->PATH);
+			interface = MOCK_BATTERY_INTERFACE;
+			g_variant_builder_add(&changed, "{sv}", "Percentage", g_variant_new_byte(100 - kind % 100));
+			break;
+	}
+
+	mock_emit(path, DBUS_PROPERTIES_NAME, "PropertiesChanged", g_variant_new("(sa{sv}as)", interface, &changed, NULL));
+	mStats.NOISE++;
+}
+
+/*
+ * Script
+*/
+static gboolean mock_script_step(gpointer userData)
+{
+	(void)userData;
+
+	int delay;
+
+	/*1. Commands run back to back until one needs time */
+	while(mScript[mScriptLine] != NULL)
+	{
+		delay = mock_script_run(g_strstrip(mScript[mScriptLine++]));
+		if(delay < 0)
+		{
+			g_main_loop_quit(mLoop);
+			return G_SOURCE_REMOVE;
+		}
+
+		if(delay > 0)
+		{
+			g_timeout_add(delay, mock_script_step, NULL);
+			return G_SOURCE_REMOVE;
+		}
+	}
+
+	g_print("Script done, serving calls until SIGINT\n");
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Commands, one per line, # starts a comment
+ *	appear N [MS]			N devices appear, one every MS, the script waits for the last one
+ *	disappear N				the N oldest devices disappear
+ *	connect N				the first N devices connect and get a media player
+ *	disconnect N			the first N devices disconnect
+ *	rssi RATE MS			RATE RSSI changes a second over every device for MS, runs in the background
+ *	track MS DURATION		every MS the track of each player changes, for DURATION, runs in the background
+ *	beacon MS DURATION		every MS the payloads of each device change, for DURATION, runs in the background
+ *	noise RATE MS			RATE signals a second Stereo does not handle, for MS, runs in the background
+ *	pair MS FAIL			Pair replies after MS, FAIL percent of them with AuthenticationFailed
+ *	adapter-add N			hciN is plugged in
+ *	adapter-remove N		hciN and its devices go away
+ *	wait MS					next command after MS
+ *	stats					print what was done so far
+ *	quit					print the stats and exit
+ * Returns how long to wait before the next command, -1 to quit
+*/
+static int mock_script_run(const char * line)
+{
+	char command[32];
+	guint a = 0;
+	guint b = 0;
+	guint i;
+	guint done;
+	int fields;
+
+	if(line[0] == '\0' || line[0] == '#')
+		return 0;
+
+	fields = sscanf(line, "%31s %u %u", command, &a, &b);
+	g_print("> %s\n", line);
+
+	if(strcmp(command, "appear") == 0)
+	{
+		if(b == 0)
+		{
+			for(i = 0; i < a && mock_device_appear() != NULL; i++)
+				;
+			return 0;
+		}
+
+		if(mAppearSource != 0)
+			g_source_remove(mAppearSource);
+		mAppearLeft = a;
+		mAppearSource = g_timeout_add(b, mock_appear_tick, NULL);
+		return (int)(a * b);
+	}
+	else if(strcmp(command, "disappear") == 0)
+	{
+		for(i = 0, done = 0; i < mDeviceCount && done < a; i++)
+			if(mDevices[i]->PRESENT)
+			{
+				mock_device_disappear(mDevices[i]);
+				done++;
+			}
+	}
+	else if(strcmp(command, "connect") == 0 || strcmp(command, "disconnect") == 0)
+	{
+		for(i = 0, done = 0; i < mDeviceCount && done < a; i++)
+			if(mDevices[i]->PRESENT)
+			{
+				mock_device_connect(mDevices[i], command[0] == 'c');
+				done++;
+			}
+	}
+	else if(strcmp(command, "rssi") == 0 && fields == 3)
+	{
+		mRssiRate = a;
+		mRssiStartUs = mRssiLastUs = g_get_monotonic_time();
+		mRssiEndUs = mRssiStartUs + (gint64)b * 1000;
+		mRssiDue = 0;
+		mRssiSent = 0;
+		if(mRssiSource == 0)
+			mRssiSource = g_timeout_add(MOCK_TICK_MS, mock_rssi_tick, NULL);
+	}
+	else if(strcmp(command, "track") == 0 && fields == 3)
+	{
+		if(mTrackSource != 0)
+			g_source_remove(mTrackSource);
+		mTrackEndUs = g_get_monotonic_time() + (gint64)b * 1000;
+		mTrackSource = g_timeout_add(MAX(a, 1), mock_track_tick, NULL);
+	}
+	else if(strcmp(command, "beacon") == 0 && fields == 3)
+	{
+		if(mBeaconSource != 0)
+			g_source_remove(mBeaconSource);
+		mBeaconEndUs = g_get_monotonic_time() + (gint64)b * 1000;
+		mBeaconSource = g_timeout_add(MAX(a, 1), mock_beacon_tick, NULL);
+	}
+	else if(strcmp(command, "noise") == 0 && fields == 3)
+	{
+		mNoiseRate = a;
+		mNoiseLastUs = g_get_monotonic_time();
+		mNoiseEndUs = mNoiseLastUs + (gint64)b * 1000;
+		mNoiseDue = 0;
+		if(mNoiseSource == 0)
+			mNoiseSource = g_timeout_add(MOCK_TICK_MS, mock_noise_tick, NULL);
+	}
+	else if(strcmp(command, "pair") == 0 && fields >= 2)
+	{
+		mPairDelayMs = a;
+		mPairFailPercent = MIN(b, 100);
+	}
+	else if(strcmp(command, "adapter-add") == 0 && fields == 2)
+		mock_adapter_add((int)a);
+	else if(strcmp(command, "adapter-remove") == 0 && fields == 2)
+		mock_adapter_remove((int)a);
+	else if(strcmp(command, "wait") == 0)
+		return (int)a;
+	else if(strcmp(command, "stats") == 0)
+		mock_print_stats();
+	else if(strcmp(command, "quit") == 0)
+		return -1;
+	else
+		g_print("Unknown command: %s\n", line);
+
+	return 0;
+}
+
+static void mock_print_stats(void)
+{
+	GHashTableIter iter;
+	gpointer method;
+	gpointer calls;
+	double seconds = (g_get_monotonic_time() - mStartUs) / 1000000.0;
+
+	g_print("***\t Mock bluetoothd after %.1f s \t***\n", seconds);
+	g_print("- Signals:\t%llu (%.0f/s)\n", (unsigned long long)mStats.SIGNALS, seconds > 0 ? mStats.SIGNALS / seconds : 0.0);
+	g_print("- RSSI:\t\t%llu\n", (unsigned long long)mStats.RSSI);
+	g_print("- Tracks:\t%llu\n", (unsigned long long)mStats.TRACKS);
+	g_print("- Beacons:\t%llu\n", (unsigned long long)mStats.BEACONS);
+	g_print("- Noise:\t%llu\n", (unsigned long long)mStats.NOISE);
+	g_print("- Appeared:\t%llu\n", (unsigned long long)mStats.APPEARED);
+	g_print("- Disappeared:\t%llu\n", (unsigned long long)mStats.DISAPPEARED);
+	g_print("- Paired:\t%llu\n", (unsigned long long)mStats.PAIRED);
+	g_print("- Pair Failed:\t%llu\n", (unsigned long long)mStats.PAIR_FAILED);
+	g_print("- Filtered:\t%llu\n", (unsigned long long)mStats.FILTERED);
+	g_mutex_lock(&mCallsLock);
+	g_print("- Calls:\t%llu\n", (unsigned long long)mStats.CALLS);
+
+	g_hash_table_iter_init(&iter, mCalls);
+	while(g_hash_table_iter_next(&iter, &method, &calls))
+		g_print("\t%s:\t%u\n", (const char *)method, GPOINTER_TO_UINT(calls));
+	g_mutex_unlock(&mCallsLock);
+}
+
+static GDBusMessage * mock_count_call(GDBusConnection *conn, GDBusMessage *message, gboolean incoming, gpointer userData)
+{
+	(void)conn;
+	(void)userData;
+
+	const char * member;
+
+	if(!incoming || g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return message;
+
+	member = g_intern_string(g_dbus_message_get_member(message));
+
+	g_mutex_lock(&mCallsLock);
+	mStats.CALLS++;
+	g_hash_table_insert(mCalls, (gpointer)member, GUINT_TO_POINTER(GPOINTER_TO_UINT(g_hash_table_lookup(mCalls, member)) + 1));
+	g_mutex_unlock(&mCallsLock);
+
+	return message;
+}
+
+static gboolean mock_quit(gpointer userData)
+{
+	(void)userData;
+
+	g_main_loop_quit(mLoop);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Method and Property handlers
+*/
+static void mock_method_call(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *method,
+				GVariant *params,
+				GDBusMethodInvocation *invocation,
+				gpointer userData)
+{
+	(void)conn;
+	(void)sender;
+	(void)path;
+
+	MockInterface * iface = userData;
+	MockObject * object = iface->OBJECT;
+	MockObject * device;
+	GVariantBuilder objects;
+	const char * devicePath;
+	guint i;
+
+	/*1. ObjectManager */
+	if(strcmp(interface, DBUS_OBJECT_MANAGER_NAME) == 0)
+	{
+		g_variant_builder_init(&objects, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+		for(i = 0; i < MOCK_MAX_ADAPTERS; i++)
+			if(mAdapters[i] != NULL && mAdapters[i]->PRESENT)
+				g_variant_builder_add(&objects, "{o@a{sa{sv}}}", mAdapters[i]->PATH, mock_object_interfaces(mAdapters[i], 0));
+		for(i = 0; i < mDeviceCount; i++)
+		{
+			if(!mDevices[i]->PRESENT)
+				continue;
+			g_variant_builder_add(&objects, "{o@a{sa{sv}}}", mDevices[i]->PATH, mock_object_interfaces(mDevices[i], 0));
+			if(mDevices[i]->PLAYER != NULL)
+				g_variant_builder_add(&objects, "{o@a{sa{sv}}}", mDevices[i]->PLAYER->PATH, mock_object_interfaces(mDevices[i]->PLAYER, 0));
+		}
+		g_dbus_method_invocation_return_value(invocation, g_variant_new("(a{oa{sa{sv}}})", &objects));
+	}
+	/*2. Adapter1 */
+	else if(strcmp(interface, BLUEZ_ADAPTER_INTERFACE) == 0)
+	{
+		if(strcmp(method, "StartDiscovery") == 0 || strcmp(method, "StopDiscovery") == 0)
+			mock_set_property(iface, "Discovering", g_variant_new_boolean(method[2] == 'a'));
+		else if(strcmp(method, "SetDiscoveryFilter") == 0 && !mock_filter_set(object->ADAPTER, g_variant_get_child_value(params, 0)))
+		{
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidArguments", "Invalid arguments in method call");
+			return;
+		}
+		else if(strcmp(method, "GetDiscoveryFilters") == 0)
+		{
+			g_dbus_method_invocation_return_value(invocation, g_variant_new_parsed("(['UUIDs', 'RSSI', 'Pathloss', 'Transport', 'DuplicateData'],)"));
+			return;
+		}
+		else if(strcmp(method, "RemoveDevice") == 0)
+		{
+			g_variant_get(params, "(&o)", &devicePath);
+			device = mock_device_find(devicePath);
+			if(device == NULL || device->ADAPTER != object->ADAPTER)
+			{
+				g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.DoesNotExist", "No such device");
+				return;
+			}
+			mock_device_disappear(device);
+		}
+
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	}
+	/*3. Device1 */
+	else if(strcmp(interface, BLUEZ_DEVICE_INTERFACE) == 0)
+	{
+		if(strcmp(method, "Pair") == 0)
+		{
+			GVariant * paired = g_hash_table_lookup(iface->PROPERTIES, "Paired");
+
+			if(paired != NULL && g_variant_get_boolean(paired))
+				g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.AlreadyExists", "Already Paired");
+			else if(object->PAIRING != NULL)
+				g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InProgress", "In Progress");
+			else
+			{
+				// the reply comes later, like a phone waiting for its user
+				object->PAIRING = invocation;
+				object->PAIR_SOURCE = g_timeout_add(mPairDelayMs, mock_pair_done, object);
+			}
+			return;
+		}
+		else if(strcmp(method, "CancelPairing") == 0 && object->PAIRING != NULL)
+		{
+			g_source_remove(object->PAIR_SOURCE);
+			g_dbus_method_invocation_return_dbus_error(object->PAIRING, "org.bluez.Error.AuthenticationCanceled", "Canceled");
+			object->PAIRING = NULL;
+			object->PAIR_SOURCE = 0;
+		}
+		else if(strcmp(method, "Connect") == 0 || strcmp(method, "Disconnect") == 0)
+			mock_device_connect(object, method[0] == 'C');
+
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	}
+	/*4. MediaPlayer1, MediaControl1 only answers */
+	else if(strcmp(interface, BLUEZ_MediaPlayer_INTERFACE) == 0)
+	{
+		if(strcmp(method, "Play") == 0)
+			mock_set_property(iface, "Status", g_variant_new_string("playing"));
+		else if(strcmp(method, "Pause") == 0)
+			mock_set_property(iface, "Status", g_variant_new_string("paused"));
+		else if(strcmp(method, "Stop") == 0)
+			mock_set_property(iface, "Status", g_variant_new_string("stopped"));
+		else if(strcmp(method, "Next") == 0 || strcmp(method, "Previous") == 0)
+			mock_player_next_track(object);
+
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	}
+	/*5. AgentManager1 and MediaControl1, every agent is accepted and nothing calls it back */
+	else
+		g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static GVariant * mock_get_property(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *property,
+				GError **error,
+				gpointer userData)
+{
+	(void)conn;
+	(void)sender;
+	(void)path;
+
+	MockInterface * iface = userData;
+	GVariant * value = g_hash_table_lookup(iface->PROPERTIES, property);
+
+	if(value == NULL)
+	{
+		g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "No such property '%s' on %s", property, interface);
+		return NULL;
+	}
+
+	return g_variant_ref(value);
+}
+
+static gboolean mock_set_property_call(GDBusConnection *conn,
+				const gchar *sender,
+				const gchar *path,
+				const gchar *interface,
+				const gchar *property,
+				GVariant *value,
+				GError **error,
+				gpointer userData)
+{
+	(void)conn;
+	(void)sender;
+	(void)path;
+	(void)interface;
+	(void)error;
+
+	MockInterface * iface = userData;
+
+	mock_set_property(iface, property, g_variant_ref(value));
+
+	// a powered off adapter stops scanning
+	if(strcmp(property, "Powered") == 0 && !g_variant_get_boolean(value) && g_hash_table_lookup(iface->PROPERTIES, "Discovering") != NULL)
+		mock_set_property(iface, "Discovering", g_variant_new_boolean(FALSE));
+
+	return TRUE;
+}